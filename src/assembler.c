@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include "assembler.h"
+#include "emulator.h"
+
+#define MAX_LABELS 1024
+#define LABEL_SIZE 32
+#define MAX_OPERANDS 64
+#define LINE_SIZE 512
+
+enum OperandKind {
+	OPERAND_VALUE,
+	OPERAND_REGISTER,	// value is the register number
+	OPERAND_I,
+	OPERAND_I_INDIRECT,	// [I]
+	OPERAND_DT,
+	OPERAND_ST,
+	OPERAND_K,
+	OPERAND_F,
+	OPERAND_B
+};
+
+struct Operand {
+	enum OperandKind kind;
+	long value;
+};
+
+struct Label {
+	char name[LABEL_SIZE];
+	uint16_t address;
+};
+
+struct Assembler {
+	struct Label labels[MAX_LABELS];
+	int labelCount;
+	int pass;				// labels are collected in pass 1 and resolved in pass 2
+	int line;
+	uint16_t address;
+	uint8_t *rom;
+	size_t capacity;
+	size_t size;
+	char *error;
+	size_t errorSize;
+	bool failed;
+};
+
+// Only the first error is reported
+static void fail(struct Assembler *as, const char *format, ...)
+{
+	if (as->failed)
+		return;
+	as->failed = true;
+
+	va_list args;
+	int length = snprintf(as->error, as->errorSize, "line %d: ", as->line);
+	if (length >= 0 && (size_t)length < as->errorSize) {
+		va_start(args, format);
+		vsnprintf(as->error + length, as->errorSize - length, format, args);
+		va_end(args);
+	}
+}
+
+static const struct Label* findLabel(const struct Assembler *as, const char *name)
+{
+	for (int i = 0; i < as->labelCount; i++) {
+		if (strcmp(as->labels[i].name, name) == 0)
+			return &as->labels[i];
+	}
+	return NULL;
+}
+
+static void defineLabel(struct Assembler *as, const char *name)
+{
+	if (as->pass == 2)
+		return;
+	if (strlen(name) >= LABEL_SIZE || as->labelCount == MAX_LABELS) {
+		fail(as, "label %s too long or too many labels", name);
+		return;
+	}
+	if (findLabel(as, name) != NULL) {
+		fail(as, "label %s defined twice", name);
+		return;
+	}
+	strcpy(as->labels[as->labelCount].name, name);
+	as->labels[as->labelCount++].address = as->address;
+}
+
+static bool isIdentifier(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+// Numbers and labels joined by + and -, labels read as 0 in pass 1
+static long parseValue(struct Assembler *as, const char *text)
+{
+	long total = 0;
+	int sign = 1;
+	const char *at = text;
+
+	for (;;) {
+		while (isspace((unsigned char)*at))
+			at++;
+		if (*at == '-' || *at == '+') {
+			sign = (*at == '-') ? -sign : sign;
+			at++;
+			continue;
+		}
+
+		char token[LABEL_SIZE + 8];
+		size_t length = 0;
+		while (isIdentifier(*at) && length < sizeof(token) - 1)
+			token[length++] = *at++;
+		token[length] = '\0';
+		if (length == 0) {
+			fail(as, "bad expression '%s'", text);
+			return 0;
+		}
+
+		long value = 0;
+		if (isdigit((unsigned char)token[0])) {
+			char *end;
+			if (token[0] == '0' && (token[1] == 'b' || token[1] == 'B'))
+				value = strtol(token + 2, &end, 2);
+			else
+				value = strtol(token, &end, 0);
+			if (*end != '\0')
+				fail(as, "bad number %s", token);
+		}
+		else {
+			const struct Label *label = findLabel(as, token);
+			if (label != NULL)
+				value = label->address;
+			else if (as->pass == 2)
+				fail(as, "unknown label %s", token);
+		}
+		total += sign * value;
+		sign = 1;
+
+		while (isspace((unsigned char)*at))
+			at++;
+		if (*at == '\0')
+			return total;
+		if (*at != '+' && *at != '-') {
+			fail(as, "bad expression '%s'", text);
+			return 0;
+		}
+	}
+}
+
+static struct Operand parseOperand(struct Assembler *as, const char *text)
+{
+	static const struct { const char *name; enum OperandKind kind; } keywords[] = {
+		{ "I", OPERAND_I }, { "[I]", OPERAND_I_INDIRECT }, { "DT", OPERAND_DT }, { "ST", OPERAND_ST },
+		{ "K", OPERAND_K }, { "F", OPERAND_F }, { "B", OPERAND_B }
+	};
+
+	for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+		if (strcasecmp(text, keywords[i].name) == 0)
+			return (struct Operand){ keywords[i].kind, 0 };
+	}
+	if ((text[0] == 'V' || text[0] == 'v') && isxdigit((unsigned char)text[1]) && text[2] == '\0') {
+		char digit[2] = { text[1], '\0' };
+		return (struct Operand){ OPERAND_REGISTER, strtol(digit, NULL, 16) };
+	}
+	return (struct Operand){ OPERAND_VALUE, parseValue(as, text) };
+}
+
+static void emitByte(struct Assembler *as, long value)
+{
+	if (as->pass == 2) {
+		if (value < -128 || value > 255)
+			fail(as, "byte %ld out of range", value);
+		if (as->size >= as->capacity) {
+			fail(as, "ROM larger than %zu bytes", as->capacity);
+			return;
+		}
+		as->rom[as->size++] = (uint8_t)value;
+	}
+	as->address++;
+}
+
+static void emitWord(struct Assembler *as, long value)
+{
+	if (as->pass == 2 && (value < 0 || value > 0xFFFF))
+		fail(as, "word %ld out of range", value);
+	emitByte(as, (value >> 8) & 0xFF);
+	emitByte(as, value & 0xFF);
+}
+
+static long checkRange(struct Assembler *as, long value, long low, long high, const char *what)
+{
+	if (as->pass == 2 && (value < low || value > high))
+		fail(as, "%s %ld out of range", what, value);
+	return value & high;
+}
+
+static long address(struct Assembler *as, const struct Operand *operand)
+{
+	if (operand->kind != OPERAND_VALUE)
+		fail(as, "expected an address");
+	return checkRange(as, operand->value, 0, 0xFFF, "address");
+}
+
+static long byteValue(struct Assembler *as, const struct Operand *operand)
+{
+	if (operand->kind != OPERAND_VALUE)
+		fail(as, "expected a byte");
+	return checkRange(as, operand->value, -128, 0xFF, "byte");
+}
+
+static int reg(struct Assembler *as, const struct Operand *operand)
+{
+	if (operand->kind != OPERAND_REGISTER)
+		fail(as, "expected a register");
+	return (int)operand->value & 0xF;
+}
+
+static bool is(const struct Operand *operand, enum OperandKind kind)
+{
+	return operand->kind == kind;
+}
+
+// Arithmetic between two registers: 8XY0 to 8XYE
+static const struct { const char *name; int n; } aluOps[] = {
+	{ "OR", 0x1 }, { "AND", 0x2 }, { "XOR", 0x3 }, { "SUB", 0x5 }, { "SUBN", 0x7 }
+};
+
+static void assembleInstruction(struct Assembler *as, const char *mnemonic, struct Operand *ops, int count)
+{
+	#define NEED(n) do { if (count != (n)) { fail(as, "%s takes " #n " operand(s)", mnemonic); return; } } while (0)
+	#define X(i) (reg(as, &ops[i]) << 8)
+	#define Y(i) (reg(as, &ops[i]) << 4)
+
+	if (strcasecmp(mnemonic, "CLS") == 0) { NEED(0); emitWord(as, 0x00E0); return; }
+	if (strcasecmp(mnemonic, "RET") == 0) { NEED(0); emitWord(as, 0x00EE); return; }
+	if (strcasecmp(mnemonic, "SYS") == 0) { NEED(1); emitWord(as, address(as, &ops[0])); return; }
+	if (strcasecmp(mnemonic, "CALL") == 0) { NEED(1); emitWord(as, 0x2000 | address(as, &ops[0])); return; }
+
+	if (strcasecmp(mnemonic, "JP") == 0) {
+		if (count == 2) {
+			if (!is(&ops[0], OPERAND_REGISTER) || ops[0].value != 0)
+				fail(as, "%s with two operands jumps from V0", mnemonic);
+			emitWord(as, 0xB000 | address(as, &ops[1]));
+			return;
+		}
+		NEED(1);
+		emitWord(as, 0x1000 | address(as, &ops[0]));
+		return;
+	}
+
+	if (strcasecmp(mnemonic, "SE") == 0 || strcasecmp(mnemonic, "SNE") == 0) {
+		bool equal = strcasecmp(mnemonic, "SE") == 0;
+		NEED(2);
+		if (is(&ops[1], OPERAND_REGISTER))
+			emitWord(as, (equal ? 0x5000 : 0x9000) | X(0) | Y(1));
+		else
+			emitWord(as, (equal ? 0x3000 : 0x4000) | X(0) | byteValue(as, &ops[1]));
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof(aluOps) / sizeof(aluOps[0]); i++) {
+		if (strcasecmp(mnemonic, aluOps[i].name) == 0) {
+			NEED(2);
+			emitWord(as, 0x8000 | X(0) | Y(1) | aluOps[i].n);
+			return;
+		}
+	}
+	if (strcasecmp(mnemonic, "SHR") == 0 || strcasecmp(mnemonic, "SHL") == 0) {
+		int n = strcasecmp(mnemonic, "SHR") == 0 ? 0x6 : 0xE;
+		if (count != 1 && count != 2) {
+			fail(as, "%s takes one or two registers", mnemonic);
+			return;
+		}
+		emitWord(as, 0x8000 | X(0) | (count == 2 ? Y(1) : Y(0)) | n);
+		return;
+	}
+
+	if (strcasecmp(mnemonic, "ADD") == 0) {
+		NEED(2);
+		if (is(&ops[0], OPERAND_I))
+			emitWord(as, 0xF01E | X(1));
+		else if (is(&ops[1], OPERAND_REGISTER))
+			emitWord(as, 0x8004 | X(0) | Y(1));
+		else
+			emitWord(as, 0x7000 | X(0) | byteValue(as, &ops[1]));
+		return;
+	}
+
+	if (strcasecmp(mnemonic, "RND") == 0) { NEED(2); emitWord(as, 0xC000 | X(0) | byteValue(as, &ops[1])); return; }
+	if (strcasecmp(mnemonic, "SKP") == 0) { NEED(1); emitWord(as, 0xE09E | X(0)); return; }
+	if (strcasecmp(mnemonic, "SKNP") == 0) { NEED(1); emitWord(as, 0xE0A1 | X(0)); return; }
+
+	if (strcasecmp(mnemonic, "DRW") == 0) {
+		NEED(3);
+		if (!is(&ops[2], OPERAND_VALUE))
+			fail(as, "%s height must be a number", mnemonic);
+		emitWord(as, 0xD000 | X(0) | Y(1) | checkRange(as, ops[2].value, 0, 0xF, "height"));
+		return;
+	}
+
+	if (strcasecmp(mnemonic, "LD") == 0) {
+		NEED(2);
+		struct Operand *to = &ops[0], *from = &ops[1];
+
+		if (is(to, OPERAND_I))					emitWord(as, 0xA000 | address(as, from));
+		else if (is(to, OPERAND_DT))			emitWord(as, 0xF015 | X(1));
+		else if (is(to, OPERAND_ST))			emitWord(as, 0xF018 | X(1));
+		else if (is(to, OPERAND_F))				emitWord(as, 0xF029 | X(1));
+		else if (is(to, OPERAND_B))				emitWord(as, 0xF033 | X(1));
+		else if (is(to, OPERAND_I_INDIRECT))	emitWord(as, 0xF055 | X(1));
+		else if (is(from, OPERAND_DT))			emitWord(as, 0xF007 | X(0));
+		else if (is(from, OPERAND_K))			emitWord(as, 0xF00A | X(0));
+		else if (is(from, OPERAND_I_INDIRECT))	emitWord(as, 0xF065 | X(0));
+		else if (is(from, OPERAND_REGISTER))	emitWord(as, 0x8000 | X(0) | Y(1));
+		else									emitWord(as, 0x6000 | X(0) | byteValue(as, from));
+		return;
+	}
+
+	if (strcasecmp(mnemonic, "DB") == 0 || strcasecmp(mnemonic, "DW") == 0) {
+		bool bytes = strcasecmp(mnemonic, "DB") == 0;
+		if (count == 0)
+			fail(as, "%s needs at least one value", mnemonic);
+		for (int i = 0; i < count; i++) {
+			if (!is(&ops[i], OPERAND_VALUE))
+				fail(as, "%s takes numbers and labels", mnemonic);
+			if (bytes)
+				emitByte(as, ops[i].value);
+			else
+				emitWord(as, ops[i].value);
+		}
+		return;
+	}
+
+	fail(as, "unknown instruction %s", mnemonic);
+
+	#undef NEED
+	#undef X
+	#undef Y
+}
+
+static char* trim(char *text)
+{
+	while (isspace((unsigned char)*text))
+		text++;
+	char *end = text + strlen(text);
+	while (end > text && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+	return text;
+}
+
+static void assembleLine(struct Assembler *as, char *line)
+{
+	char *comment = strchr(line, ';');
+	if (comment != NULL)
+		*comment = '\0';
+	char *text = trim(line);
+
+	// Any number of labels may start the line
+	char *colon;
+	while ((colon = strchr(text, ':')) != NULL) {
+		*colon = '\0';
+		char *name = trim(text);
+		bool valid = *name != '\0' && !isdigit((unsigned char)*name);
+		for (char *c = name; *c; c++)
+			valid = valid && isIdentifier(*c);
+		if (!valid) {
+			fail(as, "bad label '%s'", name);
+			return;
+		}
+		defineLabel(as, name);
+		text = trim(colon + 1);
+	}
+	if (*text == '\0')
+		return;
+
+	char *mnemonic = text;
+	while (*text && !isspace((unsigned char)*text))
+		text++;
+	if (*text)
+		*text++ = '\0';
+
+	struct Operand ops[MAX_OPERANDS];
+	int count = 0;
+	text = trim(text);
+	while (*text) {
+		if (count == MAX_OPERANDS) {
+			fail(as, "too many operands");
+			return;
+		}
+		char *comma = strchr(text, ',');
+		if (comma != NULL)
+			*comma = '\0';
+		ops[count++] = parseOperand(as, trim(text));
+		if (comma == NULL)
+			break;
+		text = comma + 1;
+	}
+	assembleInstruction(as, mnemonic, ops, count);
+}
+
+int assembleChip8(const char *source, uint8_t *rom, size_t capacity, char *error, size_t errorSize)
+{
+	struct Assembler *as = calloc(1, sizeof(struct Assembler));
+	char line[LINE_SIZE];
+
+	if (as == NULL) {
+		snprintf(error, errorSize, "out of memory");
+		return -1;
+	}
+	as->rom = rom;
+	as->capacity = capacity;
+	as->error = error;
+	as->errorSize = errorSize;
+
+	for (as->pass = 1; as->pass <= 2 && !as->failed; as->pass++) {
+		const char *at = source;
+		as->line = 0;
+		as->address = START_ADDRESS;
+		as->size = 0;
+
+		while (*at && !as->failed) {
+			const char *end = strchr(at, '\n');
+			size_t length = end ? (size_t)(end - at) : strlen(at);
+			as->line++;
+			if (length >= sizeof(line)) {
+				fail(as, "line longer than %d characters", LINE_SIZE - 1);
+				break;
+			}
+			memcpy(line, at, length);
+			line[length] = '\0';
+			assembleLine(as, line);
+			at += length + (end != NULL);
+		}
+	}
+
+	int size = as->failed ? -1 : (int)as->size;
+	free(as);
+	return size;
+}
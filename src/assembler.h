@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CHIP-8 assembler, classic mnemonics (Cowgod's reference):
+//   CLS RET SYS JP CALL SE SNE LD ADD OR AND XOR SUB SHR SUBN SHL RND DRW SKP SKNP
+//   LD Vx, DT/K/[I]   LD DT/ST/F/B/[I], Vx   LD I, addr   ADD I, Vx   JP V0, addr
+//   DB byte, ...      DW word, ...           label:       ; comment
+// Operands are V0-VF or expressions of numbers (decimal, 0x hex, 0b binary) and
+// labels joined by + and -. Bytes may be given as -128..255. Code starts at 0x200.
+
+// Assemble source into rom, returns the ROM size or -1 with "line N: message" in error
+int assembleChip8(const char *source, uint8_t *rom, size_t capacity, char *error, size_t errorSize);
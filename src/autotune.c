@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "autotune.h"
+
+#define TUNING_LINE_SIZE 64
+
+// $XDG_CACHE_HOME/chippy/tuning or ~/.cache/chippy/tuning, the directories are created.
+// False if the path doesn't fit.
+static bool findTuningFile(char out[AUTOTUNE_PATH_SIZE])
+{
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char base[AUTOTUNE_PATH_SIZE - sizeof("/chippy/tuning") + 1];
+	int length;
+
+	if (xdg != NULL && xdg[0] != '\0')
+		length = snprintf(base, sizeof(base), "%s", xdg);
+	else if (home != NULL)
+		length = snprintf(base, sizeof(base), "%s/.cache", home);
+	else
+		length = snprintf(base, sizeof(base), "/tmp");
+	if (length < 0 || (size_t)length >= sizeof(base))
+		return false;
+
+	snprintf(out, AUTOTUNE_PATH_SIZE, "%s/chippy", base);
+	mkdir(base, 0755);
+	mkdir(out, 0755);
+	snprintf(out, AUTOTUNE_PATH_SIZE, "%s/chippy/tuning", base);
+	return true;
+}
+
+// One "hash cycles" line per ROM
+static bool parseLine(const char *line, uint64_t *romHash, uint32_t *cycles)
+{
+	unsigned long long hash;
+	unsigned int rate;
+	if (sscanf(line, "%16llx %u", &hash, &rate) != 2)
+		return false;
+	*romHash = hash;
+	*cycles = rate;
+	return true;
+}
+
+uint32_t loadTunedRate(uint64_t romHash)
+{
+	char path[AUTOTUNE_PATH_SIZE];
+	char line[TUNING_LINE_SIZE];
+	if (!findTuningFile(path))
+		return 0;
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return 0;
+
+	uint32_t found = 0;
+	uint64_t hash;
+	uint32_t cycles;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (parseLine(line, &hash, &cycles) && hash == romHash)
+			found = cycles;
+	}
+	fclose(file);
+	return found;
+}
+
+bool saveTunedRate(uint64_t romHash, uint32_t cycles)
+{
+	char path[AUTOTUNE_PATH_SIZE];
+	char temporary[AUTOTUNE_PATH_SIZE + 24];
+	char line[TUNING_LINE_SIZE];
+	if (!findTuningFile(path))
+		return false;
+
+	// Copy every other ROM's line and rename into place, readers never see half a file
+	snprintf(temporary, sizeof(temporary), "%s.%ld", path, (long)getpid());
+	FILE *out = fopen(temporary, "w");
+	if (out == NULL)
+		return false;
+
+	FILE *in = fopen(path, "r");
+	uint64_t hash;
+	uint32_t rate;
+	while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+		if (parseLine(line, &hash, &rate) && hash != romHash)
+			fprintf(out, "%016llx %u\n", (unsigned long long)hash, rate);
+	}
+	if (in != NULL)
+		fclose(in);
+	fprintf(out, "%016llx %u\n", (unsigned long long)romHash, cycles);
+
+	if (fclose(out) != 0 || rename(temporary, path) != 0) {
+		remove(temporary);
+		return false;
+	}
+	return true;
+}
+
+static void startWindow(struct AutoTuner *tuner)
+{
+	tuner->ticks = 0;
+	tuner->maxNeed = 0;
+	tuner->draws = 0;
+	tuner->timerReads = 0;
+	tuner->timerWaits = 0;
+}
+
+void resyncAutoTuner(struct AutoTuner *tuner, const struct Chip8 *chip)
+{
+	tuner->lastDraws = chip->drawCount;
+	tuner->lastTimerReads = chip->timerReads;
+	tuner->lastTimerWaits = chip->timerWaits;
+	tuner->lastKeyWaits = chip->keyWaits;
+	tuner->lastTimedFrames = chip->timedFrames;
+}
+
+void initAutoTuner(struct AutoTuner *tuner, const struct Chip8 *chip, bool enabled)
+{
+	memset(tuner, 0, sizeof(*tuner));
+	tuner->enabled = enabled;
+	tuner->romHash = chip->memoryHash;
+	tuner->cycles = AUTOTUNE_DEFAULT_CYCLES;
+	resyncAutoTuner(tuner, chip);
+
+	if (enabled) {
+		tuner->savedCycles = loadTunedRate(tuner->romHash);
+		if (tuner->savedCycles >= AUTOTUNE_MIN_CYCLES && tuner->savedCycles < AUTOTUNE_MAX_CYCLES)
+			tuner->cycles = tuner->savedCycles;
+	}
+}
+
+static uint32_t clampCycles(uint64_t cycles)
+{
+	if (cycles < AUTOTUNE_MIN_CYCLES)
+		return AUTOTUNE_MIN_CYCLES;
+	return (cycles > AUTOTUNE_MAX_CYCLES) ? AUTOTUNE_MAX_CYCLES : (uint32_t)cycles;
+}
+
+// Highest rate one window may raise cycles to
+static uint32_t raiseLimit(uint32_t cycles)
+{
+	return clampCycles((uint64_t)cycles * 3 / 2 + 1);
+}
+
+// End of a window, move the rate and save it once it holds
+static void decide(struct AutoTuner *tuner)
+{
+	uint32_t previous = tuner->cycles;
+
+	if (tuner->draws == 0 || tuner->timerReads == 0) {
+		startWindow(tuner);
+		return;
+	}
+
+	if (tuner->timerWaits == 0) {
+		// Never early for the timer, the work doesn't fit
+		tuner->cycles = raiseLimit(tuner->cycles);
+	} else if (tuner->maxNeed > 0) {
+		// Approach the target from above in steps, a sudden drop could starve a busy frame
+		uint32_t target = clampCycles((uint64_t)tuner->maxNeed * 5 / 4 + 1);
+		if (target > tuner->cycles)
+			tuner->cycles = (target < raiseLimit(tuner->cycles)) ? target : raiseLimit(tuner->cycles);
+		else if (tuner->cycles - target > tuner->cycles / 16)
+			tuner->cycles = (3 * tuner->cycles + target + 3) / 4;
+	}
+
+	// A rate pinned at the top says the ROM wasn't understood, not that it needs that much
+	tuner->stableWindows = (tuner->cycles == previous) ? tuner->stableWindows + 1 : 0;
+	if (tuner->stableWindows >= AUTOTUNE_STABLE_WINDOWS && tuner->cycles != tuner->savedCycles && tuner->cycles < AUTOTUNE_MAX_CYCLES) {
+		if (saveTunedRate(tuner->romHash, tuner->cycles)) {
+			printf("autotune: %016llx settled at %u instructions per tick\n", (unsigned long long)tuner->romHash, tuner->cycles);
+			tuner->savedCycles = tuner->cycles;
+		}
+	}
+	startWindow(tuner);
+}
+
+uint32_t observeTick(struct AutoTuner *tuner, const struct Chip8 *chip)
+{
+	uint32_t draws = chip->drawCount - tuner->lastDraws;
+	uint32_t timerReads = chip->timerReads - tuner->lastTimerReads;
+	uint32_t timerWaits = chip->timerWaits - tuner->lastTimerWaits;
+	uint32_t keyWaits = chip->keyWaits - tuner->lastKeyWaits;
+	uint32_t timedFrames = chip->timedFrames - tuner->lastTimedFrames;
+
+	resyncAutoTuner(tuner, chip);
+
+	// Time spent waiting for a key is neither work nor pacing
+	if (!tuner->enabled || keyWaits > 0)
+		return tuner->cycles;
+
+	// Only the newest frame measured in a tick is seen, a guest waiting them out ends one per tick at most
+	if (timedFrames > 0 && chip->framePeriod > 0) {
+		uint64_t need = ((uint64_t)chip->frameWork + chip->framePeriod - 1) / chip->framePeriod;
+		if (need > tuner->maxNeed)
+			tuner->maxNeed = (uint32_t)need;
+	}
+
+	tuner->draws += draws;
+	tuner->timerReads += timerReads;
+	tuner->timerWaits += timerWaits;
+
+	if (++tuner->ticks == AUTOTUNE_WINDOW)
+		decide(tuner);
+	return tuner->cycles;
+}
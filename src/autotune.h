@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "emulator.h"
+
+#define AUTOTUNE_DEFAULT_CYCLES CYCLES_PER_TICK	// until a ROM is tuned
+#define AUTOTUNE_MIN_CYCLES 2
+#define AUTOTUNE_MAX_CYCLES 250		// 15000 instructions per second
+#define AUTOTUNE_WINDOW 60			// observed ticks per decision
+#define AUTOTUNE_STABLE_WINDOWS 5	// windows without a change before the rate is saved
+#define AUTOTUNE_PATH_SIZE 512
+
+// Instruction rate tuner
+// Reads the guest activity counters in struct Chip8 after every 60 Hz tick and looks for
+// the lowest instructions per tick that still lets the ROM keep up:
+//   - A ROM pacing itself on the delay timer starts it with FX15 and later polls it with
+//     FX07. The instructions in between are the frame's work and the FX15 value the ticks
+//     it has for them (Chip8.frameWork and framePeriod), so their ratio is the rate that
+//     frame needed. The wait loop after the first poll never counts, however long it is or
+//     whatever it calls, and neither does work done before the timer was started. The
+//     rate settles a quarter above the busiest frame's need.
+//   - Polls that only ever find the timer expired mean a frame's work no longer fits in
+//     its ticks, so the rate goes up by half.
+//   - One window raises the rate by half at most. A rate pinned at AUTOTUNE_MAX_CYCLES
+//     means the ROM couldn't be read and is never saved or loaded.
+//   - Ticks blocked in FX0A say nothing and are not counted. Windows without a DXYN or
+//     00E0 have no picture to keep at full speed, and ROMs that never read the delay
+//     timer give no way to tell full speed from too fast, neither does a window in which
+//     no frame was measured. All of these keep the current rate.
+// Once the rate has held for AUTOTUNE_STABLE_WINDOWS it is saved by ROM hash in
+// $XDG_CACHE_HOME/chippy/tuning (or ~/.cache), the next load starts from there.
+struct AutoTuner {
+	bool enabled;				// false keeps AUTOTUNE_DEFAULT_CYCLES
+	uint64_t romHash;			// memory hash right after loading, see fingerprint.h
+	uint32_t cycles;			// instructions per tick to run next
+	uint32_t savedCycles;		// last rate written for this ROM, 0 if none
+	uint32_t stableWindows;
+
+	// Counter values after the previous tick
+	uint32_t lastDraws;
+	uint32_t lastTimerReads;
+	uint32_t lastTimerWaits;
+	uint32_t lastKeyWaits;
+	uint32_t lastTimedFrames;
+
+	// Current window
+	uint32_t ticks;
+	uint32_t maxNeed;			// busiest frame's work per tick
+	uint32_t draws;
+	uint32_t timerReads;
+	uint32_t timerWaits;
+};
+
+// Start tuning the ROM just loaded into chip, before it runs, from its saved rate if any
+void initAutoTuner(struct AutoTuner *tuner, const struct Chip8 *chip, bool enabled);
+
+// Account for the tick just run, returns the instructions to run in the next one
+uint32_t observeTick(struct AutoTuner *tuner, const struct Chip8 *chip);
+
+// Forget the counter history after the chip state was replaced (rewind, netplay), the
+// rate and the window so far are kept
+void resyncAutoTuner(struct AutoTuner *tuner, const struct Chip8 *chip);
+
+// Saved rate for a ROM hash, 0 if it was never tuned
+uint32_t loadTunedRate(uint64_t romHash);
+
+// Save or replace the rate for a ROM hash, returns false if the file can't be written or
+// its path is too long
+bool saveTunedRate(uint64_t romHash, uint32_t cycles);
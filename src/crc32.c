@@ -0,0 +1,25 @@
+#include <pthread.h>
+#include "crc32.h"
+
+static uint32_t table[256];
+static pthread_once_t tableOnce = PTHREAD_ONCE_INIT;
+
+static void buildTable(void)
+{
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		table[n] = c;
+	}
+}
+
+uint32_t updateCrc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+	pthread_once(&tableOnce, buildTable);
+
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-32 (IEEE 802.3, reflected 0xEDB88320) as used by PNG chunks, zip and gzip.
+// Start with 0 and feed the result back in to continue over more data. Safe to call
+// from any thread.
+uint32_t updateCrc32(uint32_t crc, const uint8_t *data, size_t length);
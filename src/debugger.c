@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debugger.h"
+
+static void stopDebugger(struct Debugger *debugger, const char *reason, uint16_t address)
+{
+	debugger->paused = true;
+	debugger->stepping = false;
+	debugger->steppingOver = false;
+	snprintf(debugger->status, DEBUG_STATUS_SIZE, "%s at %03X", reason, address);
+}
+
+static bool hasBreakpoint(const struct Debugger *debugger, uint16_t address)
+{
+	address &= DEBUG_MEMORY_SIZE - 1;
+	return debugger->breakpoints[address >> 3] & (1 << (address & 7));
+}
+
+// Accesses through I wrap around memory like the core, so end can be below start
+static uint16_t pageMask(uint16_t start, uint16_t end)
+{
+	uint16_t mask = 0;
+
+	if (end < start)
+		return pageMask(start, ADDRESS_MASK) | pageMask(0, end);
+	for (unsigned int page = start >> DEBUG_PAGE_SHIFT; page <= (unsigned int)(end >> DEBUG_PAGE_SHIFT); page++)
+		mask |= 1 << page;
+	return mask;
+}
+
+static bool overlapsWatchpoint(const struct Watchpoint *watch, uint16_t start, uint16_t end)
+{
+	if (end < start)
+		return overlapsWatchpoint(watch, start, ADDRESS_MASK) || overlapsWatchpoint(watch, 0, end);
+	return start <= watch->end && end >= watch->start;
+}
+
+// Memory range the instruction at PC will touch, wrapped into memory, returns the watch kind or 0
+static uint8_t memoryAccess(const struct Chip8 *chip, uint16_t opcode, uint16_t *start, uint16_t *end)
+{
+	uint8_t x = GET_X(opcode);
+
+	*start = chip->index & ADDRESS_MASK;
+	switch (GET_INSTRUCTION_TYPE(opcode)) {
+	case 0xD:
+		if (GET_N(opcode) == 0)
+			return 0;
+		*end = (chip->index + GET_N(opcode) - 1) & ADDRESS_MASK;
+		return WATCH_READ;
+	case 0xF:
+		switch (GET_BYTE(opcode)) {
+		case 0x33:
+			*end = (chip->index + 2) & ADDRESS_MASK;
+			return WATCH_WRITE;
+		case 0x55:
+			*end = (chip->index + x) & ADDRESS_MASK;
+			return WATCH_WRITE;
+		case 0x65:
+			*end = (chip->index + x) & ADDRESS_MASK;
+			return WATCH_READ;
+		}
+		break;
+	}
+	return 0;
+}
+
+static const struct Watchpoint* findWatchpoint(const struct Debugger *debugger, const struct Chip8 *chip, uint16_t opcode)
+{
+	uint16_t start, end;
+	uint8_t kind = memoryAccess(chip, opcode, &start, &end);
+
+	if (kind == 0)
+		return NULL;
+
+	// Cheap page test first, the list is only walked when a watched page is touched
+	uint16_t pages = (kind == WATCH_READ) ? debugger->readPages : debugger->writePages;
+	if (!(pageMask(start, end) & pages))
+		return NULL;
+
+	for (unsigned int i = 0; i < debugger->watchpointCount; i++) {
+		const struct Watchpoint *watch = &debugger->watchpoints[i];
+		if ((watch->kind & kind) && overlapsWatchpoint(watch, start, end))
+			return watch;
+	}
+	return NULL;
+}
+
+static bool testCondition(const struct RegisterCondition *condition, const struct Chip8 *chip)
+{
+	uint8_t value = chip->registers[condition->reg];
+
+	switch (condition->op) {
+	case COND_EQ: return value == condition->value;
+	case COND_NE: return value != condition->value;
+	case COND_LT: return value < condition->value;
+	case COND_GT: return value > condition->value;
+	}
+	return false;
+}
+
+static void rebuildPages(struct Debugger *debugger)
+{
+	debugger->readPages = 0;
+	debugger->writePages = 0;
+
+	for (unsigned int i = 0; i < debugger->watchpointCount; i++) {
+		const struct Watchpoint *watch = &debugger->watchpoints[i];
+		if (watch->kind & WATCH_READ)
+			debugger->readPages |= pageMask(watch->start, watch->end);
+		if (watch->kind & WATCH_WRITE)
+			debugger->writePages |= pageMask(watch->start, watch->end);
+	}
+}
+
+void initDebugger(struct Debugger *debugger)
+{
+	memset(debugger, 0, sizeof(*debugger));
+	snprintf(debugger->status, DEBUG_STATUS_SIZE, "running");
+}
+
+bool debuggerArmed(const struct Debugger *debugger)
+{
+	return debugger->paused || debugger->stepping || debugger->steppingOver || debugger->breakpointCount > 0
+		|| debugger->watchpointCount > 0 || debugger->conditionCount > 0;
+}
+
+bool CycleDebug(struct Chip8 *chip, struct Debugger *debugger)
+{
+	if (debugger->paused)
+		return false;
+
+	uint16_t pc = chip->PC & (DEBUG_MEMORY_SIZE - 1);
+	uint16_t opcode = (chip->memory[pc] << 8) | chip->memory[(pc + 1) & (DEBUG_MEMORY_SIZE - 1)];
+
+	if (!debugger->resumed) {
+		if (hasBreakpoint(debugger, pc)) {
+			stopDebugger(debugger, "breakpoint", pc);
+			return false;
+		}
+
+		const struct Watchpoint *watch = findWatchpoint(debugger, chip, opcode);
+		if (watch != NULL) {
+			stopDebugger(debugger, (watch->kind & WATCH_WRITE) ? "watch write" : "watch read", pc);
+			return false;
+		}
+	}
+	debugger->resumed = false;
+
+	// Never fused, every instruction has to pass the checks above
+	CycleSingle(chip);
+
+	for (unsigned int i = 0; i < debugger->conditionCount; i++) {
+		struct RegisterCondition *condition = &debugger->conditions[i];
+		bool result = testCondition(condition, chip);
+
+		if (result && !condition->last)
+			stopDebugger(debugger, "condition", pc);
+		condition->last = result;
+	}
+
+	if (debugger->stepping)
+		stopDebugger(debugger, "step", chip->PC);
+	else if (debugger->steppingOver && chip->SP <= debugger->stepOverSP)
+		stopDebugger(debugger, "step over", chip->PC);
+
+	return true;
+}
+
+static bool parseNumber(const char *text, unsigned long *value)
+{
+	char *end;
+
+	if (text == NULL)
+		return false;
+	*value = strtoul(text, &end, 16);
+	return end != text && *end == '\0';
+}
+
+static bool parseRegister(const char *text, uint8_t *reg)
+{
+	unsigned long value;
+
+	if (text == NULL || (text[0] != 'v' && text[0] != 'V') || !parseNumber(text + 1, &value) || value > 0xF)
+		return false;
+	*reg = (uint8_t)value;
+	return true;
+}
+
+// "r", "w" or "rw", writes when left out
+static bool parseWatchKind(const char *text, uint8_t *kind)
+{
+	if (text == NULL)
+		*kind = WATCH_WRITE;
+	else if (strcmp(text, "r") == 0)
+		*kind = WATCH_READ;
+	else if (strcmp(text, "w") == 0)
+		*kind = WATCH_WRITE;
+	else if (strcmp(text, "rw") == 0)
+		*kind = WATCH_READ | WATCH_WRITE;
+	else
+		return false;
+	return true;
+}
+
+bool runDebugCommand(struct Debugger *debugger, struct Chip8 *chip, const char *command)
+{
+	char line[DEBUG_STATUS_SIZE];
+	char *args[4] = { NULL };
+	unsigned long value, end;
+	int count = 0;
+
+	strncpy(line, command, sizeof(line) - 1);
+	line[sizeof(line) - 1] = '\0';
+	for (char *token = strtok(line, " \t"); token != NULL && count < 4; token = strtok(NULL, " \t"))
+		args[count++] = token;
+	if (count == 0)
+		return false;
+
+	if (strcmp(args[0], "show") == 0 || strcmp(args[0], "hide") == 0) {
+		debugger->visible = args[0][0] == 's';
+	}
+	else if (strcmp(args[0], "break") == 0) {
+		stopDebugger(debugger, "paused", chip->PC);
+	}
+	else if (strcmp(args[0], "continue") == 0) {
+		debugger->paused = false;
+		debugger->resumed = true;
+		snprintf(debugger->status, DEBUG_STATUS_SIZE, "running");
+	}
+	else if (strcmp(args[0], "step") == 0 || strcmp(args[0], "next") == 0) {
+		uint16_t pc = chip->PC & (DEBUG_MEMORY_SIZE - 1);
+
+		// Stepping over a call runs until the stack is back at this depth
+		if (args[0][0] == 'n' && (chip->memory[pc] >> 4) == 0x2) {
+			debugger->steppingOver = true;
+			debugger->stepOverSP = chip->SP;
+		}
+		else {
+			debugger->stepping = true;
+		}
+		debugger->paused = false;
+		debugger->resumed = true;
+	}
+	else if ((strcmp(args[0], "b") == 0 || strcmp(args[0], "d") == 0) && parseNumber(args[1], &value) && value < DEBUG_MEMORY_SIZE) {
+		uint8_t bit = 1 << (value & 7);
+		bool set = (debugger->breakpoints[value >> 3] & bit) != 0;
+
+		if (args[0][0] == 'b' && !set) {
+			debugger->breakpoints[value >> 3] |= bit;
+			debugger->breakpointCount++;
+		}
+		else if (args[0][0] == 'd' && set) {
+			debugger->breakpoints[value >> 3] &= ~bit;
+			debugger->breakpointCount--;
+		}
+	}
+	else if (strcmp(args[0], "w") == 0 && parseNumber(args[1], &value) && parseNumber(args[2], &end) && value <= end && end < DEBUG_MEMORY_SIZE) {
+		uint8_t kind;
+
+		if (debugger->watchpointCount == DEBUG_MAX_WATCHPOINTS || !parseWatchKind(args[3], &kind))
+			return false;
+
+		struct Watchpoint *watch = &debugger->watchpoints[debugger->watchpointCount++];
+		watch->start = (uint16_t)value;
+		watch->end = (uint16_t)end;
+		watch->kind = kind;
+		rebuildPages(debugger);
+	}
+	else if (strcmp(args[0], "c") == 0 && count == 4) {
+		static const char *ops[] = { "==", "!=", "<", ">" };
+		struct RegisterCondition condition = { 0 };
+		int op = -1;
+
+		for (int i = 0; i < 4; i++)
+			if (strcmp(args[2], ops[i]) == 0)
+				op = i;
+		if (op < 0 || !parseRegister(args[1], &condition.reg) || !parseNumber(args[3], &value) || value > 0xFF
+			|| debugger->conditionCount == DEBUG_MAX_CONDITIONS)
+			return false;
+
+		condition.op = (uint8_t)op;
+		condition.value = (uint8_t)value;
+		condition.last = testCondition(&condition, chip);
+		debugger->conditions[debugger->conditionCount++] = condition;
+	}
+	else if (strcmp(args[0], "clear") == 0) {
+		bool visible = debugger->visible;
+		bool paused = debugger->paused;
+
+		initDebugger(debugger);
+		debugger->visible = visible;
+		debugger->paused = paused;
+	}
+	else {
+		return false;
+	}
+
+	return true;
+}
+
+void fillDebugView(const struct Debugger *debugger, const struct Chip8 *chip, struct DebugView *view)
+{
+	view->visible = debugger->visible;
+	view->paused = debugger->paused;
+	memcpy(view->registers, chip->registers, sizeof(view->registers));
+	view->index = chip->index;
+	view->PC = chip->PC;
+	memcpy(view->stack, chip->stack, sizeof(view->stack));
+	view->SP = chip->SP;
+	view->delayTimer = chip->delayTimer;
+	view->soundTimer = chip->soundTimer;
+	memcpy(view->memory, chip->memory, sizeof(view->memory));
+	memcpy(view->breakpoints, debugger->breakpoints, sizeof(view->breakpoints));
+	memcpy(view->status, debugger->status, sizeof(view->status));
+}
+
+void Disassemble(uint16_t opcode, char *out, size_t size)
+{
+	unsigned int x = GET_X(opcode);
+	unsigned int y = GET_Y(opcode);
+	unsigned int n = GET_N(opcode);
+	unsigned int nn = GET_BYTE(opcode);
+	unsigned int nnn = GET_ADDRESS(opcode);
+
+	switch (GET_INSTRUCTION_TYPE(opcode)) {
+	case 0x0:
+		if (opcode == 0x00E0) { snprintf(out, size, "CLS"); return; }
+		if (opcode == 0x00EE) { snprintf(out, size, "RET"); return; }
+		break;
+	case 0x1: snprintf(out, size, "JP   %03X", nnn); return;
+	case 0x2: snprintf(out, size, "CALL %03X", nnn); return;
+	case 0x3: snprintf(out, size, "SE   V%X, %02X", x, nn); return;
+	case 0x4: snprintf(out, size, "SNE  V%X, %02X", x, nn); return;
+	case 0x5: snprintf(out, size, "SE   V%X, V%X", x, y); return;
+	case 0x6: snprintf(out, size, "LD   V%X, %02X", x, nn); return;
+	case 0x7: snprintf(out, size, "ADD  V%X, %02X", x, nn); return;
+	case 0x8: {
+		static const char *alu[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+			NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL };
+		if (alu[n] != NULL) { snprintf(out, size, "%-4s V%X, V%X", alu[n], x, y); return; }
+		break;
+	}
+	case 0x9: snprintf(out, size, "SNE  V%X, V%X", x, y); return;
+	case 0xA: snprintf(out, size, "LD   I, %03X", nnn); return;
+	case 0xB: snprintf(out, size, "JP   V0, %03X", nnn); return;
+	case 0xC: snprintf(out, size, "RND  V%X, %02X", x, nn); return;
+	case 0xD: snprintf(out, size, "DRW  V%X, V%X, %X", x, y, n); return;
+	case 0xE:
+		if (nn == 0x9E) { snprintf(out, size, "SKP  V%X", x); return; }
+		if (nn == 0xA1) { snprintf(out, size, "SKNP V%X", x); return; }
+		break;
+	case 0xF:
+		switch (nn) {
+		case 0x07: snprintf(out, size, "LD   V%X, DT", x); return;
+		case 0x0A: snprintf(out, size, "LD   V%X, K", x); return;
+		case 0x15: snprintf(out, size, "LD   DT, V%X", x); return;
+		case 0x18: snprintf(out, size, "LD   ST, V%X", x); return;
+		case 0x1E: snprintf(out, size, "ADD  I, V%X", x); return;
+		case 0x29: snprintf(out, size, "LD   F, V%X", x); return;
+		case 0x33: snprintf(out, size, "LD   B, V%X", x); return;
+		case 0x55: snprintf(out, size, "LD   [I], V%X", x); return;
+		case 0x65: snprintf(out, size, "LD   V%X, [I]", x); return;
+		}
+		break;
+	}
+	snprintf(out, size, "DW   %04X", opcode);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "emulator.h"
+
+#define DEBUG_MEMORY_SIZE 4096
+#define DEBUG_PAGE_SHIFT 8			// watchpoint pages are 256 bytes
+#define DEBUG_MAX_WATCHPOINTS 16
+#define DEBUG_MAX_CONDITIONS 8
+#define DEBUG_STATUS_SIZE 64
+
+enum WatchKind {
+	WATCH_READ = 1,
+	WATCH_WRITE = 2
+};
+
+enum ConditionOp {
+	COND_EQ,
+	COND_NE,
+	COND_LT,
+	COND_GT
+};
+
+struct Watchpoint {
+	uint16_t start;
+	uint16_t end;				// inclusive
+	uint8_t kind;
+};
+
+// Break when register VX compared to value becomes true
+struct RegisterCondition {
+	uint8_t reg;
+	uint8_t op;
+	uint8_t value;
+	bool last;					// result after the previous instruction, conditions are edge triggered
+};
+
+// Debugger state, owned by whichever thread runs the core
+// Nothing here is looked at by Cycle(), the emulation loop switches to CycleDebug()
+// only while debuggerArmed() is true so the normal core pays nothing for it.
+struct Debugger {
+	uint8_t breakpoints[DEBUG_MEMORY_SIZE / 8];
+	unsigned int breakpointCount;
+
+	// One bit per page holding any read/write watchpoint, checked before the list
+	uint16_t readPages;
+	uint16_t writePages;
+	struct Watchpoint watchpoints[DEBUG_MAX_WATCHPOINTS];
+	unsigned int watchpointCount;
+
+	struct RegisterCondition conditions[DEBUG_MAX_CONDITIONS];
+	unsigned int conditionCount;
+
+	bool visible;				// overlay requested
+	bool paused;
+	bool resumed;				// skip the break checks for the first instruction after resuming
+	bool stepping;
+	bool steppingOver;
+	uint8_t stepOverSP;
+	char status[DEBUG_STATUS_SIZE];
+};
+
+// Snapshot of the core for the overlay
+struct DebugView {
+	bool visible;
+	bool paused;
+	uint8_t registers[16];
+	uint16_t index;
+	uint16_t PC;
+	uint16_t stack[16];
+	uint8_t SP;
+	uint8_t delayTimer;
+	uint8_t soundTimer;
+	uint8_t memory[DEBUG_MEMORY_SIZE];
+	uint8_t breakpoints[DEBUG_MEMORY_SIZE / 8];
+	char status[DEBUG_STATUS_SIZE];
+};
+
+// Clear all breakpoints, watchpoints and conditions
+void initDebugger(struct Debugger *debugger);
+
+// True if the emulation loop has to run CycleDebug() instead of Cycle()
+bool debuggerArmed(const struct Debugger *debugger);
+
+// Run one instruction with break checks, returns false if it stopped before executing
+bool CycleDebug(struct Chip8 *chip, struct Debugger *debugger);
+
+// Run a text command: break, continue, step, next, b ADDR, d ADDR, w START END r|w|rw,
+// c VX ==|!=|<|> NN, clear, show, hide. Returns false if the command was not understood.
+bool runDebugCommand(struct Debugger *debugger, struct Chip8 *chip, const char *command);
+
+// Copy the state shown by the overlay
+void fillDebugView(const struct Debugger *debugger, const struct Chip8 *chip, struct DebugView *view);
+
+// Write the mnemonic for opcode into out
+void Disassemble(uint16_t opcode, char *out, size_t size);
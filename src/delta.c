@@ -0,0 +1,130 @@
+#include <string.h>
+#include "delta.h"
+
+// Shortest zero run worth ending a literal for, shorter runs are cheaper inline
+#define DELTA_MIN_ZERO_RUN 4
+
+static uint8_t* writeVarint(uint8_t *out, size_t value)
+{
+	while (value >= 0x80) {
+		*out++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (uint8_t)value;
+	return out;
+}
+
+static const uint8_t* readVarint(const uint8_t *in, const uint8_t *end, size_t *value)
+{
+	size_t result = 0;
+	unsigned int shift = 0;
+
+	while (in < end && shift < 8 * sizeof(size_t)) {
+		uint8_t byte = *in++;
+		result |= (size_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			*value = result;
+			return in;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+static inline uint8_t deltaAt(const uint8_t *current, const uint8_t *reference, size_t i)
+{
+	return reference ? current[i] ^ reference[i] : current[i];
+}
+
+// Length of the run of unchanged bytes starting at i, compared a word at a time
+static size_t zeroRun(const uint8_t *current, const uint8_t *reference, size_t i, size_t size)
+{
+	size_t start = i;
+
+	while (i + sizeof(uint64_t) <= size) {
+		uint64_t a, b = 0;
+		memcpy(&a, current + i, sizeof(a));
+		if (reference)
+			memcpy(&b, reference + i, sizeof(b));
+		if (a != b)
+			break;
+		i += sizeof(uint64_t);
+	}
+	while (i < size && deltaAt(current, reference, i) == 0)
+		i++;
+	return i - start;
+}
+
+size_t encodeDelta(const uint8_t *current, const uint8_t *reference, size_t size, uint8_t *out)
+{
+	uint8_t *start = out;
+	size_t i = 0;
+
+	while (i < size) {
+		size_t zeros = zeroRun(current, reference, i, size);
+		i += zeros;
+		if (i == size) {
+			out = writeVarint(out, zeros);
+			out = writeVarint(out, 0);
+			break;
+		}
+
+		// Extend the literal until a zero run long enough to be worth a new record
+		size_t literal = i;
+		while (literal < size) {
+			if (deltaAt(current, reference, literal) != 0) {
+				literal++;
+				continue;
+			}
+			size_t run = zeroRun(current, reference, literal, size);
+			if (run >= DELTA_MIN_ZERO_RUN || literal + run == size)
+				break;
+			literal += run;
+		}
+
+		out = writeVarint(out, zeros);
+		out = writeVarint(out, literal - i);
+		for (; i < literal; i++)
+			*out++ = deltaAt(current, reference, i);
+	}
+
+	return (size_t)(out - start);
+}
+
+int decodeDelta(const uint8_t *in, size_t length, const uint8_t *reference, uint8_t *out, size_t size)
+{
+	const uint8_t *end = in + length;
+	size_t i = 0;
+
+	if (reference)
+		memcpy(out, reference, size);
+	else
+		memset(out, 0, size);
+
+	while (in < end) {
+		size_t zeros, literal;
+
+		in = readVarint(in, end, &zeros);
+		if (in == NULL)
+			return 0;
+		in = readVarint(in, end, &literal);
+		if (in == NULL || zeros > size - i || literal > size - i - zeros || literal > (size_t)(end - in))
+			return 0;
+
+		i += zeros;
+		for (size_t j = 0; j < literal; j++)
+			out[i++] ^= *in++;
+	}
+
+	return 1;
+}
+
+void packBits(const uint8_t *bytes, size_t count, uint8_t *bits)
+{
+	for (size_t i = 0; i < count; i += 8) {
+		uint8_t packed = 0;
+		for (size_t j = 0; j < 8; j++)
+			packed = (uint8_t)(packed << 1 | (bytes[i + j] != 0));
+		bits[i / 8] = packed;
+	}
+}
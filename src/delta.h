@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Worst case encoded size for size bytes of input
+#define DELTA_BOUND(size) ((size) + 16)
+
+// XOR delta + run-length codec
+// The input is XORed against a reference (or zeros when reference is NULL) and encoded
+// as a sequence of (zero run, literal length, literal bytes) records with varint lengths.
+// Unchanged bytes cost nothing beyond their run length, so near-identical buffers encode
+// to a handful of bytes.
+
+// Encode current against reference into out, returns the encoded size
+size_t encodeDelta(const uint8_t *current, const uint8_t *reference, size_t size, uint8_t *out);
+
+// Decode into out (size bytes) against the same reference, returns 0 on malformed input
+int decodeDelta(const uint8_t *in, size_t length, const uint8_t *reference, uint8_t *out, size_t size);
+
+// Pack count bytes (a multiple of 8) into count / 8 bytes, one bit per non-zero byte, MSB first
+void packBits(const uint8_t *bytes, size_t count, uint8_t *bits);
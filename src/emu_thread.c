@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emu_thread.h"
+
+// Emulation thread
+// Runs the Chip-8 core at a fixed tick rate independent of the render loop.
+// Input arrives through a lock-free command ring and every completed tick is
+// published through a lock-free triple buffer, so neither side ever waits on the other.
+
+static void loadEmulator(struct EmuThread *emu)
+{
+	releaseEmulator(&emu->chip);
+	initEmulator(&emu->chip);
+	loadRom(&emu->chip, emu->romPath);
+	loadFonts(&emu->chip);
+	clearRewind(&emu->history);
+	cancelLatencyProbe(&emu->latency);
+	initAutoTuner(&emu->tuner, &emu->chip, emu->tuner.enabled);
+	atomic_store_explicit(&emu->cyclesPerTick, emu->tuner.cycles, memory_order_relaxed);
+}
+
+// Step back one frame, held keys stay as they are on the host
+static void rewindFrame(struct EmuThread *emu)
+{
+	uint8_t keypad[16];
+
+	memcpy(keypad, emu->chip.keypad, sizeof(keypad));
+	stepRewind(&emu->history, &emu->chip);
+	memcpy(emu->chip.keypad, keypad, sizeof(keypad));
+	resyncAutoTuner(&emu->tuner, &emu->chip);	// the counters went back in time too
+}
+
+static void applyCommand(struct EmuThread *emu, const struct EmuCommand *command)
+{
+	// Netplay owns the keypad and anything else would make the peers disagree
+	if (emu->activeNetplay != NULL) {
+		if (command->type == EMU_CMD_KEY_DOWN)
+			emu->keys |= 1 << (command->key & 0xF);
+		else if (command->type == EMU_CMD_KEY_UP)
+			emu->keys &= ~(1 << (command->key & 0xF));
+		return;
+	}
+
+	switch (command->type) {
+	case EMU_CMD_KEY_DOWN:
+		emu->chip.keypad[command->key & 0xF] = 1;
+		emu->keys |= 1 << (command->key & 0xF);
+		startLatencyProbe(&emu->latency, command->key, command->time);
+		break;
+	case EMU_CMD_KEY_UP:
+		emu->chip.keypad[command->key & 0xF] = 0;
+		emu->keys &= ~(1 << (command->key & 0xF));
+		break;
+	case EMU_CMD_PAUSE:
+		emu->paused = true;
+		break;
+	case EMU_CMD_RESUME:
+		if (emu->paused)
+			resyncPacer(&emu->pacer);
+		emu->paused = false;
+		break;
+	case EMU_CMD_RESET:
+		loadEmulator(emu);
+		break;
+	case EMU_CMD_LOAD_ROM:
+		memcpy(emu->romPath, command->path, EMU_PATH_SIZE);
+		emu->romPath[EMU_PATH_SIZE - 1] = '\0';
+		loadEmulator(emu);
+		break;
+	case EMU_CMD_SET_SPEED:
+		if (emu->speed == EMU_SPEED_UNCAPPED && command->value != EMU_SPEED_UNCAPPED)
+			resyncPacer(&emu->pacer);
+		emu->speed = command->value;
+		break;
+	case EMU_CMD_REWIND:
+		emu->rewinding = command->value != 0;
+		break;
+	case EMU_CMD_DEBUG:
+		if (!runDebugCommand(&emu->debugger, &emu->chip, command->path))
+			printf("Unknown debugger command: %s\n", command->path);
+		break;
+	}
+}
+
+static void drainCommands(struct EmuThread *emu)
+{
+	unsigned int tail = atomic_load_explicit(&emu->commandTail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&emu->commandHead, memory_order_acquire);
+
+	while (tail != head) {
+		applyCommand(emu, &emu->commands[tail & (EMU_COMMAND_QUEUE_SIZE - 1)]);
+		tail++;
+	}
+	atomic_store_explicit(&emu->commandTail, tail, memory_order_release);
+}
+
+// FX0A rewinds PC onto itself until a key is down
+static bool isWaitingKey(const struct Chip8 *chip)
+{
+	uint16_t pc = chip->PC & 0xFFF;
+	uint16_t opcode = (chip->memory[pc] << 8) | chip->memory[(pc + 1) & 0xFFF];
+
+	return (opcode & 0xF0FF) == 0xF00A;
+}
+
+static void publishFrame(struct EmuThread *emu)
+{
+	struct EmuFrame *frame = &emu->frames[emu->back];
+
+	memcpy(frame->video, emu->chip.video, sizeof(frame->video));
+	frame->sequence = ++(emu->sequence);
+	frame->delayTimer = emu->chip.delayTimer;
+	frame->soundTimer = emu->chip.soundTimer;
+	frame->waitingKey = isWaitingKey(&emu->chip);
+	if (emu->chip.fault != emu->reportedFault) {
+		emu->reportedFault = emu->chip.fault;
+		if (emu->chip.fault != FAULT_NONE)
+			printf("ERROR: %s at %03x\n", faultName(emu->chip.fault), emu->chip.faultPC);
+	}
+	if (emu->debugger.visible)
+		fillDebugView(&emu->debugger, &emu->chip, &frame->debug);
+	else
+		frame->debug.visible = false;
+
+	unsigned int previous = atomic_exchange_explicit(&emu->shared, emu->back | EMU_FRAME_FRESH, memory_order_acq_rel);
+	emu->back = previous & 0x3;
+
+	struct ShmExport *exporter = atomic_load_explicit(&emu->frameExport, memory_order_acquire);
+	if (exporter != NULL)
+		publishShmFrame(exporter, &emu->chip, pacerNowNs());
+
+	struct Spectator *spectator = atomic_load_explicit(&emu->spectator, memory_order_acquire);
+	if (spectator != NULL)
+		publishSpectatorFrame(spectator, emu->chip.video);
+}
+
+// Run one 60 Hz tick, returns false if the debugger stopped it part way
+static bool runTick(struct EmuThread *emu)
+{
+	// Budget by instructions executed since fused sequences run several per Cycle()
+	uint64_t end = emu->chip.instructions + emu->tuner.cycles;
+
+	// The debug variant is only swapped in while something could make it stop
+	if (debuggerArmed(&emu->debugger)) {
+		while (emu->chip.instructions < end) {
+			if (!CycleDebug(&emu->chip, &emu->debugger))
+				return false;
+		}
+	}
+	else if (latencyAwaitingRead(&emu->latency)) {
+		while (emu->chip.instructions < end) {
+			checkLatencyRead(&emu->latency, &emu->chip);
+			Cycle(&emu->chip);
+		}
+	}
+	else {
+		while (emu->chip.instructions < end)
+			Cycle(&emu->chip);
+	}
+
+	atomic_store_explicit(&emu->cyclesPerTick, observeTick(&emu->tuner, &emu->chip), memory_order_relaxed);
+	updateTimers(&emu->chip);
+	checkLatencyDisplay(&emu->latency, &emu->chip, emu->sequence + 1);
+	captureRewind(&emu->history, &emu->chip);
+	emu->ticks++;
+	return true;
+}
+
+// Both peers start from the ROM with the same seed
+static void startEmuNetplay(struct EmuThread *emu, struct Netplay *netplay)
+{
+	loadEmulator(emu);
+	seedEmulator(&emu->chip, NETPLAY_SEED);
+	emu->rewinding = false;
+	startNetplay(netplay, &emu->chip, EMU_CYCLES_PER_TICK);
+	atomic_store_explicit(&emu->cyclesPerTick, EMU_CYCLES_PER_TICK, memory_order_relaxed);
+	resyncPacer(&emu->pacer);
+}
+
+// One shared tick, rollbacks happen inside and only the corrected frame is published
+static void runNetplayTick(struct EmuThread *emu, struct Netplay *netplay)
+{
+	uint64_t start = pacerNowNs(), instructions = emu->chip.instructions;
+
+	if (advanceNetplay(netplay, &emu->chip, emu->keys)) {
+		emu->ticks++;
+		atomic_fetch_add_explicit(&emu->timerTicks, 1, memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&emu->busyNs, pacerNowNs() - start, memory_order_relaxed);
+	atomic_fetch_add_explicit(&emu->executed, emu->chip.instructions - instructions, memory_order_relaxed);
+	publishFrame(emu);
+}
+
+static void* runEmuThread(void *arg)
+{
+	struct EmuThread *emu = (struct EmuThread*)arg;
+	struct PacerStats stats;
+	uint64_t nextLog = pacerNowNs() + EMU_LOG_INTERVAL_NS;
+
+	while (atomic_load_explicit(&emu->running, memory_order_acquire)) {
+		struct Netplay *netplay = atomic_load_explicit(&emu->netplay, memory_order_acquire);
+		if (netplay != emu->activeNetplay) {
+			emu->activeNetplay = netplay;
+			if (netplay != NULL)
+				startEmuNetplay(emu, netplay);
+			else
+				resyncAutoTuner(&emu->tuner, &emu->chip);
+		}
+
+		// Peers advance together at the base tick rate
+		if (netplay != NULL) {
+			waitPacer(&emu->pacer);
+			drainCommands(emu);
+			runNetplayTick(emu, netplay);
+			continue;
+		}
+
+		unsigned int due = (emu->speed == EMU_SPEED_UNCAPPED)? EMU_UNCAPPED_BATCH : waitPacer(&emu->pacer) * emu->speed;
+		drainCommands(emu);
+
+		if (emu->paused) {
+			if (emu->speed == EMU_SPEED_UNCAPPED)
+				waitPacer(&emu->pacer);	// don't spin while paused
+			continue;
+		}
+
+		if (emu->debugger.paused) {
+			if (emu->speed == EMU_SPEED_UNCAPPED)
+				waitPacer(&emu->pacer);
+			publishFrame(emu);	// keep the overlay current while stopped
+			continue;
+		}
+
+		if (emu->rewinding) {
+			// History is played back at the capture rate regardless of speed
+			if (emu->speed == EMU_SPEED_UNCAPPED)
+				waitPacer(&emu->pacer);
+			rewindFrame(emu);
+			publishFrame(emu);
+			continue;
+		}
+
+		// Only the last of several ticks run back to back is published
+		uint64_t start = pacerNowNs(), instructions = emu->chip.instructions, ticks = emu->ticks;
+		for (unsigned int tick = 0; tick < due; tick++) {
+			if (!runTick(emu))
+				break;
+		}
+		atomic_fetch_add_explicit(&emu->busyNs, pacerNowNs() - start, memory_order_relaxed);
+		atomic_fetch_add_explicit(&emu->executed, emu->chip.instructions - instructions, memory_order_relaxed);
+		atomic_fetch_add_explicit(&emu->timerTicks, emu->ticks - ticks, memory_order_relaxed);
+		publishFrame(emu);
+
+		if (pacerNowNs() >= nextLog) {
+			readPacerStats(&emu->pacer, &stats);
+			logPacerStats(stdout, &stats);
+			nextLog += EMU_LOG_INTERVAL_NS;
+		}
+	}
+
+	return NULL;
+}
+
+void startEmuThread(struct EmuThread *emu, const char *romPath)
+{
+	memset(emu, 0, sizeof(*emu));
+	strncpy(emu->romPath, romPath, EMU_PATH_SIZE - 1);
+	const char *autotune = getenv("CHIPPY_AUTOTUNE");
+	emu->tuner.enabled = autotune == NULL || strcmp(autotune, "0") != 0;
+	initRewind(&emu->history);
+	initDebugger(&emu->debugger);
+	initLatencyProbe(&emu->latency);
+	atomic_init(&emu->cyclesPerTick, EMU_CYCLES_PER_TICK);
+	loadEmulator(emu);	// starts the tuner and publishes its rate
+
+	emu->speed = 1;
+	emu->back = 0;
+	atomic_init(&emu->shared, 1);
+	emu->front = 2;
+	atomic_init(&emu->commandHead, 0);
+	atomic_init(&emu->commandTail, 0);
+	atomic_init(&emu->running, true);
+	atomic_init(&emu->busyNs, 0);
+	atomic_init(&emu->executed, 0);
+	atomic_init(&emu->timerTicks, 0);
+	atomic_init(&emu->frameExport, NULL);
+	atomic_init(&emu->spectator, NULL);
+	atomic_init(&emu->netplay, NULL);
+	initPacer(&emu->pacer, EMU_TICK_RATE);
+
+	if (pthread_create(&emu->thread, NULL, runEmuThread, emu) != 0) {
+		printf("Error while starting emulation thread\n");
+		exit(1);
+	}
+}
+
+void stopEmuThread(struct EmuThread *emu)
+{
+	atomic_store_explicit(&emu->running, false, memory_order_release);
+	pthread_join(emu->thread, NULL);
+
+	releaseEmulator(&emu->chip);
+	freeRewind(&emu->history);
+}
+
+bool pushEmuCommand(struct EmuThread *emu, struct EmuCommand command)
+{
+	unsigned int head = atomic_load_explicit(&emu->commandHead, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&emu->commandTail, memory_order_acquire);
+
+	if (head - tail >= EMU_COMMAND_QUEUE_SIZE)
+		return false;
+
+	emu->commands[head & (EMU_COMMAND_QUEUE_SIZE - 1)] = command;
+	atomic_store_explicit(&emu->commandHead, head + 1, memory_order_release);
+	return true;
+}
+
+void setEmuFrameExport(struct EmuThread *emu, struct ShmExport *exporter)
+{
+	atomic_store_explicit(&emu->frameExport, exporter, memory_order_release);
+}
+
+void setEmuSpectator(struct EmuThread *emu, struct Spectator *spectator)
+{
+	atomic_store_explicit(&emu->spectator, spectator, memory_order_release);
+}
+
+void setEmuNetplay(struct EmuThread *emu, struct Netplay *netplay)
+{
+	atomic_store_explicit(&emu->netplay, netplay, memory_order_release);
+}
+
+const struct EmuFrame* acquireEmuFrame(struct EmuThread *emu)
+{
+	if (!(atomic_load_explicit(&emu->shared, memory_order_acquire) & EMU_FRAME_FRESH))
+		return NULL;
+
+	unsigned int previous = atomic_exchange_explicit(&emu->shared, emu->front, memory_order_acq_rel);
+	emu->front = previous & 0x3;
+	return &emu->frames[emu->front];
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "pacer.h"
+#include "rewind.h"
+#include "debugger.h"
+#include "latency.h"
+#include "shm_export.h"
+#include "spectator.h"
+#include "netplay.h"
+#include "autotune.h"
+
+#define EMU_TICK_RATE 60			// timer ticks per second
+#define EMU_CYCLES_PER_TICK CYCLES_PER_TICK	// fixed under netplay, otherwise tuned per ROM
+#define EMU_COMMAND_QUEUE_SIZE 64	// must be a power of two
+#define EMU_PATH_SIZE 512
+#define EMU_LOG_INTERVAL_NS 60000000000ULL	// time between pacing log lines
+#define EMU_FRAME_FRESH 0x4			// set on the shared triple buffer index when unread
+#define EMU_SPEED_UNCAPPED 0		// run as fast as the host allows
+#define EMU_UNCAPPED_BATCH 60		// ticks run between command checks when uncapped
+
+enum EmuCommandType {
+	EMU_CMD_KEY_DOWN,
+	EMU_CMD_KEY_UP,
+	EMU_CMD_PAUSE,
+	EMU_CMD_RESUME,
+	EMU_CMD_RESET,
+	EMU_CMD_LOAD_ROM,
+	EMU_CMD_SET_SPEED,
+	EMU_CMD_REWIND,				// value 1 starts stepping back through history, 0 stops
+	EMU_CMD_DEBUG				// path holds a debugger command, see runDebugCommand()
+};
+
+struct EmuCommand {
+	uint8_t type;
+	uint8_t key;
+	uint16_t value;
+	uint64_t time;				// pacerNowNs() when a key event was seen, for the latency probe
+	char path[EMU_PATH_SIZE];
+};
+
+// Completed frame published by the emulation thread
+struct EmuFrame {
+	uint8_t video[VIDEO_SIZE];
+	uint64_t sequence;
+	uint8_t delayTimer;
+	uint8_t soundTimer;
+	bool waitingKey;			// guest is blocked in FX0A
+	struct DebugView debug;		// only filled while the debugger overlay is visible
+};
+
+struct EmuThread {
+	pthread_t thread;
+	atomic_bool running;
+
+	// Single producer (render thread), single consumer (emulation thread) ring
+	struct EmuCommand commands[EMU_COMMAND_QUEUE_SIZE];
+	atomic_uint commandHead;
+	atomic_uint commandTail;
+
+	// Triple buffer: the writer owns frames[back], the reader owns frames[front]
+	// and the third slot index is swapped atomically between them
+	struct EmuFrame frames[3];
+	atomic_uint shared;
+	unsigned int back;
+	unsigned int front;
+
+	// Owned by the emulation thread
+	struct Chip8 chip;			// embedded, reloaded in place
+	uint16_t keys;				// host keypad as a bitmask, bit k for key k
+	char romPath[EMU_PATH_SIZE];
+	bool paused;
+	unsigned int speed;			// ticks per paced tick, or EMU_SPEED_UNCAPPED
+	uint64_t sequence;
+	uint64_t ticks;				// emulated 60 Hz ticks
+	struct Pacer pacer;
+	struct Rewind history;
+	bool rewinding;
+	struct Debugger debugger;
+	struct LatencyProbe latency;	// enabled from the render thread
+	uint8_t reportedFault;		// last chip.fault logged
+	struct AutoTuner tuner;		// instructions per tick, CHIPPY_AUTOTUNE=0 keeps EMU_CYCLES_PER_TICK
+
+	// Telemetry counters, written by the emulation thread and readable from any thread
+	atomic_uint_fast64_t busyNs;		// time spent running ticks
+	atomic_uint_fast64_t executed;		// guest instructions
+	atomic_uint_fast64_t timerTicks;
+	atomic_uint cyclesPerTick;			// current tuner rate
+
+	// Every published frame is also written here when set, see setEmuFrameExport()
+	_Atomic(struct ShmExport*) frameExport;
+	_Atomic(struct Spectator*) spectator;	// see setEmuSpectator()
+
+	// Netplay session, see setEmuNetplay()
+	_Atomic(struct Netplay*) netplay;
+	struct Netplay *activeNetplay;	// owned by the emulation thread
+};
+
+// Load romPath into the embedded emulator and start running it on its own thread
+void startEmuThread(struct EmuThread *emu, const char *romPath);
+
+// Stop the emulation thread, release the emulator and free the rewind history
+void stopEmuThread(struct EmuThread *emu);
+
+// Queue a command for the emulation thread, returns false if the queue is full
+bool pushEmuCommand(struct EmuThread *emu, struct EmuCommand command);
+
+// Also publish every frame to exporter from now on. The caller keeps ownership and
+// must not close it before stopEmuThread() returns.
+void setEmuFrameExport(struct EmuThread *emu, struct ShmExport *exporter);
+
+// Also stream every frame to spectator's viewers from now on, ownership as above
+void setEmuSpectator(struct EmuThread *emu, struct Spectator *spectator);
+
+// Play netplay from now on: the emulator restarts from the ROM with the shared seed and
+// every tick goes through advanceNetplay(). Speed, pause, rewind, reset and debugger
+// commands are ignored while it runs. The caller keeps ownership and must not close it
+// before stopEmuThread() returns.
+void setEmuNetplay(struct EmuThread *emu, struct Netplay *netplay);
+
+// Latest completed frame, or NULL if nothing new was published since the last call
+const struct EmuFrame* acquireEmuFrame(struct EmuThread *emu);
@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <string.h>
 #include "emulator.h"
+#include "fusion.h"
+#include "fingerprint.h"
+#include "rom_archive.h"
 
 // Chip-8 Emulator created by Danny Huynh
 
@@ -33,33 +36,89 @@ uint8_t fontset[FONTSET_SIZE] = {
 
 struct Chip8* createEmulator()
 {
-	struct Chip8 *emulator = (struct Chip8*)malloc(sizeof(struct Chip8));
-
-	memset(emulator->memory, 0, 4096 * sizeof(uint8_t));
-	memset(emulator->registers, 0, 16 * sizeof(uint8_t));
-	emulator->index = 0;
-	emulator->PC = START_ADDRESS;
-	memset(emulator->stack, 0, 16 * sizeof(uint16_t));
-	emulator->SP = 0;
-	emulator->delayTimer = 0;
-	emulator->soundTimer = 0;
-	memset(emulator->keypad, 0, 16 * sizeof(uint8_t));
-	memset(emulator->video, 0, VIDEO_SIZE * sizeof(uint32_t));
-	emulator->opcode = 0;
+	struct Chip8 *emulator = (struct Chip8*)aligned_alloc(alignof(struct Chip8), sizeof(struct Chip8));
 
+	if (emulator != NULL)
+		initEmulator(emulator);
 	return emulator;
 }
 
+void initEmulator(struct Chip8 *chip)
+{
+	memset(chip, 0, sizeof(*chip));
+	chip->PC = START_ADDRESS;
+	chip->fusion = noFusion;
+	seedEmulator(chip, (uint32_t)rand());
+}
+
+void releaseEmulator(struct Chip8 *chip)
+{
+	releaseFusion(chip);
+}
+
+void resetEmulator(struct Chip8 *chip)
+{
+	chip->PC = START_ADDRESS;
+	chip->index = 0;
+	chip->opcode = 0;
+	chip->SP = 0;
+	chip->delayTimer = 0;
+	chip->soundTimer = 0;
+	chip->fault = FAULT_NONE;
+	chip->faultPC = 0;
+	memset(chip->registers, 0, sizeof(chip->registers));
+	memset(chip->keypad, 0, sizeof(chip->keypad));
+	memset(chip->stack, 0, sizeof(chip->stack));
+	memset(chip->video, 0, sizeof(chip->video));
+	chip->videoHash = 0;
+	chip->litPixels = 0;
+}
+
+static const char *faultNames[] = { "none", "unknown_opcode", "stack_overflow", "stack_underflow", "pc_range" };
+
+const char* faultName(uint8_t fault)
+{
+	return (fault < sizeof(faultNames) / sizeof(faultNames[0])) ? faultNames[fault] : "unknown";
+}
+
+// Only the first fault is kept, later ones are usually its consequences
+static void raiseFault(struct Chip8 *chip, uint8_t fault, uint16_t address)
+{
+	if (chip->fault == FAULT_NONE) {
+		chip->fault = fault;
+		chip->faultPC = address;
+	}
+}
+
 // Fetch, Decode, Execute Cycle
 void Cycle(struct Chip8 *chip)
+{
+	// Superinstructions, see fusion.c
+	if (chip->PC < 4096) {
+		uint8_t fused = chip->fusion[chip->PC];
+		if (fused != FUSED_NONE) {
+			runFused(chip, fused);
+			return;
+		}
+	}
+	CycleSingle(chip);
+}
+
+// Fetch, Decode, Execute exactly one instruction
+void CycleSingle(struct Chip8 *chip)
 {
 	// Fetch
+	if (chip->PC > ADDRESS_MASK - 1) {
+		raiseFault(chip, FAULT_PC_RANGE, chip->PC);
+		chip->PC &= ADDRESS_MASK - 1;
+	}
 	uint16_t first_byte = chip->memory[chip->PC] << 8;
 	uint16_t second_byte = chip->memory[chip->PC + 1];
 	chip->opcode = first_byte | second_byte;
 
 	// Prepare to fetch next instruction
 	chip->PC += 2;
+	chip->instructions++;
 
 	// Get values from opcode
 	uint16_t INSTRUCTION_TYPE = GET_INSTRUCTION_TYPE(chip->opcode);
@@ -79,172 +138,152 @@ void Cycle(struct Chip8 *chip)
 		case 0xE:
 			OP_00EE(chip);
 			break;
+		default:
+			raiseFault(chip, FAULT_UNKNOWN_OPCODE, chip->PC - 2);
+			break;
 		}
 		break;
 
 	case 0x1:
-		printf("1\n");
 		OP_1NNN(chip);
 		break;
 
 	case 0x2:
-		printf("2\n");
 		OP_2NNN(chip);
 		break;
 
 	case 0x3:
-		printf("3\n");
 		OP_3XNN(chip);
 		break;
 
 	case 0x4:
-		printf("4\n");
 		OP_4XNN(chip);
 		break;
 
 	case 0x5:
-		printf("5\n");
 		OP_5XY0(chip);
 		break;
 
 	case 0x6:
-		printf("6\n");
 		OP_6XNN(chip);
 		break;
 
 	case 0x7:
-		printf("7\n");
 		OP_7XNN(chip);
 		break;
 
 	case 0x8:
-		printf("8");
 		switch (N) {
 		case 0x0:
-			printf("0\n");
 			OP_8XY0(chip);
 			break;
 		case 0x1:
-			printf("1\n");
 			OP_8XY1(chip);
 			break;
 		case 0x2:
-			printf("2\n");
 			OP_8XY2(chip);
 			break;
 		case 0x3:
-			printf("3\n");
 			OP_8XY3(chip);
 			break;
 		case 0x4:
-			printf("4\n");
 			OP_8XY4(chip);
 			break;
 		case 0x5:
-			printf("5\n");
 			OP_8XY5(chip);
 			break;
 		case 0x6:
-			printf("6\n");
 			OP_8XY6(chip);
 			break;
 		case 0x7:
-			printf("7\n");
 			OP_8XY7(chip);
 			break;
 		case 0xE:
-			printf("E\n");
 			OP_8XYE(chip);
 			break;
+		default:
+			raiseFault(chip, FAULT_UNKNOWN_OPCODE, chip->PC - 2);
+			break;
 		}
 		break;
 
 	case 0x9:
-		printf("8\n");
 		OP_9XY0(chip);
 		break;
 
 	case 0xA:
-		printf("A\n");
 		OP_ANNN(chip);
 		break;
 
 	case 0xB:
-		printf("B\n");
 		OP_BNNN(chip);
 		break;
 
 	case 0xC:
-		printf("C\n");
 		OP_CXNN(chip);
 		break;
 
 	case 0xD:
-		printf("D\n");
 		OP_DXYN(chip);
 		break;
 
 	case 0xE:
-		printf("E");
 		switch (N) {
 		case 0xE:
-			printf("E\n");
 			OP_EX9E(chip);
 			break;
 		case 0x1:
-			printf("1\n");
 			OP_EXA1(chip);
 			break;
+		default:
+			raiseFault(chip, FAULT_UNKNOWN_OPCODE, chip->PC - 2);
+			break;
 		}
 		break;
 
 	case 0xF:
-		printf("F");
 		switch (NN) {
 		case 0x07:
-			printf("07\n");
 			OP_FX07(chip);
 			break;
 		case 0x0A:
-			printf("0A\n");
 			OP_FX0A(chip);
 			break;
 		case 0x15:
-			printf("15\n");
 			OP_FX15(chip);
 			break;
 		case 0x18:
-			printf("18\n");
 			OP_FX18(chip);
 			break;
 		case 0x1E:
-			printf("1E\n");
 			OP_FX1E(chip);
 			break;
 		case 0x29:
-			printf("29\n");
 			OP_FX29(chip);
 			break;
 		case 0x33:
-			printf("33\n");
 			OP_FX33(chip);
 			break;
 		case 0x55:
-			printf("55\n");
 			OP_FX55(chip);
 			break;
 		case 0x65:
-			printf("65\n");
 			OP_FX65(chip);
 			break;
+		default:
+			raiseFault(chip, FAULT_UNKNOWN_OPCODE, chip->PC - 2);
+			break;
 		}
 		break;
 
 	default:
-		printf("ERROR: %x\n", chip->opcode);
+		raiseFault(chip, FAULT_UNKNOWN_OPCODE, chip->PC - 2);
 	}
+}
 
-	// timers
+// Timers count down at 60 Hz regardless of instruction rate
+void updateTimers(struct Chip8 *chip)
+{
 	if (chip->delayTimer > 0)
 		(chip->delayTimer)--;
 	if (chip->soundTimer > 0)
@@ -254,59 +293,79 @@ void Cycle(struct Chip8 *chip)
 // Load ROM content into Chip8 memory
 void loadRom(struct Chip8 *chip, const char *filename) 
 {
-	FILE *file;
-	file = fopen(filename, "rb");
-	if (file == NULL) {
+	// Read or inflate straight into guest memory, see rom_archive.h for the path forms
+	long size = readRomImage(filename, chip->memory + START_ADDRESS, MAX_ROM_SIZE);
+	if (size < 0) {
 		printf("Error while opening file\n");
 		printf("%s\n", filename);
 		exit(1);
 	}
+	if (size > MAX_ROM_SIZE) {
+		fputs("ROM does not fit in memory\n", stderr);
+		exit(3);
+	}
 
-	// Get size of file and create buffer
-	fseek(file, 0, SEEK_END);
-	long bufsize = ftell(file);
-	char *buffer = (char *) calloc(bufsize + 1, sizeof(char));
-	rewind(file);
+	// Written behind storeMemory()'s back, bring the derived state up to date
+	rehashEmulator(chip);
+	attachFusion(chip);
+}
 
-	size_t len = fread(buffer, sizeof(char), bufsize, file);
-	if (ferror(file) != 0) {
-		fputs("Error reading file", stderr);
-		exit(2);
-	} else {
-		buffer[len++] = '\0';
-	}
-	fclose(file);
+bool loadRomFromMemory(struct Chip8 *chip, const uint8_t *data, size_t size)
+{
+	if (size > MAX_ROM_SIZE)
+		return false;
 
 	// Load the ROM contents into Chip8's memory, starting at 0x200
-	for (long i = 0; i < bufsize; i++) {
-		chip->memory[START_ADDRESS + i] = buffer[i];
-	}
-	free(buffer);
+	for (size_t i = 0; i < size; i++)
+		storeMemory(chip, START_ADDRESS + i, data[i]);
+	attachFusion(chip);
+	return true;
 }
 
 // Load fonts into memory
 void loadFonts(struct Chip8 *chip) 
 {
 	for (unsigned int i = 0; i < FONTSET_SIZE; i++) {
-		chip->memory[FONTSET_START_ADDRESS + i] = fontset[i];
+		storeMemory(chip, FONTSET_START_ADDRESS + i, fontset[i]);
 	}
+	attachFusion(chip);
+}
+
+void seedEmulator(struct Chip8 *chip, uint32_t seed)
+{
+	// xorshift must never be seeded with zero
+	chip->rngState = seed ? seed : 0x9E3779B9;
 }
 
 // Random number between 0 and 255
-uint8_t randByte()
+uint8_t randByte(struct Chip8 *chip)
 {
-	return (uint8_t) (rand() % 256);
+	uint32_t x = chip->rngState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	chip->rngState = x;
+	return (uint8_t) (x >> 24);
 }
 
 // opcode 00E0: CLS
 void OP_00E0(struct Chip8 *chip)
 {
-	memset(chip->video, 0, VIDEO_SIZE*sizeof(uint32_t));
+	// Games clear a screen that is already dark every frame
+	if (chip->litPixels != 0)
+		memset(chip->video, 0, sizeof(chip->video));
+	chip->videoHash = 0;
+	chip->litPixels = 0;
+	chip->drawCount++;
 }
 
 // opcode 00EE: RET
 void OP_00EE(struct Chip8 *chip)
 {
+	if (chip->SP == 0) {
+		raiseFault(chip, FAULT_STACK_UNDERFLOW, chip->PC - 2);
+		return;
+	}
 	--(chip->SP);
 	chip->PC = chip->stack[chip->SP];
 }
@@ -320,6 +379,10 @@ void OP_1NNN(struct Chip8 *chip)
 void OP_2NNN(struct Chip8 *chip)
 {
 	uint16_t address = GET_ADDRESS(chip->opcode);
+	if (chip->SP >= 16) {
+		raiseFault(chip, FAULT_STACK_OVERFLOW, chip->PC - 2);
+		return;
+	}
 	chip->stack[chip->SP] = chip->PC;
 	(chip->SP)++;
 	chip->PC = address;
@@ -486,7 +549,7 @@ void OP_BNNN(struct Chip8 *chip)
 
 void OP_CXNN(struct Chip8 *chip)
 {
-	uint8_t ran_num = randByte();
+	uint8_t ran_num = randByte(chip);
 	uint8_t x = GET_X(chip->opcode);
 	uint8_t byte = GET_BYTE(chip->opcode);
 	chip->registers[x] =  byte & ran_num;
@@ -500,36 +563,47 @@ void OP_DXYN(struct Chip8 *chip)
 
 	uint8_t x_coord = chip->registers[x] % VIDEO_WIDTH;
 	uint8_t y_coord = chip->registers[y] % VIDEO_HEIGHT;
+	uint64_t videoHash = chip->videoHash;	// locals, the pixel stores below may alias them
+	unsigned int litPixels = chip->litPixels;
 	chip->registers[0xF] = 0;
+	chip->drawCount++;
 
-	for (unsigned int row = 0; row < height; row++) {
-		uint8_t sprite_data = chip->memory[chip->index + row];
+	// Sprites are clipped at the screen edges
+	for (unsigned int row = 0; row < height && y_coord + row < VIDEO_HEIGHT; row++) {
+		uint8_t sprite_data = chip->memory[(chip->index + row) & ADDRESS_MASK];
 
-		for (unsigned int col = 0; col < 8; col++) {
+		for (unsigned int col = 0; col < 8 && x_coord + col < VIDEO_WIDTH; col++) {
 			uint8_t sprite_pixel = sprite_data & (0x80 >> col);
-			uint32_t screen_pixel = chip->video[(x_coord + col) + (y_coord + row)*VIDEO_WIDTH];
+			uint8_t *screen_pixel = &chip->video[(x_coord + col) + (y_coord + row)*VIDEO_WIDTH];
 
 			if (sprite_pixel) {
-				if (screen_pixel == 0xFFFFFFFF)
+				if (*screen_pixel == PIXEL_ON) {
 					chip->registers[0xF] = 1;
+					litPixels--;
+				} else {
+					litPixels++;
+				}
 
-				chip->video[(x_coord + col) + (y_coord + row)*VIDEO_WIDTH] ^= 0xFFFFFFFF;
+				*screen_pixel ^= PIXEL_ON;
+				videoHash ^= pixelKey(screen_pixel - chip->video);
 			}
 		}
 	}
+	chip->videoHash = videoHash;
+	chip->litPixels = (uint16_t)litPixels;
 }
 
 void OP_EX9E(struct Chip8* chip)
 {
 	uint8_t x = GET_X(chip->opcode);
-	if (chip->keypad[chip->registers[x]])
+	if (chip->keypad[chip->registers[x] & 0xF])
 		chip->PC += 2;
 }
 
 void OP_EXA1(struct Chip8* chip)
 {
 	uint8_t x = GET_X(chip->opcode);
-	if (!chip->keypad[chip->registers[x]])
+	if (!chip->keypad[chip->registers[x] & 0xF])
 		chip->PC += 2;
 }
 
@@ -537,6 +611,15 @@ void OP_FX07(struct Chip8* chip)
 {
 	uint8_t x = GET_X(chip->opcode);
 	chip->registers[x] = chip->delayTimer;
+	chip->timerReads++;
+	chip->timerWaits += chip->delayTimer != 0;
+
+	// The first look at a timer the guest started ends the work it had for that time
+	if (chip->timerSetAt != 0) {
+		chip->frameWork = (uint32_t)(chip->instructions - chip->timerSetAt);
+		chip->timedFrames++;
+		chip->timerSetAt = 0;
+	}
 }
 
 void OP_FX0A(struct Chip8* chip)
@@ -591,14 +674,19 @@ void OP_FX0A(struct Chip8* chip)
 	else if (chip->keypad[0xF])
 		chip->registers[x] = 0xF;
 
-	else
+	else {
 		chip->PC -= 2;
+		chip->keyWaits++;
+		chip->timerSetAt = 0;	// time spent waiting for a key isn't work
+	}
 }
 
 void OP_FX15(struct Chip8* chip)
 {
 	uint8_t x = GET_X(chip->opcode);
 	chip->delayTimer = chip->registers[x];
+	chip->timerSetAt = (chip->delayTimer != 0) ? chip->instructions : 0;
+	chip->framePeriod = chip->delayTimer;
 }
 
 void OP_FX18(struct Chip8* chip)
@@ -621,6 +709,20 @@ void OP_FX29(struct Chip8* chip)
 	chip->index = FONTSET_START_ADDRESS + (character * 5);
 }
 
+// Stores through I wrap around memory, so can the range to re-check for fusion
+static void invalidateWritten(struct Chip8 *chip, uint16_t index, unsigned int length)
+{
+	uint16_t start = index & ADDRESS_MASK;
+	uint16_t end = (index + length - 1) & ADDRESS_MASK;
+
+	if (end >= start) {
+		invalidateFusion(chip, start, end);
+	} else {
+		invalidateFusion(chip, start, ADDRESS_MASK);
+		invalidateFusion(chip, 0, end);
+	}
+}
+
 void OP_FX33(struct Chip8* chip)
 {
 	uint8_t x = GET_X(chip->opcode);
@@ -632,9 +734,11 @@ void OP_FX33(struct Chip8* chip)
 	num /= 10;
 	uint8_t hundreds = num % 10;
 
-	chip->memory[chip->index] = hundreds;
-	chip->memory[chip->index+1] = tens;
-	chip->memory[chip->index + 2] = ones;
+	storeMemory(chip, chip->index & ADDRESS_MASK, hundreds);
+	storeMemory(chip, (chip->index + 1) & ADDRESS_MASK, tens);
+	storeMemory(chip, (chip->index + 2) & ADDRESS_MASK, ones);
+
+	invalidateWritten(chip, chip->index, 3);
 }
 
 void OP_FX55(struct Chip8* chip)
@@ -642,8 +746,10 @@ void OP_FX55(struct Chip8* chip)
 	uint8_t x = GET_X(chip->opcode);
 	
 	for (int i = 0; i <= x; i++) {
-		chip->memory[chip->index + i] = chip->registers[i];
+		storeMemory(chip, (chip->index + i) & ADDRESS_MASK, chip->registers[i]);
 	}
+
+	invalidateWritten(chip, chip->index, x + 1);
 }
 
 void OP_FX65(struct Chip8* chip)
@@ -651,6 +757,6 @@ void OP_FX65(struct Chip8* chip)
 	uint8_t x = GET_X(chip->opcode);
 
 	for (int i = 0; i <= x; i++) {
-		chip->registers[i] = chip->memory[chip->index + i];
+		chip->registers[i] = chip->memory[(chip->index + i) & ADDRESS_MASK];
 	}
 }
\ No newline at end of file
@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include <assert.h>
 #include <time.h>
 #include <string.h>
 
@@ -13,6 +17,9 @@
 #define VIDEO_WIDTH 64
 #define VIDEO_HEIGHT 32
 #define VIDEO_SIZE 2048
+#define MAX_ROM_SIZE (4096 - START_ADDRESS)
+#define ADDRESS_MASK 0x0FFF		// guest addresses wrap around the 4 KB address space
+#define CYCLES_PER_TICK 4		// instructions per 60 Hz timer tick the front end runs until a ROM is tuned
 
 #define GET_INSTRUCTION_TYPE(n) (((n) & 0xF000) >> 12)
 #define GET_X(n) (((n) & 0x0F00) >> 8)
@@ -21,34 +28,97 @@
 #define GET_BYTE(n) ((n) & 0x00FF)
 #define GET_ADDRESS(n) ((n) & 0x0FFF)
 
+#define CHIP8_CACHE_LINE 64
+#define PIXEL_ON 0xFF			// lit pixel, video is uploaded as a grayscale texture
+
+// First guest error since power-on. Execution carries on: the offending access wraps
+// around memory or the instruction is dropped, as noted per fault.
+enum Chip8Fault {
+	FAULT_NONE = 0,
+	FAULT_UNKNOWN_OPCODE,		// ignored
+	FAULT_STACK_OVERFLOW,		// 2NNN with all 16 levels in use, the call is ignored
+	FAULT_STACK_UNDERFLOW,		// 00EE with an empty stack, the return is ignored
+	FAULT_PC_RANGE				// fetch past the end of memory, PC wraps to the start
+};
+
+struct FusionTable;
+
+// Hot CPU state shares the first cache line, bulk memory follows on lines of its own
 struct Chip8 {
-	uint8_t memory[4096];
-	uint8_t registers[16];
-	uint16_t index;			// store memory addresses
+	alignas(CHIP8_CACHE_LINE) uint64_t instructions;	// executed so far, fused sequences count every instruction
+	uint32_t rngState;		// per-instance xorshift state used by CXNN
 	uint16_t PC;			// holds address of next instruction
-	uint16_t stack[16];
+	uint16_t index;			// store memory addresses
+	uint16_t opcode;
+	uint16_t faultPC;		// address of the instruction that raised fault
 	uint8_t SP;
 	uint8_t delayTimer;
 	uint8_t soundTimer;
+	uint8_t fault;			// enum Chip8Fault
+	const uint8_t *fusion;	// superinstruction starting at each address, shared per ROM, see fusion.h
+	uint8_t registers[16];
 	uint8_t keypad[16];
-	uint32_t video[VIDEO_SIZE];
-	uint16_t opcode;
+
+	alignas(CHIP8_CACHE_LINE) uint16_t stack[16];
+	uint64_t memoryHash;	// Zobrist hashes kept current by every write, see fingerprint.h
+	uint64_t videoHash;
+	struct FusionTable *fusionTable;	// reference behind fusion, a copy borrows its source's
+	uint64_t timerSetAt;	// instructions at the FX15 that started the delay timer, 0 once FX07 or FX0A followed
+	uint32_t drawCount;		// free running activity counters for the rate tuner, see autotune.h
+	uint32_t timerReads;	// FX07
+	uint32_t timerWaits;	// FX07 with the delay timer still running
+	uint32_t keyWaits;		// FX0A with no key down
+	uint32_t timedFrames;	// FX07 right after an FX15 that started the timer
+	uint32_t frameWork;		// instructions from that FX15 to that FX07, the guest's work for the frame
+	uint8_t framePeriod;	// ticks that FX15 gave the frame
+	uint16_t litPixels;		// kept with videoHash, 00E0 on a dark screen skips the clear
+	uint8_t video[VIDEO_SIZE];	// 0 or PIXEL_ON
+	uint8_t memory[4096];
 };
 
-// Create instance of emulator
+static_assert(offsetof(struct Chip8, keypad) + sizeof(((struct Chip8*)0)->keypad) <= CHIP8_CACHE_LINE, "hot CPU state must fit one cache line");
+
+// Create instance of emulator, releaseEmulator() and free() it when done
 struct Chip8* createEmulator();
 
-// Fetch, Decode, Execute Cycle
+// Initialize an instance in caller-owned storage, e.g. an array or arena, to the power-on state.
+// Storage that held a loaded instance has to be released first.
+void initEmulator(struct Chip8 *chip);
+
+// Drop what a loaded instance shares with others running the same ROM. Copies of it
+// (snapshots, resets from a template) borrow from it and must not be released.
+void releaseEmulator(struct Chip8 *chip);
+
+// Back to the power-on CPU state and a clear display, memory keeps the loaded ROM and fonts
+void resetEmulator(struct Chip8 *chip);
+
+// Fetch, Decode, Execute Cycle, may run a fused sequence of several instructions
 void Cycle(struct Chip8 *chip);
 
-// Load ROM content into Chip8 memory
+// Fetch, Decode, Execute exactly one instruction
+void CycleSingle(struct Chip8 *chip);
+
+// Decrement delay and sound timers, call at 60 Hz
+void updateTimers(struct Chip8 *chip);
+
+// Load ROM content into Chip8 memory from a file, a .gz or a zip entry (see rom_archive.h),
+// exits if it can't be read or doesn't fit
 void loadRom(struct Chip8 *chip, char const *filename);
 
+// Load a ROM image already in memory, returns false if it is larger than MAX_ROM_SIZE
+bool loadRomFromMemory(struct Chip8 *chip, const uint8_t *data, size_t size);
+
 // Load fonts into memory
 void loadFonts(struct Chip8 *chip);
 
+// Short lowercase name of an enum Chip8Fault
+const char* faultName(uint8_t fault);
+
+// Seed the instance's random number generator, same seed gives the same CXNN results
+void seedEmulator(struct Chip8 *chip, uint32_t seed);
+
 // Generate random number between 0 and 255
-uint8_t randByte();
+uint8_t randByte(struct Chip8 *chip);
 
 // opcode 00E0: Clears the screen.
 void OP_00E0(struct Chip8 *chip);
@@ -0,0 +1,66 @@
+#include <string.h>
+#include <stdbool.h>
+#include "emulator.h"
+#include "fingerprint.h"
+
+uint64_t pixelKeys[VIDEO_SIZE];
+
+// Filled before main(), pixel key inputs live above all memory key inputs
+__attribute__((constructor)) static void initPixelKeys(void)
+{
+	for (unsigned int pixel = 0; pixel < VIDEO_SIZE; pixel++)
+		pixelKeys[pixel] = fingerprintMix(1ull << 32 | pixel);
+}
+
+uint64_t stateFingerprint(const struct Chip8 *chip)
+{
+	uint64_t words[8];
+	memcpy(words, chip->registers, sizeof(chip->registers));
+	words[2] = (uint64_t)chip->PC << 48 | (uint64_t)chip->index << 32 | chip->rngState;
+	words[3] = (uint64_t)chip->SP << 40 | (uint64_t)chip->delayTimer << 32 | (uint64_t)chip->soundTimer << 24
+		| (uint64_t)chip->fault << 16 | chip->faultPC;
+
+	// Entries at and above SP are stale and never read again
+	uint16_t stack[16] = { 0 };
+	memcpy(stack, chip->stack, (chip->SP < 16 ? chip->SP : 16) * sizeof(uint16_t));
+	memcpy(words + 4, stack, sizeof(stack));
+
+	// Independent mixes so the words hash in parallel, salted by position
+	uint64_t cpu = 0;
+	for (unsigned int i = 0; i < 8; i++)
+		cpu += fingerprintMix(words[i] ^ (uint64_t)(i + 1) * 0x9E3779B97F4A7C15ull);
+
+	return fingerprintMix(cpu) ^ chip->memoryHash ^ chip->videoHash;
+}
+
+// Mostly zero, skip empty words
+static bool zeroWord(const uint8_t *data)
+{
+	uint64_t word;
+	memcpy(&word, data, sizeof(word));
+	return word == 0;
+}
+
+void rehashEmulator(struct Chip8 *chip)
+{
+	chip->memoryHash = 0;
+	for (unsigned int word = 0; word < sizeof(chip->memory); word += 8) {
+		if (zeroWord(chip->memory + word))
+			continue;
+		for (unsigned int address = word; address < word + 8; address++)
+			chip->memoryHash ^= memoryKey(address, chip->memory[address]);
+	}
+
+	chip->videoHash = 0;
+	chip->litPixels = 0;
+	for (unsigned int word = 0; word < VIDEO_SIZE; word += 8) {
+		if (zeroWord(chip->video + word))
+			continue;
+		for (unsigned int pixel = word; pixel < word + 8; pixel++) {
+			if (chip->video[pixel]) {
+				chip->videoHash ^= pixelKey(pixel);
+				chip->litPixels++;
+			}
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include "emulator.h"
+
+// State fingerprints
+// Memory and display are hashed Zobrist style: every non-zero memory byte XORs a key for
+// its (address, value) into chip->memoryHash and every lit pixel a key for its position
+// into chip->videoHash. Zero bytes and dark pixels have no key, so a cleared instance
+// hashes to 0. The emulator updates both on every store and pixel flip, which keeps
+// stateFingerprint() down to folding in the CPU registers and live stack entries.
+// Code that writes memory or video directly must call rehashEmulator() afterwards.
+
+// Murmur3 finalizer, a bijection, so distinct key inputs give distinct keys
+static inline uint64_t fingerprintMix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDull;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+static inline uint64_t memoryKey(uint16_t address, uint8_t value)
+{
+	return value ? fingerprintMix((uint64_t)address << 8 | value) : 0;
+}
+
+// Pixel keys are looked up, a sprite flips up to 120 pixels per DXYN
+extern uint64_t pixelKeys[VIDEO_SIZE];
+
+static inline uint64_t pixelKey(unsigned int pixel)
+{
+	return pixelKeys[pixel];
+}
+
+// Write a memory byte and keep memoryHash current
+static inline void storeMemory(struct Chip8 *chip, uint16_t address, uint8_t value)
+{
+	chip->memoryHash ^= memoryKey(address, chip->memory[address]) ^ memoryKey(address, value);
+	chip->memory[address] = value;
+}
+
+// 64-bit hash of everything that decides future execution: memory, display, registers,
+// I, PC, live stack entries, timers, RNG state and fault. The keypad is input rather
+// than state and the instruction counter and last opcode are bookkeeping, none of
+// them are included.
+uint64_t stateFingerprint(const struct Chip8 *chip);
+
+// Recompute memoryHash, videoHash and litPixels from scratch
+void rehashEmulator(struct Chip8 *chip);
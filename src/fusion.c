@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "fusion.h"
+
+#define MEMORY_SIZE FUSION_MEMORY_SIZE
+
+const uint8_t noFusion[FUSION_MEMORY_SIZE];
+
+// Tables by memory image, slots with no references are reused for new images
+static struct FusionTable *tables[FUSION_MAX_TABLES];
+static pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint16_t opcodeAt(const struct Chip8 *chip, uint16_t address)
+{
+	return (chip->memory[address] << 8) | chip->memory[address + 1];
+}
+
+static int isType(uint16_t opcode, uint8_t type)
+{
+	return GET_INSTRUCTION_TYPE(opcode) == type;
+}
+
+static int isFX(uint16_t opcode, uint8_t byte)
+{
+	return isType(opcode, 0xF) && GET_BYTE(opcode) == byte;
+}
+
+static uint8_t matchFusion(const struct Chip8 *chip, uint16_t address)
+{
+	if (address > MEMORY_SIZE - 2 * 2)
+		return FUSED_NONE;
+
+	// Most addresses hold data or an instruction no sequence starts with,
+	// decide on the first opcode before reading the others
+	uint16_t first = opcodeAt(chip, address);
+	uint16_t second, third;
+
+	switch (GET_INSTRUCTION_TYPE(first)) {
+	case 0x3:
+		second = opcodeAt(chip, address + 2);
+		if (isType(second, 0x1))
+			return FUSED_SKIP_JUMP;
+		break;
+
+	case 0x6:
+		second = opcodeAt(chip, address + 2);
+		if (isType(second, 0x6))
+			return FUSED_SET_SET;
+		break;
+
+	case 0x7:
+		// Triples first so they win over the pair they start with
+		second = opcodeAt(chip, address + 2);
+		third = (address <= MEMORY_SIZE - 2 * 3) ? opcodeAt(chip, address + 4) : 0;
+		if (isType(second, 0x3) && isType(third, 0x1))
+			return FUSED_COUNTED_LOOP;
+		break;
+
+	case 0xA:
+		second = opcodeAt(chip, address + 2);
+		if (isFX(second, 0x1E))
+			return FUSED_INDEX_ADD;
+		if (isType(second, 0xD))
+			return FUSED_INDEX_DRAW;
+		if (isFX(second, 0x65))
+			return FUSED_INDEX_LOAD;
+		break;
+
+	case 0xD:
+		second = opcodeAt(chip, address + 2);
+		if (isType(second, 0x7))
+			return FUSED_DRAW_ADD;
+		break;
+
+	case 0xF:
+		second = opcodeAt(chip, address + 2);
+		third = (address <= MEMORY_SIZE - 2 * 3) ? opcodeAt(chip, address + 4) : 0;
+		if (isFX(first, 0x07) && isType(second, 0x3) && isType(third, 0x1))
+			return FUSED_WAIT_DELAY;
+		if (isFX(first, 0x29) && isType(second, 0xD))
+			return FUSED_DIGIT_DRAW;
+		if (isFX(first, 0x33) && isFX(second, 0x65))
+			return FUSED_BCD_LOAD;
+		break;
+	}
+
+	return FUSED_NONE;
+}
+
+void analyzeFusionRange(const struct Chip8 *chip, uint8_t *marks, uint16_t start, uint16_t end)
+{
+	for (uint16_t address = start; address < end && address < MEMORY_SIZE; address++)
+		marks[address] = matchFusion(chip, address);
+}
+
+void analyzeFusion(const struct Chip8 *chip, uint8_t *marks)
+{
+	analyzeFusionRange(chip, marks, 0, MEMORY_SIZE);
+}
+
+// Caller holds tableLock
+static struct FusionTable* findTable(const struct Chip8 *chip)
+{
+	struct FusionTable *unused = NULL;
+	int empty = -1;
+
+	for (int i = 0; i < FUSION_MAX_TABLES; i++) {
+		struct FusionTable *table = tables[i];
+		if (table == NULL) {
+			if (empty < 0)
+				empty = i;
+			continue;
+		}
+		if (table->key == chip->memoryHash && memcmp(table->image, chip->memory, MEMORY_SIZE) == 0)
+			return table;
+		if (table->references == 0 && unused == NULL)
+			unused = table;
+	}
+
+	// New image: a fresh slot, else one no instance holds any more
+	if (unused == NULL && empty >= 0) {
+		unused = malloc(sizeof(*unused));
+		tables[empty] = unused;
+	}
+	if (unused == NULL)
+		return NULL;
+	unused->key = chip->memoryHash;
+	unused->references = 0;
+	memcpy(unused->image, chip->memory, MEMORY_SIZE);
+	analyzeFusion(chip, unused->marks);
+	return unused;
+}
+
+void attachFusion(struct Chip8 *chip)
+{
+	pthread_mutex_lock(&tableLock);
+	if (chip->fusionTable != NULL)
+		chip->fusionTable->references--;
+	chip->fusionTable = findTable(chip);
+	if (chip->fusionTable != NULL)
+		chip->fusionTable->references++;
+	pthread_mutex_unlock(&tableLock);
+
+	chip->fusion = (chip->fusionTable != NULL) ? chip->fusionTable->marks : noFusion;
+}
+
+void releaseFusion(struct Chip8 *chip)
+{
+	if (chip->fusionTable != NULL) {
+		pthread_mutex_lock(&tableLock);
+		chip->fusionTable->references--;
+		pthread_mutex_unlock(&tableLock);
+	}
+	chip->fusionTable = NULL;
+	chip->fusion = noFusion;
+}
+
+void invalidateFusion(struct Chip8 *chip, uint16_t start, uint16_t end)
+{
+	if (chip->fusion == noFusion)
+		return;
+
+	// Any sequence starting up to two instructions before the write may include it
+	int first = (int)start - 2 * (FUSION_MAX_LENGTH - 1);
+	if (first < 0)
+		first = 0;
+	if (end >= MEMORY_SIZE)
+		end = MEMORY_SIZE - 1;
+
+	// New sequences only go unfused, a changed one would run the wrong handler
+	for (int address = first; address <= end; address++) {
+		uint8_t mark = chip->fusion[address];
+		if (mark != FUSED_NONE && matchFusion(chip, (uint16_t)address) != mark) {
+			chip->fusion = noFusion;
+			return;
+		}
+	}
+}
+
+static inline void fetch(struct Chip8 *chip)
+{
+	chip->opcode = opcodeAt(chip, chip->PC);
+	chip->PC += 2;
+	chip->instructions++;
+}
+
+// True if execution fell through to the next instruction of the sequence
+static inline int fellThrough(const struct Chip8 *chip, uint16_t start, unsigned int executed)
+{
+	return chip->PC == start + 2 * executed;
+}
+
+void runFused(struct Chip8 *chip, uint8_t op)
+{
+	uint16_t start = chip->PC;
+
+	switch (op) {
+	case FUSED_WAIT_DELAY:
+		fetch(chip); OP_FX07(chip);
+		fetch(chip); OP_3XNN(chip);
+		if (fellThrough(chip, start, 2)) {
+			fetch(chip); OP_1NNN(chip);
+		}
+		break;
+
+	case FUSED_COUNTED_LOOP:
+		fetch(chip); OP_7XNN(chip);
+		fetch(chip); OP_3XNN(chip);
+		if (fellThrough(chip, start, 2)) {
+			fetch(chip); OP_1NNN(chip);
+		}
+		break;
+
+	case FUSED_SKIP_JUMP:
+		fetch(chip); OP_3XNN(chip);
+		if (fellThrough(chip, start, 1)) {
+			fetch(chip); OP_1NNN(chip);
+		}
+		break;
+
+	case FUSED_DRAW_ADD:
+		fetch(chip); OP_DXYN(chip);
+		fetch(chip); OP_7XNN(chip);
+		break;
+
+	case FUSED_INDEX_ADD:
+		fetch(chip); OP_ANNN(chip);
+		fetch(chip); OP_FX1E(chip);
+		break;
+
+	case FUSED_INDEX_DRAW:
+		fetch(chip); OP_ANNN(chip);
+		fetch(chip); OP_DXYN(chip);
+		break;
+
+	case FUSED_INDEX_LOAD:
+		fetch(chip); OP_ANNN(chip);
+		fetch(chip); OP_FX65(chip);
+		break;
+
+	case FUSED_SET_SET:
+		fetch(chip); OP_6XNN(chip);
+		fetch(chip); OP_6XNN(chip);
+		break;
+
+	case FUSED_DIGIT_DRAW:
+		fetch(chip); OP_FX29(chip);
+		fetch(chip); OP_DXYN(chip);
+		break;
+
+	case FUSED_BCD_LOAD:
+		fetch(chip); OP_FX33(chip);
+		// FX33 may have overwritten the rest of the sequence
+		if (chip->fusion[start] == FUSED_BCD_LOAD) {
+			fetch(chip); OP_FX65(chip);
+		}
+		break;
+
+	default:
+		CycleSingle(chip);
+		break;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+
+#define FUSION_MEMORY_SIZE 4096
+#define FUSION_MAX_TABLES 64		// memory images with marks kept at once, instances beyond run unfused
+#define FUSION_MAX_LENGTH 3			// instructions in the longest sequence
+
+struct Chip8;
+
+// Superinstructions
+// analyzeFusion() scans memory for frequent opcode sequences and marks the address of
+// the first instruction. Cycle() runs a marked sequence through one fused handler
+// instead of dispatching each instruction. Only the first address is marked, so a jump
+// or skip landing in the middle of a sequence runs the plain instructions from there.
+// A fused handler stops early on any taken skip or jump, or when the sequence was
+// overwritten by one of its own instructions.
+//
+// The marks only depend on memory, so every instance that loaded the same ROM shares
+// one table: loading a ROM or fonts looks the image up by its memory fingerprint and
+// takes a reference, the first instance to load it pays for the scan. Copies of an
+// instance (rewind and netplay snapshots, search children, resets from a template)
+// borrow the reference of the instance they were copied from. The shared marks stay
+// valid while stores leave marked sequences alone; the first store that changes one
+// switches that instance to plain dispatch (chip->fusion = noFusion) rather than
+// copying the table, since a copy held by a struct copy would have no owner.
+//
+// The table below was picked from tools/opcode_profile over resources/roms/
+// (share of all executed instructions in brackets):
+//   FX07;3XNN;1NNN  delay timer wait loop        (5.5%)
+//   3XNN;1NNN       conditional jump             (9.2%)
+//   7XNN;3XNN;1NNN  counted loop                 (1.9%)
+//   DXYN;7XNN       draw and advance             (1.6%)
+//   ANNN;FX1E       table index                  (1.4%)
+//   ANNN;DXYN       sprite draw                  (1.2%)
+//   ANNN;FX65       table load                   (1.1%)
+//   6XNN;6XNN       register setup
+//   FX29;DXYN       digit draw
+//   FX33;FX65       score digits
+enum FusedOp {
+	FUSED_NONE = 0,
+	FUSED_WAIT_DELAY,			// FX07;3XNN;1NNN
+	FUSED_SKIP_JUMP,			// 3XNN;1NNN
+	FUSED_COUNTED_LOOP,			// 7XNN;3XNN;1NNN
+	FUSED_DRAW_ADD,				// DXYN;7XNN
+	FUSED_INDEX_ADD,			// ANNN;FX1E
+	FUSED_INDEX_DRAW,			// ANNN;DXYN
+	FUSED_INDEX_LOAD,			// ANNN;FX65
+	FUSED_SET_SET,				// 6XNN;6XNN
+	FUSED_DIGIT_DRAW,			// FX29;DXYN
+	FUSED_BCD_LOAD				// FX33;FX65
+};
+
+// Marks for one memory image, shared by every instance running it
+struct FusionTable {
+	uint64_t key;				// memoryHash of image
+	unsigned int references;	// instances holding it, guarded by the table lock
+	uint8_t image[FUSION_MEMORY_SIZE];
+	uint8_t marks[FUSION_MEMORY_SIZE];
+};
+
+// All FUSED_NONE, what an instance without a table runs with
+extern const uint8_t noFusion[FUSION_MEMORY_SIZE];
+
+// Mark every fusable sequence in chip's memory into marks (FUSION_MEMORY_SIZE entries)
+void analyzeFusion(const struct Chip8 *chip, uint8_t *marks);
+
+// Mark only the sequences starting in [start, end), for a caller that keeps marks of its
+// own current after writing part of memory and points chip->fusion at them without a table
+void analyzeFusionRange(const struct Chip8 *chip, uint8_t *marks, uint16_t start, uint16_t end);
+
+// Share the table for chip's current memory, scanning it if no instance has yet, and
+// drop the one chip held. Runs unfused when every table is held by other images.
+void attachFusion(struct Chip8 *chip);
+
+// Drop chip's reference, it runs unfused until the next attachFusion()
+void releaseFusion(struct Chip8 *chip);
+
+// Memory between start and end (inclusive) was written, leave the shared marks if a
+// marked sequence overlapping it changed
+void invalidateFusion(struct Chip8 *chip, uint16_t start, uint16_t end);
+
+// Run the fused sequence at PC
+void runFused(struct Chip8 *chip, uint8_t op);
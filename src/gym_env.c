@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gym_env.h"
+#include "rom_archive.h"
+
+struct GymReward {
+	uint16_t address;
+	uint8_t length;
+	uint8_t format;
+	float scale;
+};
+
+struct GymDone {
+	uint16_t address;
+	uint8_t value;
+};
+
+struct GymEnv {
+	struct Chip8 *states;
+	bool ownsStates;
+	uint32_t count;
+	uint32_t cyclesPerFrame;
+
+	struct Chip8 *initial;		// ROM, fonts and fusion table, copied over an instance to reset it
+
+	struct GymReward rewards[GYM_MAX_REWARDS];
+	uint32_t rewardCount;
+	struct GymDone dones[GYM_MAX_DONES];
+	uint32_t doneCount;
+};
+
+struct GymEnv* createGymEnv(const char *romPath, uint32_t count, uint32_t cyclesPerFrame, void *states)
+{
+	// Read here rather than through loadRom(), which exits the whole process on failure
+	uint8_t rom[MAX_ROM_SIZE];
+	long romSize = readRomImage(romPath, rom, sizeof(rom));
+	if (romSize <= 0 || romSize > MAX_ROM_SIZE)
+		return NULL;
+
+	if (count == 0 || ((uintptr_t)states % alignof(struct Chip8)) != 0)
+		return NULL;
+
+	struct GymEnv *env = calloc(1, sizeof(struct GymEnv));
+	if (env == NULL)
+		return NULL;
+
+	env->count = count;
+	env->cyclesPerFrame = cyclesPerFrame > 0 ? cyclesPerFrame : GYM_DEFAULT_CYCLES;
+	env->initial = createEmulator();
+	env->states = states;
+	if (env->states == NULL) {
+		env->states = aligned_alloc(alignof(struct Chip8), count * sizeof(struct Chip8));
+		env->ownsStates = true;
+	}
+	if (env->initial == NULL || env->states == NULL) {
+		destroyGymEnv(env);
+		return NULL;
+	}
+
+	if (!loadRomFromMemory(env->initial, rom, (size_t)romSize)) {
+		destroyGymEnv(env);
+		return NULL;
+	}
+	loadFonts(env->initial);
+	resetGymEnv(env, 0);
+	return env;
+}
+
+void destroyGymEnv(struct GymEnv *env)
+{
+	if (env == NULL)
+		return;
+	if (env->ownsStates)
+		free(env->states);
+	if (env->initial != NULL)
+		releaseEmulator(env->initial);
+	free(env->initial);
+	free(env);
+}
+
+size_t gymStateSize(void)
+{
+	return sizeof(struct Chip8);
+}
+
+size_t gymObservationOffset(void)
+{
+	return offsetof(struct Chip8, video);
+}
+
+size_t gymMemoryOffset(void)
+{
+	return offsetof(struct Chip8, memory);
+}
+
+void* gymStates(struct GymEnv *env)
+{
+	return env->states;
+}
+
+void resetGymEnvAt(struct GymEnv *env, uint32_t index, uint64_t seed)
+{
+	if (index >= env->count)
+		return;
+
+	memcpy(&env->states[index], env->initial, sizeof(struct Chip8));
+	seedEmulator(&env->states[index], (uint32_t)(seed ^ (seed >> 32)));
+}
+
+void resetGymEnv(struct GymEnv *env, uint64_t seed)
+{
+	for (uint32_t i = 0; i < env->count; i++)
+		resetGymEnvAt(env, i, seed + i);
+}
+
+static uint32_t readReward(const struct Chip8 *chip, const struct GymReward *reward)
+{
+	uint32_t value = 0;
+
+	for (unsigned int i = 0; i < reward->length; i++) {
+		uint8_t byte = chip->memory[(reward->address + i) & 0xFFF];
+		value = (reward->format == GYM_REWARD_BCD) ? value * 10 + byte % 10 : (value << 8) | byte;
+	}
+	return value;
+}
+
+static bool isDone(const struct GymEnv *env, const struct Chip8 *chip)
+{
+	uint16_t pc = chip->PC & 0xFFF;
+	uint16_t opcode = (chip->memory[pc] << 8) | chip->memory[(pc + 1) & 0xFFF];
+
+	// Most ROMs end with a jump to itself
+	if (opcode == (0x1000 | pc))
+		return true;
+
+	for (uint32_t i = 0; i < env->doneCount; i++) {
+		if (chip->memory[env->dones[i].address & 0xFFF] == env->dones[i].value)
+			return true;
+	}
+	return false;
+}
+
+void stepGymEnv(struct GymEnv *env, const uint16_t *actions, uint32_t frames, float *rewards, uint8_t *dones)
+{
+	uint32_t before[GYM_MAX_REWARDS];
+
+	for (uint32_t i = 0; i < env->count; i++) {
+		struct Chip8 *chip = &env->states[i];
+		uint16_t action = actions != NULL ? actions[i] : 0;
+
+		for (int key = 0; key < 16; key++)
+			chip->keypad[key] = (action >> key) & 1;
+		for (uint32_t r = 0; r < env->rewardCount; r++)
+			before[r] = readReward(chip, &env->rewards[r]);
+
+		// Same budget as the emulation thread: instructions per frame, then one timer tick
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			uint64_t end = chip->instructions + env->cyclesPerFrame;
+			while (chip->instructions < end)
+				Cycle(chip);
+			updateTimers(chip);
+		}
+
+		if (rewards != NULL) {
+			float reward = 0;
+			for (uint32_t r = 0; r < env->rewardCount; r++)
+				reward += env->rewards[r].scale * ((float)readReward(chip, &env->rewards[r]) - (float)before[r]);
+			rewards[i] = reward;
+		}
+		if (dones != NULL)
+			dones[i] = isDone(env, chip);
+	}
+}
+
+int addGymReward(struct GymEnv *env, uint16_t address, uint8_t length, int format, float scale)
+{
+	if (env->rewardCount == GYM_MAX_REWARDS || length == 0 || length > 4)
+		return 0;
+
+	env->rewards[env->rewardCount++] = (struct GymReward){ address, length, (uint8_t)format, scale };
+	return 1;
+}
+
+int addGymDone(struct GymEnv *env, uint16_t address, uint8_t value)
+{
+	if (env->doneCount == GYM_MAX_DONES)
+		return 0;
+
+	env->dones[env->doneCount++] = (struct GymDone){ address, value };
+	return 1;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "emulator.h"
+
+#define GYM_MAX_REWARDS 8
+#define GYM_MAX_DONES 8
+#define GYM_DEFAULT_CYCLES CYCLES_PER_TICK	// instructions per 60 Hz frame, as the front end runs
+
+// How a reward hook reads its value from guest memory
+enum GymRewardFormat {
+	GYM_REWARD_BYTE,		// unsigned bytes, big endian when length > 1
+	GYM_REWARD_BCD			// one decimal digit per byte, most significant first, as FX33 stores them
+};
+
+// Batched environment for agents and automated play
+// Every instance lives in one caller-provided (or owned) contiguous buffer of
+// count * gymStateSize() bytes, so observations are read in place without copies:
+// the screen of instance i is VIDEO_HEIGHT x VIDEO_WIDTH bytes (0 or PIXEL_ON) at
+// states + i * gymStateSize() + gymObservationOffset(), guest RAM at gymMemoryOffset().
+// From Python with ctypes and numpy:
+//
+//   lib = ctypes.CDLL("libchip8gym.so")
+//   env = lib.createGymEnv(b"pong.c8", 64, 10, None)
+//   buf = (ctypes.c_uint8 * (64 * lib.gymStateSize())).from_address(lib.gymStates(env))
+//   obs = np.lib.stride_tricks.as_strided(np.frombuffer(buf, np.uint8)[lib.gymObservationOffset():],
+//                                         (64, 32, 64), (lib.gymStateSize(), 64, 1))
+//
+// Declare restype/argtypes as pointers for createGymEnv and gymStates.
+// The reward of a step is scale * (value after - value before) summed over the hooks.
+struct GymEnv;
+
+// Load romPath for count instances, states may be NULL to let the env allocate them,
+// otherwise it must be 64-byte aligned. romPath may name a .gz or zip entry as well, see
+// rom_archive.h. Returns NULL if the ROM can't be read, is empty or is too large.
+struct GymEnv* createGymEnv(const char *romPath, uint32_t count, uint32_t cyclesPerFrame, void *states);
+
+void destroyGymEnv(struct GymEnv *env);
+
+// Size of one instance in the states buffer and where its screen and RAM are
+size_t gymStateSize(void);
+size_t gymObservationOffset(void);
+size_t gymMemoryOffset(void);
+
+// Start of the states buffer
+void* gymStates(struct GymEnv *env);
+
+// Reset every instance, instance i gets seed + i for CXNN
+void resetGymEnv(struct GymEnv *env, uint64_t seed);
+
+// Reset a single instance, e.g. after it reported done
+void resetGymEnvAt(struct GymEnv *env, uint32_t index, uint64_t seed);
+
+// Hold actions[i] (bit k = key k down) on instance i for frames 60 Hz frames.
+// rewards and dones have count entries each and may be NULL.
+void stepGymEnv(struct GymEnv *env, const uint16_t *actions, uint32_t frames, float *rewards, uint8_t *dones);
+
+// Reward from length bytes at address, returns 0 when no hook slot is left
+int addGymReward(struct GymEnv *env, uint16_t address, uint8_t length, int format, float scale);
+
+// Episode ends when the byte at address equals value, returns 0 when no slot is left.
+// An instance spinning on a jump to itself is always done.
+int addGymDone(struct GymEnv *env, uint16_t address, uint8_t value);
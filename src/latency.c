@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include "latency.h"
+#include "pacer.h"
+
+const char *latencyStageNames[LATENCY_STAGES] = {
+	"total", "keypad", "read", "display", "present"
+};
+
+void initLatencyProbe(struct LatencyProbe *probe)
+{
+	memset(probe, 0, sizeof(*probe));
+	atomic_init(&probe->enabled, false);
+	atomic_init(&probe->dropped, 0);
+	atomic_init(&probe->pendingSequence, 0);
+	probe->stage = LATENCY_HOST;
+}
+
+void startLatencyProbe(struct LatencyProbe *probe, uint8_t key, uint64_t hostNs)
+{
+	if (!atomic_load_explicit(&probe->enabled, memory_order_relaxed) || probe->stage != LATENCY_HOST)
+		return;
+	// The render thread still owns the previous sample
+	if (atomic_load_explicit(&probe->pendingSequence, memory_order_acquire) != 0)
+		return;
+
+	probe->key = key & 0xF;
+	probe->stamps[LATENCY_HOST] = hostNs;
+	probe->stamps[LATENCY_KEYPAD] = pacerNowNs();
+	probe->waitedTicks = 0;
+	probe->stage = LATENCY_READ;
+}
+
+void cancelLatencyProbe(struct LatencyProbe *probe)
+{
+	probe->stage = LATENCY_HOST;
+}
+
+void checkLatencyRead(struct LatencyProbe *probe, const struct Chip8 *chip)
+{
+	uint16_t pc = chip->PC & 0xFFF;
+	uint16_t opcode = (chip->memory[pc] << 8) | chip->memory[(pc + 1) & 0xFFF];
+	bool reads = false;
+
+	if (probe->stage != LATENCY_READ)
+		return;
+
+	if (GET_INSTRUCTION_TYPE(opcode) == 0xE && (GET_BYTE(opcode) == 0x9E || GET_BYTE(opcode) == 0xA1))
+		reads = (chip->registers[GET_X(opcode)] & 0xF) == probe->key;
+	else if (GET_INSTRUCTION_TYPE(opcode) == 0xF && GET_BYTE(opcode) == 0x0A)
+		reads = true;
+
+	if (!reads)
+		return;
+
+	probe->stamps[LATENCY_READ] = pacerNowNs();
+	memcpy(probe->before, chip->video, sizeof(probe->before));
+	probe->stage = LATENCY_DISPLAY;
+}
+
+void checkLatencyDisplay(struct LatencyProbe *probe, const struct Chip8 *chip, uint64_t sequence)
+{
+	if (probe->stage == LATENCY_HOST)
+		return;
+
+	if (probe->stage == LATENCY_DISPLAY && memcmp(probe->before, chip->video, sizeof(probe->before)) != 0) {
+		probe->stamps[LATENCY_DISPLAY] = pacerNowNs();
+		memcpy(probe->pending, probe->stamps, sizeof(probe->pending));
+		atomic_store_explicit(&probe->pendingSequence, sequence, memory_order_release);
+		probe->stage = LATENCY_HOST;
+		return;
+	}
+
+	// Key the ROM ignores, or a press that doesn't change anything on screen
+	if (++probe->waitedTicks >= LATENCY_TIMEOUT_TICKS) {
+		atomic_fetch_add_explicit(&probe->dropped, 1, memory_order_relaxed);
+		probe->stage = LATENCY_HOST;
+	}
+}
+
+void presentLatency(struct LatencyProbe *probe, uint64_t sequence)
+{
+	uint64_t pending = atomic_load_explicit(&probe->pendingSequence, memory_order_acquire);
+
+	if (pending == 0 || sequence < pending)
+		return;
+
+	uint64_t *sample = probe->samples[probe->sampleCount % LATENCY_SAMPLES];
+	memcpy(sample, probe->pending, sizeof(probe->pending));
+	sample[LATENCY_PRESENT] = pacerNowNs();
+	probe->sampleCount++;
+
+	atomic_store_explicit(&probe->pendingSequence, 0, memory_order_release);
+}
+
+static int byValue(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+void readLatencyReport(const struct LatencyProbe *probe, struct LatencyReport *report)
+{
+	uint32_t values[LATENCY_SAMPLES];
+	uint32_t count = probe->sampleCount < LATENCY_SAMPLES ? probe->sampleCount : LATENCY_SAMPLES;
+
+	memset(report, 0, sizeof(*report));
+	report->count = probe->sampleCount;
+	report->dropped = atomic_load_explicit(&probe->dropped, memory_order_relaxed);
+	if (count == 0)
+		return;
+
+	// Row 0 is the whole path, every other row is measured from the stage before it
+	for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+		for (uint32_t i = 0; i < count; i++) {
+			const uint64_t *sample = probe->samples[i];
+			uint64_t ns = (stage == LATENCY_HOST)
+				? sample[LATENCY_PRESENT] - sample[LATENCY_HOST]
+				: sample[stage] - sample[stage - 1];
+			values[i] = (uint32_t)(ns / 1000);
+		}
+		qsort(values, count, sizeof(uint32_t), byValue);
+
+		report->p50[stage] = values[(count - 1) * 50 / 100];
+		report->p90[stage] = values[(count - 1) * 90 / 100];
+		report->p99[stage] = values[(count - 1) * 99 / 100];
+		report->max[stage] = values[count - 1];
+	}
+}
+
+void logLatencyReport(FILE *out, const struct LatencyReport *report)
+{
+	fprintf(out, "latency samples=%u dropped=%u\n", report->count, report->dropped);
+	for (int stage = LATENCY_KEYPAD; stage <= LATENCY_STAGES; stage++) {
+		int row = stage % LATENCY_STAGES;	// total goes last
+		fprintf(out, "latency %-8s p50_us=%u p90_us=%u p99_us=%u max_us=%u\n", latencyStageNames[row],
+			report->p50[row], report->p90[row], report->p99[row], report->max[row]);
+	}
+}
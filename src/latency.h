@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "emulator.h"
+
+#define LATENCY_SAMPLES 256			// most recent samples kept for the percentiles
+#define LATENCY_TIMEOUT_TICKS 120	// give up if the guest doesn't react within this many ticks
+
+enum LatencyStage {
+	LATENCY_HOST,			// render thread saw the key event
+	LATENCY_KEYPAD,			// emulation thread wrote the keypad
+	LATENCY_READ,			// first EX9E/EXA1/FX0A that reads the key
+	LATENCY_DISPLAY,		// first tick that changed the display after the read
+	LATENCY_PRESENT,		// EndDrawing() returned for a frame containing the change
+	LATENCY_STAGES
+};
+
+// Input to photon latency probe
+// Follows one key press at a time through every stage, a new press is only picked up
+// once the previous one was presented or timed out. Stages up to LATENCY_DISPLAY are
+// stamped on the emulation thread, the finished sample is handed to the render thread
+// through pendingSequence which is non zero while a sample waits for presentation.
+struct LatencyProbe {
+	atomic_bool enabled;
+
+	// Owned by the emulation thread
+	int stage;					// next stage to stamp, LATENCY_HOST when idle
+	uint8_t key;
+	uint64_t stamps[LATENCY_STAGES];
+	uint32_t waitedTicks;
+	uint8_t before[sizeof(((struct Chip8*)0)->video)];
+	atomic_uint dropped;
+
+	// Handed over to the render thread
+	uint64_t pending[LATENCY_STAGES];
+	atomic_uint_fast64_t pendingSequence;
+
+	// Owned by the render thread
+	uint64_t samples[LATENCY_SAMPLES][LATENCY_STAGES];
+	uint32_t sampleCount;
+};
+
+// Percentiles in microseconds of each stage measured from the previous one,
+// the last row is the whole path from LATENCY_HOST to LATENCY_PRESENT
+struct LatencyReport {
+	uint32_t count;
+	uint32_t dropped;
+	uint32_t p50[LATENCY_STAGES];
+	uint32_t p90[LATENCY_STAGES];
+	uint32_t p99[LATENCY_STAGES];
+	uint32_t max[LATENCY_STAGES];
+};
+
+extern const char *latencyStageNames[LATENCY_STAGES];
+
+void initLatencyProbe(struct LatencyProbe *probe);
+
+// Emulation thread: key press applied to the keypad, hostNs is when the render thread saw it
+void startLatencyProbe(struct LatencyProbe *probe, uint8_t key, uint64_t hostNs);
+
+// Emulation thread: forget the press in flight, e.g. after a reset
+void cancelLatencyProbe(struct LatencyProbe *probe);
+
+// Emulation thread: true while instructions have to be checked with checkLatencyRead()
+static inline bool latencyAwaitingRead(const struct LatencyProbe *probe)
+{
+	return probe->stage == LATENCY_READ;
+}
+
+// Emulation thread: call before executing the instruction at PC
+void checkLatencyRead(struct LatencyProbe *probe, const struct Chip8 *chip);
+
+// Emulation thread: call after each tick, sequence is the frame the tick will be published in
+void checkLatencyDisplay(struct LatencyProbe *probe, const struct Chip8 *chip, uint64_t sequence);
+
+// Render thread: call after EndDrawing() with the sequence of the frame on screen
+void presentLatency(struct LatencyProbe *probe, uint64_t sequence);
+
+// Render thread: percentiles over the kept samples
+void readLatencyReport(const struct LatencyProbe *probe, struct LatencyReport *report);
+
+// Write the report, one line per stage
+void logLatencyReport(FILE *out, const struct LatencyReport *report);
@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "netplay.h"
+#include "pacer.h"
+
+#define NETPLAY_MASK (NETPLAY_WINDOW - 1)
+#define NETPLAY_HEADER_SIZE offsetof(struct NetplayPacket, inputs)
+#define NS_PER_MS 1000000ULL
+
+static uint32_t hashState(const struct Chip8 *chip, uint32_t cyclesPerFrame)
+{
+	uint32_t hash = 0x811C9DC5u;
+
+	// ROM, fonts, RNG and the instructions per frame, the rest follows from them
+	for (int i = 0; i < 4096; i++) {
+		hash ^= chip->memory[i];
+		hash *= 0x01000193u;
+	}
+	hash = (hash ^ chip->rngState) * 0x01000193u;
+	return (hash ^ cyclesPerFrame) * 0x01000193u;
+}
+
+static uint32_t nextNoise(struct Netplay *netplay)
+{
+	uint32_t x = netplay->noise;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return netplay->noise = x;
+}
+
+struct Netplay* openNetplay(uint16_t localPort, const char *host, uint16_t port)
+{
+	struct addrinfo hints = { 0 }, *found = NULL;
+	char service[8];
+
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf(service, sizeof(service), "%u", port);
+	if (getaddrinfo(host, service, &hints, &found) != 0 || found == NULL) {
+		printf("Error while resolving netplay peer %s\n", host);
+		return NULL;
+	}
+
+	struct Netplay *netplay = calloc(1, sizeof(struct Netplay));
+	if (netplay == NULL) {
+		freeaddrinfo(found);
+		return NULL;
+	}
+	memcpy(&netplay->peer, found->ai_addr, sizeof(netplay->peer));
+	freeaddrinfo(found);
+
+	struct sockaddr_in local = { 0 };
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	local.sin_port = htons(localPort);
+
+	netplay->socket = socket(AF_INET, SOCK_DGRAM, 0);
+	netplay->snapshots = aligned_alloc(alignof(struct Chip8), NETPLAY_WINDOW * sizeof(struct Chip8));
+	if (netplay->socket < 0 || netplay->snapshots == NULL ||
+		bind(netplay->socket, (struct sockaddr*)&local, sizeof(local)) != 0) {
+		printf("Error while opening netplay port %u\n", localPort);
+		closeNetplay(netplay);
+		return NULL;
+	}
+	fcntl(netplay->socket, F_SETFL, fcntl(netplay->socket, F_GETFL) | O_NONBLOCK);
+
+	netplay->noise = (uint32_t)pacerNowNs() | 1;
+	netplay->rollbackFrom = UINT32_MAX;
+	netplay->cyclesPerFrame = 1;
+	return netplay;
+}
+
+void closeNetplay(struct Netplay *netplay)
+{
+	if (netplay == NULL)
+		return;
+
+	if (netplay->socket >= 0)
+		close(netplay->socket);
+	free(netplay->snapshots);
+	free(netplay);
+}
+
+void setNetplayLatency(struct Netplay *netplay, uint32_t delayMs, uint32_t jitterMs, uint32_t lossPercent)
+{
+	netplay->delayNs = delayMs * NS_PER_MS;
+	netplay->jitterNs = jitterMs * NS_PER_MS;
+	netplay->lossPercent = lossPercent < 100 ? lossPercent : 100;
+}
+
+void parseNetplayLatency(struct Netplay *netplay, const char *spec)
+{
+	unsigned int delay = 0, jitter = 0, loss = 0;
+
+	if (spec != NULL && sscanf(spec, "%u:%u:%u", &delay, &jitter, &loss) >= 1)
+		setNetplayLatency(netplay, delay, jitter, loss);
+}
+
+void startNetplay(struct Netplay *netplay, const struct Chip8 *chip, uint32_t cyclesPerFrame)
+{
+	netplay->cyclesPerFrame = cyclesPerFrame > 0 ? cyclesPerFrame : 1;
+	netplay->stateHash = hashState(chip, netplay->cyclesPerFrame);
+	netplay->frame = 0;
+	netplay->remoteReceived = 0;
+	netplay->peerAck = 0;
+	netplay->rollbackFrom = UINT32_MAX;
+	netplay->remoteFrame = 0;
+	netplay->remoteAdvantage = 0;
+	netplay->syncFrame = 0;
+	memset(netplay->localInputs, 0, sizeof(netplay->localInputs));
+	memset(netplay->remoteInputs, 0, sizeof(netplay->remoteInputs));
+}
+
+static void transmit(struct Netplay *netplay, const struct NetplayPacket *packet, size_t length)
+{
+	sendto(netplay->socket, packet, length, 0, (const struct sockaddr*)&netplay->peer, sizeof(netplay->peer));
+	atomic_fetch_add_explicit(&netplay->statSent, 1, memory_order_relaxed);
+}
+
+// Release held back packets whose time has come, in the order they were sent
+static void flushDelayed(struct Netplay *netplay)
+{
+	uint64_t now = pacerNowNs();
+
+	while (netplay->delayedTail != netplay->delayedHead) {
+		uint32_t slot = netplay->delayedTail % NETPLAY_DELAY_QUEUE;
+		if (netplay->delayed[slot].due > now)
+			break;
+		transmit(netplay, &netplay->delayed[slot].packet, netplay->delayed[slot].length);
+		netplay->delayedTail++;
+	}
+}
+
+// Every local input the peer hasn't acknowledged yet, oldest first
+static void sendInputs(struct Netplay *netplay)
+{
+	struct NetplayPacket packet;
+	uint32_t count = netplay->frame - netplay->peerAck;
+
+	if (count > NETPLAY_REDUNDANCY)
+		count = NETPLAY_REDUNDANCY;
+
+	packet.magic = NETPLAY_MAGIC;
+	packet.stateHash = netplay->stateHash;
+	packet.frame = netplay->frame;
+	packet.ack = netplay->remoteReceived;
+	packet.advantage = (int32_t)(netplay->frame - netplay->remoteFrame);
+	packet.first = netplay->peerAck;
+	packet.count = (uint16_t)count;
+	for (uint32_t i = 0; i < count; i++)
+		packet.inputs[i] = netplay->localInputs[(packet.first + i) & NETPLAY_MASK];
+
+	size_t length = NETPLAY_HEADER_SIZE + count * sizeof(uint16_t);
+	if (netplay->delayNs == 0 && netplay->jitterNs == 0 && netplay->lossPercent == 0) {
+		transmit(netplay, &packet, length);
+		return;
+	}
+
+	if (nextNoise(netplay) % 100 < netplay->lossPercent ||
+		netplay->delayedHead - netplay->delayedTail == NETPLAY_DELAY_QUEUE) {
+		atomic_fetch_add_explicit(&netplay->statDropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	uint32_t slot = netplay->delayedHead % NETPLAY_DELAY_QUEUE;
+	uint64_t jitter = netplay->jitterNs ? nextNoise(netplay) % netplay->jitterNs : 0;
+	netplay->delayed[slot].due = pacerNowNs() + netplay->delayNs + jitter;
+	netplay->delayed[slot].length = (uint16_t)length;
+	memcpy(&netplay->delayed[slot].packet, &packet, length);
+	netplay->delayedHead++;
+}
+
+static void receiveInputs(struct Netplay *netplay)
+{
+	struct NetplayPacket packet;
+	ssize_t length;
+
+	while ((length = recv(netplay->socket, &packet, sizeof(packet), 0)) >= 0) {
+		if ((size_t)length < NETPLAY_HEADER_SIZE || packet.magic != NETPLAY_MAGIC ||
+			packet.count > NETPLAY_REDUNDANCY || (size_t)length < NETPLAY_HEADER_SIZE + packet.count * sizeof(uint16_t))
+			continue;
+		if (packet.stateHash != netplay->stateHash) {
+			atomic_fetch_add_explicit(&netplay->statMismatched, 1, memory_order_relaxed);
+			continue;
+		}
+
+		atomic_fetch_add_explicit(&netplay->statReceived, 1, memory_order_relaxed);
+		atomic_store_explicit(&netplay->connected, true, memory_order_relaxed);
+
+		if (packet.ack > netplay->peerAck && packet.ack <= netplay->frame)
+			netplay->peerAck = packet.ack;
+		if (packet.frame >= netplay->remoteFrame) {
+			netplay->remoteFrame = packet.frame;
+			netplay->remoteAdvantage = packet.advantage;
+		}
+
+		// Inputs arrive in order from our last acknowledgement, older ones are repeats
+		for (uint32_t i = 0; i < packet.count; i++) {
+			uint32_t frame = packet.first + i;
+			if (frame < netplay->remoteReceived)
+				continue;
+			if (frame > netplay->remoteReceived || (int32_t)(frame - netplay->frame) >= NETPLAY_WINDOW - NETPLAY_MAX_ROLLBACK)
+				break;
+
+			uint16_t *input = &netplay->remoteInputs[frame & NETPLAY_MASK];
+			if (frame < netplay->frame && *input != packet.inputs[i] && frame < netplay->rollbackFrom)
+				netplay->rollbackFrom = frame;
+			*input = packet.inputs[i];
+			netplay->remoteReceived = frame + 1;
+		}
+	}
+}
+
+static uint16_t predictRemote(const struct Netplay *netplay)
+{
+	return netplay->remoteReceived ? netplay->remoteInputs[(netplay->remoteReceived - 1) & NETPLAY_MASK] : 0;
+}
+
+static void runFrame(struct Netplay *netplay, struct Chip8 *chip, uint32_t frame)
+{
+	uint16_t keys = netplay->localInputs[frame & NETPLAY_MASK] | netplay->remoteInputs[frame & NETPLAY_MASK];
+
+	for (int key = 0; key < 16; key++)
+		chip->keypad[key] = (keys >> key) & 1;
+
+	uint64_t end = chip->instructions + netplay->cyclesPerFrame;
+	while (chip->instructions < end)
+		Cycle(chip);
+	updateTimers(chip);
+}
+
+// Go back to the first mispredicted frame and run up to the present again
+static void rollBack(struct Netplay *netplay, struct Chip8 *chip)
+{
+	uint32_t from = netplay->rollbackFrom;
+
+	netplay->rollbackFrom = UINT32_MAX;
+	if (from >= netplay->frame)
+		return;
+
+	uint64_t start = pacerNowNs();
+	uint16_t predicted = predictRemote(netplay);
+
+	memcpy(chip, &netplay->snapshots[from & NETPLAY_MASK], sizeof(struct Chip8));
+	for (uint32_t frame = from; frame < netplay->frame; frame++) {
+		if (frame != from)
+			memcpy(&netplay->snapshots[frame & NETPLAY_MASK], chip, sizeof(struct Chip8));
+		if (frame >= netplay->remoteReceived)
+			netplay->remoteInputs[frame & NETPLAY_MASK] = predicted;
+		runFrame(netplay, chip, frame);
+	}
+
+	uint32_t depth = netplay->frame - from;
+	atomic_fetch_add_explicit(&netplay->statRollbacks, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&netplay->statResimulated, depth, memory_order_relaxed);
+	atomic_fetch_add_explicit(&netplay->statResimulateNs, pacerNowNs() - start, memory_order_relaxed);
+	if (depth > atomic_load_explicit(&netplay->statMaxDepth, memory_order_relaxed))
+		atomic_store_explicit(&netplay->statMaxDepth, depth, memory_order_relaxed);
+}
+
+bool syncNetplay(struct Netplay *netplay, struct Chip8 *chip)
+{
+	receiveInputs(netplay);
+	rollBack(netplay, chip);
+	sendInputs(netplay);
+	flushDelayed(netplay);
+	atomic_store_explicit(&netplay->statConfirmed, netplay->remoteReceived, memory_order_relaxed);
+
+	return netplay->remoteReceived >= netplay->frame;
+}
+
+bool advanceNetplay(struct Netplay *netplay, struct Chip8 *chip, uint16_t localKeys)
+{
+	receiveInputs(netplay);
+	rollBack(netplay, chip);
+
+	uint32_t oldest = (netplay->peerAck < netplay->remoteReceived) ? netplay->peerAck : netplay->remoteReceived;
+	bool ready = atomic_load_explicit(&netplay->connected, memory_order_relaxed) && netplay->frame - oldest < NETPLAY_MAX_ROLLBACK;
+
+	// Each side sees the other late by the same one way latency, so half the difference
+	// of the two advantages is how far ahead this side really runs. Give up a tick now
+	// and then rather than piling up rollbacks on the peer.
+	if (ready && netplay->frame % NETPLAY_SYNC_INTERVAL == 0 && netplay->syncFrame != netplay->frame) {
+		int32_t advantage = (int32_t)(netplay->frame - netplay->remoteFrame);
+		netplay->syncFrame = netplay->frame;
+		if ((advantage - netplay->remoteAdvantage) / 2 >= 1) {
+			atomic_fetch_add_explicit(&netplay->statSyncSkips, 1, memory_order_relaxed);
+			ready = false;
+		}
+	}
+	else if (!ready)
+		atomic_fetch_add_explicit(&netplay->statStalls, 1, memory_order_relaxed);
+
+	if (ready) {
+		uint32_t frame = netplay->frame;
+		netplay->localInputs[frame & NETPLAY_MASK] = localKeys;
+		if (frame >= netplay->remoteReceived)
+			netplay->remoteInputs[frame & NETPLAY_MASK] = predictRemote(netplay);
+		memcpy(&netplay->snapshots[frame & NETPLAY_MASK], chip, sizeof(struct Chip8));
+		runFrame(netplay, chip, frame);
+		netplay->frame++;
+	}
+
+	sendInputs(netplay);
+	flushDelayed(netplay);
+	atomic_store_explicit(&netplay->statFrame, netplay->frame, memory_order_relaxed);
+	atomic_store_explicit(&netplay->statConfirmed, netplay->remoteReceived, memory_order_relaxed);
+	return ready;
+}
+
+void readNetplayStats(struct Netplay *netplay, struct NetplayStats *stats)
+{
+	stats->frame = atomic_load_explicit(&netplay->statFrame, memory_order_relaxed);
+	stats->confirmed = atomic_load_explicit(&netplay->statConfirmed, memory_order_relaxed);
+	stats->rollbacks = atomic_load_explicit(&netplay->statRollbacks, memory_order_relaxed);
+	stats->resimulated = atomic_load_explicit(&netplay->statResimulated, memory_order_relaxed);
+	stats->maxDepth = atomic_load_explicit(&netplay->statMaxDepth, memory_order_relaxed);
+	stats->stalls = atomic_load_explicit(&netplay->statStalls, memory_order_relaxed);
+	stats->syncSkips = atomic_load_explicit(&netplay->statSyncSkips, memory_order_relaxed);
+	stats->resimulateNs = atomic_load_explicit(&netplay->statResimulateNs, memory_order_relaxed);
+	stats->sent = atomic_load_explicit(&netplay->statSent, memory_order_relaxed);
+	stats->received = atomic_load_explicit(&netplay->statReceived, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&netplay->statDropped, memory_order_relaxed);
+	stats->mismatched = atomic_load_explicit(&netplay->statMismatched, memory_order_relaxed);
+	stats->connected = atomic_load_explicit(&netplay->connected, memory_order_relaxed);
+}
+
+void logNetplayStats(FILE *out, const struct NetplayStats *stats)
+{
+	double perFrameUs = stats->resimulated ? (double)stats->resimulateNs / 1000.0 / stats->resimulated : 0.0;
+
+	fprintf(out, "netplay frame=%u confirmed=%u rollbacks=%u resimulated=%u max_depth=%u resim_us_per_frame=%.2f "
+		"stalls=%u sync_skips=%u sent=%u received=%u dropped=%u mismatched=%u\n",
+		stats->frame, stats->confirmed, stats->rollbacks, stats->resimulated, stats->maxDepth, perFrameUs,
+		stats->stalls, stats->syncSkips, stats->sent, stats->received, stats->dropped, stats->mismatched);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "emulator.h"
+
+#define NETPLAY_MAGIC 0x4E503843		// "C8PN"
+#define NETPLAY_WINDOW 64				// snapshots kept, must be a power of two
+#define NETPLAY_MAX_ROLLBACK 30			// frames run on predicted input before waiting for the peer
+#define NETPLAY_REDUNDANCY 32			// unacknowledged inputs resent in every packet
+#define NETPLAY_SYNC_INTERVAL 10		// frames between time sync corrections
+#define NETPLAY_DELAY_QUEUE 256			// packets held back by latency injection
+#define NETPLAY_SEED 0xC8C8C8C8u		// both peers start their RNG here
+
+// Input message, every field in host byte order (peers are expected to share it)
+struct NetplayPacket {
+	uint32_t magic;
+	uint32_t stateHash;		// initial state and cyclesPerFrame, peers that differ in either ignore each other
+	uint32_t frame;			// sender's next frame
+	uint32_t ack;			// sender knows our inputs for all frames before this
+	int32_t advantage;		// sender's frame minus the newest frame it has seen from us
+	uint32_t first;			// frame of inputs[0]
+	uint16_t count;
+	uint16_t inputs[NETPLAY_REDUNDANCY];	// keypad bitmasks, bit k for key k
+};
+
+struct NetplayStats {
+	uint32_t frame;
+	uint32_t confirmed;			// frames whose remote input is known
+	uint32_t rollbacks;
+	uint32_t resimulated;		// frames run again after a misprediction
+	uint32_t maxDepth;			// longest rollback in frames
+	uint32_t stalls;			// ticks spent waiting for the peer
+	uint32_t syncSkips;			// ticks given up to let a late peer catch up
+	uint64_t resimulateNs;
+	uint32_t sent;
+	uint32_t received;
+	uint32_t dropped;			// by latency injection
+	uint32_t mismatched;		// packets from a peer in a different state
+	bool connected;
+};
+
+// Two player rollback netplay over UDP
+// Both peers run the same ROM from the same state and share one keypad: every frame the
+// guest sees the local and remote bitmasks ORed together. Only bitmasks travel, each one
+// stamped with its frame number and resent until acknowledged. A missing remote input is
+// predicted to repeat the last known one. When the real input turns out different the
+// state snapshot from before that frame is restored and the frames since are run again
+// straight away, so the guest never notices.
+struct Netplay {
+	int socket;
+	struct sockaddr_in peer;
+	uint32_t stateHash;
+	uint32_t cyclesPerFrame;
+
+	// Owned by the thread that advances the emulator
+	uint32_t frame;				// frames simulated so far
+	uint32_t remoteReceived;	// remote inputs are known for all frames before this
+	uint32_t peerAck;			// peer knows our inputs for all frames before this
+	uint32_t rollbackFrom;		// earliest mispredicted frame, UINT32_MAX when none
+	uint32_t remoteFrame;		// newest frame number the peer reported
+	int32_t remoteAdvantage;
+	uint32_t syncFrame;			// last frame checked for time sync
+	uint16_t localInputs[NETPLAY_WINDOW];
+	uint16_t remoteInputs[NETPLAY_WINDOW];	// actual below remoteReceived, predicted above
+	struct Chip8 *snapshots;	// NETPLAY_WINDOW states, frame f is stored before it runs
+
+	// Artificial latency for testing on one host
+	uint64_t delayNs;
+	uint64_t jitterNs;
+	uint32_t lossPercent;
+	uint32_t noise;
+	struct {
+		uint64_t due;
+		uint16_t length;
+		struct NetplayPacket packet;
+	} delayed[NETPLAY_DELAY_QUEUE];
+	uint32_t delayedHead;
+	uint32_t delayedTail;
+
+	// Written by the advancing thread, readable from any thread
+	atomic_uint statFrame;
+	atomic_uint statConfirmed;
+	atomic_uint statRollbacks;
+	atomic_uint statResimulated;
+	atomic_uint statMaxDepth;
+	atomic_uint statStalls;
+	atomic_uint statSyncSkips;
+	atomic_uint_fast64_t statResimulateNs;
+	atomic_uint statSent;
+	atomic_uint statReceived;
+	atomic_uint statDropped;
+	atomic_uint statMismatched;
+	atomic_bool connected;
+};
+
+// Bind localPort and exchange inputs with host:port, NULL on failure
+struct Netplay* openNetplay(uint16_t localPort, const char *host, uint16_t port);
+
+void closeNetplay(struct Netplay *netplay);
+
+// Hold every outgoing packet back by delayMs plus up to jitterMs, dropping lossPercent of them
+void setNetplayLatency(struct Netplay *netplay, uint32_t delayMs, uint32_t jitterMs, uint32_t lossPercent);
+
+// Parse "delay[:jitter[:loss]]" as used by CHIPPY_NETPLAY_LATENCY
+void parseNetplayLatency(struct Netplay *netplay, const char *spec);
+
+// Start from frame 0 at chip's current state, which must be identical on both peers, as must
+// cyclesPerFrame
+void startNetplay(struct Netplay *netplay, const struct Chip8 *chip, uint32_t cyclesPerFrame);
+
+// Run the next frame with the local keypad bitmask. Returns false without running it
+// while the peer hasn't answered yet or is too far behind.
+bool advanceNetplay(struct Netplay *netplay, struct Chip8 *chip, uint16_t localKeys);
+
+// Receive, correct mispredictions and resend without running a new frame.
+// Returns true once every remote input up to the current frame is known.
+bool syncNetplay(struct Netplay *netplay, struct Chip8 *chip);
+
+void readNetplayStats(struct Netplay *netplay, struct NetplayStats *stats);
+
+// Write a one line summary of the statistics
+void logNetplayStats(FILE *out, const struct NetplayStats *stats);
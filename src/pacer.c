@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "pacer.h"
+
+#define NS_PER_SECOND 1000000000ULL
+#define NS_PER_US 1000ULL
+
+const uint32_t pacerJitterBoundsUs[PACER_JITTER_BUCKETS - 1] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+const uint32_t pacerSpeedBoundsPpm[PACER_SPEED_BUCKETS - 1] = { 10, 100, 1000, 10000 };
+
+uint64_t pacerNowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
+
+static void sleepUntilNs(uint64_t deadline)
+{
+	struct timespec ts;
+	ts.tv_sec = (time_t)(deadline / NS_PER_SECOND);
+	ts.tv_nsec = (long)(deadline % NS_PER_SECOND);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+		;	// restart if interrupted by a signal
+}
+
+static void recordJitter(struct Pacer *pacer, uint64_t lateNs)
+{
+	uint32_t us = (uint32_t)(lateNs / NS_PER_US);
+	unsigned int bucket = 0;
+
+	while (bucket < PACER_JITTER_BUCKETS - 1 && us >= pacerJitterBoundsUs[bucket])
+		bucket++;
+	atomic_fetch_add_explicit(&pacer->jitter[bucket], 1, memory_order_relaxed);
+
+	if (us > atomic_load_explicit(&pacer->maxJitterUs, memory_order_relaxed))
+		atomic_store_explicit(&pacer->maxJitterUs, us, memory_order_relaxed);
+}
+
+// Compare ticks handed out against wall time once per second
+static void recordSpeed(struct Pacer *pacer, uint64_t now)
+{
+	uint64_t elapsed = now - pacer->windowStartNs;
+	if (elapsed < NS_PER_SECOND)
+		return;
+
+	int64_t emulated = (int64_t)(pacer->windowTicks * pacer->periodNs);
+	int64_t ppm = (emulated - (int64_t)elapsed) * 1000000 / (int64_t)elapsed;
+	uint64_t magnitude = (uint64_t)llabs(ppm);
+	unsigned int bucket = 0;
+
+	while (bucket < PACER_SPEED_BUCKETS - 1 && magnitude >= pacerSpeedBoundsPpm[bucket])
+		bucket++;
+	atomic_fetch_add_explicit(&pacer->speedError[bucket], 1, memory_order_relaxed);
+	atomic_store_explicit(&pacer->lastSpeedErrorPpm, (int)ppm, memory_order_relaxed);
+
+	pacer->windowStartNs = now;
+	pacer->windowTicks = 0;
+}
+
+void initPacer(struct Pacer *pacer, uint32_t rateHz)
+{
+	memset(pacer, 0, sizeof(*pacer));
+	pacer->periodNs = NS_PER_SECOND / rateHz;
+	pacer->spinNs = PACER_MIN_SPIN_NS * 4;
+	resyncPacer(pacer);
+}
+
+void resyncPacer(struct Pacer *pacer)
+{
+	pacer->epochNs = pacerNowNs();
+	pacer->ticks = 0;
+	pacer->windowStartNs = pacer->epochNs;
+	pacer->windowTicks = 0;
+}
+
+unsigned int waitPacer(struct Pacer *pacer)
+{
+	uint64_t deadline = pacer->epochNs + (pacer->ticks + 1) * pacer->periodNs;
+	uint64_t now = pacerNowNs();
+
+	// Coarse sleep, then spin through the last stretch where the scheduler can't be trusted
+	if (deadline > now + pacer->spinNs) {
+		uint64_t target = deadline - pacer->spinNs;
+		sleepUntilNs(target);
+		now = pacerNowNs();
+
+		uint64_t oversleep = now > target ? now - target : 0;
+		pacer->oversleepNs = (pacer->oversleepNs * 7 + oversleep) / 8;
+		pacer->spinNs = pacer->oversleepNs * 2;
+		if (pacer->spinNs < PACER_MIN_SPIN_NS)
+			pacer->spinNs = PACER_MIN_SPIN_NS;
+		else if (pacer->spinNs > PACER_MAX_SPIN_NS)
+			pacer->spinNs = PACER_MAX_SPIN_NS;
+		atomic_store_explicit(&pacer->spinUs, (unsigned int)(pacer->spinNs / NS_PER_US), memory_order_relaxed);
+	}
+	while (now < deadline) {
+		sched_yield();
+		now = pacerNowNs();
+	}
+	recordJitter(pacer, now - deadline);
+
+	// Fixed-timestep accumulator: hand out every tick that has come due
+	uint64_t due = (now - pacer->epochNs) / pacer->periodNs;
+	uint64_t count = due - pacer->ticks;
+
+	if (count > PACER_MAX_CATCHUP) {
+		// Too far behind to catch up without a visible burst, move the epoch instead
+		atomic_fetch_add_explicit(&pacer->droppedTicks, (unsigned int)(count - 1), memory_order_relaxed);
+		pacer->epochNs += (count - 1) * pacer->periodNs;
+		count = 1;
+	}
+	pacer->ticks += count;
+	pacer->windowTicks += count;
+	recordSpeed(pacer, now);
+
+	return (unsigned int)count;
+}
+
+void readPacerStats(struct Pacer *pacer, struct PacerStats *stats)
+{
+	for (int i = 0; i < PACER_JITTER_BUCKETS; i++)
+		stats->jitter[i] = atomic_load_explicit(&pacer->jitter[i], memory_order_relaxed);
+	for (int i = 0; i < PACER_SPEED_BUCKETS; i++)
+		stats->speedError[i] = atomic_load_explicit(&pacer->speedError[i], memory_order_relaxed);
+	stats->droppedTicks = atomic_load_explicit(&pacer->droppedTicks, memory_order_relaxed);
+	stats->maxJitterUs = atomic_load_explicit(&pacer->maxJitterUs, memory_order_relaxed);
+	stats->lastSpeedErrorPpm = atomic_load_explicit(&pacer->lastSpeedErrorPpm, memory_order_relaxed);
+	stats->spinUs = atomic_load_explicit(&pacer->spinUs, memory_order_relaxed);
+}
+
+void logPacerStats(FILE *out, const struct PacerStats *stats)
+{
+	fprintf(out, "pacer jitter_us");
+	for (int i = 0; i < PACER_JITTER_BUCKETS; i++) {
+		if (i < PACER_JITTER_BUCKETS - 1)
+			fprintf(out, " <%u:%u", pacerJitterBoundsUs[i], stats->jitter[i]);
+		else
+			fprintf(out, " >=%u:%u", pacerJitterBoundsUs[i - 1], stats->jitter[i]);
+	}
+	fprintf(out, " speed_ppm");
+	for (int i = 0; i < PACER_SPEED_BUCKETS; i++) {
+		if (i < PACER_SPEED_BUCKETS - 1)
+			fprintf(out, " <%u:%u", pacerSpeedBoundsPpm[i], stats->speedError[i]);
+		else
+			fprintf(out, " >=%u:%u", pacerSpeedBoundsPpm[i - 1], stats->speedError[i]);
+	}
+	fprintf(out, " max_jitter_us=%u last_speed_ppm=%d dropped=%u spin_us=%u\n",
+		stats->maxJitterUs, stats->lastSpeedErrorPpm, stats->droppedTicks, stats->spinUs);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#define PACER_JITTER_BUCKETS 10
+#define PACER_SPEED_BUCKETS 5
+#define PACER_MAX_CATCHUP 4			// ticks run back to back before the pacer resyncs
+#define PACER_MIN_SPIN_NS 50000
+#define PACER_MAX_SPIN_NS 2000000
+
+// Upper bound (exclusive) of each jitter bucket in microseconds, the last bucket is open ended
+extern const uint32_t pacerJitterBoundsUs[PACER_JITTER_BUCKETS - 1];
+
+// Upper bound (exclusive) of each emulation speed error bucket in parts per million
+extern const uint32_t pacerSpeedBoundsPpm[PACER_SPEED_BUCKETS - 1];
+
+// Fixed-timestep pacer
+// Deadlines are derived from a fixed epoch so sleep error never accumulates into drift.
+// Each wait sleeps with clock_nanosleep up to an adaptive margin before the deadline and
+// spins only for that margin, which is tuned from the observed oversleep.
+struct Pacer {
+	uint64_t periodNs;
+	uint64_t epochNs;
+	uint64_t ticks;				// ticks handed out since the epoch
+	uint64_t spinNs;			// how early to stop sleeping and start spinning
+	uint64_t oversleepNs;		// smoothed clock_nanosleep overshoot
+
+	// speed measurement window
+	uint64_t windowStartNs;
+	uint64_t windowTicks;
+
+	// Telemetry, written by the pacing thread and readable from any thread
+	atomic_uint jitter[PACER_JITTER_BUCKETS];
+	atomic_uint speedError[PACER_SPEED_BUCKETS];
+	atomic_uint droppedTicks;
+	atomic_uint maxJitterUs;
+	atomic_int lastSpeedErrorPpm;
+	atomic_uint spinUs;
+};
+
+struct PacerStats {
+	uint32_t jitter[PACER_JITTER_BUCKETS];
+	uint32_t speedError[PACER_SPEED_BUCKETS];
+	uint32_t droppedTicks;
+	uint32_t maxJitterUs;
+	int32_t lastSpeedErrorPpm;
+	uint32_t spinUs;
+};
+
+// Monotonic clock in nanoseconds
+uint64_t pacerNowNs();
+
+// Start pacing at rateHz from now
+void initPacer(struct Pacer *pacer, uint32_t rateHz);
+
+// Restart the epoch, e.g. after a pause, without clearing telemetry
+void resyncPacer(struct Pacer *pacer);
+
+// Wait for the next tick and return how many ticks are due (at least 1)
+unsigned int waitPacer(struct Pacer *pacer);
+
+// Copy the telemetry counters
+void readPacerStats(struct Pacer *pacer, struct PacerStats *stats);
+
+// Write a one line summary of the telemetry
+void logPacerStats(FILE *out, const struct PacerStats *stats);
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "png_writer.h"
+#include "crc32.h"
+
+#define STORED_BLOCK_MAX 65535
+
+static void putBigEndian(uint8_t *out, uint32_t value)
+{
+	out[0] = (uint8_t)(value >> 24);
+	out[1] = (uint8_t)(value >> 16);
+	out[2] = (uint8_t)(value >> 8);
+	out[3] = (uint8_t)value;
+}
+
+void writePngChunk(FILE *file, const char *type, const uint8_t *data, uint32_t length)
+{
+	uint8_t header[8];
+
+	putBigEndian(header, length);
+	memcpy(header + 4, type, 4);
+	fwrite(header, 1, 8, file);
+	if (length > 0)
+		fwrite(data, 1, length, file);
+
+	uint8_t crc[4];
+	putBigEndian(crc, updateCrc32(updateCrc32(0, (const uint8_t*)type, 4), data, length));
+	fwrite(crc, 1, 4, file);
+}
+
+size_t storeZlib(const uint8_t *data, size_t raw, uint8_t *out)
+{
+	size_t length = 0;
+	uint32_t a = 1, b = 0;
+
+	// zlib stream made of stored deflate blocks
+	out[length++] = 0x78;
+	out[length++] = 0x01;
+	for (size_t offset = 0; offset < raw || offset == 0; offset += STORED_BLOCK_MAX) {
+		size_t size = raw - offset < STORED_BLOCK_MAX ? raw - offset : STORED_BLOCK_MAX;
+
+		out[length++] = (offset + size == raw) ? 1 : 0;
+		out[length++] = (uint8_t)size;
+		out[length++] = (uint8_t)(size >> 8);
+		out[length++] = (uint8_t)~size;
+		out[length++] = (uint8_t)(~size >> 8);
+		memcpy(out + length, data + offset, size);
+		length += size;
+		if (raw == 0)
+			break;
+	}
+	for (size_t i = 0; i < raw; i++) {
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	putBigEndian(out + length, (b << 16) | a);
+	return length + 4;
+}
+
+int writePng(const char *path, const uint8_t *rgb, int width, int height)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	size_t stride = (size_t)width * 3 + 1;
+	size_t raw = stride * height;
+	uint8_t *filtered = malloc(raw);
+	uint8_t *zlib = malloc(PNG_STORED_BOUND(raw));
+
+	if (filtered == NULL || zlib == NULL) {
+		free(filtered);
+		free(zlib);
+		return 0;
+	}
+
+	// Every row uses filter type 0
+	for (int y = 0; y < height; y++) {
+		filtered[y * stride] = 0;
+		memcpy(filtered + y * stride + 1, rgb + (size_t)y * width * 3, (size_t)width * 3);
+	}
+
+	size_t length = storeZlib(filtered, raw, zlib);
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		free(filtered);
+		free(zlib);
+		return 0;
+	}
+
+	uint8_t header[13];
+	putBigEndian(header, (uint32_t)width);
+	putBigEndian(header + 4, (uint32_t)height);
+	header[8] = 8;		// bit depth
+	header[9] = 2;		// truecolour
+	header[10] = 0;
+	header[11] = 0;
+	header[12] = 0;
+
+	fwrite(signature, 1, sizeof(signature), file);
+	writePngChunk(file, "IHDR", header, sizeof(header));
+	writePngChunk(file, "IDAT", zlib, (uint32_t)length);
+	writePngChunk(file, "IEND", NULL, 0);
+
+	int ok = ferror(file) == 0;
+	fclose(file);
+	free(filtered);
+	free(zlib);
+	return ok;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Minimal PNG encoder for headless tools, pixels are stored uncompressed (deflate
+// stored blocks) so no compression library is needed. Images this small don't care.
+
+// Worst case storeZlib() output for size bytes
+#define PNG_STORED_BOUND(size) ((size) + ((size) / 65535 + 1) * 5 + 6)
+
+// Write width x height 8-bit RGB pixels to path, returns 0 on failure
+int writePng(const char *path, const uint8_t *rgb, int width, int height);
+
+// Write one chunk with its length and CRC, for encoders building other PNG variants
+void writePngChunk(FILE *file, const char *type, const uint8_t *data, uint32_t length);
+
+// Wrap size bytes into a zlib stream of stored blocks, returns the stream length
+size_t storeZlib(const uint8_t *data, size_t size, uint8_t *out);
@@ -0,0 +1,72 @@
+#include <string.h>
+#include "power.h"
+
+static const char *powerStateNames[] = { "active", "background", "idle" };
+
+static struct Pacer* currentPacer(struct PowerBudget *power)
+{
+	return (power->state == POWER_BACKGROUND) ? &power->background : &power->active;
+}
+
+void initPowerBudget(struct PowerBudget *power, uint32_t rateHz)
+{
+	memset(power, 0, sizeof(*power));
+	power->state = POWER_ACTIVE;
+	initPacer(&power->active, rateHz);
+	initPacer(&power->background, POWER_BACKGROUND_HZ);
+	power->windowStartNs = pacerNowNs();
+}
+
+void beginPowerFrame(struct PowerBudget *power)
+{
+	power->frameStartNs = pacerNowNs();
+}
+
+void endPowerFrame(struct PowerBudget *power, bool drawn)
+{
+	uint64_t work = pacerNowNs() - power->frameStartNs;
+
+	power->workNs = (power->workNs * 7 + work) / 8;
+	power->windowWorkNs += work;
+	power->frames++;
+	power->drawn += drawn;
+	power->idleFrames += (power->state == POWER_IDLE);
+}
+
+void setPowerState(struct PowerBudget *power, enum PowerState state)
+{
+	if (state == power->state)
+		return;
+
+	bool samePacer = (state == POWER_BACKGROUND) == (power->state == POWER_BACKGROUND);
+	power->state = state;
+	if (!samePacer)
+		resyncPacer(currentPacer(power));
+}
+
+static void logPowerBudget(struct PowerBudget *power, uint64_t now)
+{
+	uint64_t elapsed = now - power->windowStartNs;
+
+	printf("power state=%s frames=%u drawn=%u idle=%u work_us=%llu budget_us=%llu duty_pct=%.2f\n",
+		powerStateNames[power->state], power->frames, power->drawn, power->idleFrames,
+		(unsigned long long)(power->workNs / 1000), (unsigned long long)(power->active.periodNs / 1000),
+		elapsed ? 100.0 * (double)power->windowWorkNs / (double)elapsed : 0.0);
+
+	power->windowStartNs = now;
+	power->windowWorkNs = 0;
+	power->frames = 0;
+	power->drawn = 0;
+	power->idleFrames = 0;
+}
+
+void waitPowerFrame(struct PowerBudget *power)
+{
+	// After a long wait in the event queue the deadline has passed and the pacer
+	// moves its epoch, so the frame answering the input runs right away
+	waitPacer(currentPacer(power));
+
+	uint64_t now = pacerNowNs();
+	if (now - power->windowStartNs >= POWER_LOG_INTERVAL_NS)
+		logPowerBudget(power, now);
+}
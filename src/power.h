@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "pacer.h"
+
+#define POWER_BACKGROUND_HZ 10		// frame rate while the window is unfocused
+#define POWER_LOG_INTERVAL_NS 60000000000ULL	// time between power log lines
+
+enum PowerState {
+	POWER_ACTIVE,		// frames at the display rate
+	POWER_BACKGROUND,	// window unfocused, frames at POWER_BACKGROUND_HZ
+	POWER_IDLE			// guest waits in FX0A, the loop sleeps in the event queue until input
+};
+
+// CPU budget of the render loop for low-power mode
+// Frames are paced from absolute deadlines like the emulation thread, so the loop works
+// for as long as a frame needs and sleeps through the rest of it. The caller decides the
+// state each frame and skips drawing frames whose picture didn't change.
+struct PowerBudget {
+	enum PowerState state;
+	struct Pacer active;		// display rate, also caps bursts of input events while idle
+	struct Pacer background;
+	uint64_t frameStartNs;
+	uint64_t workNs;			// smoothed update and draw time per frame
+
+	// Since the last log line
+	uint64_t windowStartNs;
+	uint64_t windowWorkNs;
+	uint32_t frames;
+	uint32_t drawn;
+	uint32_t idleFrames;
+};
+
+void initPowerBudget(struct PowerBudget *power, uint32_t rateHz);
+
+// Frame work starts
+void beginPowerFrame(struct PowerBudget *power);
+
+// Frame work is done, presentation and event waits are not counted
+void endPowerFrame(struct PowerBudget *power, bool drawn);
+
+// Switch state, the pacer taken over starts from now so no frames are owed
+void setPowerState(struct PowerBudget *power, enum PowerState state);
+
+// Sleep until the next frame of the current state and log a summary now and then
+void waitPowerFrame(struct PowerBudget *power);
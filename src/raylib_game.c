@@ -12,6 +12,9 @@
 
 #include "raylib.h"
 #include "screens.h"    // NOTE: Declares global (extern) variables and screens functions
+#include "telemetry.h"
+#include "recorder.h"
+#include "power.h"
 #include <time.h>
 #include <stdlib.h>
 
@@ -28,12 +31,15 @@ Font font = { 0 };
 Music music = { 0 };
 Sound fxBeep = { 0 };
 Sound fxCoin = { 0 };
+struct Telemetry telemetry = { 0 };
+struct Recorder recorder = { 0 };
 
 //----------------------------------------------------------------------------------
 // Local Variables Definition (local to this module)
 //----------------------------------------------------------------------------------
 static const int screenWidth = 800;
 static const int screenHeight = 450;
+static const int targetFPS = 60;        // Emulation speed is set by the emulation thread, see emu_thread.h
 
 // Required variables to manage screen transitions (fade-in, fade-out)
 static float transAlpha = 0.0f;
@@ -42,6 +48,10 @@ static bool transFadeOut = false;
 static int transFromScreen = -1;
 static GameScreen transToScreen = UNKNOWN;
 
+// Low-power mode (CHIPPY_LOW_POWER=1) for always-on units, see power.h
+static bool lowPower = false;
+static struct PowerBudget power = { 0 };
+
 //----------------------------------------------------------------------------------
 // Local Functions Declaration
 //----------------------------------------------------------------------------------
@@ -52,6 +62,7 @@ static void UpdateTransition(void);         // Update transition effect
 static void DrawTransition(void);           // Draw transition effect (full-screen rectangle)
 
 static void UpdateDrawFrame(void);          // Update and draw one frame
+static void UpdatePowerState(void);         // Pick the low-power frame rate for the next frame
 
 //----------------------------------------------------------------------------------
 // Main entry point
@@ -70,6 +81,14 @@ int main(void)
     fxBeep = LoadSound("../resources/beep.wav");
     srand(time(NULL));
 
+    // Frame telemetry export, e.g. CHIPPY_TELEMETRY=unix:/run/telegraf.sock
+    const char *interval = getenv("CHIPPY_TELEMETRY_INTERVAL");
+    startTelemetry(&telemetry, getenv("CHIPPY_TELEMETRY"), (interval != NULL)? (uint32_t)atoi(interval) : TELEMETRY_DEFAULT_INTERVAL);
+
+    // Video capture of every game played, e.g. CHIPPY_RECORD=attract.gif, .png for APNG, anything else raw
+    const char *scale = getenv("CHIPPY_RECORD_SCALE");
+    startRecorder(&recorder, getenv("CHIPPY_RECORD"), (scale != NULL)? (unsigned int)atoi(scale) : RECORDER_DEFAULT_SCALE);
+
     // Setup and init first screen
     currentScreen = TITLE;
     InitTitleScreen();
@@ -82,13 +101,18 @@ int main(void)
 #if defined(PLATFORM_WEB)
     emscripten_set_main_loop(UpdateDrawFrame, 60, 1);
 #else
-    SetTargetFPS(240);       // Should be changed depending on ROM
+    // Low-power mode paces frames itself instead of raylib's busy waiting frame limiter
+    const char *lowPowerEnv = getenv("CHIPPY_LOW_POWER");
+    lowPower = (lowPowerEnv != NULL) && (atoi(lowPowerEnv) != 0);
+    if (lowPower) initPowerBudget(&power, targetFPS);
+    SetTargetFPS(lowPower? 0 : targetFPS);
     //--------------------------------------------------------------------------------------
 
     // Main game loop
     while (!WindowShouldClose())    // Detect window close button or ESC key
     {
         UpdateDrawFrame();
+        if (lowPower) waitPowerFrame(&power);
     }
 #endif
 
@@ -99,9 +123,14 @@ int main(void)
     {
         case TITLE: UnloadTitleScreen(); break;
         case GAMEPLAY: UnloadGameplayScreen(); break;
+        case TILED: UnloadTiledScreen(); break;
+        case BROWSER: UnloadBrowserScreen(); break;
         default: break;
     }
 
+    stopTelemetry(&telemetry);
+    stopRecorder(&recorder);
+
     // Unload global data loaded
     UnloadFont(font);
     UnloadSound(fxCoin);
@@ -126,6 +155,8 @@ static void ChangeToScreen(GameScreen screen)
     {
         case TITLE: UnloadTitleScreen(); break;
         case GAMEPLAY: UnloadGameplayScreen(); break;
+        case TILED: UnloadTiledScreen(); break;
+        case BROWSER: UnloadBrowserScreen(); break;
         default: break;
     }
 
@@ -134,6 +165,8 @@ static void ChangeToScreen(GameScreen screen)
     {
         case TITLE: InitTitleScreen(); break;
         case GAMEPLAY: InitGameplayScreen(); break;
+        case TILED: InitTiledScreen(); break;
+        case BROWSER: InitBrowserScreen(); break;
         default: break;
     }
 
@@ -168,6 +201,8 @@ static void UpdateTransition(void)
             {
                 case TITLE: UnloadTitleScreen(); break;
                 case GAMEPLAY: UnloadGameplayScreen(); break;
+                case TILED: UnloadTiledScreen(); break;
+                case BROWSER: UnloadBrowserScreen(); break;
                 default: break;
             }
 
@@ -176,6 +211,8 @@ static void UpdateTransition(void)
             {
                 case TITLE: InitTitleScreen(); break;
                 case GAMEPLAY: InitGameplayScreen(); break;
+                case TILED: InitTiledScreen(); break;
+                case BROWSER: InitBrowserScreen(); break;
                 default: break;
             }
 
@@ -209,6 +246,9 @@ static void DrawTransition(void)
 // Update and draw game frame
 static void UpdateDrawFrame(void)
 {
+    beginTelemetryFrame(&telemetry);
+    if (lowPower) beginPowerFrame(&power);
+
     // Update
     //----------------------------------------------------------------------------------
     UpdateMusicStream(music);       // NOTE: Music keeps playing between screens
@@ -222,6 +262,8 @@ static void UpdateDrawFrame(void)
                 UpdateTitleScreen();
 
                 if (FinishTitleScreen() == 1) TransitionToScreen(GAMEPLAY);
+                else if (FinishTitleScreen() == 2) TransitionToScreen(TILED);
+                else if (FinishTitleScreen() == 3) TransitionToScreen(BROWSER);
 
             } break;
             case GAMEPLAY:
@@ -230,13 +272,44 @@ static void UpdateDrawFrame(void)
 
                 if (FinishGameplayScreen() == 1) TransitionToScreen(TITLE);
 
+            } break;
+            case TILED:
+            {
+                UpdateTiledScreen();
+
+                if (FinishTiledScreen() == 1) TransitionToScreen(TITLE);
+
+            } break;
+            case BROWSER:
+            {
+                UpdateBrowserScreen();
+
+                if (FinishBrowserScreen() == 1) TransitionToScreen(GAMEPLAY);
+                else if (FinishBrowserScreen() == 2) TransitionToScreen(TITLE);
+
             } break;
             default: break;
         }
     }
     else UpdateTransition();    // Update transition (fade-in, fade-out)
+
+    markTelemetry(&telemetry, TELEMETRY_INPUT);
     //----------------------------------------------------------------------------------
 
+    // Fast-forward presents only some frames, input still has to be polled on the others.
+    // Low-power mode also skips frames that would look like the one on screen.
+    bool skipDraw = !onTransition && (currentScreen == GAMEPLAY) && SkipGameplayDraw();
+    if (lowPower && !onTransition && (currentScreen == GAMEPLAY) && !GameplayFrameChanged() && !IsWindowResized()) skipDraw = true;
+    if (lowPower) UpdatePowerState();
+
+    if (skipDraw)
+    {
+        if (lowPower) endPowerFrame(&power, false);
+        PollInputEvents();      // NOTE: Blocks until input while idle, see UpdatePowerState()
+        if (!lowPower) WaitTime(1.0/targetFPS);
+        return;
+    }
+
     // Draw
     //----------------------------------------------------------------------------------
     BeginDrawing();
@@ -247,12 +320,33 @@ static void UpdateDrawFrame(void)
         {
             case TITLE: DrawTitleScreen(); break;
             case GAMEPLAY: DrawGameplayScreen(); break;
+            case TILED: DrawTiledScreen(); break;
+            case BROWSER: DrawBrowserScreen(); break;
             default: break;
         }
 
         // Draw full screen rectangle in front of everything
         if (onTransition) DrawTransition();
 
+        markTelemetry(&telemetry, TELEMETRY_DRAW);
+        if (lowPower) endPowerFrame(&power, true);
+
     EndDrawing();
+
+    if (!onTransition && (currentScreen == GAMEPLAY)) GameplayFramePresented();
     //----------------------------------------------------------------------------------
 }
+
+// Choose how often the loop wakes up
+static void UpdatePowerState(void)
+{
+    enum PowerState state = POWER_ACTIVE;
+
+    // Nothing changes on screen until a key arrives, raylib then waits in the event queue
+    if (!onTransition && (currentScreen == GAMEPLAY) && GameplayWaitingForKey()) state = POWER_IDLE;
+    else if (!IsWindowFocused()) state = POWER_BACKGROUND;
+
+    if ((state == POWER_IDLE) && (power.state != POWER_IDLE)) EnableEventWaiting();
+    else if ((state != POWER_IDLE) && (power.state == POWER_IDLE)) DisableEventWaiting();
+    setPowerState(&power, state);
+}
@@ -0,0 +1,476 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#ifdef CHIPPY_ZLIB
+#include <zlib.h>
+#endif
+#include "recorder.h"
+#include "delta.h"
+#include "png_writer.h"
+#include "pacer.h"
+
+#define ROW_BYTES (VIDEO_WIDTH / 8)
+#define GIF_MIN_CODE_SIZE 2			// smallest the format allows, the palette has 2 colours
+#define GIF_MAX_CODE 4095
+#define MAX_DELAY 65535				// GIF and APNG delays are 16 bit centiseconds, longer stills are split
+#define CENTISECOND_NS 10000000ULL
+#define MILLISECOND_NS 1000000ULL
+
+// Black and the SKYBLUE tint the gameplay screen draws with
+static const uint8_t palette[6] = { 0, 0, 0, 102, 191, 255 };
+
+// Changed area in Chip-8 pixels
+struct Rect {
+	unsigned int x, y, width, height;
+};
+
+// LZW codes packed LSB first into GIF sub-blocks
+struct GifBits {
+	FILE *file;
+	uint8_t block[256];			// length byte, then up to 255 data bytes
+	uint32_t bits;
+	unsigned int count;
+};
+
+static inline unsigned int pixelAt(const uint8_t *bits, unsigned int x, unsigned int y)
+{
+	return (bits[y * ROW_BYTES + x / 8] >> (7 - x % 8)) & 1;
+}
+
+static void putLittleEndian16(uint8_t *out, uint32_t value)
+{
+	out[0] = (uint8_t)value;
+	out[1] = (uint8_t)(value >> 8);
+}
+
+static void putBigEndian(uint8_t *out, uint32_t value)
+{
+	out[0] = (uint8_t)(value >> 24);
+	out[1] = (uint8_t)(value >> 16);
+	out[2] = (uint8_t)(value >> 8);
+	out[3] = (uint8_t)value;
+}
+
+static void putVarint(FILE *file, uint64_t value)
+{
+	while (value >= 0x80) {
+		fputc((int)(value & 0x7F) | 0x80, file);
+		value >>= 7;
+	}
+	fputc((int)value, file);
+}
+
+void recordFrame(struct Recorder *recorder, const uint8_t *video, uint64_t timeNs)
+{
+	if (!recorder->enabled)
+		return;
+
+	uint8_t bits[RECORDER_FRAME_BYTES];
+	packBits(video, VIDEO_SIZE, bits);
+	if (recorder->queued && memcmp(bits, recorder->last, sizeof(bits)) == 0)
+		return;
+
+	unsigned int head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&recorder->tail, memory_order_acquire);
+	if (head - tail >= RECORDER_RING_SIZE) {
+		atomic_fetch_add_explicit(&recorder->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	struct RecorderFrame *frame = &recorder->frames[head & (RECORDER_RING_SIZE - 1)];
+	frame->timeNs = timeNs;
+	memcpy(frame->bits, bits, sizeof(bits));
+	atomic_store_explicit(&recorder->head, head + 1, memory_order_release);
+
+	memcpy(recorder->last, bits, sizeof(bits));
+	recorder->queued = true;
+}
+
+// Bounding box of the pixels that differ, a single pixel if none does
+static struct Rect changedRect(const uint8_t *before, const uint8_t *after)
+{
+	unsigned int left = VIDEO_WIDTH, right = 0, top = VIDEO_HEIGHT, bottom = 0;
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y++) {
+		for (unsigned int x = 0; x < VIDEO_WIDTH; x++) {
+			if (pixelAt(before, x, y) == pixelAt(after, x, y))
+				continue;
+			if (x < left) left = x;
+			if (x > right) right = x;
+			if (y < top) top = y;
+			if (y > bottom) bottom = y;
+		}
+	}
+
+	if (left > right)
+		return (struct Rect){ 0, 0, 1, 1 };
+	return (struct Rect){ left, top, right - left + 1, bottom - top + 1 };
+}
+
+static struct Rect frameRect(const struct Recorder *recorder)
+{
+	if (recorder->encoded == 0)
+		return (struct Rect){ 0, 0, VIDEO_WIDTH, VIDEO_HEIGHT };
+	return changedRect(recorder->written, recorder->pending.bits);
+}
+
+static void flushGifBlock(struct GifBits *out)
+{
+	if (out->block[0] > 0)
+		fwrite(out->block, 1, (size_t)out->block[0] + 1, out->file);
+	out->block[0] = 0;
+}
+
+static void putGifCode(struct GifBits *out, uint32_t code, unsigned int size)
+{
+	out->bits |= code << out->count;
+	out->count += size;
+	while (out->count >= 8) {
+		out->block[++out->block[0]] = (uint8_t)out->bits;
+		out->bits >>= 8;
+		out->count -= 8;
+		if (out->block[0] == 255)
+			flushGifBlock(out);
+	}
+}
+
+// LZW over the scaled pixels of area, the dictionary is a trie with one child per colour
+static void writeGifPixels(struct Recorder *recorder, struct Rect area)
+{
+	uint16_t child[GIF_MAX_CODE + 1][2];
+	const uint32_t clear = 1u << GIF_MIN_CODE_SIZE, end = clear + 1;
+	unsigned int size = GIF_MIN_CODE_SIZE + 1, scale = recorder->scale;
+	uint32_t maxCode = end;
+	int32_t current = -1;
+	struct GifBits out = { .file = recorder->file };
+
+	memset(child, 0, sizeof(child));
+	fputc(GIF_MIN_CODE_SIZE, recorder->file);
+	putGifCode(&out, clear, size);
+
+	for (unsigned int y = area.y * scale; y < (area.y + area.height) * scale; y++) {
+		for (unsigned int x = area.x * scale; x < (area.x + area.width) * scale; x++) {
+			unsigned int colour = pixelAt(recorder->pending.bits, x / scale, y / scale);
+			if (current < 0) {
+				current = (int32_t)colour;
+				continue;
+			}
+			if (child[current][colour] != 0) {
+				current = child[current][colour];
+				continue;
+			}
+
+			putGifCode(&out, (uint32_t)current, size);
+			child[current][colour] = (uint16_t)++maxCode;
+			if (maxCode >= (1u << size))
+				size++;
+			if (maxCode == GIF_MAX_CODE) {
+				putGifCode(&out, clear, size);
+				memset(child, 0, sizeof(child));
+				size = GIF_MIN_CODE_SIZE + 1;
+				maxCode = end;
+			}
+			current = (int32_t)colour;
+		}
+	}
+
+	// The decoder adds the entry for the previous code as it reads the last one and may
+	// widen its codes before the end code
+	putGifCode(&out, (uint32_t)current, size);
+	if (maxCode + 1 == (1u << size))
+		size++;
+	putGifCode(&out, end, size);
+	if (out.count > 0)
+		putGifCode(&out, 0, 8 - out.count);
+	flushGifBlock(&out);
+	fputc(0, recorder->file);
+}
+
+static void writeGifFrame(struct Recorder *recorder, uint32_t delay)
+{
+	struct Rect area = frameRect(recorder);
+	unsigned int scale = recorder->scale;
+
+	// Graphic control: leave the frame in place, the next one only covers what changed
+	uint8_t control[8] = { 0x21, 0xF9, 4, 1 << 2, 0, 0, 0, 0 };
+	putLittleEndian16(control + 4, delay);
+	fwrite(control, 1, sizeof(control), recorder->file);
+
+	uint8_t descriptor[10] = { 0x2C };
+	putLittleEndian16(descriptor + 1, area.x * scale);
+	putLittleEndian16(descriptor + 3, area.y * scale);
+	putLittleEndian16(descriptor + 5, area.width * scale);
+	putLittleEndian16(descriptor + 7, area.height * scale);
+	fwrite(descriptor, 1, sizeof(descriptor), recorder->file);
+
+	writeGifPixels(recorder, area);
+}
+
+static void writeGifHeader(struct Recorder *recorder)
+{
+	uint8_t screen[13] = { 'G', 'I', 'F', '8', '9', 'a' };
+	putLittleEndian16(screen + 6, VIDEO_WIDTH * recorder->scale);
+	putLittleEndian16(screen + 8, VIDEO_HEIGHT * recorder->scale);
+	screen[10] = 0x80;		// global colour table of 2 entries
+	fwrite(screen, 1, sizeof(screen), recorder->file);
+	fwrite(palette, 1, sizeof(palette), recorder->file);
+
+	// Loop forever
+	static const uint8_t loop[19] = { 0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1, 0, 0, 0 };
+	fwrite(loop, 1, sizeof(loop), recorder->file);
+}
+
+static void writeFrameCount(struct Recorder *recorder)
+{
+	uint8_t control[8];
+	putBigEndian(control, recorder->encoded);
+	putBigEndian(control + 4, 0);		// play forever
+	writePngChunk(recorder->file, "acTL", control, sizeof(control));
+}
+
+static void writeApngHeader(struct Recorder *recorder)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	uint8_t header[13];
+
+	putBigEndian(header, VIDEO_WIDTH * recorder->scale);
+	putBigEndian(header + 4, VIDEO_HEIGHT * recorder->scale);
+	header[8] = 1;		// bit depth
+	header[9] = 3;		// palette
+	header[10] = 0;
+	header[11] = 0;
+	header[12] = 0;
+
+	fwrite(signature, 1, sizeof(signature), recorder->file);
+	writePngChunk(recorder->file, "IHDR", header, sizeof(header));
+	recorder->frameCountOffset = ftell(recorder->file);
+	writeFrameCount(recorder);
+	writePngChunk(recorder->file, "PLTE", palette, sizeof(palette));
+}
+
+static size_t compressRows(struct Recorder *recorder, size_t raw, uint8_t *out)
+{
+#ifdef CHIPPY_ZLIB
+	uLongf length = compressBound(raw);
+	if (compress2(out, &length, recorder->packed, raw, Z_BEST_COMPRESSION) == Z_OK)
+		return length;
+#endif
+	return storeZlib(recorder->packed, raw, out);
+}
+
+static void writeApngFrame(struct Recorder *recorder, uint32_t delay)
+{
+	struct Rect area = frameRect(recorder);
+	unsigned int scale = recorder->scale;
+	unsigned int width = area.width * scale, height = area.height * scale;
+	size_t stride = (width + 7) / 8 + 1;
+
+	uint8_t control[26];
+	putBigEndian(control, recorder->sequence++);
+	putBigEndian(control + 4, width);
+	putBigEndian(control + 8, height);
+	putBigEndian(control + 12, area.x * scale);
+	putBigEndian(control + 16, area.y * scale);
+	control[20] = (uint8_t)(delay >> 8);
+	control[21] = (uint8_t)delay;
+	control[22] = 0;
+	control[23] = 100;	// delay in centiseconds
+	control[24] = 0;	// leave the frame in place
+	control[25] = 0;	// replace the area, no blending
+	writePngChunk(recorder->file, "fcTL", control, sizeof(control));
+
+	// Filter type 0 rows of 1 bit pixels
+	memset(recorder->packed, 0, stride * height);
+	for (unsigned int y = 0; y < height; y++) {
+		uint8_t *row = recorder->packed + y * stride;
+		for (unsigned int x = 0; x < width; x++) {
+			if (pixelAt(recorder->pending.bits, area.x + x / scale, area.y + y / scale))
+				row[1 + x / 8] |= (uint8_t)(0x80 >> (x % 8));
+		}
+	}
+
+	// The first frame is the default image, later ones carry a sequence number
+	if (recorder->encoded == 0) {
+		size_t length = compressRows(recorder, stride * height, recorder->buffer);
+		writePngChunk(recorder->file, "IDAT", recorder->buffer, (uint32_t)length);
+	}
+	else {
+		putBigEndian(recorder->buffer, recorder->sequence++);
+		size_t length = compressRows(recorder, stride * height, recorder->buffer + 4);
+		writePngChunk(recorder->file, "fdAT", recorder->buffer, (uint32_t)length + 4);
+	}
+}
+
+static void writeApngEnd(struct Recorder *recorder)
+{
+	writePngChunk(recorder->file, "IEND", NULL, 0);
+	fseek(recorder->file, recorder->frameCountOffset, SEEK_SET);
+	writeFrameCount(recorder);
+	fseek(recorder->file, 0, SEEK_END);
+}
+
+static void writeRawHeader(struct Recorder *recorder)
+{
+	fwrite(RECORDER_RAW_MAGIC, 1, 4, recorder->file);
+	fputc(RECORDER_RAW_VERSION, recorder->file);
+	fputc(VIDEO_WIDTH, recorder->file);
+	fputc(VIDEO_HEIGHT, recorder->file);
+}
+
+static void writeRawFrame(struct Recorder *recorder, uint64_t duration)
+{
+	size_t length = encodeDelta(recorder->pending.bits, recorder->written, RECORDER_FRAME_BYTES, recorder->buffer);
+	putVarint(recorder->file, duration);
+	putVarint(recorder->file, length);
+	fwrite(recorder->buffer, 1, length, recorder->file);
+}
+
+// Write the pending picture, shown until endNs
+static void encodePending(struct Recorder *recorder, uint64_t endNs)
+{
+	uint64_t units = (endNs > recorder->startNs) ? (endNs - recorder->startNs + recorder->unitNs / 2) / recorder->unitNs : 0;
+
+	// Shown for less than one delay unit, whatever follows replaces it
+	if (units <= recorder->writtenUnits)
+		return;
+
+	uint64_t duration = units - recorder->writtenUnits;
+	while (duration > 0) {
+		uint64_t delay = duration;
+		if (recorder->format == RECORDER_RAW) {
+			writeRawFrame(recorder, delay);
+		}
+		else {
+			delay = (duration > MAX_DELAY) ? MAX_DELAY : duration;
+			if (recorder->format == RECORDER_GIF)
+				writeGifFrame(recorder, (uint32_t)delay);
+			else
+				writeApngFrame(recorder, (uint32_t)delay);
+		}
+		memcpy(recorder->written, recorder->pending.bits, RECORDER_FRAME_BYTES);
+		recorder->encoded++;
+		duration -= delay;
+	}
+	recorder->writtenUnits = units;
+}
+
+static void drainRing(struct Recorder *recorder)
+{
+	unsigned int tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&recorder->head, memory_order_acquire);
+
+	while (tail != head) {
+		const struct RecorderFrame *frame = &recorder->frames[tail & (RECORDER_RING_SIZE - 1)];
+		encodePending(recorder, frame->timeNs);
+		recorder->pending = *frame;
+		tail++;
+	}
+	atomic_store_explicit(&recorder->tail, tail, memory_order_release);
+	fflush(recorder->file);
+}
+
+static void* runEncoder(void *arg)
+{
+	struct Recorder *recorder = (struct Recorder*)arg;
+	struct timespec pause = { 0, RECORDER_DRAIN_NS };
+
+	while (atomic_load_explicit(&recorder->running, memory_order_acquire)) {
+		nanosleep(&pause, NULL);
+		drainRing(recorder);
+	}
+
+	// The last picture lasts until the recording stopped, and at least one delay unit
+	// when nothing was written yet: an APNG without frames isn't a valid PNG
+	drainRing(recorder);
+	uint64_t endNs = recorder->stopNs;
+	if (recorder->encoded == 0 && endNs < recorder->startNs + recorder->unitNs)
+		endNs = recorder->startNs + recorder->unitNs;
+	encodePending(recorder, endNs);
+	if (recorder->format == RECORDER_GIF)
+		fputc(0x3B, recorder->file);
+	else if (recorder->format == RECORDER_APNG)
+		writeApngEnd(recorder);
+	return NULL;
+}
+
+static enum RecorderFormat formatOf(const char *path)
+{
+	const char *extension = strrchr(path, '.');
+	if (extension == NULL)
+		return RECORDER_RAW;
+	if (strcasecmp(extension, ".gif") == 0)
+		return RECORDER_GIF;
+	if (strcasecmp(extension, ".png") == 0 || strcasecmp(extension, ".apng") == 0)
+		return RECORDER_APNG;
+	return RECORDER_RAW;
+}
+
+void startRecorder(struct Recorder *recorder, const char *path, unsigned int scale)
+{
+	memset(recorder, 0, sizeof(*recorder));
+	if (path == NULL || path[0] == '\0')
+		return;
+
+	strncpy(recorder->path, path, RECORDER_PATH_SIZE - 1);
+	recorder->format = formatOf(path);
+	recorder->scale = (scale < 1) ? 1 : (scale > RECORDER_MAX_SCALE) ? RECORDER_MAX_SCALE : scale;
+	recorder->unitNs = (recorder->format == RECORDER_RAW) ? MILLISECOND_NS : CENTISECOND_NS;
+
+	// Worst case is a whole APNG frame at full scale, or a raw delta
+	size_t raw = ((size_t)VIDEO_WIDTH * recorder->scale / 8 + 1) * VIDEO_HEIGHT * recorder->scale;
+	recorder->packed = malloc(raw);
+	recorder->buffer = malloc(raw + raw / 64 + DELTA_BOUND(RECORDER_FRAME_BYTES) + 64);
+	recorder->file = fopen(path, "wb");
+	if (recorder->packed == NULL || recorder->buffer == NULL || recorder->file == NULL) {
+		printf("Error while opening recording %s\n", path);
+		if (recorder->file != NULL)
+			fclose(recorder->file);
+		free(recorder->packed);
+		free(recorder->buffer);
+		return;
+	}
+
+	if (recorder->format == RECORDER_GIF)
+		writeGifHeader(recorder);
+	else if (recorder->format == RECORDER_APNG)
+		writeApngHeader(recorder);
+	else
+		writeRawHeader(recorder);
+
+	// Black until the first frame comes in
+	recorder->startNs = pacerNowNs();
+	recorder->pending.timeNs = recorder->startNs;
+
+	atomic_init(&recorder->head, 0);
+	atomic_init(&recorder->tail, 0);
+	atomic_init(&recorder->dropped, 0);
+	atomic_init(&recorder->running, true);
+
+	if (pthread_create(&recorder->thread, NULL, runEncoder, recorder) != 0) {
+		printf("Error while starting recording encoder\n");
+		fclose(recorder->file);
+		free(recorder->packed);
+		free(recorder->buffer);
+		return;
+	}
+	recorder->enabled = true;
+}
+
+void stopRecorder(struct Recorder *recorder)
+{
+	if (!recorder->enabled)
+		return;
+
+	recorder->stopNs = pacerNowNs();
+	atomic_store_explicit(&recorder->running, false, memory_order_release);
+	pthread_join(recorder->thread, NULL);
+	recorder->enabled = false;
+
+	bool failed = ferror(recorder->file) != 0;
+	failed |= fclose(recorder->file) != 0;
+	printf("Recording %s: %u frames, %u dropped%s\n", recorder->path, recorder->encoded,
+		atomic_load_explicit(&recorder->dropped, memory_order_relaxed), failed ? ", write failed" : "");
+	free(recorder->packed);
+	free(recorder->buffer);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "emulator.h"
+
+#define RECORDER_RING_SIZE 256			// changed frames buffered for the encoder, must be a power of two
+#define RECORDER_DRAIN_NS 100000000ULL	// how often the encoder empties the ring
+#define RECORDER_FRAME_BYTES (VIDEO_SIZE / 8)
+#define RECORDER_DEFAULT_SCALE 4		// output pixels per Chip-8 pixel for GIF and APNG
+#define RECORDER_MAX_SCALE 16
+#define RECORDER_PATH_SIZE 256
+#define RECORDER_RAW_MAGIC "C8RV"
+#define RECORDER_RAW_VERSION 1
+
+enum RecorderFormat {
+	RECORDER_GIF,		// .gif
+	RECORDER_APNG,		// .png or .apng
+	RECORDER_RAW		// anything else
+};
+
+// One queued picture, 1 bit per pixel, rows of VIDEO_WIDTH / 8 bytes, MSB leftmost
+struct RecorderFrame {
+	uint64_t timeNs;	// pacerNowNs() when it was presented
+	uint8_t bits[RECORDER_FRAME_BYTES];
+};
+
+// Video recorder
+// The render thread packs every presented frame that differs from the previous one into
+// a single producer, single consumer ring and never waits; when the ring is full the
+// frame is dropped and counted. An encoder thread drains the ring and writes each
+// picture once its successor arrives, with the time in between as its delay, so
+// identical frames cost nothing and a still screen is one frame however long it stays.
+// GIF and APNG frames after the first only cover the rectangle that changed.
+// The raw format is RECORDER_RAW_MAGIC, version, width and height bytes, then one record
+// per picture: varint duration in ms, varint length and the packed frame encoded with
+// encodeDelta() against the previous one (zeros for the first), see delta.h.
+struct Recorder {
+	bool enabled;
+
+	// Render thread
+	uint8_t last[RECORDER_FRAME_BYTES];		// newest queued picture
+	bool queued;
+
+	struct RecorderFrame frames[RECORDER_RING_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_uint dropped;		// frames lost because the ring was full
+
+	// Encoder thread
+	pthread_t thread;
+	atomic_bool running;
+	char path[RECORDER_PATH_SIZE];
+	enum RecorderFormat format;
+	unsigned int scale;
+	FILE *file;
+	uint64_t startNs;
+	uint64_t stopNs;			// set by stopRecorder() before the encoder is told to finish
+	uint64_t unitNs;			// delay resolution of the format
+	struct RecorderFrame pending;			// waiting for its successor to know its delay
+	uint8_t written[RECORDER_FRAME_BYTES];	// picture shown after the last encoded frame
+	uint64_t writtenUnits;		// end of the last encoded frame since startNs
+	uint32_t encoded;			// frames written
+	long frameCountOffset;		// APNG acTL chunk, rewritten with the frame count at the end
+	uint32_t sequence;			// APNG chunk sequence number
+	uint8_t *buffer;			// encoder scratch space
+	uint8_t *packed;
+};
+
+// Start recording to path, the format follows its extension, scale is clamped to
+// 1..RECORDER_MAX_SCALE. A NULL or empty path leaves the recorder disabled.
+void startRecorder(struct Recorder *recorder, const char *path, unsigned int scale);
+
+// Encode what is still queued, finish the file and stop the encoder
+void stopRecorder(struct Recorder *recorder);
+
+// Render thread: queue video (VIDEO_SIZE bytes, 0 or PIXEL_ON) if it changed
+void recordFrame(struct Recorder *recorder, const uint8_t *video, uint64_t timeNs);
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+
+#define REWIND_INITIAL_CAPACITY 4096
+
+static void appendSegment(struct RewindSegment *segment, const uint8_t *data, size_t size)
+{
+	if (segment->size + size > segment->capacity) {
+		size_t capacity = segment->capacity ? segment->capacity : REWIND_INITIAL_CAPACITY;
+		while (segment->size + size > capacity)
+			capacity *= 2;
+
+		uint8_t *grown = (uint8_t*)realloc(segment->data, capacity);
+		if (grown == NULL) {
+			printf("Error while growing rewind history\n");
+			exit(1);
+		}
+		segment->data = grown;
+		segment->capacity = capacity;
+	}
+
+	memcpy(segment->data + segment->size, data, size);
+	segment->offsets[segment->count] = (uint32_t)segment->size;
+	segment->size += size;
+	segment->count++;
+	segment->offsets[segment->count] = (uint32_t)segment->size;
+}
+
+// Apply a stored frame record to state in place
+static void applyFrame(const struct RewindSegment *segment, unsigned int frame, uint8_t *state)
+{
+	const uint8_t *data = segment->data + segment->offsets[frame];
+	size_t length = segment->offsets[frame + 1] - segment->offsets[frame];
+
+	decodeDelta(data, length, frame == 0 ? NULL : state, state, REWIND_STATE_SIZE);
+}
+
+void initRewind(struct Rewind *history)
+{
+	memset(history, 0, sizeof(*history));
+}
+
+void freeRewind(struct Rewind *history)
+{
+	for (unsigned int i = 0; i < REWIND_SEGMENTS; i++)
+		free(history->segments[i].data);
+	initRewind(history);
+}
+
+void clearRewind(struct Rewind *history)
+{
+	for (unsigned int i = 0; i < REWIND_SEGMENTS; i++) {
+		history->segments[i].size = 0;
+		history->segments[i].count = 0;
+	}
+	history->newest = 0;
+	history->used = 0;
+}
+
+void captureRewind(struct Rewind *history, const struct Chip8 *chip)
+{
+	const uint8_t *state = (const uint8_t*)chip;
+	struct RewindSegment *segment = &history->segments[history->newest];
+	size_t size;
+
+	if (history->used == 0 || segment->count == REWIND_KEYFRAME_INTERVAL) {
+		// Start a new segment, recycling the oldest one when history is full
+		if (history->used > 0)
+			history->newest = (history->newest + 1) % REWIND_SEGMENTS;
+		if (history->used < REWIND_SEGMENTS)
+			history->used++;
+
+		segment = &history->segments[history->newest];
+		segment->size = 0;
+		segment->count = 0;
+
+		size = encodeDelta(state, NULL, REWIND_STATE_SIZE, history->scratch);
+	}
+	else {
+		size = encodeDelta(state, history->latest, REWIND_STATE_SIZE, history->scratch);
+	}
+
+	appendSegment(segment, history->scratch, size);
+	memcpy(history->latest, state, REWIND_STATE_SIZE);
+}
+
+// Drop the newest frame, latest becomes the one before it
+static void dropNewest(struct Rewind *history)
+{
+	struct RewindSegment *segment = &history->segments[history->newest];
+	unsigned int frame = --(segment->count);
+
+	segment->size = segment->offsets[frame];
+
+	if (frame > 0) {
+		// Undo the newest delta to get the frame before it
+		applyFrame(segment, frame, history->latest);
+	}
+	else {
+		// Segment emptied, rebuild the last frame of the previous one from its keyframe
+		history->used--;
+		if (history->used > 0) {
+			history->newest = (history->newest + REWIND_SEGMENTS - 1) % REWIND_SEGMENTS;
+			segment = &history->segments[history->newest];
+			for (unsigned int i = 0; i < segment->count; i++)
+				applyFrame(segment, i, history->latest);
+		}
+	}
+}
+
+bool stepRewind(struct Rewind *history, struct Chip8 *chip)
+{
+	// latest is the state chip was left in, so it has to go before anything changes
+	if (history->used == 0 || (history->used == 1 && history->segments[history->newest].count == 1))
+		return false;
+
+	dropNewest(history);
+	memcpy(chip, history->latest, REWIND_STATE_SIZE);
+	return true;
+}
+
+size_t rewindSize(const struct Rewind *history)
+{
+	size_t total = 0;
+
+	for (unsigned int i = 0; i < REWIND_SEGMENTS; i++)
+		total += history->segments[i].size;
+	return total;
+}
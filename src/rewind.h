@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "emulator.h"
+#include "delta.h"
+
+#define REWIND_SECONDS 120
+#define REWIND_FRAME_RATE 60
+#define REWIND_KEYFRAME_INTERVAL 180	// frames per segment, the first one is the keyframe
+#define REWIND_SEGMENTS (REWIND_SECONDS * REWIND_FRAME_RATE / REWIND_KEYFRAME_INTERVAL)
+#define REWIND_STATE_SIZE sizeof(struct Chip8)
+
+// One keyframe plus the frames that follow it, each stored as an RLE-compressed
+// XOR delta against the frame before it. XOR is its own inverse, so the same delta
+// steps backwards from the newer frame, and any frame is at most one segment of
+// deltas away from a keyframe.
+struct RewindSegment {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	uint32_t offsets[REWIND_KEYFRAME_INTERVAL + 1];
+	uint16_t count;
+};
+
+// Ring of segments, the oldest segment is recycled once history is full
+struct Rewind {
+	struct RewindSegment segments[REWIND_SEGMENTS];
+	unsigned int newest;		// segment frames are appended to
+	unsigned int used;			// segments holding at least one frame
+	uint8_t latest[REWIND_STATE_SIZE];	// newest state in history
+	uint8_t scratch[DELTA_BOUND(REWIND_STATE_SIZE)];
+};
+
+// Set up an empty history
+void initRewind(struct Rewind *history);
+
+// Free all segment storage
+void freeRewind(struct Rewind *history);
+
+// Drop all history, keeping allocated storage for reuse
+void clearRewind(struct Rewind *history);
+
+// Append the current state
+void captureRewind(struct Rewind *history, const struct Chip8 *chip);
+
+// Drop the newest state, which is the one chip is in, and restore the one before it.
+// Returns false once only the oldest state is left.
+bool stepRewind(struct Rewind *history, struct Chip8 *chip);
+
+// Total bytes of compressed history
+size_t rewindSize(const struct Rewind *history);
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef CHIPPY_ZLIB
+#include <zlib.h>
+#endif
+#include "rom_archive.h"
+#include "crc32.h"
+
+#define ARCHIVE_PATH_SIZE 1024
+#define CHUNK_SIZE 16384
+
+#define ZIP_LOCAL_SIGNATURE 0x04034B50u
+#define ZIP_CENTRAL_SIGNATURE 0x02014B50u
+#define ZIP_END_SIGNATURE 0x06054B50u
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_MAX_COMMENT 65535
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+#define ZIP_ENCRYPTED 0x0001
+
+struct ArchiveEntry {
+	char name[ARCHIVE_NAME_SIZE];
+	uint32_t headerOffset;		// local file header, the data follows its name and extra field
+	uint32_t compressedSize;
+	uint32_t size;
+	uint32_t crc;
+	uint16_t method;
+};
+
+// ROM entries of one zip, sorted by name
+struct ArchiveIndex {
+	char path[ARCHIVE_PATH_SIZE];
+	off_t fileSize;				// the index is stale once either changes
+	time_t modified;
+	uint64_t lastUse;
+	struct ArchiveEntry *entries;
+	uint32_t count;
+};
+
+static struct ArchiveIndex indices[ARCHIVE_CACHE_SIZE];
+static uint64_t useClock;
+static pthread_mutex_t indexLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint16_t read16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool hasExtension(const char *path, const char *extension)
+{
+	size_t length = strlen(path), extensionLength = strlen(extension);
+	return length >= extensionLength && strcasecmp(path + length - extensionLength, extension) == 0;
+}
+
+bool isRomName(const char *name)
+{
+	return hasExtension(name, ".ch8") || hasExtension(name, ".c8");
+}
+
+// Split "pack.zip:entry" into the archive path and the entry name, which is NULL for a
+// bare "pack.zip". Returns false if path doesn't name a zip at all.
+static bool splitZipPath(const char *path, char *archive, size_t archiveSize, const char **entry)
+{
+	for (const char *separator = strchr(path, ARCHIVE_SEPARATOR); separator != NULL; separator = strchr(separator + 1, ARCHIVE_SEPARATOR)) {
+		size_t length = (size_t)(separator - path);
+		if (length >= 4 && length < archiveSize && strncasecmp(separator - 4, ".zip", 4) == 0) {
+			memcpy(archive, path, length);
+			archive[length] = '\0';
+			*entry = separator + 1;
+			return true;
+		}
+	}
+
+	if (!hasExtension(path, ".zip") || strlen(path) >= archiveSize)
+		return false;
+	strcpy(archive, path);
+	*entry = NULL;
+	return true;
+}
+
+bool isRomArchivePath(const char *path)
+{
+	char archive[ARCHIVE_PATH_SIZE];
+	const char *entry;
+	return hasExtension(path, ".gz") || splitZipPath(path, archive, sizeof(archive), &entry);
+}
+
+static int byName(const void *a, const void *b)
+{
+	return strcmp(((const struct ArchiveEntry*)a)->name, ((const struct ArchiveEntry*)b)->name);
+}
+
+// Read the central directory, keeping the ROM entries that can be read back
+static bool buildIndex(struct ArchiveIndex *index, FILE *file, off_t fileSize)
+{
+	// The end record sits in the last 22 bytes plus an optional comment
+	long tailSize = (fileSize < ZIP_END_SIZE + ZIP_MAX_COMMENT) ? (long)fileSize : ZIP_END_SIZE + ZIP_MAX_COMMENT;
+	if (tailSize < ZIP_END_SIZE)
+		return false;
+	uint8_t *tail = malloc(tailSize);
+	if (tail == NULL || fseek(file, (long)fileSize - tailSize, SEEK_SET) != 0 || fread(tail, 1, tailSize, file) != (size_t)tailSize) {
+		free(tail);
+		return false;
+	}
+
+	const uint8_t *end = NULL;
+	for (long i = tailSize - ZIP_END_SIZE; i >= 0 && end == NULL; i--) {
+		if (read32(tail + i) == ZIP_END_SIGNATURE)
+			end = tail + i;
+	}
+	if (end == NULL) {
+		free(tail);
+		return false;
+	}
+	uint16_t total = read16(end + 10);
+	uint32_t directorySize = read32(end + 12);
+	uint32_t directoryOffset = read32(end + 16);
+	free(tail);
+
+	// Zip64 archives mark these fields as 0xFFFFFFFF, they are far beyond any ROM pack
+	if ((off_t)directoryOffset + directorySize > fileSize)
+		return false;
+	uint8_t *directory = malloc(directorySize ? directorySize : 1);
+	if (directory == NULL || fseek(file, (long)directoryOffset, SEEK_SET) != 0 || fread(directory, 1, directorySize, file) != directorySize) {
+		free(directory);
+		return false;
+	}
+
+	index->entries = malloc((total ? total : 1) * sizeof(struct ArchiveEntry));
+	index->count = 0;
+	const uint8_t *record = directory;
+	for (uint16_t i = 0; i < total && index->entries != NULL; i++) {
+		if (record + ZIP_CENTRAL_SIZE > directory + directorySize || read32(record) != ZIP_CENTRAL_SIGNATURE)
+			break;
+		uint16_t nameLength = read16(record + 28);
+		const uint8_t *next = record + ZIP_CENTRAL_SIZE + nameLength + read16(record + 30) + read16(record + 32);
+		if (next > directory + directorySize)
+			break;
+
+		uint16_t method = read16(record + 10);
+		bool readable = !(read16(record + 8) & ZIP_ENCRYPTED) && (method == ZIP_STORED || method == ZIP_DEFLATED);
+		if (readable && nameLength < ARCHIVE_NAME_SIZE) {
+			struct ArchiveEntry *entry = &index->entries[index->count];
+			memcpy(entry->name, record + ZIP_CENTRAL_SIZE, nameLength);
+			entry->name[nameLength] = '\0';
+			entry->method = method;
+			entry->crc = read32(record + 16);
+			entry->compressedSize = read32(record + 20);
+			entry->size = read32(record + 24);
+			entry->headerOffset = read32(record + 42);
+			if (isRomName(entry->name) && strlen(entry->name) == nameLength)
+				index->count++;
+		}
+		record = next;
+	}
+	free(directory);
+
+	if (index->entries == NULL)
+		return false;
+	qsort(index->entries, index->count, sizeof(struct ArchiveEntry), byName);
+	return true;
+}
+
+// Cached index of archive, call with indexLock held. NULL if it can't be read.
+static struct ArchiveIndex* findIndex(const char *archive)
+{
+	struct stat info;
+	if (stat(archive, &info) != 0 || strlen(archive) >= ARCHIVE_PATH_SIZE)
+		return NULL;
+
+	struct ArchiveIndex *slot = &indices[0];
+	for (int i = 0; i < ARCHIVE_CACHE_SIZE; i++) {
+		struct ArchiveIndex *index = &indices[i];
+		if (index->entries != NULL && strcmp(index->path, archive) == 0) {
+			if (index->fileSize == info.st_size && index->modified == info.st_mtime) {
+				index->lastUse = ++useClock;
+				return index;
+			}
+			slot = index;		// rewritten since, rebuild in place
+			break;
+		}
+		if (index->lastUse < slot->lastUse)
+			slot = index;
+	}
+
+	free(slot->entries);
+	memset(slot, 0, sizeof(*slot));
+
+	FILE *file = fopen(archive, "rb");
+	if (file == NULL)
+		return NULL;
+	bool built = buildIndex(slot, file, info.st_size);
+	fclose(file);
+	if (!built) {
+		free(slot->entries);
+		memset(slot, 0, sizeof(*slot));
+		return NULL;
+	}
+
+	strcpy(slot->path, archive);
+	slot->fileSize = info.st_size;
+	slot->modified = info.st_mtime;
+	slot->lastUse = ++useClock;
+	return slot;
+}
+
+#ifdef CHIPPY_ZLIB
+// Inflate from the file position into data, reading at most inputSize bytes (-1 for up to
+// the end of the file). Returns the size produced, capacity + 1 if there was more or -1.
+static long inflateInto(FILE *file, long inputSize, int windowBits, uint8_t *data, size_t capacity)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, windowBits) != Z_OK)
+		return -1;
+
+	uint8_t input[CHUNK_SIZE];
+	uint8_t spill;
+	bool spilling = false;
+	int status = Z_OK;
+	stream.next_out = data;
+	stream.avail_out = (uInt)capacity;
+
+	while (status == Z_OK || status == Z_BUF_ERROR) {
+		if (stream.avail_in == 0) {
+			size_t wanted = (inputSize >= 0 && inputSize < CHUNK_SIZE) ? (size_t)inputSize : CHUNK_SIZE;
+			stream.avail_in = (uInt)fread(input, 1, wanted, file);
+			stream.next_in = input;
+			if (inputSize >= 0)
+				inputSize -= stream.avail_in;
+			if (stream.avail_in == 0)
+				break;			// input ended before the stream did
+		}
+
+		// A full buffer gets one spare byte to tell whether the ROM goes on
+		if (stream.avail_out == 0) {
+			if (spilling)
+				break;
+			spilling = true;
+			stream.next_out = &spill;
+			stream.avail_out = 1;
+		}
+		status = inflate(&stream, Z_NO_FLUSH);
+	}
+
+	long size = -1;
+	if (spilling && stream.avail_out == 0)
+		size = (long)capacity + 1;
+	else if (status == Z_STREAM_END)
+		size = spilling ? (long)capacity : (long)(capacity - stream.avail_out);
+	inflateEnd(&stream);
+	return size;
+}
+#endif
+
+static long readZipEntry(const char *archive, const struct ArchiveEntry *entry, uint8_t *data, size_t capacity)
+{
+	uint8_t header[ZIP_LOCAL_SIZE];
+	FILE *file = fopen(archive, "rb");
+	if (file == NULL)
+		return -1;
+
+	long size = -1;
+	if (fseek(file, entry->headerOffset, SEEK_SET) == 0 && fread(header, 1, sizeof(header), file) == sizeof(header)
+		&& read32(header) == ZIP_LOCAL_SIGNATURE
+		&& fseek(file, read16(header + 26) + read16(header + 28), SEEK_CUR) == 0) {
+		if (entry->method == ZIP_STORED) {
+			size_t wanted = (entry->size < capacity) ? entry->size : capacity;
+			if (fread(data, 1, wanted, file) == wanted)
+				size = (entry->size > capacity) ? (long)capacity + 1 : (long)entry->size;
+		}
+#ifdef CHIPPY_ZLIB
+		else {
+			size = inflateInto(file, entry->compressedSize, -MAX_WBITS, data, capacity);
+		}
+#endif
+
+		// Only a complete entry can be checked
+		if (size >= 0 && (size_t)size <= capacity && (size != (long)entry->size || updateCrc32(0, data, size) != entry->crc))
+			size = -1;
+	}
+	fclose(file);
+	return size;
+}
+
+static long readZipRom(const char *path, uint8_t *data, size_t capacity)
+{
+	char archive[ARCHIVE_PATH_SIZE];
+	const char *name;
+	if (!splitZipPath(path, archive, sizeof(archive), &name))
+		return -1;
+
+	// Copy the entry out, the index may be replaced once the lock is released
+	struct ArchiveEntry entry;
+	bool found = false;
+	pthread_mutex_lock(&indexLock);
+	struct ArchiveIndex *index = findIndex(archive);
+	if (index != NULL && index->count > 0) {
+		struct ArchiveEntry key;
+		const struct ArchiveEntry *match = index->entries;
+		if (name != NULL) {
+			snprintf(key.name, sizeof(key.name), "%s", name);
+			match = bsearch(&key, index->entries, index->count, sizeof(struct ArchiveEntry), byName);
+		}
+		if (match != NULL) {
+			entry = *match;
+			found = true;
+		}
+	}
+	pthread_mutex_unlock(&indexLock);
+
+	return found ? readZipEntry(archive, &entry, data, capacity) : -1;
+}
+
+long readRomImage(const char *path, uint8_t *data, size_t capacity)
+{
+	char archive[ARCHIVE_PATH_SIZE];
+	const char *entry;
+	if (splitZipPath(path, archive, sizeof(archive), &entry))
+		return readZipRom(path, data, capacity);
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return -1;
+
+	long size = -1;
+	if (hasExtension(path, ".gz")) {
+#ifdef CHIPPY_ZLIB
+		size = inflateInto(file, -1, MAX_WBITS + 16, data, capacity);
+#endif
+	} else {
+		size = (long)fread(data, 1, capacity, file);
+		if (ferror(file))
+			size = -1;
+		else if ((size_t)size == capacity && fgetc(file) != EOF)
+			size = (long)capacity + 1;
+	}
+	fclose(file);
+	return size;
+}
+
+bool listRomArchive(const char *archive, void (*visit)(void *user, const char *name, uint32_t size), void *user)
+{
+	pthread_mutex_lock(&indexLock);
+	struct ArchiveIndex *index = findIndex(archive);
+	if (index != NULL) {
+		for (uint32_t i = 0; i < index->count; i++)
+			visit(user, index->entries[i].name, index->entries[i].size);
+	}
+	pthread_mutex_unlock(&indexLock);
+	return index != NULL;
+}
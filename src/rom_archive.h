@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define ARCHIVE_NAME_SIZE 256		// longer entry names are not listed
+#define ARCHIVE_CACHE_SIZE 4		// archive indices kept, least recently used goes first
+#define ARCHIVE_SEPARATOR ':'
+
+// ROM packs
+// A ROM path may name a gzip file ("game.ch8.gz"), an entry of a zip archive
+// ("pack.zip:dir/game.ch8") or a zip archive alone, meaning its first ROM by name.
+// The zip central directory is read once per archive and kept in a small process-wide
+// cache, checked against the file's size and modification time. An entry is then read
+// by seeking to it and inflating straight into the caller's buffer, nothing else in the
+// archive is decompressed and nothing is written to disk. Safe to call from any thread.
+// Deflate needs zlib (CHIPPY_ZLIB), without it only stored zip entries can be read.
+
+// True if name ends in .ch8 or .c8, in any case
+bool isRomName(const char *name);
+
+// True if path names a zip or gzip file, or an entry inside a zip
+bool isRomArchivePath(const char *path);
+
+// Read the ROM at path into data, which holds capacity bytes. Returns the ROM size,
+// capacity + 1 if it does not fit (data then holds its first capacity bytes) or -1 if
+// it can't be read. Plain files are read as they are.
+long readRomImage(const char *path, uint8_t *data, size_t capacity);
+
+// Call visit with the name and size of every .ch8/.c8 entry in a zip archive, sorted by
+// name, returns false if the archive can't be read
+bool listRomArchive(const char *archive, void (*visit)(void *user, const char *name, uint32_t size), void *user);
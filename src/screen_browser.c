@@ -0,0 +1,265 @@
+/**********************************************************************************************
+*
+*   raylib - Advance Game template
+*
+*   Browser Screen Functions Definitions (Init, Update, Draw, Unload)
+*
+*   Copyright (c) 2014-2022 Ramon Santamaria (@raysan5)
+*
+*   This software is provided "as-is", without any express or implied warranty. In no event
+*   will the authors be held liable for any damages arising from the use of this software.
+*
+*   Permission is granted to anyone to use this software for any purpose, including commercial
+*   applications, and to alter it and redistribute it freely, subject to the following restrictions:
+*
+*     1. The origin of this software must not be misrepresented; you must not claim that you
+*     wrote the original software. If you use this software in a product, an acknowledgment
+*     in the product documentation would be appreciated but is not required.
+*
+*     2. Altered source versions must be plainly marked as such, and must not be misrepresented
+*     as being the original software.
+*
+*     3. This notice may not be removed or altered from any source distribution.
+*
+**********************************************************************************************/
+
+#include "raylib.h"
+#include "screens.h"
+#include "thumbnails.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CELL_WIDTH 150
+#define CELL_HEIGHT 96
+#define THUMB_SCALE 2           // thumbnail drawn at 128x64
+#define HEADER_HEIGHT 40
+#define KEEP_ROWS 2             // textures kept this many rows outside the view
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static int finishScreen = 0;
+
+// Workers fill the thumbnails, textures are only made for rows near the view
+// and dropped again once scrolled away, so large directories cost no more GPU memory
+static struct ThumbnailCache cache = { 0 };
+static Texture2D *textures = NULL;  // per entry, id 0 while not loaded, NULL until listed
+static int columns = 1;
+static float scroll = 0.0f;         // pixels scrolled from the first row
+static int selected = 0;
+
+//----------------------------------------------------------------------------------
+// Module Functions Declaration (local)
+//----------------------------------------------------------------------------------
+static Rectangle CellBounds(int entry);             // Where an entry is drawn, taking scroll into account
+static void VisibleRows(int *first, int *last);     // Rows at least partly on screen
+static void LoadThumbnailTexture(int entry);        // Upload a finished thumbnail
+static void SelectEntry(int entry);                 // Move the selection and scroll it into view
+static int ListedCount(void);                       // Entries once the workers listed them, 0 before
+
+//----------------------------------------------------------------------------------
+// Browser Screen Functions Definition
+//----------------------------------------------------------------------------------
+
+// Browser Screen Initialization logic
+void InitBrowserScreen(void)
+{
+    finishScreen = 0;
+    scroll = 0.0f;
+    selected = 0;
+
+    textures = NULL;
+
+    // Listing happens on the workers, a large folder or pack doesn't hold up this frame
+    if (!openThumbnailCache(&cache, browse_dir)) printf("Could not open %s\n", browse_dir);
+}
+
+// Browser Screen Update logic
+void UpdateBrowserScreen(void)
+{
+    int listing = atomic_load_explicit(&cache.listing, memory_order_acquire);
+    if ((textures == NULL) && (listing != THUMB_LISTING))
+    {
+        if (listing == THUMB_UNREADABLE) printf("Could not open %s\n", browse_dir);
+        textures = calloc((cache.count > 0)? cache.count : 1, sizeof(Texture2D));
+    }
+
+    int count = ListedCount();
+
+    columns = (GetScreenWidth()/CELL_WIDTH > 0)? GetScreenWidth()/CELL_WIDTH : 1;
+    int rows = (count + columns - 1)/columns;
+    int pageRows = (GetScreenHeight() - HEADER_HEIGHT)/CELL_HEIGHT;
+    float maxScroll = (float)(rows*CELL_HEIGHT - (GetScreenHeight() - HEADER_HEIGHT));
+    if (maxScroll < 0) maxScroll = 0;
+
+    scroll -= GetMouseWheelMove()*CELL_HEIGHT/2;
+    if (scroll > maxScroll) scroll = maxScroll;
+    if (scroll < 0) scroll = 0;
+
+    if (IsKeyPressed(KEY_BACKSPACE))
+    {
+        PlaySound(fxCoin);
+        finishScreen = 2;   // TITLE
+        return;
+    }
+    if (count == 0) return;
+
+    if (IsKeyPressed(KEY_RIGHT)) SelectEntry(selected + 1);
+    if (IsKeyPressed(KEY_LEFT)) SelectEntry(selected - 1);
+    if (IsKeyPressed(KEY_DOWN)) SelectEntry(selected + columns);
+    if (IsKeyPressed(KEY_UP)) SelectEntry(selected - columns);
+    if (IsKeyPressed(KEY_PAGE_DOWN)) SelectEntry(selected + pageRows*columns);
+    if (IsKeyPressed(KEY_PAGE_UP)) SelectEntry(selected - pageRows*columns);
+    if (IsKeyPressed(KEY_HOME)) SelectEntry(0);
+    if (IsKeyPressed(KEY_END)) SelectEntry(count - 1);
+
+    bool open = IsKeyPressed(KEY_ENTER);
+    int first, last;
+    VisibleRows(&first, &last);
+
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && (GetMousePosition().y >= HEADER_HEIGHT))
+    {
+        for (int i = first*columns; (i < (last + 1)*columns) && (i < count); i++)
+        {
+            if (CheckCollisionPointRec(GetMousePosition(), CellBounds(i)))
+            {
+                selected = i;
+                open = true;
+            }
+        }
+    }
+    if (open)
+    {
+        PlaySound(fxCoin);
+        if (CopyPath(file_name, cache.entries[selected].path)) finishScreen = 1;   // GAMEPLAY
+        return;
+    }
+
+    // Requests are served newest first, so ask from the bottom up and the
+    // top left thumbnail is made first. One row past the view is prefetched.
+    int lastRequested = (last + 2)*columns - 1;
+    if (lastRequested >= count) lastRequested = count - 1;
+    for (int i = lastRequested; i >= first*columns; i--) requestThumbnail(&cache, (uint32_t)i);
+
+    // Upload what became ready, release what scrolled out of reach
+    for (int i = 0; i < count; i++)
+    {
+        int row = i/columns;
+        bool near = (row >= first - KEEP_ROWS) && (row <= last + KEEP_ROWS);
+
+        if (near && (textures[i].id == 0) && (atomic_load_explicit(&cache.entries[i].state, memory_order_acquire) == THUMB_READY)) LoadThumbnailTexture(i);
+        else if (!near && (textures[i].id != 0))
+        {
+            UnloadTexture(textures[i]);
+            textures[i] = (Texture2D){ 0 };
+        }
+    }
+}
+
+// Browser Screen Draw logic
+void DrawBrowserScreen(void)
+{
+    ClearBackground(BLACK);
+
+    int count = ListedCount();
+    int first, last;
+    VisibleRows(&first, &last);
+
+    for (int i = first*columns; (i < (last + 1)*columns) && (i < count); i++)
+    {
+        Rectangle bounds = CellBounds(i);
+        int thumbX = (int)bounds.x + (CELL_WIDTH - VIDEO_WIDTH*THUMB_SCALE)/2;
+        int thumbY = (int)bounds.y + 6;
+        int state = atomic_load_explicit(&cache.entries[i].state, memory_order_relaxed);
+
+        if (textures[i].id != 0) DrawTextureEx(textures[i], (Vector2){ (float)thumbX, (float)thumbY }, 0, THUMB_SCALE, SKYBLUE);
+        else
+        {
+            const char *status = (state == THUMB_FAILED)? "UNREADABLE" : "...";
+            DrawRectangle(thumbX, thumbY, VIDEO_WIDTH*THUMB_SCALE, VIDEO_HEIGHT*THUMB_SCALE, (Color){ 20, 20, 20, 255 });
+            DrawText(status, thumbX + (VIDEO_WIDTH*THUMB_SCALE - MeasureText(status, 10))/2, thumbY + VIDEO_HEIGHT*THUMB_SCALE/2 - 5, 10, DARKGRAY);
+        }
+
+        const char *name = cache.entries[i].name;
+        DrawText(name, (int)bounds.x + (CELL_WIDTH - MeasureText(name, 10))/2, thumbY + VIDEO_HEIGHT*THUMB_SCALE + 6, 10, (i == selected)? YELLOW : GRAY);
+        if (i == selected) DrawRectangleLinesEx(bounds, 2, YELLOW);
+    }
+
+    // Header drawn last so scrolled cells pass under it
+    DrawRectangle(0, 0, GetScreenWidth(), HEADER_HEIGHT, BLACK);
+    if (textures == NULL) DrawText(TextFormat("%s  (LISTING...)", browse_dir), 10, 10, 20, WHITE);
+    else DrawText(TextFormat("%s  (%d ROMS)", browse_dir, count), 10, 10, 20, WHITE);
+    const char *help = "ARROWS/WHEEL TO MOVE, ENTER TO PLAY, BACKSPACE TO GO BACK";
+    DrawText(help, GetScreenWidth() - MeasureText(help, 10) - 10, 16, 10, GRAY);
+
+    if ((textures != NULL) && (count == 0)) DrawText("NO .ch8 OR .c8 FILES HERE", 10, HEADER_HEIGHT + 10, 20, GRAY);
+}
+
+// Browser Screen Unload logic
+void UnloadBrowserScreen(void)
+{
+    for (int i = 0; i < ListedCount(); i++)
+    {
+        if (textures[i].id != 0) UnloadTexture(textures[i]);
+    }
+    free(textures);
+    textures = NULL;
+    closeThumbnailCache(&cache);
+}
+
+// Browser Screen should finish?
+int FinishBrowserScreen(void)
+{
+    return finishScreen;
+}
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition (local)
+//----------------------------------------------------------------------------------
+static Rectangle CellBounds(int entry)
+{
+    float left = (GetScreenWidth() - columns*CELL_WIDTH)/2.0f;
+    float top = HEADER_HEIGHT - scroll;
+
+    return (Rectangle){ left + (entry%columns)*CELL_WIDTH + 2, top + (entry/columns)*CELL_HEIGHT + 2, CELL_WIDTH - 4, CELL_HEIGHT - 4 };
+}
+
+static void VisibleRows(int *first, int *last)
+{
+    *first = (int)(scroll/CELL_HEIGHT);
+    *last = (int)((scroll + GetScreenHeight() - HEADER_HEIGHT)/CELL_HEIGHT);
+}
+
+static void LoadThumbnailTexture(int entry)
+{
+    static uint8_t pixels[VIDEO_SIZE];
+    const uint8_t *packed = cache.entries[entry].pixels;
+
+    for (int i = 0; i < VIDEO_SIZE; i++) pixels[i] = (packed[i/8] & (0x80 >> (i%8)))? PIXEL_ON : 0;
+
+    Image image = { 0 };
+    image.data = pixels;
+    image.format = (int)PIXELFORMAT_UNCOMPRESSED_GRAYSCALE;
+    image.mipmaps = 1;
+    image.width = VIDEO_WIDTH;
+    image.height = VIDEO_HEIGHT;
+    textures[entry] = LoadTextureFromImage(image);
+}
+
+static void SelectEntry(int entry)
+{
+    if (entry < 0) entry = 0;
+    if (entry >= ListedCount()) entry = ListedCount() - 1;
+    selected = entry;
+
+    float top = (float)((selected/columns)*CELL_HEIGHT);
+    float viewHeight = (float)(GetScreenHeight() - HEADER_HEIGHT);
+    if (top < scroll) scroll = top;
+    else if (top + CELL_HEIGHT > scroll + viewHeight) scroll = top + CELL_HEIGHT - viewHeight;
+}
+
+static int ListedCount(void)
+{
+    return (textures != NULL)? (int)cache.count : 0;
+}
@@ -26,6 +26,16 @@
 #include "raylib.h"
 #include "screens.h"
 #include "emulator.h"
+#include "emu_thread.h"
+#include "debugger.h"
+#include "latency.h"
+#include "telemetry.h"
+#include "recorder.h"
+#include "shm_export.h"
+#include "spectator.h"
+#include "netplay.h"
+#include <stdio.h>
+#include <string.h>
 
 //----------------------------------------------------------------------------------
 // Module Variables Definition (local)
@@ -35,7 +45,57 @@ static int finishScreen = 0;
 Image image;
 Texture2D texture;
 Vector2 position = { 0,0 };
-struct Chip8* emulator = NULL;
+static struct EmuThread emuThread = { 0 };
+static struct ShmExport *frameExport = NULL;   // CHIPPY_SHM=/name shares every frame with other processes
+static struct Spectator *spectator = NULL;      // CHIPPY_SPECTATE=port or unix:/path streams the display to viewers
+static struct Netplay *netplay = NULL;          // CHIPPY_NETPLAY=localport:host:port plays against another instance
+static bool showPacing = false;
+static bool latencyProbe = false;   // F10, percentiles are also printed when switched off
+
+// Fast-forward: hold TAB to run uncapped, F4 toggles a fixed multiplier
+#define TURBO_MULTIPLIER 4
+#define TURBO_PRESENT_EVERY 4       // present one of every N frames while fast-forwarding
+static bool turboToggled = false;
+static unsigned int emuSpeed = 1;
+static bool skipDraw = false;
+static bool rewinding = false;      // BACKSPACE held
+
+// Debugger: F5 shows the overlay, then F6 break/continue, F7 step, F8 step over,
+// F9 toggles a breakpoint at PC and F1 opens a command prompt (see runDebugCommand)
+static bool debugVisible = false;
+static bool promptOpen = false;
+static char prompt[DEBUG_STATUS_SIZE] = { 0 };
+static const struct EmuFrame *lastFrame = NULL;
+
+// Low-power mode redraws only when the picture changed and lets the main loop sleep
+// while the guest waits for a key (see GameplayFrameChanged, GameplayWaitingForKey)
+static uint8_t shownVideo[VIDEO_SIZE] = { 0 };
+static bool textureValid = false;
+static bool frameChanged = true;
+static uint64_t keySequence = 0;    // newest frame sequence when a key event was last sent
+
+// Emulation thread counters at the previous frame, for telemetry
+static uint64_t lastBusyNs = 0;
+static uint64_t lastExecuted = 0;
+static uint64_t lastTimerTicks = 0;
+
+// Host key for each Chip-8 keypad index, shared with the tiled screen
+const int keymap[16] = {
+    KEY_X, KEY_ONE, KEY_TWO, KEY_THREE,
+    KEY_Q, KEY_W, KEY_E, KEY_A,
+    KEY_S, KEY_D, KEY_Z, KEY_C,
+    KEY_FOUR, KEY_R, KEY_F, KEY_V
+};
+
+//----------------------------------------------------------------------------------
+// Module Functions Declaration (local)
+//----------------------------------------------------------------------------------
+static void DrawPacingOverlay(void);    // Draw emulation thread jitter and speed histograms
+static void DrawLatencyOverlay(void);   // Draw input to photon latency percentiles
+static void DrawNetplayStatus(void);    // Draw peer connection and rollback counters
+static void SendDebugCommand(const char *text);     // Queue a debugger command for the emulation thread
+static void UpdateDebugger(void);       // Debugger hotkeys and command prompt
+static void DrawDebugOverlay(const struct DebugView *view);     // Draw registers, memory and disassembly
 
 //----------------------------------------------------------------------------------
 // Gameplay Screen Functions Definition
@@ -47,129 +107,152 @@ void InitGameplayScreen(void)
     //Initialize GAMEPLAY screen variables here!
     framesCounter = 0;
     finishScreen = 0;
+    turboToggled = false;
+    emuSpeed = 1;
+    skipDraw = false;
+    rewinding = false;
+    debugVisible = false;
+    promptOpen = false;
+    latencyProbe = false;
+    lastFrame = NULL;
+    textureValid = false;
+    frameChanged = true;
+    keySequence = 0;
+    lastBusyNs = 0;
+    lastExecuted = 0;
+    lastTimerTicks = 0;
 
     image.data = NULL;
-    image.format = (int)PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+    image.format = (int)PIXELFORMAT_UNCOMPRESSED_GRAYSCALE;     // one byte per Chip-8 pixel
     image.mipmaps = 1;
     image.height = VIDEO_HEIGHT;
     image.width = VIDEO_WIDTH;
 
-    emulator = createEmulator();
-    loadRom(emulator, file_name);
-    loadFonts(emulator);
-
     texture = LoadTextureFromImage(image);
+
+    // Emulation runs on its own thread from here on
+    startEmuThread(&emuThread, file_name);
+
+    const char *shmName = getenv("CHIPPY_SHM");
+    if (shmName != NULL)
+    {
+        frameExport = openShmExport(shmName);
+        if (frameExport != NULL) setEmuFrameExport(&emuThread, frameExport);
+    }
+
+    const char *spectateAddress = getenv("CHIPPY_SPECTATE");
+    if (spectateAddress != NULL)
+    {
+        spectator = openSpectator(spectateAddress);
+        if (spectator != NULL) setEmuSpectator(&emuThread, spectator);
+    }
+
+    // Both players run the same ROM, CHIPPY_NETPLAY_LATENCY=delay:jitter:loss fakes a slow link for testing
+    const char *netplaySpec = getenv("CHIPPY_NETPLAY");
+    unsigned int localPort = 0, peerPort = 0;
+    char peerHost[128] = { 0 };
+    if ((netplaySpec != NULL) && (sscanf(netplaySpec, "%u:%127[^:]:%u", &localPort, peerHost, &peerPort) == 3))
+    {
+        netplay = openNetplay((uint16_t)localPort, peerHost, (uint16_t)peerPort);
+        if (netplay != NULL)
+        {
+            parseNetplayLatency(netplay, getenv("CHIPPY_NETPLAY_LATENCY"));
+            setEmuNetplay(&emuThread, netplay);
+        }
+    }
 }
 
 // Gameplay Screen Update logic
 void UpdateGameplayScreen(void)
 {
     // Update GAMEPLAY screen variables here!
-    
-    // Update if Key pressed
-    switch (GetKeyPressed()) {
-    case KEY_X:
-        emulator->keypad[0x0] = 1;
-        break;
-    case KEY_ONE:
-        emulator->keypad[0x1] = 1;
-        break;
-    case KEY_TWO:
-        emulator->keypad[0x2] = 1;
-        break;
-    case KEY_THREE:
-        emulator->keypad[0x3] = 1;
-        break;
-    case KEY_Q:
-        emulator->keypad[0x4] = 1;
-        break;
-    case KEY_W:
-        emulator->keypad[0x5] = 1;
-        break;
-    case KEY_E:
-        emulator->keypad[0x6] = 1;
-        break;
-    case KEY_A:
-        emulator->keypad[0x7] = 1;
-        break;
-    case KEY_S:
-        emulator->keypad[0x8] = 1;
-        break;
-    case KEY_D:
-        emulator->keypad[0x9] = 1;
-        break;
-    case KEY_Z:
-        emulator->keypad[0xA] = 1;
-        break;
-    case KEY_C:
-        emulator->keypad[0xB] = 1;
-        break;
-    case KEY_FOUR:
-        emulator->keypad[0xC] = 1;
-        break;
-    case KEY_R:
-        emulator->keypad[0xD] = 1;
-        break;
-    case KEY_F:
-        emulator->keypad[0xE] = 1;
-        break;
-    case KEY_V:
-        emulator->keypad[0xF] = 1;
-        break;
-    default:
-        break;
-    }
-
-    // Update if key released
-    if (IsKeyReleased(KEY_X))
-        emulator->keypad[0x0] = 0;
-    else if (IsKeyReleased(KEY_ONE))
-        emulator->keypad[0x1] = 0;
-    else if (IsKeyReleased(KEY_TWO))
-        emulator->keypad[0x2] = 0;
-    else if (IsKeyReleased(KEY_THREE))
-        emulator->keypad[0x3] = 0;
-    else if (IsKeyReleased(KEY_Q))
-        emulator->keypad[0x4] = 0;
-    else if (IsKeyReleased(KEY_W))
-        emulator->keypad[0x5] = 0;
-    else if (IsKeyReleased(KEY_E))
-        emulator->keypad[0x6] = 0;
-    else if (IsKeyReleased(KEY_A))
-        emulator->keypad[0x7] = 0;
-    else if (IsKeyReleased(KEY_S))
-        emulator->keypad[0x8] = 0;
-    else if (IsKeyReleased(KEY_D))
-        emulator->keypad[0x9] = 0;
-    else if (IsKeyReleased(KEY_Z))
-        emulator->keypad[0xA] = 0;
-    else if (IsKeyReleased(KEY_C))
-        emulator->keypad[0xB] = 0;
-    else if (IsKeyReleased(KEY_FOUR))
-        emulator->keypad[0xC] = 0;
-    else if (IsKeyReleased(KEY_R))
-        emulator->keypad[0xD] = 0;
-    else if (IsKeyReleased(KEY_F))
-        emulator->keypad[0xE] = 0;
-    else if (IsKeyReleased(KEY_V))
-        emulator->keypad[0xF] = 0;
-
-    // Click to switch to title
-    if (IsKeyPressed(KEY_ENTER))
-    {
-        PlaySound(fxCoin);
-        finishScreen = 1; // TITLE
-    }
-
-    // Sound
-    if (emulator->soundTimer > 0)
-        PlaySound(fxBeep);
-
-    // Fetch-Decode-Execute
-    Cycle(emulator);
-
-    // Turns the video memory into a displayable texture
-    UpdateTexture(texture, emulator->video);
+    UpdateDebugger();
+
+    // Keys go to the debugger prompt while it is open
+    if (!promptOpen)
+    {
+        // Forward key presses and releases to the emulation thread
+        uint64_t now = pacerNowNs();
+        for (int i = 0; i < 16; i++)
+        {
+            if (IsKeyPressed(keymap[i])) pushEmuCommand(&emuThread, (struct EmuCommand){ .type = EMU_CMD_KEY_DOWN, .key = (uint8_t)i, .time = now });
+            if (IsKeyReleased(keymap[i])) pushEmuCommand(&emuThread, (struct EmuCommand){ .type = EMU_CMD_KEY_UP, .key = (uint8_t)i });
+            if (IsKeyPressed(keymap[i]) || IsKeyReleased(keymap[i])) keySequence = (lastFrame != NULL)? lastFrame->sequence : 0;
+        }
+
+        // Click to switch to title
+        if (IsKeyPressed(KEY_ENTER))
+        {
+            PlaySound(fxCoin);
+            finishScreen = 1; // TITLE
+        }
+
+        // Hold to step back through history, not while the peer shares it
+        if ((netplay == NULL) && IsKeyPressed(KEY_BACKSPACE) && pushEmuCommand(&emuThread, (struct EmuCommand){ .type = EMU_CMD_REWIND, .value = 1 })) rewinding = true;
+    }
+    if (IsKeyReleased(KEY_BACKSPACE) && rewinding && pushEmuCommand(&emuThread, (struct EmuCommand){ .type = EMU_CMD_REWIND, .value = 0 })) rewinding = false;
+
+    // Toggle frame pacing overlay
+    if (IsKeyPressed(KEY_F3)) showPacing = !showPacing;
+
+    // Toggle input latency probe
+    if (IsKeyPressed(KEY_F10))
+    {
+        latencyProbe = !latencyProbe;
+        atomic_store(&emuThread.latency.enabled, latencyProbe);
+
+        if (!latencyProbe)
+        {
+            struct LatencyReport report;
+            readLatencyReport(&emuThread.latency, &report);
+            logLatencyReport(stdout, &report);
+        }
+    }
+
+    // Fast-forward
+    if (IsKeyPressed(KEY_F4)) turboToggled = !turboToggled;
+
+    unsigned int speed = IsKeyDown(KEY_TAB)? EMU_SPEED_UNCAPPED : (turboToggled? TURBO_MULTIPLIER : 1);
+    if (speed != emuSpeed && pushEmuCommand(&emuThread, (struct EmuCommand){ .type = EMU_CMD_SET_SPEED, .value = (uint16_t)speed })) emuSpeed = speed;
+
+    // Emulation work done since the previous frame
+    uint64_t busyNs = atomic_load_explicit(&emuThread.busyNs, memory_order_relaxed);
+    uint64_t executed = atomic_load_explicit(&emuThread.executed, memory_order_relaxed);
+    uint64_t timerTicks = atomic_load_explicit(&emuThread.timerTicks, memory_order_relaxed);
+    addTelemetryTime(&telemetry, TELEMETRY_EMULATION, busyNs - lastBusyNs);
+    addTelemetryCounters(&telemetry, (uint32_t)(executed - lastExecuted), (uint32_t)(timerTicks - lastTimerTicks));
+    lastBusyNs = busyNs;
+    lastExecuted = executed;
+    lastTimerTicks = timerTicks;
+
+    bool fastForward = (emuSpeed != 1);
+    framesCounter++;
+    skipDraw = fastForward && (framesCounter%TURBO_PRESENT_EVERY != 0);
+    if (skipDraw) return;
+
+    // Only the latest completed frame is consumed, older ones are skipped
+    const struct EmuFrame *frame = acquireEmuFrame(&emuThread);
+    if (frame != NULL)
+    {
+        lastFrame = frame;
+
+        // Sound, muted while fast-forwarding
+        if (frame->soundTimer > 0 && !fastForward)
+            PlaySound(fxBeep);
+
+        // Turns the video memory into a displayable texture, most frames repeat the last one
+        if (!textureValid || (memcmp(shownVideo, frame->video, VIDEO_SIZE) != 0))
+        {
+            memcpy(shownVideo, frame->video, VIDEO_SIZE);
+            textureValid = true;
+            frameChanged = true;
+
+            markTelemetry(&telemetry, TELEMETRY_INPUT);
+            UpdateTexture(texture, frame->video);
+            markTelemetry(&telemetry, TELEMETRY_UPLOAD);
+            recordFrame(&recorder, frame->video, pacerNowNs());
+        }
+    }
 }
 
 // Gameplay Screen Draw logic
@@ -178,18 +261,257 @@ void DrawGameplayScreen(void)
     // Draw GAMEPLAY screen here!
     ClearBackground(BLACK);
     DrawTextureEx(texture, position, 0, 10, SKYBLUE);
+
+    if (rewinding) DrawText("<< REWIND", 10, 330, 20, SKYBLUE);
+    if (netplay != NULL) DrawNetplayStatus();
+
+    if (debugVisible && (lastFrame != NULL) && lastFrame->debug.visible) DrawDebugOverlay(&lastFrame->debug);
+    else
+    {
+        if (showPacing) DrawPacingOverlay();
+        if (latencyProbe) DrawLatencyOverlay();
+    }
 }
 
 // Gameplay Screen Unload logic
 void UnloadGameplayScreen(void)
 {
     // Unload GAMEPLAY screen variables here!
+    stopEmuThread(&emuThread);
+    closeShmExport(frameExport);
+    frameExport = NULL;
+    closeSpectator(spectator);
+    spectator = NULL;
+
+    if (netplay != NULL)
+    {
+        struct NetplayStats stats;
+        readNetplayStats(netplay, &stats);
+        logNetplayStats(stdout, &stats);
+        closeNetplay(netplay);
+        netplay = NULL;
+    }
     UnloadTexture(texture);
-    free(emulator);
 }
 
 // Gameplay Screen should finish?
 int FinishGameplayScreen(void)
 {
     return finishScreen;
-}
\ No newline at end of file
+}
+
+// Gameplay Screen skips drawing this frame? (fast-forward)
+int SkipGameplayDraw(void)
+{
+    return skipDraw;
+}
+
+// Gameplay Screen frame is on screen (called after EndDrawing)
+void GameplayFramePresented(void)
+{
+    frameChanged = false;
+    if (latencyProbe && (lastFrame != NULL)) presentLatency(&emuThread.latency, lastFrame->sequence);
+}
+
+// Gameplay Screen shows something new? (low-power mode skips the redraw otherwise)
+int GameplayFrameChanged(void)
+{
+    // Overlays show live numbers
+    return frameChanged || (netplay != NULL) || rewinding || promptOpen || showPacing || latencyProbe || (debugVisible && (lastFrame != NULL) && lastFrame->debug.visible);
+}
+
+// Gameplay Screen only changes on input? (guest blocked in FX0A)
+int GameplayWaitingForKey(void)
+{
+    if ((lastFrame == NULL) || !lastFrame->waitingKey || (lastFrame->soundTimer > 0) || (netplay != NULL)) return 0;
+    if ((emuSpeed != 1) || rewinding || promptOpen || debugVisible || showPacing || latencyProbe) return 0;
+
+    // A key event sent after frame n is only certain to be seen by frame n + 2
+    return lastFrame->sequence >= keySequence + 2;
+}
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition (local)
+//----------------------------------------------------------------------------------
+static void DrawPacingOverlay(void)
+{
+    struct PacerStats stats;
+    readPacerStats(&emuThread.pacer, &stats);
+
+    uint32_t total = 0;
+    for (int i = 0; i < PACER_JITTER_BUCKETS; i++) total += stats.jitter[i];
+    if (total == 0) total = 1;
+
+    int x = 650, y = 10;
+    DrawRectangle(x - 5, y - 5, 150, 16*PACER_JITTER_BUCKETS + 74, Fade(BLACK, 0.7f));
+    DrawText("JITTER (us)", x, y, 10, WHITE);
+    y += 14;
+
+    for (int i = 0; i < PACER_JITTER_BUCKETS; i++)
+    {
+        int width = (int)(90.0f*stats.jitter[i]/total);
+        const char *label = (i < PACER_JITTER_BUCKETS - 1)? TextFormat("<%u", pacerJitterBoundsUs[i]) : TextFormat(">=%u", pacerJitterBoundsUs[i - 1]);
+
+        DrawText(label, x, y, 10, LIGHTGRAY);
+        DrawRectangle(x + 45, y + 1, width, 8, (i < 6)? LIME : ORANGE);
+        y += 16;
+    }
+
+    DrawText(TextFormat("speed %+d ppm", stats.lastSpeedErrorPpm), x, y, 10, WHITE);
+    DrawText(TextFormat("max %u us  spin %u us", stats.maxJitterUs, stats.spinUs), x, y + 14, 10, WHITE);
+    DrawText(TextFormat("dropped %u", stats.droppedTicks), x, y + 28, 10, WHITE);
+    DrawText(TextFormat("rate %u per tick", atomic_load_explicit(&emuThread.cyclesPerTick, memory_order_relaxed)), x, y + 42, 10, WHITE);
+}
+
+static void DrawLatencyOverlay(void)
+{
+    struct LatencyReport report;
+    readLatencyReport(&emuThread.latency, &report);
+
+    int x = 650, y = 254;
+    DrawRectangle(x - 5, y - 5, 150, 14*LATENCY_STAGES + 24, Fade(BLACK, 0.7f));
+    DrawText(TextFormat("LATENCY (us) n=%u", report.count), x, y, 10, WHITE);
+    y += 14;
+
+    // Stages in path order, total last
+    for (int i = 1; i <= LATENCY_STAGES; i++)
+    {
+        int stage = i%LATENCY_STAGES;
+        DrawText(TextFormat("%-7s %6u %6u", latencyStageNames[stage], report.p50[stage], report.p99[stage]), x, y, 10, (stage == LATENCY_HOST)? YELLOW : LIGHTGRAY);
+        y += 14;
+    }
+    DrawText(TextFormat("p50 / p99  dropped %u", report.dropped), x, y, 10, GRAY);
+}
+
+static void DrawNetplayStatus(void)
+{
+    struct NetplayStats stats;
+    readNetplayStats(netplay, &stats);
+
+    if (!stats.connected)
+    {
+        DrawText("NETPLAY: WAITING FOR PEER", 10, 360, 20, YELLOW);
+        return;
+    }
+
+    uint32_t ahead = stats.frame - ((stats.confirmed < stats.frame)? stats.confirmed : stats.frame);
+    DrawText(TextFormat("NETPLAY frame %u  predicted %u  rollbacks %u (max %u)  stalls %u", stats.frame, ahead, stats.rollbacks, stats.maxDepth, stats.stalls), 10, 360, 10, GRAY);
+}
+
+static void SendDebugCommand(const char *text)
+{
+    struct EmuCommand command = { .type = EMU_CMD_DEBUG };
+
+    strncpy(command.path, text, EMU_PATH_SIZE - 1);
+    pushEmuCommand(&emuThread, command);
+}
+
+static void UpdateDebugger(void)
+{
+    if (promptOpen)
+    {
+        size_t length = strlen(prompt);
+
+        for (int ch = GetCharPressed(); ch > 0; ch = GetCharPressed())
+        {
+            if ((ch >= 32) && (ch < 127) && (length < DEBUG_STATUS_SIZE - 1))
+            {
+                prompt[length++] = (char)ch;
+                prompt[length] = '\0';
+            }
+        }
+
+        if (IsKeyPressed(KEY_BACKSPACE) && (length > 0)) prompt[length - 1] = '\0';
+        if (IsKeyPressed(KEY_ENTER))
+        {
+            if (length > 0) SendDebugCommand(prompt);
+            promptOpen = false;
+        }
+        if (IsKeyPressed(KEY_F1)) promptOpen = false;
+        return;
+    }
+
+    if (IsKeyPressed(KEY_F5))
+    {
+        debugVisible = !debugVisible;
+        SendDebugCommand(debugVisible? "show" : "hide");
+    }
+    if (!debugVisible) return;
+
+    const struct DebugView *view = ((lastFrame != NULL) && lastFrame->debug.visible)? &lastFrame->debug : NULL;
+
+    if (IsKeyPressed(KEY_F1))
+    {
+        // Release everything so no key stays held while typing
+        for (int i = 0; i < 16; i++) pushEmuCommand(&emuThread, (struct EmuCommand){ .type = EMU_CMD_KEY_UP, .key = (uint8_t)i });
+        while (GetCharPressed() > 0) { }
+        prompt[0] = '\0';
+        promptOpen = true;
+    }
+    if (IsKeyPressed(KEY_F6)) SendDebugCommand(((view != NULL) && view->paused)? "continue" : "break");
+    if (IsKeyPressed(KEY_F7)) SendDebugCommand("step");
+    if (IsKeyPressed(KEY_F8)) SendDebugCommand("next");
+    if (IsKeyPressed(KEY_F9) && (view != NULL))
+    {
+        uint16_t pc = view->PC & (DEBUG_MEMORY_SIZE - 1);
+        bool set = view->breakpoints[pc >> 3] & (1 << (pc & 7));
+
+        SendDebugCommand(TextFormat("%s %03X", set? "d" : "b", pc));
+    }
+}
+
+static void DrawDebugOverlay(const struct DebugView *view)
+{
+    char text[32];
+
+    // Registers
+    int x = 650, y = 10;
+    DrawRectangle(x - 5, y - 5, 150, 310, Fade(BLACK, 0.7f));
+    for (int i = 0; i < 16; i++)
+    {
+        DrawText(TextFormat("V%X %02X", i, view->registers[i]), x + (i%2)*70, y + (i/2)*14, 10, WHITE);
+    }
+    y += 8*14 + 6;
+    DrawText(TextFormat("PC %03X  I %03X", view->PC, view->index), x, y, 10, SKYBLUE);
+    DrawText(TextFormat("DT %02X  ST %02X  SP %X", view->delayTimer, view->soundTimer, view->SP), x, y + 14, 10, SKYBLUE);
+    y += 34;
+    DrawText("STACK", x, y, 10, LIGHTGRAY);
+    for (int i = 0; (i < view->SP) && (i < 16); i++)
+    {
+        DrawText(TextFormat("%03X", view->stack[i]), x + (i%4)*35, y + 14 + (i/4)*14, 10, WHITE);
+    }
+
+    // Disassembly around PC
+    x = 10; y = 325;
+    DrawRectangle(0, 320, GetScreenWidth(), GetScreenHeight() - 320, Fade(BLACK, 0.7f));
+    for (int i = -3; i < 5; i++)
+    {
+        uint16_t address = (view->PC + i*2) & (DEBUG_MEMORY_SIZE - 1);
+        uint16_t opcode = (view->memory[address] << 8) | view->memory[(address + 1) & (DEBUG_MEMORY_SIZE - 1)];
+        bool breakpoint = view->breakpoints[address >> 3] & (1 << (address & 7));
+
+        Disassemble(opcode, text, sizeof(text));
+        DrawText(TextFormat("%c%c %03X  %04X  %s", breakpoint? '*' : ' ', (i == 0)? '>' : ' ', address, opcode, text), x, y, 10, (i == 0)? YELLOW : WHITE);
+        y += 14;
+    }
+
+    // Memory at I
+    x = 250; y = 325;
+    uint16_t base = view->index & 0xFF0;
+    for (int row = 0; row < 4; row++)
+    {
+        uint16_t address = (base + row*16) & (DEBUG_MEMORY_SIZE - 1);
+        DrawText(TextFormat("%03X", address), x, y, 10, LIGHTGRAY);
+        for (int col = 0; col < 16; col++)
+        {
+            uint16_t cell = (address + col) & (DEBUG_MEMORY_SIZE - 1);
+            DrawText(TextFormat("%02X", view->memory[cell]), x + 30 + col*18, y, 10, (cell == view->index)? YELLOW : WHITE);
+        }
+        y += 14;
+    }
+
+    // Status and prompt
+    DrawText(view->status, 250, 395, 10, view->paused? ORANGE : LIME);
+    if (promptOpen) DrawText(TextFormat("> %s_", prompt), 250, 415, 10, YELLOW);
+    else DrawText("F1 cmd  F6 run/break  F7 step  F8 over  F9 bp", 250, 415, 10, GRAY);
+}
@@ -0,0 +1,217 @@
+/**********************************************************************************************
+*
+*   raylib - Advance Game template
+*
+*   Tiled Screen Functions Definitions (Init, Update, Draw, Unload)
+*
+*   Copyright (c) 2014-2022 Ramon Santamaria (@raysan5)
+*
+*   This software is provided "as-is", without any express or implied warranty. In no event
+*   will the authors be held liable for any damages arising from the use of this software.
+*
+*   Permission is granted to anyone to use this software for any purpose, including commercial
+*   applications, and to alter it and redistribute it freely, subject to the following restrictions:
+*
+*     1. The origin of this software must not be misrepresented; you must not claim that you
+*     wrote the original software. If you use this software in a product, an acknowledgment
+*     in the product documentation would be appreciated but is not required.
+*
+*     2. Altered source versions must be plainly marked as such, and must not be misrepresented
+*     as being the original software.
+*
+*     3. This notice may not be removed or altered from any source distribution.
+*
+**********************************************************************************************/
+
+#include "raylib.h"
+#include "screens.h"
+#include "emulator.h"
+#include "emu_thread.h"
+#include "telemetry.h"
+#include <math.h>
+#include <string.h>
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static int finishScreen = 0;
+
+// Every instance runs on its own emulation thread, frames are copied into one atlas
+// image so the GPU sees a single texture upload per frame however many tiles there are
+static struct EmuThread tiles[MAX_TILED_ROMS] = { 0 };
+static int tileCount = 0;
+static int tileColumns = 1;
+static int tileRows = 1;
+static int focused = 0;             // tile receiving keypad input, click or LEFT/RIGHT to change
+static uint8_t atlas[MAX_TILED_ROMS*VIDEO_SIZE] = { 0 };
+static Texture2D atlasTexture;
+
+// Emulation thread counters summed over all tiles at the previous frame, for telemetry
+static uint64_t lastBusyNs = 0;
+static uint64_t lastExecuted = 0;
+static uint64_t lastTimerTicks = 0;
+
+//----------------------------------------------------------------------------------
+// Module Functions Declaration (local)
+//----------------------------------------------------------------------------------
+static Rectangle TileBounds(int tile);      // Where a tile is drawn in the window
+static void FocusTile(int tile);            // Move keypad input to another tile
+static void UpdateTileTelemetry(void);      // Add emulation work of every tile to the frame telemetry
+
+//----------------------------------------------------------------------------------
+// Tiled Screen Functions Definition
+//----------------------------------------------------------------------------------
+
+// Tiled Screen Initialization logic
+void InitTiledScreen(void)
+{
+    finishScreen = 0;
+    focused = 0;
+    lastBusyNs = 0;
+    lastExecuted = 0;
+    lastTimerTicks = 0;
+
+    tileCount = (tiled_count < MAX_TILED_ROMS)? tiled_count : MAX_TILED_ROMS;
+    tileColumns = (int)ceilf(sqrtf((float)tileCount));
+    tileRows = (tileCount + tileColumns - 1)/tileColumns;
+    memset(atlas, 0, sizeof(atlas));
+
+    Image image = { 0 };
+    image.data = NULL;
+    image.format = (int)PIXELFORMAT_UNCOMPRESSED_GRAYSCALE;
+    image.mipmaps = 1;
+    image.width = tileColumns*VIDEO_WIDTH;
+    image.height = tileRows*VIDEO_HEIGHT;
+    atlasTexture = LoadTextureFromImage(image);
+
+    for (int i = 0; i < tileCount; i++)
+    {
+        startEmuThread(&tiles[i], tiled_files[i]);
+        if (tiled_speeds[i] != 1) pushEmuCommand(&tiles[i], (struct EmuCommand){ .type = EMU_CMD_SET_SPEED, .value = (uint16_t)tiled_speeds[i] });
+    }
+}
+
+// Tiled Screen Update logic
+void UpdateTiledScreen(void)
+{
+    // Focus follows clicks and the arrow keys
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
+    {
+        for (int i = 0; i < tileCount; i++)
+        {
+            if (CheckCollisionPointRec(GetMousePosition(), TileBounds(i))) FocusTile(i);
+        }
+    }
+    if (IsKeyPressed(KEY_RIGHT)) FocusTile((focused + 1)%tileCount);
+    if (IsKeyPressed(KEY_LEFT)) FocusTile((focused + tileCount - 1)%tileCount);
+
+    // Keypad goes to the focused tile only
+    uint64_t now = pacerNowNs();
+    for (int i = 0; i < 16; i++)
+    {
+        if (IsKeyPressed(keymap[i])) pushEmuCommand(&tiles[focused], (struct EmuCommand){ .type = EMU_CMD_KEY_DOWN, .key = (uint8_t)i, .time = now });
+        if (IsKeyReleased(keymap[i])) pushEmuCommand(&tiles[focused], (struct EmuCommand){ .type = EMU_CMD_KEY_UP, .key = (uint8_t)i });
+    }
+
+    if (IsKeyPressed(KEY_ENTER))
+    {
+        PlaySound(fxCoin);
+        finishScreen = 1; // TITLE
+    }
+
+    UpdateTileTelemetry();
+
+    // Copy every new frame into its cell of the atlas
+    bool dirty = false;
+    int atlasWidth = tileColumns*VIDEO_WIDTH;
+    for (int i = 0; i < tileCount; i++)
+    {
+        const struct EmuFrame *frame = acquireEmuFrame(&tiles[i]);
+        if (frame == NULL) continue;
+
+        uint8_t *cell = atlas + (i/tileColumns)*VIDEO_HEIGHT*atlasWidth + (i%tileColumns)*VIDEO_WIDTH;
+        for (int y = 0; y < VIDEO_HEIGHT; y++) memcpy(cell + y*atlasWidth, frame->video + y*VIDEO_WIDTH, VIDEO_WIDTH);
+        dirty = true;
+
+        if ((i == focused) && (frame->soundTimer > 0)) PlaySound(fxBeep);
+    }
+
+    // One upload for all tiles
+    if (dirty)
+    {
+        markTelemetry(&telemetry, TELEMETRY_INPUT);
+        UpdateTexture(atlasTexture, atlas);
+        markTelemetry(&telemetry, TELEMETRY_UPLOAD);
+    }
+}
+
+// Tiled Screen Draw logic
+void DrawTiledScreen(void)
+{
+    ClearBackground(BLACK);
+
+    for (int i = 0; i < tileCount; i++)
+    {
+        Rectangle source = { (float)((i%tileColumns)*VIDEO_WIDTH), (float)((i/tileColumns)*VIDEO_HEIGHT), VIDEO_WIDTH, VIDEO_HEIGHT };
+        Rectangle bounds = TileBounds(i);
+        const char *speed = (tiled_speeds[i] == EMU_SPEED_UNCAPPED)? "max" : TextFormat("x%d", tiled_speeds[i]);
+
+        DrawTexturePro(atlasTexture, source, bounds, (Vector2){ 0, 0 }, 0, SKYBLUE);
+        DrawText(TextFormat("%s %s", GetFileName(tiled_files[i]), speed), (int)bounds.x + 4, (int)(bounds.y + bounds.height) - 12, 10, (i == focused)? YELLOW : GRAY);
+        if (i == focused) DrawRectangleLinesEx(bounds, 2, YELLOW);
+    }
+}
+
+// Tiled Screen Unload logic
+void UnloadTiledScreen(void)
+{
+    for (int i = 0; i < tileCount; i++) stopEmuThread(&tiles[i]);
+    UnloadTexture(atlasTexture);
+}
+
+// Tiled Screen should finish?
+int FinishTiledScreen(void)
+{
+    return finishScreen;
+}
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition (local)
+//----------------------------------------------------------------------------------
+static Rectangle TileBounds(int tile)
+{
+    // Largest scale at which the whole grid fits, centered
+    float scale = fminf((float)GetScreenWidth()/(tileColumns*VIDEO_WIDTH), (float)GetScreenHeight()/(tileRows*VIDEO_HEIGHT));
+    float width = VIDEO_WIDTH*scale, height = VIDEO_HEIGHT*scale;
+    float left = (GetScreenWidth() - width*tileColumns)/2.0f;
+    float top = (GetScreenHeight() - height*tileRows)/2.0f;
+
+    return (Rectangle){ left + (tile%tileColumns)*width + 1, top + (tile/tileColumns)*height + 1, width - 2, height - 2 };
+}
+
+static void FocusTile(int tile)
+{
+    if (tile == focused) return;
+
+    // Nothing stays held on the tile losing focus
+    for (int i = 0; i < 16; i++) pushEmuCommand(&tiles[focused], (struct EmuCommand){ .type = EMU_CMD_KEY_UP, .key = (uint8_t)i });
+    focused = tile;
+}
+
+static void UpdateTileTelemetry(void)
+{
+    uint64_t busyNs = 0, executed = 0, timerTicks = 0;
+
+    for (int i = 0; i < tileCount; i++)
+    {
+        busyNs += atomic_load_explicit(&tiles[i].busyNs, memory_order_relaxed);
+        executed += atomic_load_explicit(&tiles[i].executed, memory_order_relaxed);
+        timerTicks += atomic_load_explicit(&tiles[i].timerTicks, memory_order_relaxed);
+    }
+
+    addTelemetryTime(&telemetry, TELEMETRY_EMULATION, busyNs - lastBusyNs);
+    addTelemetryCounters(&telemetry, (uint32_t)(executed - lastExecuted), (uint32_t)(timerTicks - lastTimerTicks));
+    lastBusyNs = busyNs;
+    lastExecuted = executed;
+    lastTimerTicks = timerTicks;
+}
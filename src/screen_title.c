@@ -45,7 +45,13 @@ bool btnAction;
 Vector2 mousePoint;
 
 // File loading
-char file_name[250];
+char file_name[MAX_PATH_LENGTH];
+char tiled_files[MAX_TILED_ROMS][MAX_PATH_LENGTH];
+int tiled_speeds[MAX_TILED_ROMS];
+int tiled_count;
+char browse_dir[MAX_PATH_LENGTH];
+
+#define SPEED_LADDER 4      // T tiles the dropped ROM at x1 up to this speed
 
 //----------------------------------------------------------------------------------
 // Title Screen Functions Definition
@@ -58,6 +64,7 @@ void InitTitleScreen(void)
     framesCounter = 0;
     finishScreen = 0;
     file_name[0] = '\0';
+    tiled_count = 0;
 
     // Button variables
     showButton = false;
@@ -76,14 +83,37 @@ void UpdateTitleScreen(void)
     /* Getting ROM PATH when dragged onto window */
     if (IsFileDropped()) {
         FilePathList droppedFiles = LoadDroppedFiles();
-        showButton = true;
+
+        // A dropped folder or zip pack is opened in the browser
+        if (DirectoryExists(droppedFiles.paths[0]) || IsFileExtension(droppedFiles.paths[0], ".zip")) {
+            PlaySound(fxCoin);
+            if (CopyPath(browse_dir, droppedFiles.paths[0])) finishScreen = 3;   // BROWSER
+        }
 
         char tmp[200] = { 0 };
-        TextCopy(file_name, droppedFiles.paths[0]);
-        printf("%s\n", file_name);
+        if (CopyPath(file_name, droppedFiles.paths[0])) {
+            printf("%s\n", file_name);
+            showButton = true;
+        }
+
+        // Several ROMs dropped at once are shown side by side
+        tiled_count = 0;
+        for (unsigned int i = 0; (i < droppedFiles.count) && (tiled_count < MAX_TILED_ROMS); i++) {
+            if (CopyPath(tiled_files[tiled_count], droppedFiles.paths[i])) tiled_speeds[tiled_count++] = 1;
+        }
         UnloadDroppedFiles(droppedFiles);
     }
 
+    /* Same ROM at increasing speeds */
+    if (showButton && IsKeyPressed(KEY_T)) {
+        PlaySound(fxCoin);
+        for (tiled_count = 0; tiled_count < SPEED_LADDER; tiled_count++) {
+            TextCopy(tiled_files[tiled_count], file_name);
+            tiled_speeds[tiled_count] = tiled_count + 1;
+        }
+        finishScreen = 2;   // TILED
+    }
+
     /* Button Press */
     if (showButton) {
         mousePoint = GetMousePosition();
@@ -101,13 +131,20 @@ void UpdateTitleScreen(void)
         // Press button to change to GAMEPLAY screen
         if (btnAction) {
             PlaySound(fxCoin);
-            finishScreen = 1;   // GAMEPLAY
+            finishScreen = (tiled_count > 1)? 2 : 1;   // TILED or GAMEPLAY
         }
 
         // Calculate button frame rectangle to draw depending on button state
         sourceRec.y = btnState * frameHeight;
     }
 
+    /* Browse the bundled ROMs */
+    if (IsKeyPressed(KEY_B)) {
+        PlaySound(fxCoin);
+        TextCopy(browse_dir, "../resources/roms");
+        finishScreen = 3;   // BROWSER
+    }
+
     /* Load Default ROM*/
     if (IsKeyPressed(KEY_ENTER)) {
         PlaySound(fxCoin);
@@ -128,9 +165,14 @@ void DrawTitleScreen(void)
     ClearBackground(BLACK);
     DrawTextEx(font, "CHIP-8 EMULATOR", pos, font.baseSize*4.0f, 4, WHITE);
     DrawText("DROP A .ch8 ROM INTO THIS WINDOW!", dropRomWidth, GetScreenHeight()/2 - 30, 30, SKYBLUE);
+    DrawText("OR A FOLDER OR .zip PACK, PRESS B TO BROWSE THE BUNDLED ROMS", GetScreenWidth()/2 - MeasureText("OR A FOLDER OR .zip PACK, PRESS B TO BROWSE THE BUNDLED ROMS", 20)/2, GetScreenHeight()/2 + 40, 20, DARKGRAY);
 
-    if (showButton)
+    if (showButton) {
         DrawTextureRec(button, sourceRec, (Vector2){ btnBounds.x, btnBounds.y }, WHITE);
+
+        const char *hint = (tiled_count > 1)? TextFormat("%d ROMS WILL RUN SIDE BY SIDE", tiled_count) : "PRESS T TO COMPARE SPEEDS SIDE BY SIDE";
+        DrawText(hint, GetScreenWidth()/2 - MeasureText(hint, 20)/2, GetScreenHeight()/2 + 10, 20, GRAY);
+    }
 }
 
 // Title Screen Unload logic
@@ -144,4 +186,15 @@ void UnloadTitleScreen(void)
 int FinishTitleScreen(void)
 {
     return finishScreen;
-}
\ No newline at end of file
+}
+// Copy a path into a MAX_PATH_LENGTH buffer, one that doesn't fit is rejected rather than cut short
+bool CopyPath(char *dst, const char *src)
+{
+    if (TextLength(src) >= MAX_PATH_LENGTH) {
+        printf("Path too long: %s\n", src);
+        return false;
+    }
+
+    TextCopy(dst, src);
+    return true;
+}
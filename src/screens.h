@@ -29,7 +29,10 @@
 //----------------------------------------------------------------------------------
 // Types and Structures Definition
 //----------------------------------------------------------------------------------
-typedef enum GameScreen { UNKNOWN = -1, LOGO = 0, TITLE, OPTIONS, GAMEPLAY, ENDING } GameScreen;
+typedef enum GameScreen { UNKNOWN = -1, LOGO = 0, TITLE, OPTIONS, GAMEPLAY, ENDING, TILED, BROWSER } GameScreen;
+
+#define MAX_TILED_ROMS 16
+#define MAX_PATH_LENGTH 512     // ROM and folder path buffers, THUMB_PATH_SIZE and EMU_PATH_SIZE fit
 
 //----------------------------------------------------------------------------------
 // Global Variables Declaration (shared by several modules)
@@ -40,6 +43,13 @@ extern Music music;
 extern Sound fxCoin;
 extern Sound fxBeep;
 extern char file_name[];	// global string to keep path of file
+extern char tiled_files[MAX_TILED_ROMS][MAX_PATH_LENGTH];	// ROMs shown side by side on the tiled screen
+extern int tiled_speeds[MAX_TILED_ROMS];		// speed of each tile, see EMU_CMD_SET_SPEED
+extern int tiled_count;
+extern char browse_dir[];	// directory listed by the browser screen
+extern const int keymap[16];	// host key for each Chip-8 keypad index
+extern struct Telemetry telemetry;	// per-frame host telemetry, see telemetry.h
+extern struct Recorder recorder;	// video capture of the gameplay screen, see recorder.h
 
 #ifdef __cplusplus
 extern "C" {            // Prevents name mangling of functions
@@ -62,6 +72,7 @@ void UpdateTitleScreen(void);
 void DrawTitleScreen(void);
 void UnloadTitleScreen(void);
 int FinishTitleScreen(void);
+bool CopyPath(char *dst, const char *src);  // Bounded copy into a MAX_PATH_LENGTH buffer, longer paths are rejected
 
 //----------------------------------------------------------------------------------
 // Options Screen Functions Declaration
@@ -80,6 +91,28 @@ void UpdateGameplayScreen(void);
 void DrawGameplayScreen(void);
 void UnloadGameplayScreen(void);
 int FinishGameplayScreen(void);
+int SkipGameplayDraw(void);
+void GameplayFramePresented(void);
+int GameplayFrameChanged(void);
+int GameplayWaitingForKey(void);
+
+//----------------------------------------------------------------------------------
+// Tiled Screen Functions Declaration
+//----------------------------------------------------------------------------------
+void InitTiledScreen(void);
+void UpdateTiledScreen(void);
+void DrawTiledScreen(void);
+void UnloadTiledScreen(void);
+int FinishTiledScreen(void);
+
+//----------------------------------------------------------------------------------
+// Browser Screen Functions Declaration
+//----------------------------------------------------------------------------------
+void InitBrowserScreen(void);
+void UpdateBrowserScreen(void);
+void DrawBrowserScreen(void);
+void UnloadBrowserScreen(void);
+int FinishBrowserScreen(void);
 
 //----------------------------------------------------------------------------------
 // Ending Screen Functions Declaration
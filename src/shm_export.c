@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_export.h"
+
+struct ShmExport* openShmExport(const char *name)
+{
+	struct ShmExport *exporter = calloc(1, sizeof(struct ShmExport));
+	if (exporter == NULL)
+		return NULL;
+
+	int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Error while creating shared memory %s\n", name);
+		free(exporter);
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(struct ShmExportHeader)) != 0) {
+		close(fd);
+		shm_unlink(name);
+		free(exporter);
+		return NULL;
+	}
+
+	exporter->header = mmap(NULL, sizeof(struct ShmExportHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (exporter->header == MAP_FAILED) {
+		shm_unlink(name);
+		free(exporter);
+		return NULL;
+	}
+
+	// ftruncate zero filled the object, every sequence starts even
+	struct ShmExportHeader *header = exporter->header;
+	header->version = SHM_EXPORT_VERSION;
+	header->slotCount = SHM_EXPORT_SLOTS;
+	header->slotSize = sizeof(struct ShmFrame);
+	header->width = VIDEO_WIDTH;
+	header->height = VIDEO_HEIGHT;
+	atomic_store_explicit(&header->latest, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	header->magic = SHM_EXPORT_MAGIC;
+
+	strncpy(exporter->name, name, sizeof(exporter->name) - 1);
+	return exporter;
+}
+
+void closeShmExport(struct ShmExport *exporter)
+{
+	if (exporter == NULL)
+		return;
+
+	munmap(exporter->header, sizeof(struct ShmExportHeader));
+	shm_unlink(exporter->name);
+	free(exporter);
+}
+
+void publishShmFrame(struct ShmExport *exporter, const struct Chip8 *chip, uint64_t timeNs)
+{
+	uint64_t frame = ++(exporter->frames);
+	struct ShmFrame *slot = &exporter->header->slots[frame % SHM_EXPORT_SLOTS];
+	unsigned int sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+	uint32_t keypad = 0;
+
+	for (int i = 0; i < 16; i++)
+		keypad |= (uint32_t)(chip->keypad[i] != 0) << i;
+
+	atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->keypad = keypad;
+	slot->frame = frame;
+	slot->timeNs = timeNs;
+	slot->delayTimer = chip->delayTimer;
+	slot->soundTimer = chip->soundTimer;
+	memcpy(slot->video, chip->video, sizeof(slot->video));
+
+	atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+	atomic_store_explicit(&exporter->header->latest, frame, memory_order_release);
+}
+
+const struct ShmExportHeader* attachShmExport(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	// A writer starting up truncates the object before sizing it, touching pages past
+	// the end in that window would raise SIGBUS
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct ShmExportHeader)) {
+		close(fd);
+		return NULL;
+	}
+
+	struct ShmExportHeader *header = mmap(NULL, sizeof(struct ShmExportHeader), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+		return NULL;
+
+	if (header->magic != SHM_EXPORT_MAGIC || header->version != SHM_EXPORT_VERSION || header->slotSize != sizeof(struct ShmFrame)) {
+		munmap(header, sizeof(struct ShmExportHeader));
+		return NULL;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	return header;
+}
+
+void detachShmExport(const struct ShmExportHeader *header)
+{
+	if (header != NULL)
+		munmap((void*)header, sizeof(struct ShmExportHeader));
+}
+
+const struct ShmFrame* beginShmRead(const struct ShmExportHeader *header, uint64_t frame, uint32_t *sequence)
+{
+	const struct ShmFrame *slot = &header->slots[frame % SHM_EXPORT_SLOTS];
+	unsigned int current = atomic_load_explicit((atomic_uint*)&slot->sequence, memory_order_acquire);
+
+	if ((current & 1) || slot->frame != frame)
+		return NULL;
+
+	*sequence = current;
+	return slot;
+}
+
+bool endShmRead(const struct ShmFrame *slot, uint32_t sequence)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit((atomic_uint*)&slot->sequence, memory_order_relaxed) == sequence;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "emulator.h"
+
+#define SHM_EXPORT_MAGIC 0x38504843	// "CHP8"
+#define SHM_EXPORT_VERSION 1
+#define SHM_EXPORT_SLOTS 8				// a frame stays readable for this many publications
+
+// One published frame, guarded by its own seqlock
+struct ShmFrame {
+	atomic_uint sequence;		// odd while the writer is inside the slot
+	uint32_t keypad;			// bit k set while key k is down
+	uint64_t frame;				// frame number, starts at 1
+	uint64_t timeNs;			// CLOCK_MONOTONIC when it was published
+	uint8_t delayTimer;
+	uint8_t soundTimer;
+	uint8_t video[VIDEO_SIZE];	// 0 or PIXEL_ON, row major
+};
+
+// Layout of the shared memory object, readers check magic, version and slotSize
+struct ShmExportHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slotCount;
+	uint32_t slotSize;
+	uint32_t width;
+	uint32_t height;
+	atomic_uint_fast64_t latest;	// newest complete frame number, 0 before the first
+	struct ShmFrame slots[SHM_EXPORT_SLOTS];
+};
+
+// Frame export through a POSIX shared memory ring
+// The writer never waits for readers: frame n goes to slot n % SHM_EXPORT_SLOTS under
+// the slot's seqlock. Readers look at the slot in place and afterwards confirm with
+// endShmRead() that it wasn't rewritten meanwhile, so no frame is ever copied.
+struct ShmExport {
+	struct ShmExportHeader *header;
+	char name[64];
+	uint64_t frames;
+};
+
+// Writer: create (or replace) the shared memory object, name as for shm_open, e.g. "/chippy"
+struct ShmExport* openShmExport(const char *name);
+
+// Writer: unmap and unlink the object
+void closeShmExport(struct ShmExport *exporter);
+
+// Writer: publish the current display and state of chip as the next frame
+void publishShmFrame(struct ShmExport *exporter, const struct Chip8 *chip, uint64_t timeNs);
+
+// Reader: map an existing object read-only, NULL if missing, not sized yet or incompatible
+const struct ShmExportHeader* attachShmExport(const char *name);
+
+void detachShmExport(const struct ShmExportHeader *header);
+
+// Reader: slot holding frame, NULL if it has already been overwritten or is being written.
+// The slot may be read in place until endShmRead() is called with the returned sequence.
+const struct ShmFrame* beginShmRead(const struct ShmExportHeader *header, uint64_t frame, uint32_t *sequence);
+
+// Reader: true if the slot wasn't touched since beginShmRead(), otherwise discard what was read
+bool endShmRead(const struct ShmFrame *slot, uint32_t sequence);
@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "spectator.h"
+
+#define SLOT_MASK (SPECTATOR_SLOTS - 1)
+#define RING_MASK (SPECTATOR_RING_SIZE - 1)
+#define LISTEN_BACKLOG 16
+
+static void writeHeader(uint8_t *out, uint8_t type, size_t length, uint32_t frame)
+{
+	out[0] = type;
+	out[1] = (uint8_t)length;
+	out[2] = (uint8_t)(length >> 8);
+	out[3] = (uint8_t)frame;
+	out[4] = (uint8_t)(frame >> 8);
+	out[5] = (uint8_t)(frame >> 16);
+	out[6] = (uint8_t)(frame >> 24);
+}
+
+static void writeHello(uint8_t *out)
+{
+	memcpy(out, SPECTATOR_MAGIC, 4);
+	out[4] = SPECTATOR_VERSION;
+	out[5] = VIDEO_WIDTH;
+	out[6] = VIDEO_HEIGHT;
+}
+
+static bool isUnixAddress(const char *address)
+{
+	return strncmp(address, SPECTATOR_UNIX_PREFIX, strlen(SPECTATOR_UNIX_PREFIX)) == 0;
+}
+
+// Split "host:port" or "port", host stays empty for the latter
+static bool splitAddress(const char *address, char *host, size_t size, char *service, size_t serviceSize)
+{
+	const char *colon = strrchr(address, ':');
+	host[0] = '\0';
+	if (colon == NULL) {
+		snprintf(service, serviceSize, "%s", address);
+		return address[0] != '\0';
+	}
+	if ((size_t)(colon - address) >= size)
+		return false;
+	memcpy(host, address, (size_t)(colon - address));
+	host[colon - address] = '\0';
+	snprintf(service, serviceSize, "%s", colon + 1);
+	return colon[1] != '\0';
+}
+
+// Listening socket for address, non-blocking, -1 on failure
+static int listenOn(struct Spectator *spectator, const char *address)
+{
+	if (isUnixAddress(address)) {
+		struct sockaddr_un local = { .sun_family = AF_UNIX };
+		strncpy(local.sun_path, address + strlen(SPECTATOR_UNIX_PREFIX), sizeof(local.sun_path) - 1);
+		unlink(local.sun_path);		// left behind by an earlier run
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr*)&local, sizeof(local)) != 0 || listen(fd, LISTEN_BACKLOG) != 0) {
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	char host[128], service[16];
+	struct addrinfo hints = { 0 }, *found = NULL;
+	if (!splitAddress(address, host, sizeof(host), service, sizeof(service)))
+		return -1;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	// Viewers are local unless an address is given, 0.0.0.0:port serves every interface
+	if (getaddrinfo(host[0] != '\0' ? host : "127.0.0.1", service, &hints, &found) != 0 || found == NULL)
+		return -1;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	if (fd >= 0)
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if (fd < 0 || bind(fd, found->ai_addr, found->ai_addrlen) != 0 || listen(fd, LISTEN_BACKLOG) != 0) {
+		if (fd >= 0)
+			close(fd);
+		freeaddrinfo(found);
+		return -1;
+	}
+	freeaddrinfo(found);
+
+	struct sockaddr_in bound;
+	socklen_t length = sizeof(bound);
+	if (getsockname(fd, (struct sockaddr*)&bound, &length) == 0)
+		spectator->port = ntohs(bound.sin_port);
+	return fd;
+}
+
+void publishSpectatorFrame(struct Spectator *spectator, const uint8_t *video)
+{
+	uint32_t frame = ++(spectator->frames);
+	struct SpectatorFrame *slot = &spectator->slots[frame & SLOT_MASK].frame;
+	atomic_uint *sequence = &spectator->slots[frame & SLOT_MASK].sequence;
+	unsigned int current = atomic_load_explicit(sequence, memory_order_relaxed);
+
+	atomic_store_explicit(sequence, current + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	// The only encode this frame gets, every viewer is sent these bytes
+	slot->frame = frame;
+	packBits(video, VIDEO_SIZE, slot->bits);
+	size_t length = encodeDelta(slot->bits, spectator->previous, SPECTATOR_FRAME_BYTES, slot->message + SPECTATOR_HEADER_SIZE);
+	writeHeader(slot->message, SPECTATOR_DELTA, length, frame);
+	slot->length = (uint16_t)(SPECTATOR_HEADER_SIZE + length);
+	memcpy(spectator->previous, slot->bits, SPECTATOR_FRAME_BYTES);
+
+	atomic_store_explicit(sequence, current + 2, memory_order_release);
+	atomic_store_explicit(&spectator->latest, frame, memory_order_release);
+}
+
+// Copy frames published since the last call into the broadcast ring. A torn copy means
+// the emulator lapped the slots, the frame is marked missing and viewers resync past it.
+static void collectFrames(struct Spectator *spectator)
+{
+	uint32_t latest = atomic_load_explicit(&spectator->latest, memory_order_acquire);
+	uint32_t frame = spectator->newest + 1;
+
+	if (latest - spectator->newest > SPECTATOR_SLOTS)
+		frame = latest - SPECTATOR_SLOTS + 1;
+
+	for (; frame <= latest; frame++) {
+		atomic_uint *sequence = &spectator->slots[frame & SLOT_MASK].sequence;
+		struct SpectatorFrame *copy = &spectator->ring[frame & RING_MASK];
+		unsigned int before = atomic_load_explicit(sequence, memory_order_acquire);
+
+		*copy = spectator->slots[frame & SLOT_MASK].frame;
+		atomic_thread_fence(memory_order_acquire);
+		if ((before & 1) || atomic_load_explicit(sequence, memory_order_relaxed) != before || copy->frame != frame) {
+			copy->frame = 0;
+			continue;
+		}
+		spectator->newest = frame;
+	}
+}
+
+// Keyframe of the newest frame, encoded once however many viewers need it
+static void makeKeyframe(struct Spectator *spectator)
+{
+	if (spectator->keyframeFrame == spectator->newest)
+		return;
+
+	const struct SpectatorFrame *frame = &spectator->ring[spectator->newest & RING_MASK];
+	size_t length = encodeDelta(frame->bits, NULL, SPECTATOR_FRAME_BYTES, spectator->keyframe + SPECTATOR_HEADER_SIZE);
+	writeHeader(spectator->keyframe, SPECTATOR_KEYFRAME, length, frame->frame);
+	spectator->keyframeLength = (uint16_t)(SPECTATOR_HEADER_SIZE + length);
+	spectator->keyframeFrame = spectator->newest;
+	atomic_fetch_add_explicit(&spectator->statKeyframes, 1, memory_order_relaxed);
+}
+
+// Queue the client's next message, false once it is up to date
+static bool nextMessage(struct Spectator *spectator, struct SpectatorClient *client)
+{
+	if (spectator->newest == 0)
+		return false;
+	if (client->synced && client->next > spectator->newest)
+		return false;
+
+	const struct SpectatorFrame *frame = &spectator->ring[client->next & RING_MASK];
+	if (client->synced && frame->frame == client->next) {
+		memcpy(client->pending, frame->message, frame->length);
+		client->pendingLength = frame->length;
+		client->next++;
+	}
+	else {
+		// New, or so far behind that the ring moved on
+		makeKeyframe(spectator);
+		memcpy(client->pending, spectator->keyframe, spectator->keyframeLength);
+		client->pendingLength = spectator->keyframeLength;
+		client->next = spectator->newest + 1;
+		client->synced = true;
+	}
+	client->pendingSent = 0;
+	return true;
+}
+
+// Send as much as the socket takes right now, false if the client is gone
+static bool pumpClient(struct Spectator *spectator, struct SpectatorClient *client)
+{
+	for (;;) {
+		if (client->pendingSent == client->pendingLength && !nextMessage(spectator, client))
+			return true;
+
+		ssize_t sent = send(client->socket, client->pending + client->pendingSent, client->pendingLength - client->pendingSent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		client->pendingSent += (size_t)sent;
+		atomic_fetch_add_explicit(&spectator->statBytes, (uint64_t)sent, memory_order_relaxed);
+	}
+}
+
+static bool clientWaiting(const struct Spectator *spectator, const struct SpectatorClient *client)
+{
+	if (client->pendingSent < client->pendingLength)
+		return true;
+	return spectator->newest != 0 && (!client->synced || client->next <= spectator->newest);
+}
+
+static void acceptClients(struct Spectator *spectator)
+{
+	for (;;) {
+		int fd = accept(spectator->listener, NULL, NULL);
+		if (fd < 0)
+			return;
+		if (spectator->clientCount == SPECTATOR_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		struct SpectatorClient *client = &spectator->clients[spectator->clientCount++];
+		memset(client, 0, sizeof(*client));
+		client->socket = fd;
+		writeHello(client->pending);
+		client->pendingLength = SPECTATOR_HELLO_SIZE;
+		atomic_fetch_add_explicit(&spectator->statServed, 1, memory_order_relaxed);
+	}
+}
+
+// Viewers never send anything, readable means closed
+static bool clientClosed(struct SpectatorClient *client)
+{
+	uint8_t discard[64];
+	ssize_t got = recv(client->socket, discard, sizeof(discard), MSG_DONTWAIT);
+	return got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+static void* runServer(void *arg)
+{
+	struct Spectator *spectator = (struct Spectator*)arg;
+	struct pollfd fds[1 + SPECTATOR_MAX_CLIENTS];
+
+	while (atomic_load_explicit(&spectator->running, memory_order_acquire)) {
+		int count = spectator->clientCount;
+
+		fds[0] = (struct pollfd){ .fd = spectator->listener, .events = POLLIN };
+		for (int i = 0; i < count; i++) {
+			short events = POLLIN | (clientWaiting(spectator, &spectator->clients[i]) ? POLLOUT : 0);
+			fds[1 + i] = (struct pollfd){ .fd = spectator->clients[i].socket, .events = events };
+		}
+		poll(fds, (nfds_t)(1 + count), SPECTATOR_POLL_MS);
+
+		collectFrames(spectator);
+
+		// Newly accepted clients go after the polled ones, the indices above stay valid
+		if (fds[0].revents & POLLIN)
+			acceptClients(spectator);
+
+		for (int i = spectator->clientCount - 1; i >= 0; i--) {
+			struct SpectatorClient *client = &spectator->clients[i];
+			bool gone = (i < count) && (fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR)) && clientClosed(client);
+			if (!gone)
+				gone = !pumpClient(spectator, client);
+			if (gone) {
+				close(client->socket);
+				*client = spectator->clients[--spectator->clientCount];
+			}
+		}
+		atomic_store_explicit(&spectator->statClients, (unsigned int)spectator->clientCount, memory_order_relaxed);
+	}
+
+	for (int i = 0; i < spectator->clientCount; i++)
+		close(spectator->clients[i].socket);
+	spectator->clientCount = 0;
+	return NULL;
+}
+
+struct Spectator* openSpectator(const char *address)
+{
+	struct Spectator *spectator = calloc(1, sizeof(struct Spectator));
+	if (spectator == NULL)
+		return NULL;
+
+	snprintf(spectator->address, sizeof(spectator->address), "%s", address);
+	spectator->ring = calloc(SPECTATOR_RING_SIZE, sizeof(struct SpectatorFrame));
+	spectator->listener = listenOn(spectator, address);
+	if (spectator->ring == NULL || spectator->listener < 0) {
+		printf("Error while opening spectator server on %s\n", address);
+		if (spectator->listener >= 0)
+			close(spectator->listener);
+		free(spectator->ring);
+		free(spectator);
+		return NULL;
+	}
+	fcntl(spectator->listener, F_SETFL, fcntl(spectator->listener, F_GETFL) | O_NONBLOCK);
+
+	for (int i = 0; i < SPECTATOR_SLOTS; i++)
+		atomic_init(&spectator->slots[i].sequence, 0);
+	atomic_init(&spectator->latest, 0);
+	atomic_init(&spectator->statClients, 0);
+	atomic_init(&spectator->statServed, 0);
+	atomic_init(&spectator->statKeyframes, 0);
+	atomic_init(&spectator->statBytes, 0);
+	atomic_init(&spectator->running, true);
+
+	if (pthread_create(&spectator->thread, NULL, runServer, spectator) != 0) {
+		printf("Error while starting spectator server\n");
+		close(spectator->listener);
+		free(spectator->ring);
+		free(spectator);
+		return NULL;
+	}
+	return spectator;
+}
+
+void closeSpectator(struct Spectator *spectator)
+{
+	if (spectator == NULL)
+		return;
+
+	atomic_store_explicit(&spectator->running, false, memory_order_release);
+	pthread_join(spectator->thread, NULL);
+	close(spectator->listener);
+	if (isUnixAddress(spectator->address))
+		unlink(spectator->address + strlen(SPECTATOR_UNIX_PREFIX));
+	free(spectator->ring);
+	free(spectator);
+}
+
+int connectSpectator(const char *address)
+{
+	if (isUnixAddress(address)) {
+		struct sockaddr_un remote = { .sun_family = AF_UNIX };
+		strncpy(remote.sun_path, address + strlen(SPECTATOR_UNIX_PREFIX), sizeof(remote.sun_path) - 1);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*)&remote, sizeof(remote)) != 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	char host[128], service[16];
+	struct addrinfo hints = { 0 }, *found = NULL;
+	if (!splitAddress(address, host, sizeof(host), service, sizeof(service)))
+		return -1;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host[0] != '\0' ? host : "127.0.0.1", service, &hints, &found) != 0 || found == NULL)
+		return -1;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, found->ai_addr, found->ai_addrlen) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(found);
+	return fd;
+}
+
+void initSpectatorView(struct SpectatorView *view, int socket)
+{
+	memset(view, 0, sizeof(*view));
+	view->socket = socket;
+}
+
+static void consume(struct SpectatorView *view, size_t count)
+{
+	memmove(view->buffer, view->buffer + count, view->length - count);
+	view->length -= count;
+}
+
+// Decode one buffered message, 1 if a frame was decoded, 0 if more bytes are needed
+static int decodeMessage(struct SpectatorView *view)
+{
+	if (!view->greeted) {
+		if (view->length < SPECTATOR_HELLO_SIZE)
+			return 0;
+		if (memcmp(view->buffer, SPECTATOR_MAGIC, 4) != 0 || view->buffer[4] != SPECTATOR_VERSION ||
+			view->buffer[5] != VIDEO_WIDTH || view->buffer[6] != VIDEO_HEIGHT)
+			return -1;
+		consume(view, SPECTATOR_HELLO_SIZE);
+		view->greeted = true;
+	}
+	if (view->length < SPECTATOR_HEADER_SIZE)
+		return 0;
+
+	const uint8_t *header = view->buffer;
+	size_t length = (size_t)header[1] | (size_t)header[2] << 8;
+	uint32_t frame = (uint32_t)header[3] | (uint32_t)header[4] << 8 | (uint32_t)header[5] << 16 | (uint32_t)header[6] << 24;
+	if (length > SPECTATOR_MESSAGE_SIZE - SPECTATOR_HEADER_SIZE)
+		return -1;
+	if (view->length < SPECTATOR_HEADER_SIZE + length)
+		return 0;
+
+	// A delta only applies on top of the frame right before it
+	uint8_t bits[SPECTATOR_FRAME_BYTES];
+	const uint8_t *payload = view->buffer + SPECTATOR_HEADER_SIZE;
+	if (header[0] == SPECTATOR_KEYFRAME) {
+		if (!decodeDelta(payload, length, NULL, bits, sizeof(bits)))
+			return -1;
+		view->keyframes++;
+	}
+	else if (header[0] == SPECTATOR_DELTA && view->valid && frame == view->frame + 1) {
+		if (!decodeDelta(payload, length, view->bits, bits, sizeof(bits)))
+			return -1;
+		view->deltas++;
+	}
+	else {
+		return -1;
+	}
+
+	memcpy(view->bits, bits, sizeof(bits));
+	view->frame = frame;
+	view->valid = true;
+	consume(view, SPECTATOR_HEADER_SIZE + length);
+	return 1;
+}
+
+int receiveSpectatorFrame(struct SpectatorView *view)
+{
+	for (;;) {
+		int decoded = decodeMessage(view);
+		if (decoded != 0)
+			return decoded;
+
+		ssize_t got = recv(view->socket, view->buffer + view->length, sizeof(view->buffer) - view->length, 0);
+		if (got > 0) {
+			view->length += (size_t)got;
+			view->bytes += (uint64_t)got;
+			continue;
+		}
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		return -1;
+	}
+}
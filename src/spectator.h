@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "delta.h"
+
+#define SPECTATOR_MAGIC "C8SP"
+#define SPECTATOR_VERSION 1
+#define SPECTATOR_HELLO_SIZE 7			// magic, version, width, height
+#define SPECTATOR_HEADER_SIZE 7			// type, 16 bit length, 32 bit frame, little endian
+#define SPECTATOR_FRAME_BYTES (VIDEO_SIZE / 8)
+#define SPECTATOR_MESSAGE_SIZE (SPECTATOR_HEADER_SIZE + DELTA_BOUND(SPECTATOR_FRAME_BYTES))
+#define SPECTATOR_SLOTS 64				// frames the server can fall behind the emulator, must be a power of two
+#define SPECTATOR_RING_SIZE 256			// frames kept for clients, must be a power of two
+#define SPECTATOR_MAX_CLIENTS 64
+#define SPECTATOR_POLL_MS 4				// how often the server looks for new frames
+#define SPECTATOR_UNIX_PREFIX "unix:"	// address prefix for a local stream socket
+
+enum SpectatorMessage {
+	SPECTATOR_KEYFRAME = 'K',	// frame delta encoded against a blank screen
+	SPECTATOR_DELTA = 'D'		// frame delta encoded against the previous frame
+};
+
+// One frame as sent, the payload is the packed display (1 bit per pixel, rows of
+// VIDEO_WIDTH / 8 bytes, MSB leftmost) encoded with encodeDelta()
+struct SpectatorFrame {
+	uint32_t frame;
+	uint16_t length;			// whole message
+	uint8_t message[SPECTATOR_MESSAGE_SIZE];	// header and delta payload, ready to send
+	uint8_t bits[SPECTATOR_FRAME_BYTES];		// the packed display, keyframes are made from it
+};
+
+struct SpectatorClient {
+	int socket;
+	uint32_t next;				// frame to send after the pending message
+	bool synced;				// got a keyframe, deltas can follow
+	uint8_t pending[SPECTATOR_HELLO_SIZE + SPECTATOR_MESSAGE_SIZE];
+	size_t pendingLength;
+	size_t pendingSent;
+};
+
+// Spectator server
+// Streams the display to any number of local viewers over TCP or a Unix socket. The
+// emulation thread packs and delta encodes every published frame exactly once into a
+// seqlocked slot and never waits. The server thread copies new slots into a broadcast
+// ring and sends from there: every client follows the ring with its own cursor, so all
+// of them share the same encoded bytes. A new client, or one so slow that the ring
+// moved past it, gets a keyframe of the newest frame and carries on from there.
+// Stream: SPECTATOR_MAGIC, version, width, height, then one message per frame.
+struct Spectator {
+	int listener;
+	char address[108];
+	uint16_t port;				// bound TCP port, useful when 0 was asked for
+
+	// Emulation thread
+	uint32_t frames;
+	uint8_t previous[SPECTATOR_FRAME_BYTES];
+	struct {
+		atomic_uint sequence;	// odd while the writer is inside the slot
+		struct SpectatorFrame frame;
+	} slots[SPECTATOR_SLOTS];
+	atomic_uint latest;			// newest complete frame, 0 before the first
+
+	// Server thread
+	pthread_t thread;
+	atomic_bool running;
+	struct SpectatorFrame *ring;	// SPECTATOR_RING_SIZE frames by number
+	uint32_t newest;
+	uint8_t keyframe[SPECTATOR_MESSAGE_SIZE];
+	uint16_t keyframeLength;
+	uint32_t keyframeFrame;		// frame the cached keyframe shows, 0 if none
+	struct SpectatorClient clients[SPECTATOR_MAX_CLIENTS];
+	int clientCount;
+
+	// Written by the server thread, readable from any thread
+	atomic_uint statClients;
+	atomic_uint statServed;		// clients accepted in total
+	atomic_uint statKeyframes;
+	atomic_uint_fast64_t statBytes;
+};
+
+// Viewer side decoder state, see receiveSpectatorFrame()
+struct SpectatorView {
+	int socket;
+	uint8_t buffer[SPECTATOR_HELLO_SIZE + SPECTATOR_MESSAGE_SIZE];
+	size_t length;
+	bool greeted;
+	bool valid;					// bits holds a picture
+	uint32_t frame;				// newest decoded frame
+	uint8_t bits[SPECTATOR_FRAME_BYTES];
+	uint32_t keyframes;
+	uint32_t deltas;
+	uint64_t bytes;
+};
+
+// Listen on address, "unix:/path/to/socket", "host:port" or "port" for loopback only,
+// "0.0.0.0:port" exposes the stream to other machines. NULL on failure.
+struct Spectator* openSpectator(const char *address);
+
+// Stop serving, disconnect every viewer and remove a Unix socket
+void closeSpectator(struct Spectator *spectator);
+
+// Emulation thread: publish video (VIDEO_SIZE bytes, 0 or PIXEL_ON) as the next frame
+void publishSpectatorFrame(struct Spectator *spectator, const uint8_t *video);
+
+// Viewer: connect to address as given to openSpectator(), -1 on failure
+int connectSpectator(const char *address);
+
+// Viewer: start decoding the stream on socket
+void initSpectatorView(struct SpectatorView *view, int socket);
+
+// Viewer: read until the next frame is decoded into view->bits. Returns 1 for a new
+// frame, 0 if a non-blocking socket has nothing more yet and -1 once the stream ended
+// or turned out malformed.
+int receiveSpectatorFrame(struct SpectatorView *view);
+
+static inline bool spectatorPixel(const uint8_t *bits, unsigned int x, unsigned int y)
+{
+	return (bits[y * (VIDEO_WIDTH / 8) + x / 8] >> (7 - x % 8)) & 1;
+}
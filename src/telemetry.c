@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "telemetry.h"
+#include "pacer.h"
+
+#define TELEMETRY_FIELDS (TELEMETRY_PHASES + 1)
+#define TELEMETRY_LINE_SIZE 1024
+
+static const char *fieldNames[TELEMETRY_FIELDS] = {
+	"frame", "input", "emulation", "upload", "draw"
+};
+
+// Exporter side buffer for one interval
+struct Interval {
+	struct TelemetrySample *samples;
+	size_t count;
+	size_t capacity;
+	uint32_t dropped;
+};
+
+static uint32_t toUs(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+void beginTelemetryFrame(struct Telemetry *telemetry)
+{
+	if (!telemetry->enabled)
+		return;
+
+	uint64_t now = pacerNowNs();
+
+	if (telemetry->frameStartNs != 0) {
+		unsigned int head = atomic_load_explicit(&telemetry->head, memory_order_relaxed);
+		unsigned int tail = atomic_load_explicit(&telemetry->tail, memory_order_acquire);
+
+		telemetry->current.frameUs = toUs(now - telemetry->frameStartNs);
+		if (head - tail >= TELEMETRY_RING_SIZE) {
+			atomic_fetch_add_explicit(&telemetry->dropped, 1, memory_order_relaxed);
+		}
+		else {
+			telemetry->samples[head & (TELEMETRY_RING_SIZE - 1)] = telemetry->current;
+			atomic_store_explicit(&telemetry->head, head + 1, memory_order_release);
+		}
+	}
+
+	memset(&telemetry->current, 0, sizeof(telemetry->current));
+	telemetry->frameStartNs = now;
+	telemetry->markNs = now;
+}
+
+void markTelemetry(struct Telemetry *telemetry, enum TelemetryPhase phase)
+{
+	if (!telemetry->enabled)
+		return;
+
+	uint64_t now = pacerNowNs();
+	telemetry->current.phaseUs[phase] += toUs(now - telemetry->markNs);
+	telemetry->markNs = now;
+}
+
+void addTelemetryTime(struct Telemetry *telemetry, enum TelemetryPhase phase, uint64_t ns)
+{
+	if (telemetry->enabled)
+		telemetry->current.phaseUs[phase] += toUs(ns);
+}
+
+void addTelemetryCounters(struct Telemetry *telemetry, uint32_t instructions, uint32_t timerTicks)
+{
+	if (!telemetry->enabled)
+		return;
+
+	telemetry->current.instructions += instructions;
+	telemetry->current.timerTicks += timerTicks;
+}
+
+static void drainRing(struct Telemetry *telemetry, struct Interval *interval)
+{
+	unsigned int tail = atomic_load_explicit(&telemetry->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&telemetry->head, memory_order_acquire);
+
+	if (interval->capacity < interval->count + (head - tail)) {
+		size_t capacity = (interval->count + (head - tail)) * 2;
+		struct TelemetrySample *samples = realloc(interval->samples, capacity * sizeof(struct TelemetrySample));
+		if (samples == NULL)
+			return;		// try again on the next drain, the render thread counts drops meanwhile
+		interval->samples = samples;
+		interval->capacity = capacity;
+	}
+
+	while (tail != head) {
+		interval->samples[interval->count++] = telemetry->samples[tail & (TELEMETRY_RING_SIZE - 1)];
+		tail++;
+	}
+	atomic_store_explicit(&telemetry->tail, tail, memory_order_release);
+}
+
+static int byValue(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t fieldValue(const struct TelemetrySample *sample, int field)
+{
+	return field == 0 ? sample->frameUs : sample->phaseUs[field - 1];
+}
+
+// One line protocol record: measurement,tags fields timestamp
+static size_t formatInterval(const struct Telemetry *telemetry, struct Interval *interval, char *line, size_t size)
+{
+	uint64_t instructions = 0, timerTicks = 0;
+	struct timespec now;
+	size_t length;
+	uint32_t *values = malloc(interval->count * sizeof(uint32_t));
+
+	if (values == NULL)
+		return 0;
+
+	for (size_t i = 0; i < interval->count; i++) {
+		instructions += interval->samples[i].instructions;
+		timerTicks += interval->samples[i].timerTicks;
+	}
+
+	length = (size_t)snprintf(line, size, "chippy_frame,host=%s frames=%zui,dropped=%ui,instructions=%llui,timer_ticks=%llui",
+		telemetry->host, interval->count, interval->dropped, (unsigned long long)instructions, (unsigned long long)timerTicks);
+
+	for (int field = 0; field < TELEMETRY_FIELDS && length < size; field++) {
+		for (size_t i = 0; i < interval->count; i++)
+			values[i] = fieldValue(&interval->samples[i], field);
+		qsort(values, interval->count, sizeof(uint32_t), byValue);
+
+		size_t last = interval->count - 1;
+		length += (size_t)snprintf(line + length, size - length, ",%s_p50_us=%ui,%s_p99_us=%ui,%s_max_us=%ui",
+			fieldNames[field], values[last * 50 / 100], fieldNames[field], values[last * 99 / 100], fieldNames[field], values[last]);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (length < size)
+		length += (size_t)snprintf(line + length, size - length, " %llu\n", (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec);
+
+	free(values);
+	return length < size ? length : 0;
+}
+
+static int connectSocket(const char *path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+
+	strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+	if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Write one record, a missing collector only loses the summary
+static void writeLine(struct Telemetry *telemetry, const char *line, size_t length)
+{
+	if (strncmp(telemetry->destination, TELEMETRY_UNIX_PREFIX, strlen(TELEMETRY_UNIX_PREFIX)) == 0) {
+		if (telemetry->socket < 0)
+			telemetry->socket = connectSocket(telemetry->destination + strlen(TELEMETRY_UNIX_PREFIX));
+		if (telemetry->socket < 0)
+			return;
+		if (send(telemetry->socket, line, length, MSG_NOSIGNAL) != (ssize_t)length) {
+			close(telemetry->socket);
+			telemetry->socket = -1;		// reconnect next time
+		}
+		return;
+	}
+
+	if (telemetry->file == NULL)
+		telemetry->file = fopen(telemetry->destination, "a");
+	if (telemetry->file == NULL)
+		return;
+	fwrite(line, 1, length, telemetry->file);
+	fflush(telemetry->file);
+}
+
+static void exportInterval(struct Telemetry *telemetry, struct Interval *interval)
+{
+	char line[TELEMETRY_LINE_SIZE];
+	uint32_t dropped = atomic_exchange_explicit(&telemetry->dropped, 0, memory_order_relaxed);
+
+	interval->dropped = dropped;
+	if (interval->count > 0) {
+		size_t length = formatInterval(telemetry, interval, line, sizeof(line));
+		if (length > 0)
+			writeLine(telemetry, line, length);
+	}
+	interval->count = 0;
+}
+
+static void* runExporter(void *arg)
+{
+	struct Telemetry *telemetry = (struct Telemetry*)arg;
+	struct Interval interval = { 0 };
+	struct timespec pause = { 0, TELEMETRY_DRAIN_NS };
+	uint64_t nextExport = pacerNowNs() + telemetry->intervalNs;
+
+	while (atomic_load_explicit(&telemetry->running, memory_order_acquire)) {
+		nanosleep(&pause, NULL);
+		drainRing(telemetry, &interval);
+
+		if (pacerNowNs() >= nextExport) {
+			exportInterval(telemetry, &interval);
+			nextExport += telemetry->intervalNs;
+		}
+	}
+
+	// Whatever was recorded since the last summary
+	drainRing(telemetry, &interval);
+	exportInterval(telemetry, &interval);
+	free(interval.samples);
+	return NULL;
+}
+
+void startTelemetry(struct Telemetry *telemetry, const char *destination, uint32_t intervalSeconds)
+{
+	memset(telemetry, 0, sizeof(*telemetry));
+	telemetry->socket = -1;
+	if (destination == NULL || destination[0] == '\0')
+		return;
+
+	strncpy(telemetry->destination, destination, TELEMETRY_PATH_SIZE - 1);
+	telemetry->intervalNs = (uint64_t)(intervalSeconds > 0 ? intervalSeconds : TELEMETRY_DEFAULT_INTERVAL) * 1000000000ULL;
+	if (gethostname(telemetry->host, sizeof(telemetry->host) - 1) != 0)
+		strcpy(telemetry->host, "unknown");
+
+	// Tag values can't hold spaces or commas in line protocol
+	for (char *c = telemetry->host; *c != '\0'; c++) {
+		if (*c == ' ' || *c == ',' || *c == '=')
+			*c = '_';
+	}
+
+	atomic_init(&telemetry->head, 0);
+	atomic_init(&telemetry->tail, 0);
+	atomic_init(&telemetry->dropped, 0);
+	atomic_init(&telemetry->running, true);
+
+	if (pthread_create(&telemetry->thread, NULL, runExporter, telemetry) != 0) {
+		printf("Error while starting telemetry exporter\n");
+		return;
+	}
+	telemetry->enabled = true;
+}
+
+void stopTelemetry(struct Telemetry *telemetry)
+{
+	if (!telemetry->enabled)
+		return;
+
+	atomic_store_explicit(&telemetry->running, false, memory_order_release);
+	pthread_join(telemetry->thread, NULL);
+	telemetry->enabled = false;
+
+	if (telemetry->file != NULL)
+		fclose(telemetry->file);
+	if (telemetry->socket >= 0)
+		close(telemetry->socket);
+}
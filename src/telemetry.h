@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define TELEMETRY_RING_SIZE 1024		// frames buffered for the exporter, must be a power of two
+#define TELEMETRY_DEFAULT_INTERVAL 10	// seconds between exported summaries
+#define TELEMETRY_DRAIN_NS 250000000ULL	// how often the exporter empties the ring
+#define TELEMETRY_PATH_SIZE 256
+#define TELEMETRY_UNIX_PREFIX "unix:"	// destination prefix for a local stream socket
+
+enum TelemetryPhase {
+	TELEMETRY_INPUT,		// screen update logic other than the texture upload
+	TELEMETRY_EMULATION,	// emulation thread busy time since the previous frame
+	TELEMETRY_UPLOAD,		// UpdateTexture() of the emulator frame
+	TELEMETRY_DRAW,			// draw calls up to EndDrawing(), buffer swap and frame wait excluded
+	TELEMETRY_PHASES
+};
+
+struct TelemetrySample {
+	uint32_t frameUs;		// whole frame, start to start
+	uint32_t phaseUs[TELEMETRY_PHASES];
+	uint32_t instructions;	// guest instructions executed during the frame
+	uint32_t timerTicks;	// 60 Hz timer ticks during the frame
+};
+
+// Per-frame host telemetry
+// The render thread records one sample per frame into a single producer, single consumer
+// ring; an exporter thread drains it and writes p50/p99/max summaries in line protocol
+// to a file or a Unix socket. Everything is a no-op when no destination is configured.
+struct Telemetry {
+	bool enabled;
+
+	// Render thread
+	struct TelemetrySample current;
+	uint64_t frameStartNs;
+	uint64_t markNs;
+
+	struct TelemetrySample samples[TELEMETRY_RING_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_uint dropped;		// frames lost because the ring was full
+
+	// Exporter thread
+	pthread_t thread;
+	atomic_bool running;
+	char destination[TELEMETRY_PATH_SIZE];
+	char host[64];
+	uint64_t intervalNs;
+	FILE *file;
+	int socket;
+};
+
+// Start exporting to destination, a file path or "unix:/path/to/socket", every intervalSeconds.
+// A NULL or empty destination leaves telemetry disabled.
+void startTelemetry(struct Telemetry *telemetry, const char *destination, uint32_t intervalSeconds);
+
+// Flush the last summary and stop the exporter
+void stopTelemetry(struct Telemetry *telemetry);
+
+// Render thread: close the previous frame and start timing a new one
+void beginTelemetryFrame(struct Telemetry *telemetry);
+
+// Render thread: charge the time since the last mark to phase
+void markTelemetry(struct Telemetry *telemetry, enum TelemetryPhase phase);
+
+// Render thread: add time measured elsewhere, e.g. on the emulation thread, to phase
+void addTelemetryTime(struct Telemetry *telemetry, enum TelemetryPhase phase, uint64_t ns);
+
+// Render thread: add guest progress made during this frame
+void addTelemetryCounters(struct Telemetry *telemetry, uint32_t instructions, uint32_t timerTicks);
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "thumbnails.h"
+#include "rom_archive.h"
+
+#define THUMB_MAGIC 0x48543843u		// "C8TH"
+#define THUMB_VERSION 1
+#define THUMB_SEED 0xC8C8C8C8u
+#define THUMB_FILE_SIZE (THUMB_PATH_SIZE + 32)	// cacheDir plus "/<hash>.thumb"
+
+// On disk as <cacheDir>/<hash>.thumb
+struct ThumbFile {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frames;		// capture settings, a change makes old files stale
+	uint32_t cycles;
+	uint8_t pixels[THUMB_BYTES];
+};
+
+static uint64_t fnv1a(const uint8_t *data, size_t length)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+// $XDG_CACHE_HOME/chippy/thumbs or ~/.cache/chippy/thumbs, created if needed.
+// False if the path doesn't fit, thumbnails are then made every time.
+static bool findCacheDir(char out[THUMB_PATH_SIZE])
+{
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char base[THUMB_PATH_SIZE - sizeof("/chippy/thumbs") + 1];
+	int length;
+
+	if (xdg != NULL && xdg[0] != '\0')
+		length = snprintf(base, sizeof(base), "%s", xdg);
+	else if (home != NULL)
+		length = snprintf(base, sizeof(base), "%s/.cache", home);
+	else
+		length = snprintf(base, sizeof(base), "/tmp");
+	if (length < 0 || (size_t)length >= sizeof(base))
+		return false;
+
+	snprintf(out, THUMB_PATH_SIZE, "%s/chippy", base);
+	mkdir(base, 0755);
+	mkdir(out, 0755);
+	snprintf(out, THUMB_PATH_SIZE, "%s/chippy/thumbs", base);
+	mkdir(out, 0755);
+	return true;
+}
+
+static uint32_t countLit(const uint8_t *video)
+{
+	uint32_t lit = 0;
+	for (int i = 0; i < VIDEO_SIZE; i++)
+		lit += video[i] != 0;
+	return lit;
+}
+
+bool renderThumbnail(const uint8_t *rom, size_t size, uint8_t *pixels)
+{
+	struct Chip8 chip;
+
+	initEmulator(&chip);
+	if (size == 0 || !loadRomFromMemory(&chip, rom, size)) {
+		releaseEmulator(&chip);
+		return false;
+	}
+	loadFonts(&chip);
+	seedEmulator(&chip, THUMB_SEED);
+
+	// Title screens are often drawn and cleared again, keep the busiest capture
+	uint32_t best = 0;
+	memset(pixels, 0, THUMB_BYTES);
+	for (int frame = 1; frame <= THUMB_FRAMES; frame++) {
+		uint64_t end = chip.instructions + CYCLES_PER_TICK;
+		while (chip.instructions < end)
+			Cycle(&chip);
+		updateTimers(&chip);
+
+		if (frame % THUMB_SAMPLE_EVERY != 0)
+			continue;
+
+		uint32_t lit = countLit(chip.video);
+		if (lit < best || lit == VIDEO_SIZE)
+			continue;
+		best = lit;
+		memset(pixels, 0, THUMB_BYTES);
+		for (int i = 0; i < VIDEO_SIZE; i++) {
+			if (chip.video[i])
+				pixels[i / 8] |= 0x80 >> (i % 8);
+		}
+	}
+	releaseEmulator(&chip);
+	return true;
+}
+
+static bool readCached(const char *path, uint8_t *pixels)
+{
+	struct ThumbFile stored;
+	FILE *file = fopen(path, "rb");
+
+	if (file == NULL)
+		return false;
+	bool ok = fread(&stored, sizeof(stored), 1, file) == 1;
+	fclose(file);
+
+	if (!ok || stored.magic != THUMB_MAGIC || stored.version != THUMB_VERSION ||
+		stored.frames != THUMB_FRAMES || stored.cycles != CYCLES_PER_TICK)
+		return false;
+	memcpy(pixels, stored.pixels, THUMB_BYTES);
+	return true;
+}
+
+static void writeCached(const char *path, const uint8_t *pixels)
+{
+	struct ThumbFile stored = { THUMB_MAGIC, THUMB_VERSION, THUMB_FRAMES, CYCLES_PER_TICK, { 0 } };
+	char temporary[THUMB_FILE_SIZE + 24];
+
+	memcpy(stored.pixels, pixels, THUMB_BYTES);
+
+	// Rename into place so a concurrent reader never sees half a file
+	snprintf(temporary, sizeof(temporary), "%s.%ld", path, (long)getpid());
+	FILE *file = fopen(temporary, "wb");
+	if (file == NULL)
+		return;
+	bool ok = fwrite(&stored, sizeof(stored), 1, file) == 1;
+	if (fclose(file) == 0 && ok)
+		rename(temporary, path);
+	else
+		remove(temporary);
+}
+
+// Hash first so a cached thumbnail skips the headless run
+static void makeThumbnail(struct ThumbnailCache *cache, struct Thumbnail *entry)
+{
+	uint8_t rom[MAX_ROM_SIZE + 1];
+	char cached[THUMB_FILE_SIZE];
+	long read = readRomImage(entry->path, rom, sizeof(rom));
+
+	if (read < 0) {
+		atomic_store_explicit(&entry->state, THUMB_FAILED, memory_order_release);
+		return;
+	}
+	size_t size = (read > (long)sizeof(rom)) ? sizeof(rom) : (size_t)read;
+
+	// Anything past MAX_ROM_SIZE makes the load fail, the hash needn't cover it
+	bool cacheable = cache->cacheDir[0] != '\0';
+	if (cacheable)
+		snprintf(cached, sizeof(cached), "%s/%016llx.thumb", cache->cacheDir, (unsigned long long)fnv1a(rom, size));
+	if (cacheable && readCached(cached, entry->pixels)) {
+		atomic_store_explicit(&entry->state, THUMB_READY, memory_order_release);
+		return;
+	}
+
+	if (!renderThumbnail(rom, size, entry->pixels)) {
+		atomic_store_explicit(&entry->state, THUMB_FAILED, memory_order_release);
+		return;
+	}
+	if (cacheable)
+		writeCached(cached, entry->pixels);
+	atomic_store_explicit(&entry->state, THUMB_READY, memory_order_release);
+}
+
+static bool listEntries(struct ThumbnailCache *cache);
+
+static void* runThumbnailWorker(void *arg)
+{
+	struct ThumbnailCache *cache = (struct ThumbnailCache*)arg;
+
+	pthread_mutex_lock(&cache->lock);
+
+	// The first worker up lists the directory, requests only come in once it is done
+	if (!cache->listingTaken) {
+		cache->listingTaken = true;
+		pthread_mutex_unlock(&cache->lock);
+		bool listed = listEntries(cache);
+		atomic_store_explicit(&cache->listing, listed ? THUMB_LISTED : THUMB_UNREADABLE, memory_order_release);
+		pthread_mutex_lock(&cache->lock);
+	}
+
+	for (;;) {
+		while (cache->queueLength == 0 && !cache->stopping)
+			pthread_cond_wait(&cache->wake, &cache->lock);
+		if (cache->stopping)
+			break;
+
+		// Newest request first, it is the one on screen
+		cache->queueLength--;
+		uint32_t index = cache->queue[(cache->queueStart + cache->queueLength) % THUMB_QUEUE_SIZE];
+
+		pthread_mutex_unlock(&cache->lock);
+		makeThumbnail(cache, &cache->entries[index]);
+		pthread_mutex_lock(&cache->lock);
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return NULL;
+}
+
+// Append an entry for path, which is romDir/name or archive:name
+static void addEntry(struct ThumbnailCache *cache, uint32_t *capacity, const char *romDir, char separator, const char *name)
+{
+	if (cache->count == *capacity) {
+		uint32_t grown = *capacity ? *capacity * 2 : 64;
+		struct Thumbnail *entries = realloc(cache->entries, grown * sizeof(struct Thumbnail));
+		if (entries == NULL)
+			return;
+		cache->entries = entries;
+		*capacity = grown;
+	}
+
+	struct Thumbnail *entry = &cache->entries[cache->count++];
+	snprintf(entry->path, sizeof(entry->path), "%s%c%s", romDir, separator, name);
+	entry->name = NULL;
+	atomic_init(&entry->state, THUMB_NONE);
+}
+
+struct ArchiveListing {
+	struct ThumbnailCache *cache;
+	uint32_t *capacity;
+	const char *archive;
+};
+
+static void addArchiveEntry(void *user, const char *name, uint32_t size)
+{
+	struct ArchiveListing *listing = (struct ArchiveListing*)user;
+	(void)size;
+	addEntry(listing->cache, listing->capacity, listing->archive, ARCHIVE_SEPARATOR, name);
+}
+
+// File name part of an entry path, archive entries may sit in folders of their own
+static const char* entryName(const char *path)
+{
+	const char *separator = strrchr(path, ARCHIVE_SEPARATOR);
+	const char *slash = strrchr(path, '/');
+	if (slash == NULL || (separator != NULL && separator > slash))
+		slash = separator;
+	return slash ? slash + 1 : path;
+}
+
+// File name order, name itself is only set after sorting as qsort moves the entries
+static int byName(const void *a, const void *b)
+{
+	return strcmp(entryName(((const struct Thumbnail*)a)->path), entryName(((const struct Thumbnail*)b)->path));
+}
+
+// Fill entries from romDir sorted by file name, false if it can't be read
+static bool listEntries(struct ThumbnailCache *cache)
+{
+	const char *romDir = cache->romDir;
+	uint32_t capacity = 0;
+
+	if (isRomArchivePath(romDir)) {
+		// A zip pack is listed from its cached index, nothing is extracted
+		struct ArchiveListing listing = { cache, &capacity, romDir };
+		if (!listRomArchive(romDir, addArchiveEntry, &listing)) {
+			free(cache->entries);
+			cache->entries = NULL;
+			cache->count = 0;
+			return false;
+		}
+	} else {
+		DIR *dir = opendir(romDir);
+		if (dir == NULL)
+			return false;
+		for (struct dirent *item = readdir(dir); item != NULL; item = readdir(dir)) {
+			if (isRomName(item->d_name))
+				addEntry(cache, &capacity, romDir, '/', item->d_name);
+		}
+		closedir(dir);
+	}
+
+	// Names point into the paths, so they are set once the entries stop moving
+	if (cache->count > 0)
+		qsort(cache->entries, cache->count, sizeof(struct Thumbnail), byName);
+	for (uint32_t i = 0; i < cache->count; i++)
+		cache->entries[i].name = entryName(cache->entries[i].path);
+
+	if (!findCacheDir(cache->cacheDir))
+		cache->cacheDir[0] = '\0';
+	return true;
+}
+
+bool openThumbnailCache(struct ThumbnailCache *cache, const char *romDir)
+{
+	memset(cache, 0, sizeof(*cache));
+	atomic_init(&cache->listing, THUMB_LISTING);
+	int length = snprintf(cache->romDir, sizeof(cache->romDir), "%s", romDir);
+	if (length < 0 || (size_t)length >= sizeof(cache->romDir)) {
+		atomic_store(&cache->listing, THUMB_UNREADABLE);
+		return false;
+	}
+
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->wake, NULL);
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int workers = (cores > 1) ? (int)cores - 1 : 1;
+	if (workers > THUMB_MAX_WORKERS)
+		workers = THUMB_MAX_WORKERS;
+	for (int i = 0; i < workers; i++) {
+		if (pthread_create(&cache->workers[cache->workerCount], NULL, runThumbnailWorker, cache) == 0)
+			cache->workerCount++;
+	}
+	cache->open = true;
+
+	// No worker to hand it to, list here and let thumbnails wait
+	if (cache->workerCount == 0) {
+		cache->listingTaken = true;
+		bool listed = listEntries(cache);
+		atomic_store_explicit(&cache->listing, listed ? THUMB_LISTED : THUMB_UNREADABLE, memory_order_release);
+	}
+	return true;
+}
+
+void closeThumbnailCache(struct ThumbnailCache *cache)
+{
+	if (!cache->open)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	cache->stopping = true;
+	pthread_cond_broadcast(&cache->wake);
+	pthread_mutex_unlock(&cache->lock);
+
+	for (int i = 0; i < cache->workerCount; i++)
+		pthread_join(cache->workers[i], NULL);
+
+	pthread_cond_destroy(&cache->wake);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->count = 0;
+	cache->open = false;
+}
+
+void requestThumbnail(struct ThumbnailCache *cache, uint32_t index)
+{
+	if (atomic_load_explicit(&cache->listing, memory_order_acquire) != THUMB_LISTED || index >= cache->count)
+		return;
+
+	struct Thumbnail *entry = &cache->entries[index];
+	int expected = THUMB_NONE;
+	if (!atomic_compare_exchange_strong(&entry->state, &expected, THUMB_QUEUED))
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	if (cache->queueLength == THUMB_QUEUE_SIZE) {
+		// Scrolled far past it, it is asked for again if it comes back into view
+		atomic_store(&cache->entries[cache->queue[cache->queueStart]].state, THUMB_NONE);
+		cache->queueStart = (cache->queueStart + 1) % THUMB_QUEUE_SIZE;
+		cache->queueLength--;
+	}
+	cache->queue[(cache->queueStart + cache->queueLength) % THUMB_QUEUE_SIZE] = index;
+	cache->queueLength++;
+	pthread_cond_signal(&cache->wake);
+	pthread_mutex_unlock(&cache->lock);
+}
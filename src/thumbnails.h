@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "emulator.h"
+
+#define THUMB_BYTES (VIDEO_SIZE / 8)	// 1bpp, row major, most significant bit first
+#define THUMB_FRAMES 750				// 60 Hz frames of CYCLES_PER_TICK run headless per ROM
+#define THUMB_SAMPLE_EVERY 10			// frames between candidate captures
+#define THUMB_MAX_WORKERS 4
+#define THUMB_QUEUE_SIZE 256			// oldest requests are forgotten beyond this
+#define THUMB_PATH_SIZE 512
+
+enum ThumbState {
+	THUMB_NONE,
+	THUMB_QUEUED,
+	THUMB_READY,
+	THUMB_FAILED
+};
+
+enum ThumbListing {
+	THUMB_LISTING,
+	THUMB_LISTED,
+	THUMB_UNREADABLE
+};
+
+struct Thumbnail {
+	char path[THUMB_PATH_SIZE];
+	const char *name;				// file name part of path
+	atomic_int state;
+	uint8_t pixels[THUMB_BYTES];	// valid once state is THUMB_READY
+};
+
+// ROM directory listing with thumbnails made on demand by a worker pool
+// A worker lists and sorts the directory first, so opening a large one doesn't stall
+// the UI thread, which waits for listing to leave THUMB_LISTING. It then asks for the
+// entries it shows with requestThumbnail(), newest requests are served first so
+// scrolling always fills the visible rows next. Each thumbnail is
+// the busiest of several frames captured over the first seconds of a headless run and
+// is cached on disk by ROM hash, so a later launch only reads it back.
+struct ThumbnailCache {
+	struct Thumbnail *entries;		// entries and count are read once listing is THUMB_LISTED
+	uint32_t count;
+	atomic_int listing;				// enum ThumbListing
+	char romDir[THUMB_PATH_SIZE];
+	char cacheDir[THUMB_PATH_SIZE];	// empty if the path didn't fit, nothing is cached then
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	uint32_t queue[THUMB_QUEUE_SIZE];	// ring of entry indices, served newest first
+	uint32_t queueStart;
+	uint32_t queueLength;
+	bool listingTaken;				// a worker is listing or has listed romDir
+	bool stopping;
+
+	pthread_t workers[THUMB_MAX_WORKERS];
+	int workerCount;
+	bool open;						// lock, wake and workers exist, an empty folder has no entries
+};
+
+// Start the workers listing the ROMs in romDir, a folder or a zip pack. Returns false if
+// the path is too long, a directory that can't be read ends up THUMB_UNREADABLE.
+bool openThumbnailCache(struct ThumbnailCache *cache, const char *romDir);
+
+// Stop the workers and free the listing
+void closeThumbnailCache(struct ThumbnailCache *cache);
+
+// UI thread: make sure the thumbnail of entry index is on its way, once listed
+void requestThumbnail(struct ThumbnailCache *cache, uint32_t index);
+
+// Headless capture used by the workers, false if the ROM doesn't fit in memory
+bool renderThumbnail(const uint8_t *rom, size_t size, uint8_t *pixels);
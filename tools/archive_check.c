@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#ifdef CHIPPY_ZLIB
+#include <zlib.h>
+#endif
+#include "emulator.h"
+#include "rom_archive.h"
+#include "crc32.h"
+
+// ROM pack reader check
+// Writes zip and gzip files to /tmp and reads them back through readRomImage() and
+// listRomArchive(): stored and deflated entries, a bare zip meaning its first ROM, a
+// missing entry, entries of exactly MAX_ROM_SIZE bytes and one byte more, a bad CRC,
+// .gz files, and central directories that are truncated, overrun or corrupt. Deflated
+// data is written as stored deflate blocks so no compressor is needed, with zlib one
+// entry is also really compressed. Without zlib every deflated read has to fail cleanly.
+//
+// usage: archive_check
+
+#define ARCHIVE_BUFFER 65536
+#define SMALL_SIZE 100
+#define MEDIUM_SIZE 700
+#define LIMIT MAX_ROM_SIZE
+
+#ifdef CHIPPY_ZLIB
+#define INFLATED(size) (size)
+#else
+#define INFLATED(size) -1L
+#endif
+
+enum Method {
+	STORED = 0,
+	DEFLATED = 8,			// as stored deflate blocks
+	COMPRESSED = 9			// deflated by zlib, written with method 8
+};
+
+struct Entry {
+	const char *name;
+	const uint8_t *data;
+	uint32_t size;
+	enum Method method;
+	bool badCrc;
+};
+
+struct Zip {
+	uint8_t bytes[ARCHIVE_BUFFER];
+	size_t size;
+	size_t directory;		// offset of the central directory
+	size_t end;				// offset of the end record
+};
+
+static int failures;
+static int checks;
+static int fileCount;
+static char paths[32][128];
+
+static void expect(bool ok, const char *what)
+{
+	checks++;
+	if (!ok) {
+		fprintf(stderr, "FAIL %s\n", what);
+		failures++;
+	}
+}
+
+static void put16(uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+	put16(p, value);
+	put16(p + 2, value >> 16);
+}
+
+static void fill(uint8_t *data, size_t size, uint32_t seed)
+{
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 1103515245u + 12345u;
+		data[i] = (i % 7 < 3) ? (uint8_t)(seed >> 16) : (uint8_t)i;
+	}
+}
+
+// Raw deflate of stored blocks, valid input for any inflater
+static size_t storeDeflate(const uint8_t *data, size_t size, uint8_t *out)
+{
+	size_t length = 0;
+	do {
+		size_t block = size > 65535 ? 65535 : size;
+		out[length] = block == size;		// BFINAL on the last block, BTYPE 00
+		put16(out + length + 1, (uint32_t)block);
+		put16(out + length + 3, (uint32_t)~block);
+		memcpy(out + length + 5, data, block);
+		length += 5 + block;
+		data += block;
+		size -= block;
+	} while (size > 0);
+	return length;
+}
+
+static size_t compressEntry(const struct Entry *entry, uint8_t *out, size_t capacity)
+{
+	if (entry->method == STORED) {
+		memcpy(out, entry->data, entry->size);
+		return entry->size;
+	}
+#ifdef CHIPPY_ZLIB
+	if (entry->method == COMPRESSED) {
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+		stream.next_in = (Bytef*)entry->data;
+		stream.avail_in = entry->size;
+		stream.next_out = out;
+		stream.avail_out = (uInt)capacity;
+		deflate(&stream, Z_FINISH);
+		size_t length = stream.total_out;
+		deflateEnd(&stream);
+		return length;
+	}
+#else
+	(void)capacity;
+#endif
+	return storeDeflate(entry->data, entry->size, out);
+}
+
+static void buildZip(struct Zip *zip, const struct Entry *entries, int count)
+{
+	uint32_t offsets[16], crcs[16], compressed[16];
+	uint8_t *p = zip->bytes;
+
+	for (int i = 0; i < count; i++) {
+		const struct Entry *entry = &entries[i];
+		size_t nameLength = strlen(entry->name);
+		offsets[i] = (uint32_t)(p - zip->bytes);
+		crcs[i] = updateCrc32(0, entry->data, entry->size) ^ (entry->badCrc ? 1 : 0);
+		compressed[i] = (uint32_t)compressEntry(entry, p + 30 + nameLength, ARCHIVE_BUFFER / 2);
+
+		put32(p, 0x04034B50u);
+		put16(p + 4, 20);
+		put16(p + 6, 0);
+		put16(p + 8, entry->method == STORED ? 0 : 8);
+		put32(p + 10, 0x00210000u);
+		put32(p + 14, crcs[i]);
+		put32(p + 18, compressed[i]);
+		put32(p + 22, entry->size);
+		put16(p + 26, (uint32_t)nameLength);
+		put16(p + 28, 0);
+		memcpy(p + 30, entry->name, nameLength);
+		p += 30 + nameLength + compressed[i];
+	}
+
+	zip->directory = (size_t)(p - zip->bytes);
+	for (int i = 0; i < count; i++) {
+		const struct Entry *entry = &entries[i];
+		size_t nameLength = strlen(entry->name);
+		memset(p, 0, 46);
+		put32(p, 0x02014B50u);
+		put16(p + 4, 20);
+		put16(p + 6, 20);
+		put16(p + 10, entry->method == STORED ? 0 : 8);
+		put32(p + 12, 0x00210000u);
+		put32(p + 16, crcs[i]);
+		put32(p + 20, compressed[i]);
+		put32(p + 24, entry->size);
+		put16(p + 28, (uint32_t)nameLength);
+		put32(p + 42, offsets[i]);
+		memcpy(p + 46, entry->name, nameLength);
+		p += 46 + nameLength;
+	}
+
+	zip->end = (size_t)(p - zip->bytes);
+	memset(p, 0, 22);
+	put32(p, 0x06054B50u);
+	put16(p + 8, (uint32_t)count);
+	put16(p + 10, (uint32_t)count);
+	put32(p + 12, (uint32_t)(zip->end - zip->directory));
+	put32(p + 16, (uint32_t)zip->directory);
+	zip->size = zip->end + 22;
+}
+
+// Each case gets a file of its own, the archive index cache is keyed by path
+static const char* writeFile(const char *name, const uint8_t *data, size_t size)
+{
+	char *path = paths[fileCount++];
+	snprintf(path, sizeof(paths[0]), "/tmp/chippy-archive-%d-%s", (int)getpid(), name);
+	FILE *file = fopen(path, "wb");
+	bool ok = file != NULL && fwrite(data, 1, size, file) == size;
+	if (file != NULL)
+		ok = fclose(file) == 0 && ok;
+	expect(ok, path);
+	return path;
+}
+
+static long readEntry(const char *archive, const char *entry, uint8_t *data, size_t capacity)
+{
+	char path[256];
+	if (entry != NULL)
+		snprintf(path, sizeof(path), "%s%c%s", archive, ARCHIVE_SEPARATOR, entry);
+	else
+		snprintf(path, sizeof(path), "%s", archive);
+	return readRomImage(path, data, capacity);
+}
+
+struct Listing {
+	char names[16][ARCHIVE_NAME_SIZE];
+	uint32_t sizes[16];
+	int count;
+};
+
+static void listEntry(void *user, const char *name, uint32_t size)
+{
+	struct Listing *listing = (struct Listing*)user;
+	if (listing->count < 16) {
+		snprintf(listing->names[listing->count], ARCHIVE_NAME_SIZE, "%s", name);
+		listing->sizes[listing->count] = size;
+	}
+	listing->count++;
+}
+
+// Read name back and compare it with what was written, expected is the size readRomImage() should return
+static void checkRead(const char *archive, const char *name, const uint8_t *original, long expected, const char *what)
+{
+	static uint8_t data[LIMIT + 1];
+	memset(data, 0xAA, sizeof(data));
+	long size = readEntry(archive, name, data, LIMIT);
+	bool ok = size == expected;
+	if (ok && expected > 0)
+		ok = memcmp(data, original, expected <= LIMIT ? (size_t)expected : LIMIT) == 0;
+	if (!ok)
+		fprintf(stderr, "%s: got %ld, expected %ld\n", what, size, expected);
+	expect(ok, what);
+}
+
+static void checkPack(void)
+{
+	static uint8_t small[SMALL_SIZE], medium[MEDIUM_SIZE], exact[LIMIT], over[LIMIT + 1], text[40];
+	fill(small, sizeof(small), 1);
+	fill(medium, sizeof(medium), 2);
+	fill(exact, sizeof(exact), 3);
+	fill(over, sizeof(over), 4);
+	fill(text, sizeof(text), 5);
+
+	const struct Entry entries[] = {
+		{ "a.ch8", small, SMALL_SIZE, STORED, false },
+		{ "dir/b.c8", medium, MEDIUM_SIZE, DEFLATED, false },
+		{ "UPPER.CH8", small, 10, STORED, false },
+		{ "exact.ch8", exact, LIMIT, STORED, false },
+		{ "exact-deflated.ch8", exact, LIMIT, DEFLATED, false },
+		{ "over.ch8", over, LIMIT + 1, STORED, false },
+		{ "over-deflated.ch8", over, LIMIT + 1, DEFLATED, false },
+		{ "bad-crc.ch8", small, SMALL_SIZE, STORED, true },
+		{ "notes.txt", text, sizeof(text), STORED, false },
+#ifdef CHIPPY_ZLIB
+		{ "packed.ch8", medium, MEDIUM_SIZE, COMPRESSED, false },
+#endif
+	};
+	static struct Zip zip;
+	buildZip(&zip, entries, sizeof(entries) / sizeof(entries[0]));
+	const char *pack = writeFile("pack.zip", zip.bytes, zip.size);
+
+	// Sorted by name, only ROMs, the bad CRC only shows on reading
+	static const char *sorted[] = { "UPPER.CH8", "a.ch8", "bad-crc.ch8", "dir/b.c8", "exact-deflated.ch8", "exact.ch8",
+		"over-deflated.ch8", "over.ch8",
+#ifdef CHIPPY_ZLIB
+		"packed.ch8",
+#endif
+	};
+	int expected = sizeof(sorted) / sizeof(sorted[0]);
+	struct Listing listing = { .count = 0 };
+	bool listed = listRomArchive(pack, listEntry, &listing) && listing.count == expected;
+	for (int i = 0; listed && i < expected; i++)
+		listed = strcmp(listing.names[i], sorted[i]) == 0;
+	expect(listed, "zip: ROM entries listed in name order");
+	expect(listed && listing.sizes[0] == 10 && listing.sizes[7] == LIMIT + 1, "zip: listed sizes");
+
+	checkRead(pack, "a.ch8", small, SMALL_SIZE, "zip: stored entry");
+	checkRead(pack, "dir/b.c8", medium, INFLATED(MEDIUM_SIZE), "zip: deflated entry in a folder");
+	checkRead(pack, "exact.ch8", exact, LIMIT, "zip: stored entry of exactly MAX_ROM_SIZE");
+	checkRead(pack, "exact-deflated.ch8", exact, INFLATED(LIMIT), "zip: deflated entry of exactly MAX_ROM_SIZE");
+	checkRead(pack, "over.ch8", over, LIMIT + 1, "zip: stored entry one byte too large");
+	checkRead(pack, "over-deflated.ch8", over, INFLATED(LIMIT + 1), "zip: deflated entry one byte too large");
+	checkRead(pack, "bad-crc.ch8", small, -1, "zip: entry with a bad CRC");
+	checkRead(pack, "nope.ch8", NULL, -1, "zip: missing entry");
+	checkRead(pack, "notes.txt", NULL, -1, "zip: entry that isn't a ROM");
+	checkRead(pack, NULL, small, 10, "zip: bare archive reads its first ROM by name");
+#ifdef CHIPPY_ZLIB
+	checkRead(pack, "packed.ch8", medium, MEDIUM_SIZE, "zip: entry compressed by zlib");
+#endif
+}
+
+static void checkGzip(void)
+{
+	static uint8_t rom[LIMIT + 1], file[LIMIT + 64];
+	fill(rom, sizeof(rom), 6);
+
+	static const uint32_t sizes[] = { 300, LIMIT, LIMIT + 1 };
+	static const char *names[] = { "game.ch8.gz", "exact.ch8.gz", "over.ch8.gz" };
+	for (int i = 0; i < 3; i++) {
+		static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 3 };
+		memcpy(file, header, sizeof(header));
+		size_t length = sizeof(header) + storeDeflate(rom, sizes[i], file + sizeof(header));
+		put32(file + length, updateCrc32(0, rom, sizes[i]));
+		put32(file + length + 4, sizes[i]);
+		const char *path = writeFile(names[i], file, length + 8);
+
+		checkRead(path, NULL, rom, INFLATED((long)sizes[i]), names[i]);
+
+		// Cut inside the deflate stream, the ROM never ends
+		if (i == 0) {
+			path = writeFile("cut.ch8.gz", file, length / 2);
+			checkRead(path, NULL, rom, -1, "gzip: truncated stream");
+		}
+	}
+}
+
+static void checkCorrupt(void)
+{
+	static uint8_t x[64], y[80];
+	fill(x, sizeof(x), 7);
+	fill(y, sizeof(y), 8);
+	const struct Entry entries[] = {
+		{ "x.ch8", x, sizeof(x), STORED, false },
+		{ "y.ch8", y, sizeof(y), STORED, false },
+	};
+	static struct Zip zip, changed;
+	buildZip(&zip, entries, 2);
+	size_t second = zip.directory + 46 + strlen("x.ch8");
+	struct Listing listing;
+	const char *path;
+
+	// The control: the same archive untouched lists both
+	path = writeFile("good.zip", zip.bytes, zip.size);
+	listing.count = 0;
+	expect(listRomArchive(path, listEntry, &listing) && listing.count == 2, "corrupt: intact archive lists both entries");
+
+	// Cut in the middle of the central directory, the end record is gone
+	path = writeFile("cut.zip", zip.bytes, zip.directory + 20);
+	listing.count = 0;
+	expect(!listRomArchive(path, listEntry, &listing), "corrupt: truncated central directory isn't listed");
+	checkRead(path, "x.ch8", x, -1, "corrupt: entry of a truncated archive");
+
+	// End record claims a directory reaching past the file
+	changed = zip;
+	put32(changed.bytes + changed.end + 12, (uint32_t)(zip.end - zip.directory + 100));
+	path = writeFile("overrun.zip", changed.bytes, changed.size);
+	expect(!listRomArchive(path, listEntry, &listing), "corrupt: directory past the end of the file isn't listed");
+
+	// A broken signature on the second record ends the directory there
+	changed = zip;
+	put32(changed.bytes + second, 0x12345678u);
+	path = writeFile("signature.zip", changed.bytes, changed.size);
+	listing.count = 0;
+	expect(listRomArchive(path, listEntry, &listing) && listing.count == 1, "corrupt: records after a bad signature are dropped");
+	checkRead(path, "x.ch8", x, sizeof(x), "corrupt: entry before a bad record still reads");
+	checkRead(path, "y.ch8", y, -1, "corrupt: entry behind a bad record");
+
+	// A name running past the directory ends it before that record
+	changed = zip;
+	put16(changed.bytes + zip.directory + 28, 0xFFFF);
+	path = writeFile("name.zip", changed.bytes, changed.size);
+	listing.count = 0;
+	expect(listRomArchive(path, listEntry, &listing) && listing.count == 0, "corrupt: record overrunning the directory");
+	checkRead(path, NULL, x, -1, "corrupt: bare archive without readable entries");
+
+	// More entries claimed than there are records
+	changed = zip;
+	put16(changed.bytes + changed.end + 10, 200);
+	path = writeFile("count.zip", changed.bytes, changed.size);
+	listing.count = 0;
+	expect(listRomArchive(path, listEntry, &listing) && listing.count == 2, "corrupt: entry count larger than the directory");
+
+	// A local header offset pointing into the other entry's data
+	changed = zip;
+	put32(changed.bytes + second + 42, 40);
+	path = writeFile("offset.zip", changed.bytes, changed.size);
+	checkRead(path, "y.ch8", y, -1, "corrupt: local header offset off its header");
+
+	// Too short to hold an end record
+	path = writeFile("tiny.zip", zip.bytes, 10);
+	expect(!listRomArchive(path, listEntry, &listing), "corrupt: file shorter than an end record");
+}
+
+static void checkPlain(void)
+{
+	static uint8_t rom[LIMIT + 1];
+	fill(rom, sizeof(rom), 9);
+	checkRead(writeFile("exact.ch8", rom, LIMIT), NULL, rom, LIMIT, "plain: file of exactly MAX_ROM_SIZE");
+	checkRead(writeFile("over.ch8", rom, LIMIT + 1), NULL, rom, LIMIT + 1, "plain: file one byte too large");
+	checkRead("/tmp/chippy-archive-missing.ch8", NULL, rom, -1, "plain: missing file");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 1;
+	}
+
+	checkPack();
+	checkGzip();
+	checkCorrupt();
+	checkPlain();
+	for (int i = 0; i < fileCount; i++)
+		remove(paths[i]);
+
+#ifdef CHIPPY_ZLIB
+	const char *inflater = "zlib";
+#else
+	const char *inflater = "no zlib";
+#endif
+	printf("archive: %d checks, %d failed (%s)\n", checks, failures, inflater);
+	return failures == 0 ? 0 : 1;
+}
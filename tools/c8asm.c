@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assembler.h"
+#include "emulator.h"
+
+// CHIP-8 assembler front end, see src/assembler.h for the syntax
+//
+// usage: c8asm source.asm [rom.ch8]
+// The ROM defaults to the source name with .ch8 in place of its extension.
+
+int main(int argc, char **argv)
+{
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "usage: %s source.asm [rom.ch8]\n", argv[0]);
+		return 1;
+	}
+
+	FILE *file = fopen(argv[1], "rb");
+	if (file == NULL) {
+		printf("Error while opening file\n%s\n", argv[1]);
+		return 1;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	rewind(file);
+	char *source = calloc(length + 1, 1);
+	size_t read = fread(source, 1, length, file);
+	fclose(file);
+	source[read] = '\0';
+
+	uint8_t rom[MAX_ROM_SIZE];
+	char error[256];
+	int size = assembleChip8(source, rom, sizeof(rom), error, sizeof(error));
+	free(source);
+	if (size < 0) {
+		fprintf(stderr, "%s: %s\n", argv[1], error);
+		return 1;
+	}
+
+	char output[1024];
+	if (argc == 3) {
+		snprintf(output, sizeof(output), "%s", argv[2]);
+	} else {
+		snprintf(output, sizeof(output), "%s", argv[1]);
+		char *extension = strrchr(output, '.');
+		char *slash = strrchr(output, '/');
+		if (extension != NULL && (slash == NULL || extension > slash))
+			*extension = '\0';
+		strncat(output, ".ch8", sizeof(output) - strlen(output) - 1);
+	}
+
+	file = fopen(output, "wb");
+	if (file == NULL || fwrite(rom, 1, size, file) != (size_t)size || fclose(file) != 0) {
+		fprintf(stderr, "could not write %s\n", output);
+		return 1;
+	}
+	printf("%s: %d bytes\n", output, size);
+	return 0;
+}
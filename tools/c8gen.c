@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include "assembler.h"
+#include "emulator.h"
+#include "fingerprint.h"
+#include "pacer.h"
+
+// Synthetic workload generator
+// Writes assembly for ROMs that stress one interpreter path each and assembles it:
+//   alu     unrolled 8XYN/7XNN/6XNN arithmetic with skips in a counted loop
+//   draw    DXYN storm over the whole screen with tall sprites, cleared every 256 passes
+//   call    2NNN/00EE recursion 15 levels deep plus a fan of leaf subroutines
+//   memory  FX33/FX55/FX65 walking a buffer through FX1E
+//   smc     code that rewrites its own immediates, opcodes and a fused 3XNN;1NNN pair
+// Every ROM loops forever without input, the same seed always gives the same bytes.
+//
+// usage: c8gen [--seed S] [--length N] [--out DIR] [--check] [workload...]
+//
+// --length is the number of generated instructions in unrolled loop bodies. Each workload
+// takes as many as its worst case ROM still fits in MAX_ROM_SIZE bytes for, it fails with
+// that limit beyond it.
+// --check runs every ROM headless and fails if it faults, the targeted instructions are
+// less than their expected share of all executed ones or the state fingerprint drifted
+// from a full rehash, then times the fused core on it without frame pacing.
+
+#define DEFAULT_SEED 0xC8C8u
+#define DEFAULT_LENGTH 64
+#define SOURCE_SIZE 65536
+#define CHECK_FRAMES 600
+#define BENCH_INSTRUCTIONS 2000000
+
+struct Source {
+	char text[SOURCE_SIZE];
+	size_t length;
+};
+
+struct Workload {
+	const char *name;
+	void (*generate)(struct Source *source, uint32_t *rng, int length);
+	bool (*targets)(uint16_t opcode);	// instructions the workload is meant to stress
+	double minimumShare;
+	int fixedBytes;						// worst case ROM size is fixedBytes + bytesPerLength * length
+	int bytesPerLength;
+};
+
+static void emitf(struct Source *source, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(source->text + source->length, sizeof(source->text) - source->length, format, args);
+	va_end(args);
+	if (written > 0)
+		source->length += (size_t)written;
+	if (source->length >= sizeof(source->text))
+		source->length = sizeof(source->text) - 1;
+}
+
+static uint32_t nextRandom(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static unsigned int pick(uint32_t *rng, unsigned int count)
+{
+	return nextRandom(rng) % count;
+}
+
+// V0-VC are scratch, VD and VE count loop passes
+static void generateAlu(struct Source *source, uint32_t *rng, int length)
+{
+	static const char *binary[] = { "ADD", "SUB", "SUBN", "OR", "AND", "XOR", "LD" };
+
+	emitf(source, "; ALU heavy\n");
+	for (int r = 0; r < 13; r++)
+		emitf(source, "\tLD V%X, %u\n", r, pick(rng, 256));
+	emitf(source, "loop:\n");
+	for (int i = 0; i < length; i++) {
+		unsigned int x = pick(rng, 13), y = pick(rng, 13);
+		switch (pick(rng, 6)) {
+		case 0: case 1: case 2:
+			emitf(source, "\t%s V%X, V%X\n", binary[pick(rng, 7)], x, y);
+			break;
+		case 3:
+			emitf(source, "\t%s V%X\n", pick(rng, 2) ? "SHR" : "SHL", x);
+			break;
+		case 4:
+			emitf(source, "\tADD V%X, %u\n", x, pick(rng, 256));
+			break;
+		case 5:
+			// A taken skip jumps over the next ALU instruction, never off the body
+			emitf(source, "\t%s V%X, %s\n", pick(rng, 2) ? "SE" : "SNE", x, pick(rng, 2) ? "V1" : "0x80");
+			emitf(source, "\tXOR V%X, V%X\n", y, x);
+			break;
+		}
+	}
+	emitf(source, "\tADD VE, 1\n\tSE VE, 0\n\tJP loop\n\tADD VD, 1\n\tJP loop\n");
+}
+
+static void generateDraw(struct Source *source, uint32_t *rng, int length)
+{
+	emitf(source, "; DXYN heavy\n\tLD I, sprite\n\tLD VE, 0\nloop:\n");
+	for (int i = 0; i < length; i++) {
+		unsigned int x = pick(rng, 6) * 2, y = x + 1;
+		emitf(source, "\tDRW V%X, V%X, %u\n", x, y, 8 + pick(rng, 8));
+		if (pick(rng, 3) == 0)
+			emitf(source, "\tADD V%X, %u\n\tADD V%X, %u\n", x, 1 + pick(rng, 63), y, 1 + pick(rng, 31));
+	}
+	emitf(source, "\tADD VE, 1\n\tSE VE, 0\n\tJP loop\n\tCLS\n\tJP loop\nsprite:\n\tDB ");
+	for (int i = 0; i < 15; i++)
+		emitf(source, "%s0x%02X", i ? ", " : "", pick(rng, 256));
+	emitf(source, "\n");
+}
+
+static void generateCall(struct Source *source, uint32_t *rng, int length)
+{
+	int leaves = length / 4 + 1;
+
+	emitf(source, "; 2NNN/00EE heavy\nloop:\n\tLD V0, 15\n\tCALL recurse\n");
+	for (int i = 0; i < length; i++)
+		emitf(source, "\tCALL leaf%u\n", pick(rng, leaves));
+	emitf(source, "\tADD VE, 1\n\tJP loop\n");
+
+	// 15 levels counting the loop's own CALL, one short of the 16 entry stack
+	emitf(source, "recurse:\n\tADD V1, V0\n\tADD V0, -1\n\tSE V0, 0\n\tCALL recurse\n\tRET\n");
+	for (int i = 0; i < leaves; i++)
+		emitf(source, "leaf%d:\n\tADD V%X, %u\n\tRET\n", i, 2 + pick(rng, 12), 1 + pick(rng, 255));
+}
+
+static void generateMemory(struct Source *source, uint32_t *rng, int length)
+{
+	// The buffer is free memory after the ROM, I stays below buffer + 255 + 16
+	emitf(source, "; FX33/FX55/FX65 heavy\nloop:\n");
+	for (int i = 0; i < length; i++) {
+		unsigned int x = pick(rng, 16);
+		emitf(source, "\tLD I, buffer\n\tADD I, VE\n");
+		switch (pick(rng, 3)) {
+		case 0:
+			emitf(source, "\tLD B, V%X\n", x);
+			break;
+		case 1:
+			emitf(source, "\tLD [I], V%X\n", x);
+			break;
+		case 2:
+			emitf(source, "\tLD V%X, [I]\n", pick(rng, 14));
+			break;
+		}
+		emitf(source, "\tADD VE, %u\n", 1 + pick(rng, 7));
+	}
+	emitf(source, "\tJP loop\nbuffer:\n");
+}
+
+static void generateSmc(struct Source *source, uint32_t *rng, int length)
+{
+	emitf(source, "; Self-modifying code\n\tLD V6, 0x10\t; ADD VX, NN <-> LD VX, NN\nloop:\n");
+	for (int i = 0; i < length / 8 + 1; i++) {
+		unsigned int x = 7 + pick(rng, 6);
+
+		// Rewrite the immediate of an ADD that runs right after
+		emitf(source, "\tADD V2, %u\n\tLD V0, V2\n\tLD I, patch%d + 1\n\tLD [I], V0\n", 1 + pick(rng, 255), i);
+		emitf(source, "patch%d:\n\tADD V3, 0\n", i);
+
+		// Flip an instruction between ADD and LD
+		emitf(source, "\tLD I, flip%d\n\tLD V0, [I]\n\tXOR V0, V6\n\tLD [I], V0\n", i);
+		emitf(source, "flip%d:\n\tADD V%X, %u\n", i, x, 1 + pick(rng, 255));
+
+		// Change the compare of a fused skip and jump pair
+		emitf(source, "\tLD V0, V2\n\tLD I, pair%d + 1\n\tLD [I], V0\n", i);
+		emitf(source, "pair%d:\n\tSE V4, 0\n\tJP next%d\n\tADD V5, 1\nnext%d:\n", i, i, i);
+	}
+	emitf(source, "\tJP loop\n");
+}
+
+static bool isAlu(uint16_t opcode)
+{
+	uint8_t type = GET_INSTRUCTION_TYPE(opcode);
+	return type == 0x3 || type == 0x4 || type == 0x5 || type == 0x6 || type == 0x7 || type == 0x8 || type == 0x9;
+}
+
+static bool isDraw(uint16_t opcode)
+{
+	return GET_INSTRUCTION_TYPE(opcode) == 0xD;
+}
+
+static bool isCall(uint16_t opcode)
+{
+	return GET_INSTRUCTION_TYPE(opcode) == 0x2 || opcode == 0x00EE;
+}
+
+static bool isMemory(uint16_t opcode)
+{
+	uint8_t byte = GET_BYTE(opcode);
+	return GET_INSTRUCTION_TYPE(opcode) == 0xF && (byte == 0x33 || byte == 0x55 || byte == 0x65);
+}
+
+static bool isStore(uint16_t opcode)
+{
+	return GET_INSTRUCTION_TYPE(opcode) == 0xF && GET_BYTE(opcode) == 0x55;
+}
+
+// Sizes count what each generator can emit at most: a skip and its XOR, a draw and two
+// ADDs, a CALL and a quarter of a leaf, a step of the walk plus the 271 bytes the buffer
+// reaches past the ROM, an eighth of a rewrite block
+static const struct Workload workloads[] = {
+	{ "alu", generateAlu, isAlu, 0.80, 26 + 10, 4 },
+	{ "draw", generateDraw, isDraw, 0.50, 4 + 10 + 15, 6 },
+	{ "call", generateCall, isCall, 0.50, 4 + 4 + 10 + 4, 3 },
+	{ "memory", generateMemory, isMemory, 0.20, 2 + 255 + 16, 8 },
+	{ "smc", generateSmc, isStore, 0.10, 2 + 2 + 32, 4 },
+};
+
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+// Run the ROM like the emulation thread does and measure how much of it hit the target
+static bool checkWorkload(const struct Workload *workload, const uint8_t *rom, int size)
+{
+	struct Chip8 *chip = createEmulator();
+	uint64_t targeted = 0;
+
+	loadRomFromMemory(chip, rom, size);
+	loadFonts(chip);
+	seedEmulator(chip, DEFAULT_SEED);
+
+	for (int frame = 0; frame < CHECK_FRAMES && chip->fault == FAULT_NONE; frame++) {
+		uint64_t end = chip->instructions + CYCLES_PER_TICK;
+		while (chip->instructions < end) {
+			CycleSingle(chip);
+			targeted += workload->targets(chip->opcode);
+		}
+		updateTimers(chip);
+	}
+
+	double share = chip->instructions ? (double)targeted / (double)chip->instructions : 0;
+	bool ok = chip->fault == FAULT_NONE && share >= workload->minimumShare;
+
+	// Every workload writes memory or video, the incremental fingerprint must keep up
+	uint64_t fingerprint = stateFingerprint(chip);
+	rehashEmulator(chip);
+	if (stateFingerprint(chip) != fingerprint) {
+		printf("%s: fingerprint differs from a full rehash\n", workload->name);
+		ok = false;
+	}
+
+	// Timers still tick every CYCLES_PER_TICK so delay loops behave as in the check
+	uint64_t start = pacerNowNs();
+	uint64_t end = chip->instructions + BENCH_INSTRUCTIONS;
+	while (ok && chip->instructions < end && chip->fault == FAULT_NONE) {
+		uint64_t frameEnd = chip->instructions + CYCLES_PER_TICK;
+		while (chip->instructions < frameEnd)
+			Cycle(chip);
+		updateTimers(chip);
+	}
+	double seconds = (double)(pacerNowNs() - start) / 1e9;
+	double mips = ok && seconds > 0 ? BENCH_INSTRUCTIONS / seconds / 1e6 : 0;
+	ok = ok && chip->fault == FAULT_NONE;
+
+	printf("%-6s %5d bytes  %5.1f%% targeted (min %.0f%%)  %7.1f MIPS  %s%s%s\n", workload->name, size, 100 * share,
+		100 * workload->minimumShare, mips, ok ? "ok" : "FAIL", chip->fault ? " " : "", chip->fault ? faultName(chip->fault) : "");
+	releaseEmulator(chip);
+	free(chip);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t seed = DEFAULT_SEED;
+	int length = DEFAULT_LENGTH;
+	const char *outDir = NULL;
+	bool check = false;
+	int arg = 1;
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc)
+			seed = (uint32_t)strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "--length") == 0 && arg + 1 < argc)
+			length = atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "--out") == 0 && arg + 1 < argc)
+			outDir = argv[++arg];
+		else if (strcmp(argv[arg], "--check") == 0)
+			check = true;
+		else
+			break;
+	}
+	if ((outDir == NULL && !check) || length < 1 || (arg < argc && argv[arg][0] == '-')) {
+		fprintf(stderr, "usage: %s [--seed S] [--length N] [--out DIR] [--check] [workload...]\n", argv[0]);
+		return 1;
+	}
+
+	int failed = 0;
+	for (size_t w = 0; w < WORKLOAD_COUNT; w++) {
+		const struct Workload *workload = &workloads[w];
+		bool wanted = arg == argc;
+		for (int i = arg; i < argc; i++)
+			wanted = wanted || strcmp(argv[i], workload->name) == 0;
+		if (!wanted)
+			continue;
+
+		int maxLength = (MAX_ROM_SIZE - workload->fixedBytes) / workload->bytesPerLength;
+		if (length > maxLength) {
+			fprintf(stderr, "%s: ROM too large, --length is at most %d\n", workload->name, maxLength);
+			failed++;
+			continue;
+		}
+
+		// Each workload draws from its own stream so adding one doesn't change the others
+		static struct Source source;
+		uint32_t rng = (seed ? seed : 1) * 0x9E3779B9u + (uint32_t)w;
+		source.length = 0;
+		source.text[0] = '\0';
+		emitf(&source, "; c8gen %s --seed %u --length %d\n", workload->name, seed, length);
+		workload->generate(&source, &rng, length);
+
+		uint8_t rom[MAX_ROM_SIZE];
+		char error[256];
+		int size = assembleChip8(source.text, rom, sizeof(rom), error, sizeof(error));
+		if (size < 0) {
+			fprintf(stderr, "%s: %s\n", workload->name, error);
+			failed++;
+			continue;
+		}
+
+		if (outDir != NULL) {
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/bench_%s.asm", outDir, workload->name);
+			FILE *file = fopen(path, "w");
+			bool written = file != NULL && fwrite(source.text, 1, source.length, file) == source.length;
+			if (file != NULL)
+				written = (fclose(file) == 0) && written;
+
+			snprintf(path, sizeof(path), "%s/bench_%s.ch8", outDir, workload->name);
+			file = fopen(path, "wb");
+			written = written && file != NULL && fwrite(rom, 1, size, file) == (size_t)size;
+			if (file != NULL)
+				written = (fclose(file) == 0) && written;
+			if (!written) {
+				fprintf(stderr, "could not write %s\n", path);
+				failed++;
+				continue;
+			}
+		}
+
+		if (check)
+			failed += !checkWorkload(workload, rom, size);
+		else
+			printf("%-6s %5d bytes\n", workload->name, size);
+	}
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "png_writer.h"
+
+// Conformance runner
+// Runs the test ROMs headless for a fixed number of 60 Hz ticks, hashes the final memory
+// and display and compares against the golden file. A failing ROM gets <name>.diff.png in
+// the output directory: white = lit in both, green = only actual, red = only expected.
+//
+// usage: conformance [--update] [--threads N] [--out DIR] golden rom_dir [rom...]
+//
+// Golden lines are "name ticks hash display", display is the packed 1bpp screen in hex.
+// --update rewrites the hashes of every listed ROM and adds any ROM named after rom_dir.
+
+#define MAX_ROMS 64
+#define NAME_SIZE 128
+#define PATH_SIZE 512
+#define DEFAULT_TICKS 600
+#define ROM_SEED 0xC8C8C8C8u
+#define DISPLAY_BYTES (VIDEO_SIZE / 8)
+#define DIFF_SCALE 8
+
+struct Job {
+	char name[NAME_SIZE];
+	unsigned long ticks;
+	uint64_t expectedHash;
+	uint8_t expectedDisplay[DISPLAY_BYTES];
+
+	uint64_t hash;
+	uint8_t display[DISPLAY_BYTES];
+};
+
+static struct Job jobs[MAX_ROMS];
+static int jobCount;
+static atomic_int nextJob;
+static const char *romDir;
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t length)
+{
+	for (size_t i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+// Hashed as 1bpp so the golden files don't depend on how the core stores pixels
+static void packDisplay(const struct Chip8 *chip, uint8_t *out)
+{
+	memset(out, 0, DISPLAY_BYTES);
+	for (int i = 0; i < VIDEO_SIZE; i++) {
+		if (chip->video[i])
+			out[i / 8] |= 0x80 >> (i % 8);
+	}
+}
+
+static void runJob(struct Job *job)
+{
+	char path[PATH_SIZE];
+	struct Chip8 state;
+	struct Chip8 *chip = &state;
+
+	int length = snprintf(path, sizeof(path), "%s/%s", romDir, job->name);
+	if (length < 0 || (size_t)length >= sizeof(path)) {
+		fprintf(stderr, "%s/%s: path too long\n", romDir, job->name);
+		job->hash = 0;
+		return;
+	}
+
+	initEmulator(chip);
+	loadRom(chip, path);
+	loadFonts(chip);
+	seedEmulator(chip, ROM_SEED);
+
+	// Same scheduling as the emulation thread before a ROM is tuned, no keys are ever pressed
+	for (unsigned long tick = 0; tick < job->ticks; tick++) {
+		uint64_t end = chip->instructions + CYCLES_PER_TICK;
+		while (chip->instructions < end)
+			Cycle(chip);
+		updateTimers(chip);
+	}
+
+	packDisplay(chip, job->display);
+	job->hash = fnv1a(0xCBF29CE484222325ull, chip->memory, sizeof(chip->memory));
+	job->hash = fnv1a(job->hash, job->display, DISPLAY_BYTES);
+	releaseEmulator(chip);
+}
+
+static void* runWorker(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		int index = atomic_fetch_add(&nextJob, 1);
+		if (index >= jobCount)
+			return NULL;
+		runJob(&jobs[index]);
+	}
+}
+
+static int pixelAt(const uint8_t *display, int x, int y)
+{
+	int i = y * VIDEO_WIDTH + x;
+	return (display[i / 8] >> (7 - i % 8)) & 1;
+}
+
+static void writeDiff(const char *outDir, const struct Job *job)
+{
+	int width = VIDEO_WIDTH * DIFF_SCALE, height = VIDEO_HEIGHT * DIFF_SCALE;
+	uint8_t *rgb = calloc((size_t)width * height, 3);
+	char path[PATH_SIZE];
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int actual = pixelAt(job->display, x / DIFF_SCALE, y / DIFF_SCALE);
+			int expected = pixelAt(job->expectedDisplay, x / DIFF_SCALE, y / DIFF_SCALE);
+			uint8_t *pixel = rgb + ((size_t)y * width + x) * 3;
+
+			pixel[0] = expected ? 255 : 0;
+			pixel[1] = actual ? 255 : 0;
+			pixel[2] = actual && expected ? 255 : 0;
+		}
+	}
+
+	int length = snprintf(path, sizeof(path), "%s/%s.diff.png", outDir, job->name);
+	if (length < 0 || (size_t)length >= sizeof(path) || !writePng(path, rgb, width, height))
+		fprintf(stderr, "could not write %s\n", path);
+	else
+		printf("       diff written to %s\n", path);
+	free(rgb);
+}
+
+static int hexValue(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static struct Job* addJob(const char *name, unsigned long ticks)
+{
+	if (jobCount == MAX_ROMS) {
+		fprintf(stderr, "too many ROMs, at most %d\n", MAX_ROMS);
+		exit(1);
+	}
+
+	struct Job *job = &jobs[jobCount++];
+	memset(job, 0, sizeof(*job));
+	snprintf(job->name, sizeof(job->name), "%s", name);
+	job->ticks = ticks;
+	return job;
+}
+
+static int readGolden(const char *path, bool update)
+{
+	char line[NAME_SIZE + DISPLAY_BYTES * 2 + 64];
+	FILE *file = fopen(path, "r");
+
+	if (file == NULL)
+		return update;		// a new golden file is fine when updating
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char name[NAME_SIZE], display[DISPLAY_BYTES * 2 + 1];
+		unsigned long ticks;
+		unsigned long long hash;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%127s %lu %llx %512s", name, &ticks, &hash, display) != 4 || strlen(display) != DISPLAY_BYTES * 2) {
+			fprintf(stderr, "%s: malformed line: %s", path, line);
+			fclose(file);
+			return 0;
+		}
+
+		struct Job *job = addJob(name, ticks);
+		job->expectedHash = hash;
+		for (int i = 0; i < DISPLAY_BYTES; i++)
+			job->expectedDisplay[i] = (uint8_t)(hexValue(display[i * 2]) << 4 | hexValue(display[i * 2 + 1]));
+	}
+
+	fclose(file);
+	return 1;
+}
+
+static int writeGolden(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		return 0;
+
+	fprintf(file, "# name ticks hash display, regenerate with conformance --update\n");
+	for (int i = 0; i < jobCount; i++) {
+		fprintf(file, "%s %lu %016llx ", jobs[i].name, jobs[i].ticks, (unsigned long long)jobs[i].hash);
+		for (int j = 0; j < DISPLAY_BYTES; j++)
+			fprintf(file, "%02x", jobs[i].display[j]);
+		fprintf(file, "\n");
+	}
+
+	return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	bool update = false;
+	int threads = 4;
+	const char *outDir = ".";
+	int arg = 1;
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "--update") == 0)
+			update = true;
+		else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc)
+			threads = atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "--out") == 0 && arg + 1 < argc)
+			outDir = argv[++arg];
+		else
+			break;
+	}
+	if (arg + 2 > argc || threads < 1) {
+		fprintf(stderr, "usage: %s [--update] [--threads N] [--out DIR] golden rom_dir [rom...]\n", argv[0]);
+		return 1;
+	}
+
+	const char *goldenPath = argv[arg];
+	romDir = argv[arg + 1];
+
+	if (!readGolden(goldenPath, update)) {
+		fprintf(stderr, "could not read %s\n", goldenPath);
+		return 1;
+	}
+	for (int i = arg + 2; i < argc && update; i++)
+		addJob(argv[i], DEFAULT_TICKS);
+	if (jobCount == 0) {
+		fprintf(stderr, "no ROMs to run\n");
+		return 1;
+	}
+
+	if (threads > jobCount)
+		threads = jobCount;
+
+	pthread_t workers[MAX_ROMS];
+	for (int i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, runWorker, NULL);
+	for (int i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+
+	if (update) {
+		if (!writeGolden(goldenPath)) {
+			fprintf(stderr, "could not write %s\n", goldenPath);
+			return 1;
+		}
+		printf("updated %d ROMs in %s\n", jobCount, goldenPath);
+		return 0;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < jobCount; i++) {
+		struct Job *job = &jobs[i];
+
+		if (job->hash == job->expectedHash) {
+			printf("PASS   %s\n", job->name);
+			continue;
+		}
+
+		printf("FAIL   %s: hash %016llx, expected %016llx\n", job->name,
+			(unsigned long long)job->hash, (unsigned long long)job->expectedHash);
+		writeDiff(outDir, job);
+		failed++;
+	}
+
+	printf("%d/%d passed\n", jobCount - failed, jobCount);
+	return failed == 0 ? 0 : 1;
+}
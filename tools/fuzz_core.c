@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "emulator.h"
+#include "fingerprint.h"
+#include "fusion.h"
+#include "pacer.h"
+#include "rom_archive.h"
+
+// Coverage-guided fuzzing harness for the core
+// One input is a keypad script followed by a ROM:
+//   byte 0          script length n (taken modulo FUZZ_MAX_SCRIPT + 1)
+//   bytes 1..2n     n keypad bitmasks, little endian, frame f holds script[f % n]
+//   the rest        ROM image loaded at 0x200
+// Each input runs FUZZ_FRAMES frames of CYCLES_PER_TICK instructions. Runs share one
+// instance and only undo what the last one changed: the registers in front of video are
+// copied from a template, the memory pages guest stores touched and a lit display are
+// cleared back, and only the ROM bytes that differ from the last input are
+// written, with their fingerprint keys and superinstruction marks updated in place.
+//
+// One run in FUZZ_CHECK_EVERY, picked by input so a failing one fails on every replay,
+// also checks that the incrementally kept hashes and lit pixel count match a rehash and, if
+// the guest wrote to memory, every superinstruction mark still in use a fresh
+// analyzeFusion() scan, or the run aborts. Build with -DFUZZ_CHECK_EVERY=1 to check
+// every run, the replay driver below always does.
+//
+// Guest coverage (PC reached, opcode class executed, PC to PC edges between cycles) is
+// counted in guestCoverage, which libFuzzer reads from the __libfuzzer_extra_counters
+// section. Built with afl-cc the same counters are also folded into the AFL++ map.
+//
+// libFuzzer: cmake -DCMAKE_C_COMPILER=clang -DCHIPPY_FUZZ=ON, then fuzz_core corpus_dir
+// AFL++:     CC=afl-clang-fast cmake -DCHIPPY_FUZZ=ON, then afl-fuzz -i seeds -o out -- fuzz_core
+// Without either the driver below is built:
+//   fuzz_core file|dir...                 replay inputs, e.g. a crash found elsewhere
+//   fuzz_core --bench SECONDS [file|dir]  mutate the inputs for SECONDS, keeping the ones
+//                                         that reach new guest coverage, and report execs/s
+// .ch8 and .c8 files are read as a ROM with an empty script.
+
+#define FUZZ_MAX_SCRIPT 32
+#define FUZZ_FRAMES 60
+#define FUZZ_PAGE_SIZE 64			// granularity guest stores are undone at
+#ifndef FUZZ_CHECK_EVERY
+#define FUZZ_CHECK_EVERY 64
+#endif
+
+#define COVERAGE_PC 4096
+#define COVERAGE_OPCODES 4096		// instruction type and low byte
+#define COVERAGE_EDGES 65536		// hashed (previous PC, PC) pairs
+#define COVERAGE_SIZE (COVERAGE_PC + COVERAGE_OPCODES + COVERAGE_EDGES)
+
+__attribute__((section("__libfuzzer_extra_counters")))
+static uint8_t guestCoverage[COVERAGE_SIZE];
+
+#ifdef __AFL_COMPILER
+extern unsigned char *__afl_area_ptr;
+extern unsigned int __afl_map_size;
+#define COVER(i) (guestCoverage[i]++, __afl_area_ptr[((i) * 0x9E3779B1u) % __afl_map_size]++)
+#else
+#define COVER(i) (guestCoverage[i]++)
+#endif
+
+// A jump from a to b lands elsewhere than one from b to a
+#define EDGE(from, to) (COVERAGE_PC + COVERAGE_OPCODES + ((((from) * 4099u) ^ (to)) * 0x9E3779B1u >> 16))
+
+static struct Chip8 pristine;		// fonts and seed, what every run's registers start from
+static struct Chip8 chip;			// fonts and the last input's ROM, plus what that run changed
+static uint8_t image[4096];			// chip's memory as loaded
+static uint8_t marks[4096];			// superinstructions of image, chip's own
+static uint64_t imageHash;			// memoryHash of image
+static size_t romLoaded;
+static unsigned int checkEvery = FUZZ_CHECK_EVERY;
+static bool initialized;
+
+static void initialize(void)
+{
+	initEmulator(&pristine);
+	loadFonts(&pristine);
+	releaseEmulator(&pristine);
+	seedEmulator(&pristine, 1);
+
+	memcpy(&chip, &pristine, sizeof(chip));
+	memcpy(image, pristine.memory, sizeof(image));
+	analyzeFusion(&pristine, marks);
+	imageHash = pristine.memoryHash;
+	initialized = true;
+}
+
+// Undo the last run and put rom in place of its ROM, touching only what differs
+static void prepareRun(const uint8_t *rom, size_t size)
+{
+	// Stores changed the hash, a store it missed shows up in the sampled rehash
+	if (chip.memoryHash != imageHash) {
+		for (unsigned int page = 0; page < sizeof(image); page += FUZZ_PAGE_SIZE) {
+			if (memcmp(chip.memory + page, image + page, FUZZ_PAGE_SIZE) != 0)
+				memcpy(chip.memory + page, image + page, FUZZ_PAGE_SIZE);
+		}
+	}
+
+	// Only DXYN lights pixels, a dark screen has nothing to undo
+	if (chip.litPixels != 0)
+		memset(chip.video, 0, sizeof(chip.video));
+	memcpy(&chip, &pristine, offsetof(struct Chip8, video));
+
+	size_t span = (size > romLoaded) ? size : romLoaded;
+	int first = -1, last = -1;
+	for (size_t i = 0; i < span; i++) {
+		uint16_t address = (uint16_t)(START_ADDRESS + i);
+		uint8_t value = (i < size) ? rom[i] : 0;
+		if (image[address] == value)
+			continue;
+		imageHash ^= memoryKey(address, image[address]) ^ memoryKey(address, value);
+		image[address] = chip.memory[address] = value;
+		if (first < 0)
+			first = address;
+		last = address;
+	}
+	romLoaded = size;
+	chip.memoryHash = imageHash;
+
+	// Sequences starting up to two instructions before a changed byte may include it
+	if (first >= 0) {
+		int start = first - 2 * (FUSION_MAX_LENGTH - 1);
+		analyzeFusionRange(&chip, marks, (uint16_t)(start > 0 ? start : 0), (uint16_t)(last + 1));
+	}
+	chip.fusion = marks;
+}
+
+static void checkDrift(void)
+{
+	uint64_t memoryHash = chip.memoryHash, videoHash = chip.videoHash;
+	uint16_t litPixels = chip.litPixels;
+	rehashEmulator(&chip);
+	if (memoryHash != chip.memoryHash || videoHash != chip.videoHash || litPixels != chip.litPixels) {
+		fprintf(stderr, "fingerprint drift after opcode %04X at %03X\n", chip.opcode, chip.PC);
+		abort();
+	}
+
+	// Only a guest that wrote to memory can leave marks behind.
+	// New sequences may stay unfused, every mark still in use has to match what memory holds now.
+	if (chip.memoryHash != imageHash && chip.fusion != noFusion) {
+		static uint8_t fresh[FUSION_MEMORY_SIZE];
+		analyzeFusion(&chip, fresh);
+		for (unsigned int address = 0; address < FUSION_MEMORY_SIZE; address++) {
+			if (chip.fusion[address] != FUSED_NONE && chip.fusion[address] != fresh[address]) {
+				fprintf(stderr, "stale superinstruction mark at %03X after opcode %04X at %03X\n",
+					address, chip.opcode, chip.PC);
+				abort();
+			}
+		}
+	}
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size == 0)
+		return 0;
+	if (!initialized)
+		initialize();
+
+	size_t scriptLength = data[0] % (FUZZ_MAX_SCRIPT + 1);
+	if (size < 1 + 2 * scriptLength)
+		return 0;
+	const uint8_t *script = data + 1;
+	const uint8_t *rom = script + 2 * scriptLength;
+	size_t romSize = size - 1 - 2 * scriptLength;
+	if (romSize > MAX_ROM_SIZE)
+		return 0;
+
+	prepareRun(rom, romSize);
+	uint64_t sample = imageHash;
+	for (size_t i = 0; i < 2 * scriptLength; i++)
+		sample = (sample ^ script[i]) * 0x100000001B3ull;
+
+	uint64_t end = 0;
+	uint16_t previous = chip.PC;
+	for (unsigned int frame = 0; frame < FUZZ_FRAMES; frame++) {
+		if (scriptLength > 0) {
+			const uint8_t *keys = script + 2 * (frame % scriptLength);
+			uint16_t mask = keys[0] | (keys[1] << 8);
+			for (int key = 0; key < 16; key++)
+				chip.keypad[key] = (mask >> key) & 1;
+		}
+
+		end += CYCLES_PER_TICK;
+		while (chip.instructions < end) {
+			uint16_t pc = chip.PC & ADDRESS_MASK;
+			COVER(pc);
+			COVER(EDGE(previous, pc));
+			previous = pc;
+			Cycle(&chip);
+			COVER(COVERAGE_PC + ((GET_INSTRUCTION_TYPE(chip.opcode) << 8) | GET_BYTE(chip.opcode)));
+		}
+		updateTimers(&chip);
+	}
+
+	if (fingerprintMix(sample) % checkEvery == 0)
+		checkDrift();
+	return 0;
+}
+
+#ifndef CHIPPY_LIBFUZZER
+
+struct Input {
+	uint8_t *data;
+	size_t size;
+};
+
+struct Corpus {
+	struct Input *inputs;
+	size_t count;
+	size_t capacity;
+};
+
+static void addInput(struct Corpus *corpus, const uint8_t *data, size_t size)
+{
+	if (corpus->count == corpus->capacity) {
+		corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 64;
+		corpus->inputs = realloc(corpus->inputs, corpus->capacity * sizeof(struct Input));
+	}
+	struct Input *input = &corpus->inputs[corpus->count++];
+	input->data = malloc(size ? size : 1);
+	input->size = size;
+	memcpy(input->data, data, size);
+}
+
+static void freeCorpus(struct Corpus *corpus)
+{
+	for (size_t i = 0; i < corpus->count; i++)
+		free(corpus->inputs[i].data);
+	free(corpus->inputs);
+}
+
+static void loadInput(struct Corpus *corpus, const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		printf("Error while opening file\n%s\n", path);
+		return;
+	}
+
+	// Plain ROMs get an empty script in front so the bundled ones can seed a run
+	bool rom = isRomName(path);
+
+	uint8_t buffer[1 + 2 * FUZZ_MAX_SCRIPT + MAX_ROM_SIZE + 1];
+	buffer[0] = 0;
+	size_t size = fread(buffer + rom, 1, sizeof(buffer) - rom, file) + rom;
+	fclose(file);
+	addInput(corpus, buffer, size);
+}
+
+// Files are taken as they are, directories for every regular file in them
+static void loadInputs(struct Corpus *corpus, const char *path)
+{
+	struct stat info;
+	if (stat(path, &info) != 0 || !S_ISDIR(info.st_mode)) {
+		loadInput(corpus, path);
+		return;
+	}
+
+	DIR *dir = opendir(path);
+	struct dirent *entry;
+	char file[1024];
+
+	while (dir != NULL && (entry = readdir(dir)) != NULL) {
+		snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+		if (stat(file, &info) == 0 && S_ISREG(info.st_mode))
+			loadInput(corpus, file);
+	}
+	if (dir != NULL)
+		closedir(dir);
+}
+
+static unsigned int countCoverage(unsigned int from, unsigned int to)
+{
+	unsigned int count = 0;
+	for (unsigned int i = from; i < to; i++)
+		count += guestCoverage[i] != 0;
+	return count;
+}
+
+static uint32_t nextRandom(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// Byte flips, random bytes, random opcodes and inserted keypad frames
+static size_t mutate(uint8_t *data, size_t size, size_t capacity, uint32_t *rng)
+{
+	unsigned int mutations = 1 + nextRandom(rng) % 4;
+
+	for (unsigned int m = 0; m < mutations; m++) {
+		uint32_t r = nextRandom(rng);
+		switch (r % 5) {
+		case 0:
+			if (size > 0)
+				data[(r >> 8) % size] ^= 1 << ((r >> 4) & 7);
+			break;
+		case 1:
+			if (size > 0)
+				data[(r >> 8) % size] = (uint8_t)nextRandom(rng);
+			break;
+		case 2:
+			if (size > 2) {
+				size_t at = (r >> 8) % (size - 1);
+				uint16_t opcode = (uint16_t)nextRandom(rng);
+				data[at] = opcode >> 8;
+				data[at + 1] = opcode & 0xFF;
+			}
+			break;
+		case 3:
+			if (size + 2 <= capacity) {
+				uint32_t r2 = nextRandom(rng);
+				data[size++] = (uint8_t)r2;
+				data[size++] = (uint8_t)(r2 >> 8);
+			}
+			break;
+		case 4:
+			if (size > 1)
+				size -= 1 + (r >> 8) % (size / 2);
+			break;
+		}
+	}
+	return size;
+}
+
+static void bench(struct Corpus *corpus, double seconds)
+{
+	static uint8_t buffer[1 + 2 * FUZZ_MAX_SCRIPT + MAX_ROM_SIZE + 64];
+	uint8_t seen[COVERAGE_SIZE] = { 0 };
+	uint32_t rng = 0x2545F491;
+	uint64_t execs = 0;
+
+	if (corpus->count == 0) {
+		uint8_t empty[1] = { 0 };
+		addInput(corpus, empty, 1);
+	}
+
+	uint64_t start = pacerNowNs();
+	uint64_t deadline = start + (uint64_t)(seconds * 1e9);
+	uint64_t now = start;
+
+	while (now < deadline) {
+		// Check the clock once per batch, reading it costs more than a short run
+		for (int batch = 0; batch < 256; batch++, execs++) {
+			const struct Input *parent = &corpus->inputs[nextRandom(&rng) % corpus->count];
+			size_t size = parent->size < sizeof(buffer) ? parent->size : sizeof(buffer);
+			memcpy(buffer, parent->data, size);
+			size = mutate(buffer, size, sizeof(buffer), &rng);
+
+			memset(guestCoverage, 0, sizeof(guestCoverage));
+			LLVMFuzzerTestOneInput(buffer, size);
+
+			// One branch-free pass finds whether anything is new, the few runs that reach
+			// new coverage pay for a second pass marking it seen
+			uint64_t fresh = 0;
+			for (unsigned int w = 0; w < COVERAGE_SIZE; w += sizeof(uint64_t)) {
+				uint64_t word, known;
+				memcpy(&word, guestCoverage + w, sizeof(word));
+				memcpy(&known, seen + w, sizeof(known));
+				fresh |= word & ~known;
+			}
+			if (fresh) {
+				for (unsigned int w = 0; w < COVERAGE_SIZE; w += sizeof(uint64_t)) {
+					uint64_t word, known;
+					memcpy(&word, guestCoverage + w, sizeof(word));
+					memcpy(&known, seen + w, sizeof(known));
+					// 0xFF in each byte with a nonzero count
+					word |= word >> 4;
+					word |= word >> 2;
+					word |= word >> 1;
+					known |= (word & 0x0101010101010101ull) * 0xFF;
+					memcpy(seen + w, &known, sizeof(known));
+				}
+				addInput(corpus, buffer, size);
+			}
+		}
+		now = pacerNowNs();
+	}
+
+	memcpy(guestCoverage, seen, sizeof(seen));
+	double elapsed = (double)(now - start) / 1e9;
+	printf("execs=%llu seconds=%.2f execs_per_sec=%.0f corpus=%zu pcs=%u opcodes=%u edges=%u\n",
+		(unsigned long long)execs, elapsed, (double)execs / elapsed, corpus->count,
+		countCoverage(0, COVERAGE_PC), countCoverage(COVERAGE_PC, COVERAGE_PC + COVERAGE_OPCODES),
+		countCoverage(COVERAGE_PC + COVERAGE_OPCODES, COVERAGE_SIZE));
+}
+
+int main(int argc, char **argv)
+{
+	struct Corpus corpus = { NULL, 0, 0 };
+	double seconds = 0;
+	int arg = 1;
+
+	if (arg + 1 < argc && strcmp(argv[arg], "--bench") == 0) {
+		seconds = atof(argv[arg + 1]);
+		arg += 2;
+	}
+	if ((seconds <= 0 && arg >= argc) || (arg < argc && argv[arg][0] == '-')) {
+		fprintf(stderr, "usage: %s file|dir...\n       %s --bench SECONDS [file|dir...]\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	for (; arg < argc; arg++)
+		loadInputs(&corpus, argv[arg]);
+
+	if (seconds > 0) {
+		bench(&corpus, seconds);
+	} else {
+		// Replays are few, check every one of them
+		checkEvery = 1;
+		for (size_t i = 0; i < corpus.count; i++)
+			LLVMFuzzerTestOneInput(corpus.inputs[i].data, corpus.inputs[i].size);
+		printf("ran %zu inputs, pcs=%u opcodes=%u edges=%u\n", corpus.count,
+			countCoverage(0, COVERAGE_PC), countCoverage(COVERAGE_PC, COVERAGE_PC + COVERAGE_OPCODES),
+			countCoverage(COVERAGE_PC + COVERAGE_OPCODES, COVERAGE_SIZE));
+	}
+	freeCorpus(&corpus);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,613 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "fingerprint.h"
+#include "pacer.h"
+
+// Input sequence search
+// Beam search over keypad input for a ROM, headless and unpaced. Every step forks each
+// state in the beam once per key choice (no key, or one of --keys held for --hold frames),
+// runs the children on a thread pool, drops children that faulted or reached a state seen
+// before, and keeps the --beam best by the score expression. The best state found at any
+// depth is written out as an input script and checked by replaying it from the start.
+//
+// usage: input_search --score EXPR [--beam W] [--depth D] [--hold F] [--keys 0-F digits]
+//                     [--cycles N] [--threads N] [--seed S] [--output script.txt] rom
+//
+// Score expressions read the guest state after a step:
+//   m[a]  byte at a        w[a]  big endian word at a     bcd[a]  FX33 digits at a..a+2
+//   v0-vf registers        i dt st pc
+//   numbers (decimal or 0x hex), ( ), unary -, * / (real division), + -, < > <= >= == !=
+// e.g. Pong keeps both scores in VE and draws them with FX33 at 0x2F2, so
+// "m[0x2F4] - m[0x2F3]" is the right paddle's lead (keys C and D). --keys CD gets it to 1
+// at the default depth; --keys 14CD --depth 600 also makes the left paddle miss and
+// finds a 9:0 line in about 2 s.
+//
+// Scripts have one "frames mask" line per held input, mask in hex with bit k for key k.
+
+#define DEFAULT_BEAM 256
+#define DEFAULT_DEPTH 120
+#define DEFAULT_HOLD 6
+#define ROM_SEED 0xC8C8C8C8u
+#define MAX_CHOICES 17
+#define MAX_PROGRAM 256
+
+// Score expressions compile to a small stack program
+enum Op {
+	OP_CONST, OP_MEM, OP_WORD, OP_BCD, OP_REG, OP_INDEX, OP_DELAY, OP_SOUND, OP_PC,
+	OP_NEG, OP_MUL, OP_DIV, OP_ADD, OP_SUB, OP_LT, OP_GT, OP_LE, OP_GE, OP_EQ, OP_NE
+};
+
+struct Instruction {
+	uint8_t op;
+	double value;		// constant or register number
+};
+
+struct Program {
+	struct Instruction code[MAX_PROGRAM];
+	int length;
+	int depth;			// stack needed
+};
+
+struct Parser {
+	const char *text;
+	const char *at;
+	struct Program *program;
+	int stack;
+	const char *error;
+};
+
+// Search tree, one entry per state kept in a beam
+struct Node {
+	uint32_t parent;
+	uint16_t keys;
+	uint16_t depth;
+	double score;
+	uint64_t hash;
+};
+
+struct Child {
+	double score;
+	uint64_t hash;
+	bool faulted;
+};
+
+struct Search {
+	struct Program score;
+	uint16_t choices[MAX_CHOICES];
+	int choiceCount;
+	uint32_t beamWidth;
+	uint32_t hold;
+	uint32_t cyclesPerFrame;
+
+	struct Chip8 *beam;			// current states
+	uint32_t *beamNodes;		// tree entry of each
+	uint32_t beamCount;
+	struct Chip8 *children;		// beamCount * choiceCount
+	struct Child *results;
+	atomic_uint nextChild;
+	uint32_t childCount;
+
+	struct Node *tree;
+	uint32_t treeCount;
+	uint32_t treeCapacity;
+
+	uint64_t *visited;			// open addressing set of state hashes, 0 marks a free slot
+	uint32_t visitedMask;
+	uint32_t visitedCount;
+};
+
+// The first error is the one reported
+static void fail(struct Parser *parser, const char *error)
+{
+	if (parser->error == NULL)
+		parser->error = error;
+}
+
+static void emit(struct Parser *parser, uint8_t op, double value, int stackChange)
+{
+	if (parser->program->length >= MAX_PROGRAM) {
+		fail(parser, "expression too long");
+		return;
+	}
+	parser->program->code[parser->program->length++] = (struct Instruction){ op, value };
+	parser->stack += stackChange;
+	if (parser->stack > parser->program->depth)
+		parser->program->depth = parser->stack;
+}
+
+static void skipSpace(struct Parser *parser)
+{
+	while (isspace((unsigned char)*parser->at))
+		parser->at++;
+}
+
+static bool accept(struct Parser *parser, const char *token)
+{
+	skipSpace(parser);
+	size_t length = strlen(token);
+	if (strncmp(parser->at, token, length) != 0)
+		return false;
+	parser->at += length;
+	return true;
+}
+
+static void parseExpression(struct Parser *parser);
+
+// m[a], w[a] and bcd[a] take an address expression
+static void parseAccess(struct Parser *parser, uint8_t op)
+{
+	if (!accept(parser, "[")) {
+		fail(parser, "expected [");
+		return;
+	}
+	parseExpression(parser);
+	if (!accept(parser, "]")) {
+		fail(parser, "expected ]");
+		return;
+	}
+	emit(parser, op, 0, 0);
+}
+
+static void parsePrimary(struct Parser *parser)
+{
+	skipSpace(parser);
+	const char *at = parser->at;
+
+	if (isdigit((unsigned char)*at)) {
+		char *end;
+		bool hex = at[0] == '0' && (at[1] == 'x' || at[1] == 'X');
+		double value = (double)strtoul(at, &end, hex ? 16 : 10);
+		parser->at = end;
+		emit(parser, OP_CONST, value, 1);
+	}
+	else if (accept(parser, "(")) {
+		parseExpression(parser);
+		if (!accept(parser, ")"))
+			fail(parser, "expected )");
+	}
+	else if (accept(parser, "bcd"))
+		parseAccess(parser, OP_BCD);
+	else if (accept(parser, "m"))
+		parseAccess(parser, OP_MEM);
+	else if (accept(parser, "w"))
+		parseAccess(parser, OP_WORD);
+	else if ((at[0] == 'v' || at[0] == 'V') && isxdigit((unsigned char)at[1])) {
+		char digit[2] = { at[1], '\0' };
+		parser->at += 2;
+		emit(parser, OP_REG, (double)strtoul(digit, NULL, 16), 1);
+	}
+	else if (accept(parser, "dt"))
+		emit(parser, OP_DELAY, 0, 1);
+	else if (accept(parser, "st"))
+		emit(parser, OP_SOUND, 0, 1);
+	else if (accept(parser, "pc"))
+		emit(parser, OP_PC, 0, 1);
+	else if (accept(parser, "i"))
+		emit(parser, OP_INDEX, 0, 1);
+	else
+		fail(parser, "expected a number, m[], w[], bcd[], register, i, dt, st, pc or (");
+}
+
+static void parseUnary(struct Parser *parser)
+{
+	if (accept(parser, "-")) {
+		parseUnary(parser);
+		emit(parser, OP_NEG, 0, 0);
+	}
+	else
+		parsePrimary(parser);
+}
+
+static void parseProduct(struct Parser *parser)
+{
+	parseUnary(parser);
+	while (parser->error == NULL) {
+		if (accept(parser, "*")) {
+			parseUnary(parser);
+			emit(parser, OP_MUL, 0, -1);
+		}
+		else if (accept(parser, "/")) {
+			parseUnary(parser);
+			emit(parser, OP_DIV, 0, -1);
+		}
+		else
+			break;
+	}
+}
+
+static void parseSum(struct Parser *parser)
+{
+	parseProduct(parser);
+	while (parser->error == NULL) {
+		if (accept(parser, "+")) {
+			parseProduct(parser);
+			emit(parser, OP_ADD, 0, -1);
+		}
+		else if (accept(parser, "-")) {
+			parseProduct(parser);
+			emit(parser, OP_SUB, 0, -1);
+		}
+		else
+			break;
+	}
+}
+
+static void parseExpression(struct Parser *parser)
+{
+	// Longer operators first so "<=" isn't taken as "<"
+	static const struct { const char *token; uint8_t op; } comparisons[] = {
+		{ "<=", OP_LE }, { ">=", OP_GE }, { "==", OP_EQ }, { "!=", OP_NE }, { "<", OP_LT }, { ">", OP_GT }
+	};
+
+	parseSum(parser);
+	for (size_t c = 0; c < sizeof(comparisons) / sizeof(comparisons[0]) && parser->error == NULL; c++) {
+		if (accept(parser, comparisons[c].token)) {
+			parseSum(parser);
+			emit(parser, comparisons[c].op, 0, -1);
+			break;
+		}
+	}
+}
+
+static bool compileScore(struct Program *program, const char *text)
+{
+	struct Parser parser = { text, text, program, 0, NULL };
+
+	memset(program, 0, sizeof(*program));
+	parseExpression(&parser);
+	skipSpace(&parser);
+	if (*parser.at != '\0')
+		fail(&parser, "unexpected text");
+	if (parser.error != NULL) {
+		fprintf(stderr, "score: %s at column %d\n  %s\n  %*s^\n", parser.error, (int)(parser.at - text) + 1, text, (int)(parser.at - text), "");
+		return false;
+	}
+	return true;
+}
+
+static uint8_t peek(const struct Chip8 *chip, double address)
+{
+	return chip->memory[(uint32_t)address & ADDRESS_MASK];
+}
+
+static double evaluate(const struct Program *program, const struct Chip8 *chip)
+{
+	double stack[MAX_PROGRAM];
+	int top = -1;
+
+	for (int pc = 0; pc < program->length; pc++) {
+		const struct Instruction *in = &program->code[pc];
+		double a;
+
+		switch (in->op) {
+		case OP_CONST:	stack[++top] = in->value; break;
+		case OP_REG:	stack[++top] = chip->registers[(int)in->value]; break;
+		case OP_INDEX:	stack[++top] = chip->index; break;
+		case OP_DELAY:	stack[++top] = chip->delayTimer; break;
+		case OP_SOUND:	stack[++top] = chip->soundTimer; break;
+		case OP_PC:		stack[++top] = chip->PC; break;
+		case OP_MEM:	stack[top] = peek(chip, stack[top]); break;
+		case OP_WORD:	a = stack[top]; stack[top] = peek(chip, a) * 256 + peek(chip, a + 1); break;
+		case OP_BCD:	a = stack[top]; stack[top] = peek(chip, a) * 100 + peek(chip, a + 1) * 10 + peek(chip, a + 2); break;
+		case OP_NEG:	stack[top] = -stack[top]; break;
+		case OP_MUL:	top--; stack[top] *= stack[top + 1]; break;
+		case OP_DIV:	top--; stack[top] = stack[top + 1] != 0 ? stack[top] / stack[top + 1] : 0; break;
+		case OP_ADD:	top--; stack[top] += stack[top + 1]; break;
+		case OP_SUB:	top--; stack[top] -= stack[top + 1]; break;
+		case OP_LT:		top--; stack[top] = stack[top] < stack[top + 1]; break;
+		case OP_GT:		top--; stack[top] = stack[top] > stack[top + 1]; break;
+		case OP_LE:		top--; stack[top] = stack[top] <= stack[top + 1]; break;
+		case OP_GE:		top--; stack[top] = stack[top] >= stack[top + 1]; break;
+		case OP_EQ:		top--; stack[top] = stack[top] == stack[top + 1]; break;
+		case OP_NE:		top--; stack[top] = stack[top] != stack[top + 1]; break;
+		}
+	}
+	return top == 0 ? stack[0] : 0;
+}
+
+// Zero marks an empty visited slot
+static uint64_t hashState(const struct Chip8 *chip)
+{
+	uint64_t hash = stateFingerprint(chip);
+	return hash ? hash : 1;
+}
+
+static void runFrames(struct Chip8 *chip, uint16_t keys, uint32_t frames, uint32_t cyclesPerFrame)
+{
+	for (int key = 0; key < 16; key++)
+		chip->keypad[key] = (keys >> key) & 1;
+
+	for (uint32_t frame = 0; frame < frames && chip->fault == FAULT_NONE; frame++) {
+		uint64_t end = chip->instructions + cyclesPerFrame;
+		while (chip->instructions < end)
+			Cycle(chip);
+		updateTimers(chip);
+	}
+}
+
+static void* expandChildren(void *arg)
+{
+	struct Search *search = arg;
+
+	for (;;) {
+		uint32_t c = atomic_fetch_add(&search->nextChild, 1);
+		if (c >= search->childCount)
+			return NULL;
+
+		// Fork the parent's snapshot and hold one key choice on it
+		struct Chip8 *child = &search->children[c];
+		memcpy(child, &search->beam[c / search->choiceCount], sizeof(struct Chip8));
+		runFrames(child, search->choices[c % search->choiceCount], search->hold, search->cyclesPerFrame);
+
+		struct Child *result = &search->results[c];
+		result->faulted = child->fault != FAULT_NONE;
+		result->hash = hashState(child);
+		result->score = evaluate(&search->score, child);
+	}
+}
+
+// Returns false if hash was already in the set
+static bool visit(struct Search *search, uint64_t hash)
+{
+	if (2 * (search->visitedCount + 1) > search->visitedMask + 1) {
+		uint64_t *old = search->visited;
+		uint32_t oldSize = search->visitedMask + 1;
+
+		search->visitedMask = 2 * oldSize - 1;
+		search->visited = calloc(2 * oldSize, sizeof(uint64_t));
+		search->visitedCount = 0;
+		for (uint32_t i = 0; i < oldSize; i++) {
+			if (old[i] != 0)
+				visit(search, old[i]);
+		}
+		free(old);
+	}
+
+	uint32_t slot = (uint32_t)hash & search->visitedMask;
+	while (search->visited[slot] != 0) {
+		if (search->visited[slot] == hash)
+			return false;
+		slot = (slot + 1) & search->visitedMask;
+	}
+	search->visited[slot] = hash;
+	search->visitedCount++;
+	return true;
+}
+
+static uint32_t addNode(struct Search *search, uint32_t parent, uint16_t keys, uint16_t depth, double score, uint64_t hash)
+{
+	if (search->treeCount == search->treeCapacity) {
+		search->treeCapacity = search->treeCapacity ? search->treeCapacity * 2 : 4096;
+		search->tree = realloc(search->tree, search->treeCapacity * sizeof(struct Node));
+	}
+	search->tree[search->treeCount] = (struct Node){ parent, keys, depth, score, hash };
+	return search->treeCount++;
+}
+
+static const struct Child *sortResults;
+
+static int compareChildren(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	double sx = sortResults[x].score, sy = sortResults[y].score;
+
+	// Best first, earlier children (no key, lower keys, better parents) win ties
+	if (sx != sy)
+		return sx > sy ? -1 : 1;
+	return (x > y) - (x < y);
+}
+
+static void loadStart(struct Chip8 *chip, const uint8_t *rom, size_t size, uint32_t seed)
+{
+	initEmulator(chip);
+	loadRomFromMemory(chip, rom, size);
+	loadFonts(chip);
+	seedEmulator(chip, seed);
+}
+
+// Steps from the root to node, returns how many
+static uint32_t tracePath(const struct Search *search, uint32_t node, uint16_t *keys)
+{
+	uint32_t steps = search->tree[node].depth;
+	for (uint32_t step = steps; step > 0; step--) {
+		keys[step - 1] = search->tree[node].keys;
+		node = search->tree[node].parent;
+	}
+	return steps;
+}
+
+static bool writeScript(FILE *out, const uint16_t *keys, uint32_t steps, uint32_t hold)
+{
+	for (uint32_t step = 0; step < steps;) {
+		uint32_t run = 1;
+		while (step + run < steps && keys[step + run] == keys[step])
+			run++;
+		fprintf(out, "%u %04x\n", run * hold, keys[step]);
+		step += run;
+	}
+	return !ferror(out);
+}
+
+int main(int argc, char **argv)
+{
+	struct Search search;
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = processors > 0 ? (int)processors : 4;
+	uint32_t maxDepth = DEFAULT_DEPTH;
+	uint32_t seed = ROM_SEED;
+	const char *keyList = "0123456789ABCDEF";
+	const char *scoreText = NULL;
+	const char *output = NULL;
+	int arg = 1;
+
+	memset(&search, 0, sizeof(search));
+	search.beamWidth = DEFAULT_BEAM;
+	search.hold = DEFAULT_HOLD;
+	search.cyclesPerFrame = CYCLES_PER_TICK;
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "--score") == 0 && arg + 1 < argc)
+			scoreText = argv[++arg];
+		else if (strcmp(argv[arg], "--beam") == 0 && arg + 1 < argc)
+			search.beamWidth = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--depth") == 0 && arg + 1 < argc)
+			maxDepth = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--hold") == 0 && arg + 1 < argc)
+			search.hold = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--keys") == 0 && arg + 1 < argc)
+			keyList = argv[++arg];
+		else if (strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc)
+			search.cyclesPerFrame = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc)
+			threads = atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc)
+			seed = (uint32_t)strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "--output") == 0 && arg + 1 < argc)
+			output = argv[++arg];
+		else
+			break;
+	}
+	if (arg != argc - 1 || scoreText == NULL || search.beamWidth == 0 || maxDepth == 0 || maxDepth > UINT16_MAX
+		|| search.hold == 0 || search.cyclesPerFrame == 0 || threads < 1) {
+		fprintf(stderr, "usage: %s --score EXPR [--beam W] [--depth D] [--hold F] [--keys 0-F digits] [--cycles N] [--threads N] [--seed S] [--output script.txt] rom\n", argv[0]);
+		return 1;
+	}
+	if (!compileScore(&search.score, scoreText))
+		return 1;
+
+	// No key is always a choice, then each listed key on its own
+	search.choices[search.choiceCount++] = 0;
+	for (const char *k = keyList; *k && search.choiceCount < MAX_CHOICES; k++) {
+		char digit[2] = { *k, '\0' };
+		if (isxdigit((unsigned char)*k))
+			search.choices[search.choiceCount++] = 1 << strtoul(digit, NULL, 16);
+	}
+
+	uint8_t rom[MAX_ROM_SIZE + 1];
+	FILE *file = fopen(argv[arg], "rb");
+	if (file == NULL) {
+		printf("Error while opening file\n%s\n", argv[arg]);
+		return 1;
+	}
+	size_t romSize = fread(rom, 1, sizeof(rom), file);
+	fclose(file);
+	if (romSize > MAX_ROM_SIZE) {
+		fprintf(stderr, "ROM does not fit in memory\n");
+		return 1;
+	}
+
+	size_t maxChildren = (size_t)search.beamWidth * search.choiceCount;
+	struct Chip8 *next = aligned_alloc(alignof(struct Chip8), search.beamWidth * sizeof(struct Chip8));
+	search.beam = aligned_alloc(alignof(struct Chip8), search.beamWidth * sizeof(struct Chip8));
+	search.children = aligned_alloc(alignof(struct Chip8), maxChildren * sizeof(struct Chip8));
+	search.results = malloc(maxChildren * sizeof(struct Child));
+	search.beamNodes = malloc(search.beamWidth * sizeof(uint32_t));
+	uint32_t *nextNodes = malloc(search.beamWidth * sizeof(uint32_t));
+	uint32_t *order = malloc(maxChildren * sizeof(uint32_t));
+	search.visitedMask = 4095;
+	search.visited = calloc(search.visitedMask + 1, sizeof(uint64_t));
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+
+	loadStart(&search.beam[0], rom, romSize, seed);
+	search.beamCount = 1;
+	uint64_t rootHash = hashState(&search.beam[0]);
+	visit(&search, rootHash);
+	search.beamNodes[0] = addNode(&search, 0, 0, 0, evaluate(&search.score, &search.beam[0]), rootHash);
+
+	uint32_t best = 0;
+	uint64_t expanded = 0, duplicates = 0, faulted = 0;
+	uint64_t start = pacerNowNs();
+
+	for (uint32_t depth = 1; depth <= maxDepth && search.beamCount > 0; depth++) {
+		search.childCount = search.beamCount * search.choiceCount;
+		atomic_store(&search.nextChild, 0);
+
+		int running = threads < (int)search.childCount ? threads : (int)search.childCount;
+		for (int i = 0; i < running; i++)
+			pthread_create(&workers[i], NULL, expandChildren, &search);
+		for (int i = 0; i < running; i++)
+			pthread_join(workers[i], NULL);
+		expanded += search.childCount;
+
+		for (uint32_t c = 0; c < search.childCount; c++)
+			order[c] = c;
+		sortResults = search.results;
+		qsort(order, search.childCount, sizeof(uint32_t), compareChildren);
+
+		// The best children that are new states become the next beam
+		uint32_t kept = 0;
+		for (uint32_t i = 0; i < search.childCount && kept < search.beamWidth; i++) {
+			uint32_t c = order[i];
+			const struct Child *result = &search.results[c];
+
+			if (result->faulted) {
+				faulted++;
+				continue;
+			}
+			if (!visit(&search, result->hash)) {
+				duplicates++;
+				continue;
+			}
+
+			uint32_t node = addNode(&search, search.beamNodes[c / search.choiceCount], search.choices[c % search.choiceCount],
+				(uint16_t)depth, result->score, result->hash);
+			if (result->score > search.tree[best].score)
+				best = node;
+			memcpy(&next[kept], &search.children[c], sizeof(struct Chip8));
+			nextNodes[kept++] = node;
+		}
+
+		struct Chip8 *swapStates = search.beam;
+		search.beam = next;
+		next = swapStates;
+		uint32_t *swapNodes = search.beamNodes;
+		search.beamNodes = nextNodes;
+		nextNodes = swapNodes;
+		search.beamCount = kept;
+	}
+
+	double seconds = (double)(pacerNowNs() - start) / 1e9;
+	uint16_t *keys = malloc((search.tree[best].depth + 1) * sizeof(uint16_t));
+	uint32_t steps = tracePath(&search, best, keys);
+
+	// The script has to reproduce the state it was found with
+	struct Chip8 *replay = createEmulator();
+	loadStart(replay, rom, romSize, seed);
+	for (uint32_t step = 0; step < steps; step++)
+		runFrames(replay, keys[step], search.hold, search.cyclesPerFrame);
+	bool verified = hashState(replay) == search.tree[best].hash;
+
+	fprintf(stderr, "best score %g at depth %u (%u frames), %llu states expanded, %llu duplicate, %llu faulted, %u kept, %.2f s, %.0f states/s, replay %s\n",
+		search.tree[best].score, steps, steps * search.hold, (unsigned long long)expanded, (unsigned long long)duplicates,
+		(unsigned long long)faulted, search.treeCount, seconds, seconds > 0 ? (double)expanded / seconds : 0.0,
+		verified ? "verified" : "MISMATCH");
+
+	FILE *out = output ? fopen(output, "w") : stdout;
+	bool written = out != NULL && writeScript(out, keys, steps, search.hold);
+	if (output && out != NULL)
+		written = (fclose(out) == 0) && written;
+	if (!written)
+		fprintf(stderr, "could not write %s\n", output ? output : "script");
+
+	releaseEmulator(replay);
+	free(replay);
+	free(keys);
+	free(workers);
+	free(search.visited);
+	free(order);
+	free(nextNodes);
+	free(search.beamNodes);
+	free(search.results);
+	free(search.children);
+	free(search.beam);
+	free(next);
+	free(search.tree);
+	return (verified && written) ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "emulator.h"
+#include "netplay.h"
+#include "pacer.h"
+
+// Netplay peer
+// Runs one side of a netplay session headless with scripted input, then prints the hash of
+// the state once every remote input is confirmed. Two peers given the same ROM have to print
+// the same hash however late their packets were.
+//
+// usage: netplay_peer [--player 0|1] [--frames N] [--rate HZ] [--cycles N] [--latency D[:J[:L]]] [--port P] [--peer HOST:PORT] rom
+//        netplay_peer --self-test [--frames N] [--rate HZ] [--cycles N] [--latency D[:J[:L]]] [--port P] rom
+//
+// --cycles sets the instructions per frame, CYCLES_PER_TICK by default. Peers only accept
+// each other's packets if they agree on it.
+// --latency delays every outgoing packet by D ms plus up to J ms and drops L percent of them.
+// --self-test forks both players on 127.0.0.1 (ports P and P + 1) and also runs the same
+// inputs without netplay, all three hashes must match.
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_RATE 60
+#define DEFAULT_PORT 47310
+#define CONNECT_TIMEOUT_NS 10000000000ULL
+#define LINGER_NS 2000000000ULL		// time to wait for the peer to acknowledge the last inputs
+#define SCRIPT_HOLD 6				// frames each scripted key combination is held
+
+struct Options {
+	int player;
+	uint32_t frames;
+	uint32_t rate;
+	uint32_t cycles;
+	const char *latency;
+	uint16_t port;
+	char host[128];
+	uint16_t peerPort;
+	const char *rom;
+};
+
+// Player 0 presses keys 0-7, player 1 keys 8-F, both change every few frames
+static uint16_t scriptedKeys(int player, uint32_t frame)
+{
+	uint32_t x = (frame / SCRIPT_HOLD) * 0x9E3779B9u + (uint32_t)player * 0x85EBCA6Bu;
+	x ^= x >> 15;
+	x *= 0x2C1B3C6Du;
+	x ^= x >> 12;
+	return (uint16_t)((x & (x >> 8) & 0xFF) << (player * 8));
+}
+
+static uint64_t hashChip(const struct Chip8 *chip)
+{
+	// The fusion pointers differ between processes running the same state
+	struct Chip8 state = *chip;
+	state.fusion = NULL;
+	state.fusionTable = NULL;
+	const uint8_t *bytes = (const uint8_t*)&state;
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (size_t i = 0; i < sizeof(struct Chip8); i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static void loadChip(struct Chip8 *chip, const char *rom)
+{
+	initEmulator(chip);
+	loadRom(chip, rom);
+	loadFonts(chip);
+	seedEmulator(chip, NETPLAY_SEED);
+}
+
+// Both players' inputs applied directly, what netplay has to reproduce
+static uint64_t runReference(const struct Options *options)
+{
+	struct Chip8 chip;
+
+	loadChip(&chip, options->rom);
+	for (uint32_t frame = 0; frame < options->frames; frame++) {
+		uint16_t keys = scriptedKeys(0, frame) | scriptedKeys(1, frame);
+		for (int key = 0; key < 16; key++)
+			chip.keypad[key] = (keys >> key) & 1;
+
+		uint64_t end = chip.instructions + options->cycles;
+		while (chip.instructions < end)
+			Cycle(&chip);
+		updateTimers(&chip);
+	}
+	return hashChip(&chip);
+}
+
+static int runPeer(const struct Options *options, uint64_t *hash)
+{
+	struct Chip8 chip;
+	struct Pacer pacer;
+	struct NetplayStats stats;
+
+	struct Netplay *netplay = openNetplay(options->port, options->host, options->peerPort);
+	if (netplay == NULL)
+		return 1;
+	parseNetplayLatency(netplay, options->latency);
+
+	loadChip(&chip, options->rom);
+	startNetplay(netplay, &chip, options->cycles);
+	initPacer(&pacer, options->rate);
+
+	uint64_t start = pacerNowNs();
+	while (netplay->frame < options->frames) {
+		waitPacer(&pacer);
+		advanceNetplay(netplay, &chip, scriptedKeys(options->player, netplay->frame));
+
+		if (!atomic_load(&netplay->connected) && pacerNowNs() - start > CONNECT_TIMEOUT_NS) {
+			fprintf(stderr, "player %d: no answer from %s:%u\n", options->player, options->host, options->peerPort);
+			closeNetplay(netplay);
+			return 2;
+		}
+	}
+
+	// Late remote inputs may still roll the last frames back
+	bool confirmed = false;
+	uint64_t lingerStart = 0;
+	for (;;) {
+		waitPacer(&pacer);
+		confirmed = syncNetplay(netplay, &chip);
+		if (confirmed && lingerStart == 0)
+			lingerStart = pacerNowNs();
+		if (confirmed && (netplay->peerAck >= netplay->frame || pacerNowNs() - lingerStart > LINGER_NS))
+			break;
+		if (!confirmed && pacerNowNs() - start > CONNECT_TIMEOUT_NS + options->frames * 1000000000ULL / options->rate * 4) {
+			fprintf(stderr, "player %d: remote inputs never arrived\n", options->player);
+			closeNetplay(netplay);
+			return 3;
+		}
+	}
+
+	*hash = hashChip(&chip);
+	readNetplayStats(netplay, &stats);
+	printf("player %d: frames=%u hash=%016llx\n", options->player, netplay->frame, (unsigned long long)*hash);
+	logNetplayStats(stdout, &stats);
+	fflush(stdout);
+
+	closeNetplay(netplay);
+	return 0;
+}
+
+static int selfTest(struct Options *options)
+{
+	int pipes[2][2];
+	pid_t children[2];
+
+	for (int player = 0; player < 2; player++) {
+		if (pipe(pipes[player]) != 0)
+			return 1;
+
+		children[player] = fork();
+		if (children[player] < 0)
+			return 1;
+		if (children[player] == 0) {
+			uint64_t hash = 0;
+			uint16_t base = options->port;
+
+			options->player = player;
+			options->port = base + player;
+			options->peerPort = base + 1 - player;
+			strcpy(options->host, "127.0.0.1");
+
+			int result = runPeer(options, &hash);
+			if (write(pipes[player][1], &hash, sizeof(hash)) != sizeof(hash))
+				result = 1;
+			_exit(result);
+		}
+		close(pipes[player][1]);
+	}
+
+	uint64_t reference = runReference(options);
+	uint64_t hashes[2] = { 0, 0 };
+	bool ok = true;
+
+	for (int player = 0; player < 2; player++) {
+		int status = 0;
+		if (read(pipes[player][0], &hashes[player], sizeof(uint64_t)) != sizeof(uint64_t))
+			ok = false;
+		close(pipes[player][0]);
+		waitpid(children[player], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			ok = false;
+	}
+
+	ok = ok && hashes[0] == reference && hashes[1] == reference;
+	printf("reference: frames=%u hash=%016llx\n%s\n", options->frames, (unsigned long long)reference, ok ? "OK" : "MISMATCH");
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct Options options = { 0, DEFAULT_FRAMES, DEFAULT_RATE, CYCLES_PER_TICK, NULL, DEFAULT_PORT, "127.0.0.1", DEFAULT_PORT + 1, NULL };
+	bool test = false;
+	int arg = 1;
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "--self-test") == 0)
+			test = true;
+		else if (strcmp(argv[arg], "--player") == 0 && arg + 1 < argc)
+			options.player = atoi(argv[++arg]) != 0;
+		else if (strcmp(argv[arg], "--frames") == 0 && arg + 1 < argc)
+			options.frames = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--rate") == 0 && arg + 1 < argc)
+			options.rate = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc)
+			options.cycles = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--latency") == 0 && arg + 1 < argc)
+			options.latency = argv[++arg];
+		else if (strcmp(argv[arg], "--port") == 0 && arg + 1 < argc)
+			options.port = (uint16_t)atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "--peer") == 0 && arg + 1 < argc) {
+			const char *peer = argv[++arg];
+			const char *colon = strrchr(peer, ':');
+			if (colon == NULL || (size_t)(colon - peer) >= sizeof(options.host))
+				break;
+			memcpy(options.host, peer, colon - peer);
+			options.host[colon - peer] = '\0';
+			options.peerPort = (uint16_t)atoi(colon + 1);
+		}
+		else
+			break;
+	}
+	if (arg != argc - 1 || options.frames == 0 || options.rate == 0 || options.cycles == 0) {
+		fprintf(stderr, "usage: %s [--self-test] [--player 0|1] [--frames N] [--rate HZ] [--cycles N] [--latency D[:J[:L]]] [--port P] [--peer HOST:PORT] rom\n", argv[0]);
+		return 1;
+	}
+	options.rom = argv[arg];
+
+	if (test)
+		return selfTest(&options);
+
+	uint64_t hash;
+	return runPeer(&options, &hash);
+}
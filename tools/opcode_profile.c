@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+
+// Opcode profiler
+// Runs ROMs headless and counts the executed instruction classes, pairs and triples.
+// The superinstruction table in fusion.c was picked from this output over resources/roms/.
+//
+// usage: opcode_profile [-t ticks] rom...
+
+#define PROFILE_CLASSES 40
+#define PROFILE_TOP 24
+#define DEFAULT_TICKS 3600
+
+static const char *classNames[PROFILE_CLASSES] = {
+	"00E0", "00EE", "0NNN", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+	"8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE", "9XY0",
+	"ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1", "FX07", "FX0A", "FX15", "FX18",
+	"FX1E", "FX29", "FX33", "FX55", "FX65", "????"
+};
+
+static unsigned int classify(uint16_t opcode)
+{
+	switch (GET_INSTRUCTION_TYPE(opcode)) {
+	case 0x0: return opcode == 0x00E0 ? 0 : (opcode == 0x00EE ? 1 : 2);
+	case 0x8:
+		switch (GET_N(opcode)) {
+		case 0x0: case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x6: case 0x7:
+			return 10 + GET_N(opcode);
+		case 0xE: return 18;
+		}
+		return 35;
+	case 0xE: return GET_BYTE(opcode) == 0x9E ? 24 : (GET_BYTE(opcode) == 0xA1 ? 25 : 35);
+	case 0xF:
+		switch (GET_BYTE(opcode)) {
+		case 0x07: return 26;
+		case 0x0A: return 27;
+		case 0x15: return 28;
+		case 0x18: return 29;
+		case 0x1E: return 30;
+		case 0x29: return 31;
+		case 0x33: return 32;
+		case 0x55: return 33;
+		case 0x65: return 34;
+		}
+		return 35;
+	case 0x9: return 19;
+	default: {
+		static const unsigned int plain[16] = { 0, 3, 4, 5, 6, 7, 8, 9, 0, 0, 20, 21, 22, 23, 0, 0 };
+		return plain[GET_INSTRUCTION_TYPE(opcode)];
+	}
+	}
+}
+
+struct Count {
+	unsigned int key;
+	unsigned long long count;
+};
+
+static unsigned long long singles[PROFILE_CLASSES];
+static unsigned long long pairs[PROFILE_CLASSES * PROFILE_CLASSES];
+static unsigned long long triples[PROFILE_CLASSES * PROFILE_CLASSES * PROFILE_CLASSES];
+
+static int byCount(const void *a, const void *b)
+{
+	const struct Count *x = a, *y = b;
+	return (x->count < y->count) - (x->count > y->count);
+}
+
+static void printTop(const char *title, const unsigned long long *counts, unsigned int size, unsigned int arity, unsigned long long total)
+{
+	struct Count *sorted = malloc(size * sizeof(struct Count));
+
+	for (unsigned int i = 0; i < size; i++)
+		sorted[i] = (struct Count){ i, counts[i] };
+	qsort(sorted, size, sizeof(struct Count), byCount);
+
+	printf("%s\n", title);
+	for (unsigned int i = 0; i < PROFILE_TOP && sorted[i].count > 0; i++) {
+		unsigned int key = sorted[i].key;
+		unsigned int classes[3];
+		char name[32] = "";
+
+		// Keys are built oldest first, most significant digit is the first instruction
+		for (unsigned int j = arity; j-- > 0;) {
+			classes[j] = key % PROFILE_CLASSES;
+			key /= PROFILE_CLASSES;
+		}
+		for (unsigned int j = 0; j < arity; j++) {
+			if (j > 0)
+				strcat(name, ";");
+			strcat(name, classNames[classes[j]]);
+		}
+		printf("  %-16s %12llu  %5.2f%%\n", name, sorted[i].count, 100.0 * sorted[i].count / total);
+	}
+	free(sorted);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long ticks = DEFAULT_TICKS;
+	unsigned long long total = 0;
+	int first = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+		ticks = strtoul(argv[2], NULL, 10);
+		first = 3;
+	}
+	if (first >= argc) {
+		fprintf(stderr, "usage: %s [-t ticks] rom...\n", argv[0]);
+		return 1;
+	}
+
+	for (int r = first; r < argc; r++) {
+		struct Chip8 *chip = createEmulator();
+		unsigned int previous[2] = { PROFILE_CLASSES, PROFILE_CLASSES };
+
+		loadRom(chip, argv[r]);
+		loadFonts(chip);
+		seedEmulator(chip, 1);
+
+		for (unsigned long tick = 0; tick < ticks; tick++) {
+			// Tap a different key every half second so input driven paths are reached
+			memset(chip->keypad, 0, sizeof(chip->keypad));
+			if (tick % 30 < 10)
+				chip->keypad[(tick / 30) % 16] = 1;
+
+			for (int i = 0; i < CYCLES_PER_TICK; i++) {
+				uint16_t pc = chip->PC & 0xFFF;
+				unsigned int cls = classify((chip->memory[pc] << 8) | chip->memory[(pc + 1) & 0xFFF]);
+
+				singles[cls]++;
+				if (previous[1] < PROFILE_CLASSES)
+					pairs[previous[1] * PROFILE_CLASSES + cls]++;
+				if (previous[0] < PROFILE_CLASSES)
+					triples[(previous[0] * PROFILE_CLASSES + previous[1]) * PROFILE_CLASSES + cls]++;
+				previous[0] = previous[1];
+				previous[1] = cls;
+				total++;
+
+				CycleSingle(chip);
+			}
+			updateTimers(chip);
+		}
+		releaseEmulator(chip);
+		free(chip);
+	}
+
+	printTop("instructions", singles, PROFILE_CLASSES, 1, total);
+	printTop("pairs", pairs, PROFILE_CLASSES * PROFILE_CLASSES, 2, total);
+	printTop("triples", triples, PROFILE_CLASSES * PROFILE_CLASSES * PROFILE_CLASSES, 3, total);
+	return 0;
+}
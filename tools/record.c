@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "recorder.h"
+#include "delta.h"
+#include "png_writer.h"
+#include "crc32.h"
+#include "pacer.h"
+
+// Headless recorder
+// Runs rom without input at 60 frames per second for --frames frames and records the
+// display like CHIPPY_RECORD does, the format follows the extension of output.
+// --self-test records a scripted series of pictures, repeats included, to GIF, APNG and
+// raw files and reads them back: every chunk and block has to be well formed, repeats
+// must not become frames and the GIF and raw pictures have to match what was recorded.
+// A recording stopped before its first delay unit has to hold one frame too.
+//
+// usage: record [--frames N] [--scale S] rom output
+//        record --self-test
+
+#define DEFAULT_FRAMES 600
+#define TEST_SCALE 3					// odd on purpose, frames then start mid byte in the APNG rows
+#define TEST_STEP_NS 20000000			// two GIF delay units between pictures
+#define GIF_MAX_CODES 4096
+
+// Pictures in the order recorded, repeats of the previous one must be merged
+static const int script[] = { 0, 0, 1, 1, 1, 2, 0, 0, 3, 4, 4, 5, 5 };
+
+struct File {
+	uint8_t *data;
+	size_t size;
+};
+
+static uint32_t readLittleEndian16(const uint8_t *in)
+{
+	return in[0] | (uint32_t)in[1] << 8;
+}
+
+static uint32_t readBigEndian(const uint8_t *in)
+{
+	return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+}
+
+static inline unsigned int pixelAt(const uint8_t *bits, unsigned int x, unsigned int y)
+{
+	return (bits[y * (VIDEO_WIDTH / 8) + x / 8] >> (7 - x % 8)) & 1;
+}
+
+static bool readFile(const char *path, struct File *file)
+{
+	FILE *in = fopen(path, "rb");
+	if (in == NULL)
+		return false;
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	file->data = malloc(size > 0 ? (size_t)size : 1);
+	file->size = (file->data != NULL && size > 0) ? fread(file->data, 1, (size_t)size, in) : 0;
+	fclose(in);
+	return file->data != NULL && size > 0 && file->size == (size_t)size;
+}
+
+static bool readVarint(const struct File *file, size_t *at, uint64_t *value)
+{
+	*value = 0;
+	for (unsigned int shift = 0; *at < file->size && shift < 64; shift += 7) {
+		uint8_t byte = file->data[(*at)++];
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Noise of a different density per picture, long enough runs for LZW to fill its table
+static void makePicture(int index, uint8_t *video)
+{
+	uint32_t state = 0x9E3779B9u * (uint32_t)(index + 1);
+	for (unsigned int i = 0; i < VIDEO_SIZE; i++) {
+		state = state * 1664525u + 1013904223u;
+		video[i] = ((state >> 24) % (unsigned int)(index + 2) == 0) ? PIXEL_ON : 0;
+	}
+}
+
+// Standard GIF LZW decoder, fails unless exactly count pixels are followed by the end code
+static bool decodeGifPixels(const struct File *file, size_t *at, uint8_t *out, size_t count)
+{
+	static uint16_t prefix[GIF_MAX_CODES];
+	static uint8_t suffix[GIF_MAX_CODES], stack[GIF_MAX_CODES + 1];
+
+	if (*at >= file->size || file->data[*at] < 2 || file->data[*at] > 8)
+		return false;
+	unsigned int minSize = file->data[(*at)++];
+
+	uint8_t *codes = malloc(file->size);
+	size_t length = 0;
+	if (codes == NULL)
+		return false;
+	while (*at < file->size && file->data[*at] != 0) {
+		size_t block = file->data[*at];
+		if (*at + 1 + block > file->size)
+			break;
+		memcpy(codes + length, file->data + *at + 1, block);
+		length += block;
+		*at += 1 + block;
+	}
+	if (*at >= file->size || file->data[*at] != 0) {
+		free(codes);
+		return false;
+	}
+	(*at)++;
+
+	const uint32_t clear = 1u << minSize, end = clear + 1;
+	uint32_t next = end + 1;
+	unsigned int size = minSize + 1;
+	int32_t previous = -1;
+	uint8_t first = 0;
+	size_t produced = 0, bit = 0;
+	bool ok = false;
+
+	for (uint32_t i = 0; i < clear; i++)
+		suffix[i] = (uint8_t)i;
+	while (bit + size <= length * 8) {
+		uint32_t code = 0;
+		for (unsigned int b = 0; b < size; b++, bit++)
+			code |= (uint32_t)((codes[bit / 8] >> (bit % 8)) & 1) << b;
+
+		if (code == clear) {
+			size = minSize + 1;
+			next = end + 1;
+			previous = -1;
+			continue;
+		}
+		if (code == end) {
+			ok = produced == count;
+			break;
+		}
+		if (code > next || (previous < 0 && code >= clear))
+			break;
+
+		unsigned int depth = 0;
+		uint32_t walk = code;
+		if (code == next) {
+			stack[depth++] = first;
+			walk = (uint32_t)previous;
+		}
+		while (walk >= clear) {
+			stack[depth++] = suffix[walk];
+			walk = prefix[walk];
+		}
+		stack[depth++] = (uint8_t)walk;
+		first = (uint8_t)walk;
+		if (produced + depth > count)
+			break;
+		while (depth > 0)
+			out[produced++] = stack[--depth];
+
+		if (previous >= 0 && next < GIF_MAX_CODES) {
+			prefix[next] = (uint16_t)previous;
+			suffix[next] = first;
+			if (++next == (1u << size) && size < 12)
+				size++;
+		}
+		previous = (int32_t)code;
+	}
+
+	free(codes);
+	return ok;
+}
+
+// Composes every frame on a canvas and compares it with the expected picture
+static bool checkGif(const char *path, uint8_t (*expected)[RECORDER_FRAME_BYTES], uint32_t frames, unsigned int scale)
+{
+	struct File file;
+	if (!readFile(path, &file) || file.size < 13 || memcmp(file.data, "GIF89a", 6) != 0) {
+		fprintf(stderr, "%s: not a GIF\n", path);
+		return false;
+	}
+
+	unsigned int width = readLittleEndian16(file.data + 6), height = readLittleEndian16(file.data + 8);
+	size_t at = 13;
+	if (file.data[10] & 0x80)
+		at += 3u << ((file.data[10] & 7) + 1);
+	uint8_t *canvas = calloc((size_t)width * height, 1), *pixels = malloc((size_t)width * height);
+	uint32_t decoded = 0, delays = 0, controls = 0;
+	bool ok = width == VIDEO_WIDTH * scale && height == VIDEO_HEIGHT * scale && canvas != NULL && pixels != NULL;
+
+	while (ok) {
+		if (at >= file.size) {
+			fprintf(stderr, "%s: no trailer\n", path);
+			ok = false;
+		}
+		else if (file.data[at] == 0x3B) {
+			if (at + 1 != file.size) {
+				fprintf(stderr, "%s: data after the trailer\n", path);
+				ok = false;
+			}
+			break;
+		}
+		else if (file.data[at] == 0x21 && at + 2 < file.size) {
+			// Extension: graphic control carries the delay, the rest is skipped
+			if (file.data[at + 1] == 0xF9 && at + 8 <= file.size) {
+				delays += readLittleEndian16(file.data + at + 4) > 0;
+				controls++;
+			}
+			at += 2;
+			while (at < file.size && file.data[at] != 0)
+				at += file.data[at] + 1u;
+			at++;
+		}
+		else if (file.data[at] == 0x2C && at + 10 <= file.size) {
+			unsigned int left = readLittleEndian16(file.data + at + 1), top = readLittleEndian16(file.data + at + 3);
+			unsigned int areaWidth = readLittleEndian16(file.data + at + 5), areaHeight = readLittleEndian16(file.data + at + 7);
+			at += 10;
+			if (left + areaWidth > width || top + areaHeight > height || file.data[at - 1] != 0 ||
+				!decodeGifPixels(&file, &at, pixels, (size_t)areaWidth * areaHeight)) {
+				fprintf(stderr, "%s: frame %u is malformed\n", path, decoded);
+				ok = false;
+				break;
+			}
+			for (unsigned int y = 0; y < areaHeight; y++)
+				memcpy(canvas + (size_t)(top + y) * width + left, pixels + (size_t)y * areaWidth, areaWidth);
+
+			for (unsigned int y = 0; ok && decoded < frames && y < height; y++) {
+				for (unsigned int x = 0; x < width; x++) {
+					if (canvas[(size_t)y * width + x] != pixelAt(expected[decoded], x / scale, y / scale)) {
+						fprintf(stderr, "%s: frame %u differs at %u,%u\n", path, decoded, x, y);
+						ok = false;
+						break;
+					}
+				}
+			}
+			decoded++;
+		}
+		else {
+			fprintf(stderr, "%s: unknown block at %zu\n", path, at);
+			ok = false;
+		}
+	}
+
+	if (ok && (decoded != frames || controls != frames || delays != frames)) {
+		fprintf(stderr, "%s: %u frames, %u with a delay, expected %u\n", path, decoded, delays, frames);
+		ok = false;
+	}
+	printf("%s: %u frames, %zu bytes %s\n", path, decoded, file.size, ok ? "ok" : "FAILED");
+	free(canvas);
+	free(pixels);
+	free(file.data);
+	return ok;
+}
+
+// Walks the chunks: CRCs, order, sequence numbers and the frame count in acTL
+static bool checkApng(const char *path, uint32_t frames, unsigned int scale)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	struct File file;
+	if (!readFile(path, &file) || file.size < 8 || memcmp(file.data, signature, 8) != 0) {
+		fprintf(stderr, "%s: not a PNG\n", path);
+		return false;
+	}
+
+	uint32_t width = 0, height = 0, declared = 0, controls = 0, images = 0, sequence = 0, chunks = 0;
+	bool ok = true, ended = false;
+	size_t at = 8;
+
+	while (ok && !ended && at + 12 <= file.size) {
+		uint32_t length = readBigEndian(file.data + at);
+		const uint8_t *type = file.data + at + 4, *data = type + 4;
+		if (length > file.size - at - 12 ||
+			readBigEndian(data + length) != updateCrc32(updateCrc32(0, type, 4), data, length)) {
+			fprintf(stderr, "%s: chunk %u is truncated or has a bad CRC\n", path, chunks);
+			ok = false;
+			break;
+		}
+
+		if (chunks == 0 && (memcmp(type, "IHDR", 4) != 0 || length != 13)) {
+			fprintf(stderr, "%s: IHDR isn't first\n", path);
+			ok = false;
+		}
+		else if (memcmp(type, "IHDR", 4) == 0) {
+			width = readBigEndian(data);
+			height = readBigEndian(data + 4);
+		}
+		else if (memcmp(type, "acTL", 4) == 0 && length == 8) {
+			declared = readBigEndian(data);
+			ok = images == 0;
+		}
+		else if (memcmp(type, "fcTL", 4) == 0 && length == 26) {
+			uint32_t frameWidth = readBigEndian(data + 4), frameHeight = readBigEndian(data + 8);
+			ok = readBigEndian(data) == sequence++ && frameWidth > 0 && frameHeight > 0 &&
+				readBigEndian(data + 12) + frameWidth <= width && readBigEndian(data + 16) + frameHeight <= height &&
+				(data[20] << 8 | data[21]) > 0;
+			controls++;
+		}
+		else if (memcmp(type, "IDAT", 4) == 0) {
+			// The default image is the first frame, its fcTL comes before it
+			ok = controls == 1 && images == 0;
+			images++;
+		}
+		else if (memcmp(type, "fdAT", 4) == 0 && length > 4) {
+			ok = images > 0 && readBigEndian(data) == sequence++ && controls == images + 1;
+			images++;
+		}
+		else if (memcmp(type, "IEND", 4) == 0) {
+			ended = true;
+		}
+		else if (memcmp(type, "PLTE", 4) != 0) {
+			ok = false;
+		}
+		if (!ok)
+			fprintf(stderr, "%s: chunk %u (%.4s) is out of place or malformed\n", path, chunks, (const char*)type);
+		at += 12 + (size_t)length;
+		chunks++;
+	}
+
+	if (ok && (!ended || at != file.size)) {
+		fprintf(stderr, "%s: IEND missing or not last\n", path);
+		ok = false;
+	}
+	if (ok && (width != VIDEO_WIDTH * scale || height != VIDEO_HEIGHT * scale || declared != frames ||
+		controls != frames || images != frames)) {
+		fprintf(stderr, "%s: acTL says %u frames, %u fcTL, %u images, expected %u\n", path, declared, controls, images, frames);
+		ok = false;
+	}
+	printf("%s: %u frames, %zu bytes %s\n", path, images, file.size, ok ? "ok" : "FAILED");
+	free(file.data);
+	return ok;
+}
+
+// Decodes every record against the previous picture and compares it with the expected one
+static bool checkRaw(const char *path, uint8_t (*expected)[RECORDER_FRAME_BYTES], uint32_t frames)
+{
+	struct File file;
+	if (!readFile(path, &file) || file.size < 7 || memcmp(file.data, RECORDER_RAW_MAGIC, 4) != 0 ||
+		file.data[4] != RECORDER_RAW_VERSION || file.data[5] != VIDEO_WIDTH || file.data[6] != VIDEO_HEIGHT) {
+		fprintf(stderr, "%s: bad raw header\n", path);
+		return false;
+	}
+
+	uint8_t previous[RECORDER_FRAME_BYTES] = { 0 }, picture[RECORDER_FRAME_BYTES];
+	uint32_t decoded = 0;
+	size_t at = 7;
+	bool ok = true;
+
+	while (ok && at < file.size) {
+		uint64_t duration, length;
+		if (!readVarint(&file, &at, &duration) || !readVarint(&file, &at, &length) || length > file.size - at ||
+			duration == 0 || !decodeDelta(file.data + at, (size_t)length, previous, picture, sizeof(picture))) {
+			fprintf(stderr, "%s: record %u is malformed\n", path, decoded);
+			ok = false;
+			break;
+		}
+		if (decoded >= frames || memcmp(picture, expected[decoded], sizeof(picture)) != 0) {
+			fprintf(stderr, "%s: record %u isn't the recorded picture\n", path, decoded);
+			ok = false;
+		}
+		memcpy(previous, picture, sizeof(picture));
+		at += (size_t)length;
+		decoded++;
+	}
+
+	if (ok && decoded != frames) {
+		fprintf(stderr, "%s: %u records, expected %u\n", path, decoded, frames);
+		ok = false;
+	}
+	printf("%s: %u frames, %zu bytes %s\n", path, decoded, file.size, ok ? "ok" : "FAILED");
+	free(file.data);
+	return ok;
+}
+
+static int selfTest(void)
+{
+	const char *extensions[3] = { "gif", "png", "c8v" };
+	char paths[3][64], emptyPaths[2][64];
+	static struct Recorder recorders[3], empty[2];
+	static uint8_t video[VIDEO_SIZE];
+
+	// The screen is black until the first picture, then each change is one frame
+	uint8_t (*expected)[RECORDER_FRAME_BYTES] = calloc(sizeof(script) / sizeof(script[0]) + 1, RECORDER_FRAME_BYTES);
+	uint32_t frames = 1;
+	if (expected == NULL)
+		return 1;
+
+	for (int i = 0; i < 3; i++) {
+		snprintf(paths[i], sizeof(paths[i]), "/tmp/chippy-record-%d.%s", (int)getpid(), extensions[i]);
+		startRecorder(&recorders[i], paths[i], TEST_SCALE);
+		if (!recorders[i].enabled)
+			return 1;
+	}
+
+	struct timespec step = { 0, TEST_STEP_NS };
+	for (size_t s = 0; s < sizeof(script) / sizeof(script[0]); s++) {
+		makePicture(script[s], video);
+		packBits(video, VIDEO_SIZE, expected[frames]);
+		if (memcmp(expected[frames], expected[frames - 1], RECORDER_FRAME_BYTES) != 0)
+			frames++;
+
+		nanosleep(&step, NULL);
+		for (int i = 0; i < 3; i++)
+			recordFrame(&recorders[i], video, pacerNowNs());
+	}
+	nanosleep(&step, NULL);
+
+	bool ok = true;
+	for (int i = 0; i < 3; i++) {
+		stopRecorder(&recorders[i]);
+		if (recorders[i].encoded != frames || atomic_load(&recorders[i].dropped) != 0) {
+			fprintf(stderr, "%s: %u frames encoded, expected %u\n", paths[i], recorders[i].encoded, frames);
+			ok = false;
+		}
+	}
+	ok &= checkGif(paths[0], expected, frames, TEST_SCALE);
+	ok &= checkApng(paths[1], frames, TEST_SCALE);
+	ok &= checkRaw(paths[2], expected, frames);
+
+	// Stopped right away: one black frame, not an empty animation
+	for (int i = 0; i < 2; i++) {
+		snprintf(emptyPaths[i], sizeof(emptyPaths[i]), "/tmp/chippy-record-%d-empty.%s", (int)getpid(), extensions[i]);
+		startRecorder(&empty[i], emptyPaths[i], TEST_SCALE);
+		stopRecorder(&empty[i]);
+	}
+	ok &= checkGif(emptyPaths[0], expected, 1, TEST_SCALE);
+	ok &= checkApng(emptyPaths[1], 1, TEST_SCALE);
+
+	for (int i = 0; i < 3; i++)
+		remove(paths[i]);
+	for (int i = 0; i < 2; i++)
+		remove(emptyPaths[i]);
+	free(expected);
+	return ok ? 0 : 1;
+}
+
+static int record(const char *rom, const char *output, unsigned long frames, unsigned int scale)
+{
+	static struct Chip8 chip;
+	static struct Recorder recorder;
+	struct Pacer pacer;
+
+	initEmulator(&chip);
+	loadRom(&chip, rom);
+	loadFonts(&chip);
+	startRecorder(&recorder, output, scale);
+	if (!recorder.enabled)
+		return 1;
+
+	initPacer(&pacer, 60);
+	for (unsigned long frame = 0; frame < frames && chip.fault == FAULT_NONE; frame++) {
+		waitPacer(&pacer);
+		uint64_t end = chip.instructions + CYCLES_PER_TICK;
+		while (chip.instructions < end && chip.fault == FAULT_NONE)
+			Cycle(&chip);
+		updateTimers(&chip);
+		recordFrame(&recorder, chip.video, pacerNowNs());
+	}
+
+	stopRecorder(&recorder);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long frames = DEFAULT_FRAMES;
+	unsigned int scale = RECORDER_DEFAULT_SCALE;
+	int arg = 1;
+
+	if (argc == 2 && strcmp(argv[1], "--self-test") == 0)
+		return selfTest();
+
+	for (; arg < argc - 2; arg++) {
+		if (strcmp(argv[arg], "--frames") == 0 && arg + 3 < argc)
+			frames = strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--scale") == 0 && arg + 3 < argc)
+			scale = (unsigned int)strtoul(argv[++arg], NULL, 10);
+		else
+			break;
+	}
+	if (arg != argc - 2) {
+		fprintf(stderr, "usage: %s [--frames N] [--scale S] rom output\n       %s --self-test\n", argv[0], argv[0]);
+		return 1;
+	}
+	return record(argv[arg], argv[arg + 1], frames, scale);
+}
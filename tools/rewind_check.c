@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "emulator.h"
+#include "delta.h"
+#include "rewind.h"
+
+// Rewind and delta codec check
+// Round-trips encodeDelta()/decodeDelta() on random, sparse and worst case buffers with
+// and without a reference, every encoding has to stay within DELTA_BOUND. Then runs rom
+// headless with changing keys, captures every tick into a rewind history like the
+// emulation thread and checks stepping back against the state saved at each frame: part
+// way back across keyframes, forward again from there, and finally all the way to the
+// oldest frame still held once the history wrapped.
+//
+// usage: rewind_check [--frames N] rom
+
+#define DEFAULT_FRAMES (REWIND_SECONDS * REWIND_FRAME_RATE + 3 * REWIND_KEYFRAME_INTERVAL + 37)
+#define PARTIAL_STEPS (2 * REWIND_KEYFRAME_INTERVAL + 11)
+#define ROM_SEED 0xC8C8C8C8u
+#define MAX_BUFFER REWIND_STATE_SIZE
+
+enum Pattern {
+	PATTERN_RANDOM,				// every byte differs
+	PATTERN_SPARSE,				// a few scattered changes
+	PATTERN_SHORT_GAPS,			// zero runs just too short to end a literal
+	PATTERN_LONG_GAPS,			// zero runs just long enough to end one
+	PATTERN_SAME,				// identical to the reference
+	PATTERN_COUNT
+};
+
+static const char *patternNames[PATTERN_COUNT] = { "random", "sparse", "short gaps", "long gaps", "same" };
+
+static uint32_t rngState = 0x2545F491u;
+
+static uint32_t nextRandom(void)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+static uint8_t nonZero(void)
+{
+	return (uint8_t)(nextRandom() % 255 + 1);
+}
+
+static uint64_t hashChip(const struct Chip8 *chip)
+{
+	const uint8_t *bytes = (const uint8_t*)chip;
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (size_t i = 0; i < sizeof(struct Chip8); i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+// current differs from reference (or zeros) as pattern says
+static void makeBuffer(enum Pattern pattern, const uint8_t *reference, uint8_t *current, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		uint8_t base = reference ? reference[i] : 0;
+		bool change;
+		switch (pattern) {
+		case PATTERN_RANDOM:		change = true; break;
+		case PATTERN_SPARSE:		change = nextRandom() % 97 == 0; break;
+		case PATTERN_SHORT_GAPS:	change = i % 4 == 0; break;
+		case PATTERN_LONG_GAPS:		change = i % 5 == 0; break;
+		default:					change = false; break;
+		}
+		current[i] = change ? base ^ nonZero() : base;
+	}
+}
+
+static int checkDelta(void)
+{
+	static const size_t sizes[] = { 0, 1, 3, 4, 5, 7, 8, 9, 63, 64, 65, 200, 4096, MAX_BUFFER };
+	static uint8_t reference[MAX_BUFFER], current[MAX_BUFFER], decoded[MAX_BUFFER];
+	static uint8_t encoded[DELTA_BOUND(MAX_BUFFER)];
+	int failures = 0, cases = 0;
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		size_t size = sizes[s];
+		for (int pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+			for (int withReference = 0; withReference < 2; withReference++) {
+				const uint8_t *base = withReference ? reference : NULL;
+				for (size_t i = 0; i < size; i++)
+					reference[i] = (uint8_t)nextRandom();
+				makeBuffer((enum Pattern)pattern, base, current, size);
+
+				size_t length = encodeDelta(current, base, size, encoded);
+				bool ok = length <= DELTA_BOUND(size) && decodeDelta(encoded, length, base, decoded, size) &&
+					memcmp(decoded, current, size) == 0;
+				// The same delta also steps back from current to the reference
+				if (ok && base != NULL)
+					ok = decodeDelta(encoded, length, current, decoded, size) && memcmp(decoded, reference, size) == 0;
+				if (!ok) {
+					fprintf(stderr, "delta: %s, %zu bytes, %s reference: %zu bytes encoded, bound %zu, round trip failed\n",
+						patternNames[pattern], size, withReference ? "random" : "no", length, (size_t)DELTA_BOUND(size));
+					failures++;
+				}
+				cases++;
+			}
+		}
+	}
+
+	// A literal claiming more bytes than the buffer holds has to be rejected
+	static const uint8_t overlong[] = { 0, 10, 1, 2, 3 };
+	if (decodeDelta(overlong, sizeof(overlong), NULL, decoded, 4)) {
+		fprintf(stderr, "delta: overlong literal accepted\n");
+		failures++;
+	}
+
+	printf("delta: %d round trips, %d failed\n", cases, failures);
+	return failures;
+}
+
+static void runTick(struct Chip8 *chip, uint32_t frame)
+{
+	for (int k = 0; k < 16; k++)
+		chip->keypad[k] = ((frame / 20 + (uint32_t)k) % 5) == 0;
+	uint64_t end = chip->instructions + CYCLES_PER_TICK;
+	while (chip->instructions < end)
+		Cycle(chip);
+	updateTimers(chip);
+}
+
+// Step back count frames from frame, comparing each restored state, returns the frame reached
+static uint32_t stepBack(struct Rewind *history, struct Chip8 *chip, const uint64_t *hashes, uint32_t frame,
+	uint32_t count, int *failures)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		if (!stepRewind(history, chip))
+			break;
+		frame--;
+		if (hashChip(chip) != hashes[frame]) {
+			if (*failures < 10)
+				fprintf(stderr, "rewind: state at frame %u differs from the one saved\n", frame);
+			(*failures)++;
+		}
+	}
+	return frame;
+}
+
+static int checkRewind(const char *rom, uint32_t frames)
+{
+	static struct Chip8 chip;
+	static struct Rewind history;
+	uint64_t *hashes = malloc((size_t)frames * sizeof(uint64_t));
+	int failures = 0;
+	if (hashes == NULL)
+		return 1;
+
+	initEmulator(&chip);
+	loadRom(&chip, rom);
+	loadFonts(&chip);
+	seedEmulator(&chip, ROM_SEED);
+	initRewind(&history);
+
+	// hashes[f] is the state after tick f, as captured
+	for (uint32_t frame = 0; frame < frames; frame++) {
+		runTick(&chip, frame);
+		captureRewind(&history, &chip);
+		hashes[frame] = hashChip(&chip);
+	}
+
+	// Back across keyframes, then forward again from there must retrace the same states
+	uint32_t steps = frames - 1 < PARTIAL_STEPS ? frames - 1 : PARTIAL_STEPS;
+	uint32_t frame = stepBack(&history, &chip, hashes, frames - 1, steps, &failures);
+	if (frame != frames - 1 - steps) {
+		fprintf(stderr, "rewind: stopped %u frames back, expected %u\n", frames - 1 - frame, steps);
+		failures++;
+	}
+	for (frame++; frame < frames; frame++) {
+		runTick(&chip, frame);
+		captureRewind(&history, &chip);
+		if (hashChip(&chip) != hashes[frame]) {
+			fprintf(stderr, "rewind: replay after stepping back diverged at frame %u\n", frame);
+			failures++;
+			break;
+		}
+	}
+
+	// Then all the way back, the oldest segment went once the history wrapped
+	uint32_t oldest = stepBack(&history, &chip, hashes, frames - 1, frames, &failures);
+	uint32_t kept = frames - oldest;
+	uint32_t minimum = (REWIND_SEGMENTS - 1) * REWIND_KEYFRAME_INTERVAL;
+	if (stepRewind(&history, &chip) || kept < (frames < minimum ? frames : minimum)) {
+		fprintf(stderr, "rewind: %u frames held, expected at least %u\n", kept, frames < minimum ? frames : minimum);
+		failures++;
+	}
+
+	printf("rewind: %u frames captured, %u held, %zu bytes, %d mismatches\n", frames, kept, rewindSize(&history), failures);
+	freeRewind(&history);
+	free(hashes);
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long frames = DEFAULT_FRAMES;
+	int arg = 1;
+
+	for (; arg < argc - 1; arg++) {
+		if (strcmp(argv[arg], "--frames") == 0 && arg + 2 < argc)
+			frames = strtoul(argv[++arg], NULL, 10);
+		else
+			break;
+	}
+	if (arg != argc - 1 || frames < 2) {
+		fprintf(stderr, "usage: %s [--frames N] rom\n", argv[0]);
+		return 1;
+	}
+
+	int failures = checkDelta();
+	failures += checkRewind(argv[arg], (uint32_t)frames);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "emulator.h"
+#include "fingerprint.h"
+#include "rom_archive.h"
+#include "pacer.h"
+
+// ROM corpus crawler
+// Runs every ROM under the given directories and zip packs headless, no keys pressed,
+// for a budget of 60 Hz frames and sorts each into one of:
+//   crashed            the core raised a fault (unknown opcode, stack under/overflow, PC range)
+//   hung               the whole state repeats and nothing read the keypad in between
+//   waiting_for_input  the state repeats while the ROM sits in FX0A or polls EX9E/EXA1
+//   healthy            the budget ran out with the state still changing
+//   invalid            unreadable or larger than MAX_ROM_SIZE
+// With no input and a deterministic core a repeated state means the ROM loops forever.
+// The state is compared once per frame through its incrementally kept fingerprint.
+//
+// usage: rom_crawler [--threads N] [--frames N] [--cycles N] [--output report.json] dir|zip|rom...
+
+#define DEFAULT_FRAMES 1800
+#define ROM_SEED 0xC8C8C8C8u
+#define PATH_SIZE 1024
+
+enum Status { STATUS_HEALTHY, STATUS_CRASHED, STATUS_HUNG, STATUS_WAITING, STATUS_INVALID, STATUS_COUNT };
+
+static const char *statusNames[] = { "healthy", "crashed", "hung", "waiting_for_input", "invalid" };
+
+struct Job {
+	char *path;
+	size_t size;
+
+	enum Status status;
+	const char *reason;
+	uint32_t frames;		// frames run before the verdict
+	uint32_t loopFrames;	// length of the repeating cycle
+	uint64_t instructions;
+	uint16_t pc;
+	uint16_t opcode;		// at pc, or at the faulting instruction
+	double ms;
+};
+
+// Frame hashes seen so far, open addressing
+struct SeenTable {
+	uint64_t *hashes;
+	uint32_t *frames;
+	uint32_t mask;
+};
+
+static struct Job *jobs;
+static size_t jobCount;
+static size_t jobCapacity;
+static atomic_size_t nextJob;
+static uint32_t frameBudget = DEFAULT_FRAMES;
+static uint32_t cyclesPerFrame = CYCLES_PER_TICK;
+
+// Returns the frame hash was first seen at, or UINT32_MAX after recording it for frame
+static uint32_t checkSeen(struct SeenTable *seen, uint64_t hash, uint32_t frame)
+{
+	uint32_t slot = (uint32_t)hash & seen->mask;
+
+	while (seen->frames[slot] != UINT32_MAX) {
+		if (seen->hashes[slot] == hash)
+			return seen->frames[slot];
+		slot = (slot + 1) & seen->mask;
+	}
+	seen->hashes[slot] = hash;
+	seen->frames[slot] = frame;
+	return UINT32_MAX;
+}
+
+static bool readsInput(uint16_t opcode)
+{
+	return (opcode & 0xF000) == 0xE000 || (opcode & 0xF0FF) == 0xF00A;
+}
+
+static uint16_t opcodeAt(const struct Chip8 *chip, uint16_t address)
+{
+	return (chip->memory[address & ADDRESS_MASK] << 8) | chip->memory[(address + 1) & ADDRESS_MASK];
+}
+
+static bool loadJob(struct Job *job, struct Chip8 *chip)
+{
+	uint8_t buffer[MAX_ROM_SIZE + 1];
+	long size = readRomImage(job->path, buffer, sizeof(buffer));
+
+	if (size < 0) {
+		job->reason = "unreadable";
+		return false;
+	}
+	job->size = (size > (long)sizeof(buffer)) ? sizeof(buffer) : (size_t)size;
+
+	releaseEmulator(chip);
+	initEmulator(chip);
+	loadFonts(chip);
+	if (!loadRomFromMemory(chip, buffer, job->size)) {
+		job->reason = "too_large";
+		return false;
+	}
+	seedEmulator(chip, ROM_SEED);
+	return true;
+}
+
+static void runJob(struct Job *job, struct Chip8 *chip, struct SeenTable *seen)
+{
+	uint64_t start = pacerNowNs();
+
+	job->status = STATUS_HEALTHY;
+	job->reason = "budget";
+	if (!loadJob(job, chip)) {
+		job->status = STATUS_INVALID;
+		job->ms = (double)(pacerNowNs() - start) / 1e6;
+		return;
+	}
+
+	memset(seen->frames, 0xFF, (seen->mask + 1) * sizeof(uint32_t));
+
+	uint32_t inputFrame = UINT32_MAX;	// last frame that read the keypad
+	uint32_t frame = 0;
+
+	checkSeen(seen, stateFingerprint(chip), 0);
+	while (frame < frameBudget) {
+		// Same scheduling as the emulation thread before a ROM is tuned, unless --cycles says otherwise
+		uint64_t end = chip->instructions + cyclesPerFrame;
+		while (chip->instructions < end && chip->fault == FAULT_NONE) {
+			Cycle(chip);
+			if (readsInput(chip->opcode))
+				inputFrame = frame;
+		}
+		updateTimers(chip);
+		frame++;
+
+		if (chip->fault != FAULT_NONE) {
+			job->status = STATUS_CRASHED;
+			job->reason = faultName(chip->fault);
+			job->pc = chip->faultPC;
+			job->opcode = opcodeAt(chip, chip->faultPC);
+			break;
+		}
+
+		uint32_t first = checkSeen(seen, stateFingerprint(chip), frame);
+		if (first != UINT32_MAX) {
+			job->loopFrames = frame - first;
+			if (inputFrame != UINT32_MAX && inputFrame >= first) {
+				job->status = STATUS_WAITING;
+				job->reason = ((opcodeAt(chip, chip->PC) & 0xF0FF) == 0xF00A) ? "fx0a" : "polling";
+			}
+			else {
+				job->status = STATUS_HUNG;
+				job->reason = "loop";
+			}
+			break;
+		}
+	}
+
+	job->frames = frame;
+	job->instructions = chip->instructions;
+	if (job->status != STATUS_CRASHED) {
+		job->pc = chip->PC;
+		job->opcode = opcodeAt(chip, chip->PC);
+	}
+	job->ms = (double)(pacerNowNs() - start) / 1e6;
+}
+
+static void* runWorker(void *arg)
+{
+	(void)arg;
+	struct Chip8 *chip = createEmulator();
+	struct SeenTable seen;
+
+	// At most one entry per frame, keep the table at most half full
+	uint32_t capacity = 1024;
+	while (capacity < 2 * (frameBudget + 1))
+		capacity *= 2;
+	seen.hashes = malloc(capacity * sizeof(uint64_t));
+	seen.frames = malloc(capacity * sizeof(uint32_t));
+	seen.mask = capacity - 1;
+
+	for (;;) {
+		size_t index = atomic_fetch_add(&nextJob, 1);
+		if (index >= jobCount)
+			break;
+		runJob(&jobs[index], chip, &seen);
+	}
+
+	free(seen.frames);
+	free(seen.hashes);
+	releaseEmulator(chip);
+	free(chip);
+	return NULL;
+}
+
+static void addJob(const char *path)
+{
+	if (jobCount == jobCapacity) {
+		jobCapacity = jobCapacity ? jobCapacity * 2 : 256;
+		jobs = realloc(jobs, jobCapacity * sizeof(struct Job));
+	}
+	memset(&jobs[jobCount], 0, sizeof(struct Job));
+	jobs[jobCount++].path = strdup(path);
+}
+
+static void addArchiveJob(void *user, const char *name, uint32_t size)
+{
+	char path[PATH_SIZE];
+	(void)size;
+	snprintf(path, sizeof(path), "%s%c%s", (const char*)user, ARCHIVE_SEPARATOR, name);
+	addJob(path);
+}
+
+// Files named on the command line are taken as they are, directories are walked for ROMs
+// and zip packs are crawled entry by entry
+static void collect(const char *path, bool named)
+{
+	struct stat info;
+	if (stat(path, &info) != 0) {
+		if (named)
+			addJob(path);
+		return;
+	}
+	if (S_ISREG(info.st_mode) && strlen(path) > 4 && strcasecmp(path + strlen(path) - 4, ".zip") == 0) {
+		if (!listRomArchive(path, addArchiveJob, (void*)path))
+			addJob(path);		// reported as unreadable
+		return;
+	}
+	if (!S_ISDIR(info.st_mode)) {
+		if (named || (S_ISREG(info.st_mode) && isRomName(path)))
+			addJob(path);
+		return;
+	}
+
+	DIR *dir = opendir(path);
+	struct dirent *entry;
+	char child[PATH_SIZE];
+
+	while (dir != NULL && (entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+		collect(child, false);
+	}
+	if (dir != NULL)
+		closedir(dir);
+}
+
+static int compareJobs(const void *a, const void *b)
+{
+	return strcmp(((const struct Job*)a)->path, ((const struct Job*)b)->path);
+}
+
+static void writeString(FILE *out, const char *text)
+{
+	fputc('"', out);
+	for (const unsigned char *c = (const unsigned char*)text; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(out, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(out, "\\u%04x", *c);
+		else
+			fputc(*c, out);
+	}
+	fputc('"', out);
+}
+
+static void writeReport(FILE *out, const size_t *counts, double seconds)
+{
+	fprintf(out, "{\n  \"frames\": %u,\n  \"cycles_per_frame\": %u,\n  \"seconds\": %.3f,\n  \"summary\": {",
+		frameBudget, cyclesPerFrame, seconds);
+	for (int status = 0; status < STATUS_COUNT; status++)
+		fprintf(out, "%s\"%s\": %zu", status ? ", " : " ", statusNames[status], counts[status]);
+	fprintf(out, " },\n  \"roms\": [");
+
+	for (size_t i = 0; i < jobCount; i++) {
+		const struct Job *job = &jobs[i];
+
+		fprintf(out, "%s\n    { \"path\": ", i ? "," : "");
+		writeString(out, job->path);
+		fprintf(out, ", \"size\": %zu, \"status\": \"%s\", \"reason\": \"%s\"", job->size, statusNames[job->status], job->reason);
+		if (job->status != STATUS_INVALID) {
+			fprintf(out, ", \"frames\": %u, \"instructions\": %llu, \"pc\": \"0x%03X\", \"opcode\": \"0x%04X\"",
+				job->frames, (unsigned long long)job->instructions, job->pc, job->opcode);
+		}
+		if (job->status == STATUS_HUNG || job->status == STATUS_WAITING)
+			fprintf(out, ", \"loop_frames\": %u", job->loopFrames);
+		fprintf(out, ", \"ms\": %.3f }", job->ms);
+	}
+	fprintf(out, "\n  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = processors > 0 ? (int)processors : 4;
+	const char *output = NULL;
+	int arg = 1;
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc)
+			threads = atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "--frames") == 0 && arg + 1 < argc)
+			frameBudget = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc)
+			cyclesPerFrame = (uint32_t)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--output") == 0 && arg + 1 < argc)
+			output = argv[++arg];
+		else
+			break;
+	}
+	if (arg >= argc || threads < 1 || frameBudget == 0 || cyclesPerFrame == 0) {
+		fprintf(stderr, "usage: %s [--threads N] [--frames N] [--cycles N] [--output report.json] dir|zip|rom...\n", argv[0]);
+		return 1;
+	}
+
+	for (; arg < argc; arg++)
+		collect(argv[arg], true);
+	if (jobCount == 0) {
+		fprintf(stderr, "no ROMs found\n");
+		return 1;
+	}
+	qsort(jobs, jobCount, sizeof(struct Job), compareJobs);
+
+	if ((size_t)threads > jobCount)
+		threads = (int)jobCount;
+
+	uint64_t start = pacerNowNs();
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	for (int i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, runWorker, NULL);
+	for (int i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	double seconds = (double)(pacerNowNs() - start) / 1e9;
+
+	size_t counts[STATUS_COUNT] = { 0 };
+	for (size_t i = 0; i < jobCount; i++)
+		counts[jobs[i].status]++;
+
+	FILE *out = output ? fopen(output, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "could not write %s\n", output);
+		return 1;
+	}
+	writeReport(out, counts, seconds);
+	if (output)
+		fclose(out);
+
+	fprintf(stderr, "%zu ROMs in %.2f s:", jobCount, seconds);
+	for (int status = 0; status < STATUS_COUNT; status++)
+		fprintf(stderr, " %s=%zu", statusNames[status], counts[status]);
+	fprintf(stderr, "\n");
+
+	for (size_t i = 0; i < jobCount; i++)
+		free(jobs[i].path);
+	free(jobs);
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shm_export.h"
+
+// Shared memory frame reader
+// Example consumer for CHIPPY_SHM: follows the newest frame at its own pace, reads each
+// slot in place and reports frames it had to skip. --ascii also draws the display.
+// Stops after N frames or once the writer has been quiet for five seconds.
+//
+// usage: shm_reader [--ascii] [--frames N] name
+
+#define POLL_NS 2000000
+#define RETRY_NS 100000		// the writer is inside the slot, it is done within microseconds
+#define IDLE_POLLS 2500		// give up after 5 s without a new frame, the writer is gone
+
+static int litPixels(const struct ShmFrame *slot)
+{
+	int lit = 0;
+	for (int i = 0; i < VIDEO_SIZE; i++)
+		lit += slot->video[i] != 0;
+	return lit;
+}
+
+static void drawAscii(const struct ShmFrame *slot, char *out)
+{
+	for (int y = 0; y < VIDEO_HEIGHT; y++) {
+		for (int x = 0; x < VIDEO_WIDTH; x++)
+			*out++ = slot->video[y * VIDEO_WIDTH + x] ? '#' : '.';
+		*out++ = '\n';
+	}
+	*out = '\0';
+}
+
+int main(int argc, char **argv)
+{
+	bool ascii = false;
+	unsigned long limit = 0;
+	int arg = 1;
+
+	for (; arg < argc - 1; arg++) {
+		if (strcmp(argv[arg], "--ascii") == 0)
+			ascii = true;
+		else if (strcmp(argv[arg], "--frames") == 0 && arg + 2 < argc)
+			limit = strtoul(argv[++arg], NULL, 10);
+		else
+			break;
+	}
+	if (arg != argc - 1) {
+		fprintf(stderr, "usage: %s [--ascii] [--frames N] name\n", argv[0]);
+		return 1;
+	}
+
+	const struct ShmExportHeader *header = attachShmExport(argv[arg]);
+	if (header == NULL) {
+		fprintf(stderr, "%s: no compatible frame export\n", argv[arg]);
+		return 1;
+	}
+
+	struct timespec pause = { 0, POLL_NS }, retry = { 0, RETRY_NS };
+	char picture[(VIDEO_WIDTH + 1) * VIDEO_HEIGHT + 1];
+	uint64_t last = 0;
+	unsigned long seen = 0, skipped = 0, torn = 0, idle = 0;
+
+	while (limit == 0 || seen < limit) {
+		uint64_t latest = atomic_load_explicit((atomic_uint_fast64_t*)&header->latest, memory_order_acquire);
+		if (latest == last) {
+			if (++idle == IDLE_POLLS)
+				break;
+			nanosleep(&pause, NULL);
+			continue;
+		}
+		idle = 0;
+
+		uint32_t sequence;
+		const struct ShmFrame *slot = beginShmRead(header, latest, &sequence);
+		if (slot == NULL) {
+			nanosleep(&retry, NULL);
+			continue;
+		}
+
+		// Everything taken from the slot is only trusted once endShmRead() agrees
+		uint32_t keypad = slot->keypad;
+		uint8_t delayTimer = slot->delayTimer, soundTimer = slot->soundTimer;
+		int lit = litPixels(slot);
+		if (ascii)
+			drawAscii(slot, picture);
+		if (!endShmRead(slot, sequence)) {
+			torn++;
+			continue;
+		}
+
+		if (last != 0 && latest > last + 1)
+			skipped += latest - last - 1;
+		last = latest;
+		seen++;
+
+		printf("frame %llu keypad %04x DT %02x ST %02x lit %d\n", (unsigned long long)latest, keypad, delayTimer, soundTimer, lit);
+		if (ascii)
+			fputs(picture, stdout);
+	}
+
+	printf("read %lu frames, skipped %lu, retried %lu torn reads\n", seen, skipped, torn);
+	detachShmExport(header);
+	return 0;
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "spectator.h"
+#include "pacer.h"
+
+// Spectator viewer
+// Connects to a session started with CHIPPY_SPECTATE and draws its display in the
+// terminal, two pixel rows per character cell. --quiet only prints the summary.
+// --self-test serves a headless run of rom over loopback TCP and a Unix socket to viewers
+// joining at different times and checks every frame they decode against the emulator.
+//
+// usage: spectate [--quiet] [--frames N] address
+//        spectate --self-test [--frames N] rom
+//
+// address is "port" (loopback), "host:port" or "unix:/path/to/socket".
+
+#define DEFAULT_TEST_FRAMES 600
+#define TEST_VIEWERS 4
+#define FRAME_PAUSE_NS 1000000			// lets the server send most frames as deltas
+#define SETTLE_NS 5000000000ULL			// time for the viewers to catch up at the end
+
+struct TestViewer {
+	struct SpectatorView view;
+	const char *name;
+	uint32_t joinFrame;			// connects once the emulator reached this frame
+	bool unixSocket;
+	bool connected;
+	uint32_t checked;
+	uint32_t mismatches;
+};
+
+static void drawFrame(const struct SpectatorView *view)
+{
+	static const char *cells[4] = { " ", "▀", "▄", "█" };
+	char picture[VIDEO_HEIGHT / 2 * (VIDEO_WIDTH * 3 + 1) + 1], *out = picture;
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y += 2) {
+		for (unsigned int x = 0; x < VIDEO_WIDTH; x++) {
+			const char *cell = cells[spectatorPixel(view->bits, x, y) | spectatorPixel(view->bits, x, y + 1) << 1];
+			size_t length = strlen(cell);
+			memcpy(out, cell, length);
+			out += length;
+		}
+		*out++ = '\n';
+	}
+	*out = '\0';
+	printf("\x1b[H%sframe %u keyframes %u bytes %llu\x1b[K\n", picture, view->frame, view->keyframes, (unsigned long long)view->bytes);
+	fflush(stdout);
+}
+
+static int view(const char *address, bool quiet, unsigned long limit)
+{
+	int fd = connectSpectator(address);
+	if (fd < 0) {
+		fprintf(stderr, "%s: can't connect\n", address);
+		return 1;
+	}
+
+	struct SpectatorView spectatorView;
+	unsigned long seen = 0;
+	initSpectatorView(&spectatorView, fd);
+	if (!quiet)
+		printf("\x1b[2J");
+
+	while (limit == 0 || seen < limit) {
+		if (receiveSpectatorFrame(&spectatorView) < 0)
+			break;
+		seen++;
+		if (!quiet)
+			drawFrame(&spectatorView);
+	}
+
+	close(fd);
+	printf("received %lu frames, %u keyframes, %u deltas, %llu bytes\n", seen, spectatorView.keyframes, spectatorView.deltas,
+		(unsigned long long)spectatorView.bytes);
+	return 0;
+}
+
+// Pull whatever arrived and compare each decoded frame with the one the emulator showed
+static void checkViewer(struct TestViewer *viewer, uint8_t (*history)[SPECTATOR_FRAME_BYTES], uint32_t frames)
+{
+	int result;
+	while ((result = receiveSpectatorFrame(&viewer->view)) == 1) {
+		if (viewer->view.frame == 0 || viewer->view.frame > frames ||
+			memcmp(viewer->view.bits, history[viewer->view.frame - 1], SPECTATOR_FRAME_BYTES) != 0)
+			viewer->mismatches++;
+		viewer->checked++;
+	}
+	if (result < 0 && viewer->connected) {
+		fprintf(stderr, "%s: stream ended or malformed at frame %u\n", viewer->name, viewer->view.frame);
+		viewer->mismatches++;
+		viewer->connected = false;
+	}
+}
+
+static int selfTest(const char *rom, uint32_t frames)
+{
+	char unixAddress[108], tcpAddress[32];
+	snprintf(unixAddress, sizeof(unixAddress), SPECTATOR_UNIX_PREFIX "/tmp/chippy-spectate-%d.sock", (int)getpid());
+
+	struct Spectator *tcp = openSpectator("127.0.0.1:0");
+	struct Spectator *local = openSpectator(unixAddress);
+	if (tcp == NULL || local == NULL)
+		return 1;
+	snprintf(tcpAddress, sizeof(tcpAddress), "127.0.0.1:%u", tcp->port);
+
+	struct TestViewer viewers[TEST_VIEWERS] = {
+		{ .name = "tcp early", .joinFrame = 0 },
+		{ .name = "unix early", .joinFrame = 0, .unixSocket = true },
+		{ .name = "tcp late", .joinFrame = frames / 3 },
+		{ .name = "unix late", .joinFrame = frames * 2 / 3, .unixSocket = true },
+	};
+
+	static struct Chip8 chip;
+	uint8_t (*history)[SPECTATOR_FRAME_BYTES] = malloc((size_t)frames * SPECTATOR_FRAME_BYTES);
+	struct timespec pause = { 0, FRAME_PAUSE_NS };
+	if (history == NULL)
+		return 1;
+
+	initEmulator(&chip);
+	loadRom(&chip, rom);
+	loadFonts(&chip);
+
+	for (uint32_t frame = 0; frame < frames; frame++) {
+		for (int i = 0; i < TEST_VIEWERS; i++) {
+			struct TestViewer *viewer = &viewers[i];
+			if (viewer->connected || viewer->joinFrame != frame)
+				continue;
+			int fd = connectSpectator(viewer->unixSocket ? unixAddress : tcpAddress);
+			if (fd < 0) {
+				fprintf(stderr, "%s: can't connect\n", viewer->name);
+				return 1;
+			}
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			initSpectatorView(&viewer->view, fd);
+			viewer->connected = true;
+		}
+
+		// Keys change every few frames so the picture keeps moving
+		for (int k = 0; k < 16; k++)
+			chip.keypad[k] = ((frame / 20 + k) % 4) == 0;
+		uint64_t end = chip.instructions + CYCLES_PER_TICK;
+		while (chip.instructions < end && chip.fault == FAULT_NONE)
+			Cycle(&chip);
+		updateTimers(&chip);
+
+		packBits(chip.video, VIDEO_SIZE, history[frame]);
+		publishSpectatorFrame(tcp, chip.video);
+		publishSpectatorFrame(local, chip.video);
+
+		for (int i = 0; i < TEST_VIEWERS; i++) {
+			if (viewers[i].connected)
+				checkViewer(&viewers[i], history, frames);
+		}
+		nanosleep(&pause, NULL);
+	}
+
+	// Every viewer has to end on the last frame
+	uint64_t deadline = pacerNowNs() + SETTLE_NS;
+	bool settled = false;
+	while (!settled && pacerNowNs() < deadline) {
+		settled = true;
+		for (int i = 0; i < TEST_VIEWERS; i++) {
+			checkViewer(&viewers[i], history, frames);
+			settled &= !viewers[i].connected || viewers[i].view.frame == frames;
+		}
+		nanosleep(&pause, NULL);
+	}
+
+	int failures = 0;
+	for (int i = 0; i < TEST_VIEWERS; i++) {
+		struct TestViewer *viewer = &viewers[i];
+		bool ok = viewer->connected && viewer->mismatches == 0 && viewer->view.frame == frames && viewer->view.keyframes >= 1;
+		printf("%-10s joined at %4u: %4u frames checked, %u keyframes, %4u deltas, %6llu bytes, %u mismatches %s\n",
+			viewer->name, viewer->joinFrame, viewer->checked, viewer->view.keyframes, viewer->view.deltas,
+			(unsigned long long)viewer->view.bytes, viewer->mismatches, ok ? "ok" : "FAILED");
+		failures += !ok;
+		if (viewer->connected)
+			close(viewer->view.socket);
+	}
+
+	printf("server keyframes encoded: tcp %u, unix %u\n", atomic_load(&tcp->statKeyframes), atomic_load(&local->statKeyframes));
+	closeSpectator(tcp);
+	closeSpectator(local);
+	free(history);
+	return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	bool quiet = false, test = false;
+	unsigned long limit = 0;
+	int arg = 1;
+
+	for (; arg < argc - 1; arg++) {
+		if (strcmp(argv[arg], "--quiet") == 0)
+			quiet = true;
+		else if (strcmp(argv[arg], "--self-test") == 0)
+			test = true;
+		else if (strcmp(argv[arg], "--frames") == 0 && arg + 2 < argc)
+			limit = strtoul(argv[++arg], NULL, 10);
+		else
+			break;
+	}
+	if (arg != argc - 1) {
+		fprintf(stderr, "usage: %s [--quiet] [--frames N] address\n       %s --self-test [--frames N] rom\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	if (test)
+		return selfTest(argv[arg], limit > 0 ? (uint32_t)limit : DEFAULT_TEST_FRAMES);
+	return view(argv[arg], quiet, limit);
+}